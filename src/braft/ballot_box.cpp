@@ -20,8 +20,9 @@
 #include <butil/scoped_lock.h>
 #include <bvar/latency_recorder.h>
 
+#include <algorithm>  // std::nth_element
 #include <cstddef>
-#include <optional>
+#include <functional>  // std::greater
 
 #include "braft/closure_queue.h"
 #include "braft/fsm_caller.h"
@@ -47,35 +48,50 @@ int BallotBox::init(const BallotBoxOptions& options) {
     return 0;
 }
 
+int64_t BallotBox::pending_queue_size() const {
+    if (_pending_runs.empty()) {
+        return 0;
+    }
+    return _pending_runs.back().last_index - _pending_index + 1;
+}
+
+int64_t BallotBox::quorum_match_index(const Configuration& conf) {
+    if (conf.empty()) {
+        return INT64_MAX;
+    }
+    _quorum_buf.clear();
+    for (Configuration::const_iterator it = conf.begin(); it != conf.end();
+         ++it) {
+        std::map<PeerId, int64_t>::const_iterator match_it =
+            _match_indexes.find(*it);
+        _quorum_buf.push_back(
+            match_it != _match_indexes.end() ? match_it->second : 0);
+    }
+    // The (size / 2 + 1)-th largest one is stable at a quorum
+    std::vector<int64_t>::iterator nth =
+        _quorum_buf.begin() + _quorum_buf.size() / 2;
+    std::nth_element(_quorum_buf.begin(), nth, _quorum_buf.end(),
+                     std::greater<int64_t>());
+    return *nth;
+}
+
 int BallotBox::commit_at(int64_t first_log_index, int64_t last_log_index,
                          const PeerId& peer) {
-    // FIXME(chenzhangyi01): The cricital section is unacceptable because it
-    // blocks all the other Replicators and LogManagers
+    // Costs O(peers) for each run of configuration, no matter how many logs
+    // are acknowledged at once
     std::unique_lock<raft_mutex_t> lck(_mutex);
     if (_pending_index == 0) {
         return EINVAL;
     }
-    if (last_log_index < _pending_index) {
-        return 0;
-    }
-    if (last_log_index >=
-        _pending_index + (int64_t)_pending_meta_queue.size()) {
+    if (last_log_index >= _pending_index + pending_queue_size()) {
         return ERANGE;
     }
-
-    int64_t last_committed_index = 0;
-    const int64_t start_at = std::max(_pending_index, first_log_index);
-    Ballot::PosHint pos_hint;
-    for (int64_t log_index = start_at; log_index <= last_log_index;
-         ++log_index) {
-        Ballot& bl = _pending_meta_queue[log_index - _pending_index];
-        pos_hint = bl.grant(peer, pos_hint);
-        if (bl.granted()) {
-            last_committed_index = log_index;
-        }
+    int64_t& match_index = _match_indexes[peer];
+    if (last_log_index <= match_index) {
+        return 0;
     }
-
-    if (last_committed_index == 0) {
+    match_index = last_log_index;
+    if (last_log_index < _pending_index) {
         return 0;
     }
 
@@ -86,9 +102,29 @@ int BallotBox::commit_at(int64_t first_log_index, int64_t last_log_index,
     // removal request, we think it's safe to commit all the uncommitted
     // previous logs, which is not well proved right now
     // TODO: add vlog when committing previous logs
-    for (int64_t index = _pending_index; index <= last_committed_index;
-         ++index) {
-        _pending_meta_queue.pop_front();
+    int64_t last_committed_index = 0;
+    int64_t run_first_index = _pending_index;
+    for (std::deque<PendingRun>::const_iterator it = _pending_runs.begin();
+         it != _pending_runs.end() && run_first_index <= last_log_index;
+         ++it) {
+        // Runs after |last_log_index| are not affected by this ack
+        const int64_t index =
+            std::min(it->last_index,
+                     std::min(quorum_match_index(it->conf),
+                              quorum_match_index(it->old_conf)));
+        if (index >= run_first_index) {
+            last_committed_index = index;
+        }
+        run_first_index = it->last_index + 1;
+    }
+
+    if (last_committed_index == 0) {
+        return 0;
+    }
+
+    while (!_pending_runs.empty() &&
+           _pending_runs.front().last_index <= last_committed_index) {
+        _pending_runs.pop_front();
     }
 
     _pending_index = last_committed_index + 1;
@@ -101,10 +137,11 @@ int BallotBox::commit_at(int64_t first_log_index, int64_t last_log_index,
 }
 
 int BallotBox::clear_pending_tasks() {
-    std::deque<Ballot> saved_meta;
+    std::deque<PendingRun> saved_runs;
     {
         BAIDU_SCOPED_LOCK(_mutex);
-        saved_meta.swap(_pending_meta_queue);
+        saved_runs.swap(_pending_runs);
+        _match_indexes.clear();
         _pending_index = 0;
     }
     _closure_queue->clear();
@@ -113,12 +150,13 @@ int BallotBox::clear_pending_tasks() {
 
 int BallotBox::reset_pending_index(int64_t new_pending_index) {
     BAIDU_SCOPED_LOCK(_mutex);
-    CHECK(_pending_index == 0 && _pending_meta_queue.empty())
-        << "pending_index " << _pending_index << " pending_meta_queue "
-        << _pending_meta_queue.size();
+    CHECK(_pending_index == 0 && _pending_runs.empty())
+        << "pending_index " << _pending_index << " pending_queue_size "
+        << pending_queue_size();
     CHECK_GT(new_pending_index,
              _last_committed_index.load(butil::memory_order_relaxed));
     _pending_index = new_pending_index;
+    _match_indexes.clear();
     _closure_queue->reset_first_index(new_pending_index);
     return 0;
 }
@@ -126,13 +164,22 @@ int BallotBox::reset_pending_index(int64_t new_pending_index) {
 int BallotBox::append_pending_task(const Configuration& conf,
                                    const Configuration* old_conf,
                                    Closure* closure) {
-    Ballot bl;
-    bl.init(conf,
-            old_conf == nullptr ? std::nullopt : std::make_optional(*old_conf));
-
+    CHECK_GT(conf.size(), 0);
     BAIDU_SCOPED_LOCK(_mutex);
     CHECK(_pending_index > 0);
-    _pending_meta_queue.push_back(std::move(bl));
+    const int64_t index = _pending_index + pending_queue_size();
+    const Configuration empty_conf;
+    const Configuration& old = old_conf ? *old_conf : empty_conf;
+    if (!_pending_runs.empty() && _pending_runs.back().conf.equals(conf) &&
+        _pending_runs.back().old_conf.equals(old)) {
+        _pending_runs.back().last_index = index;
+    } else {
+        PendingRun run;
+        run.last_index = index;
+        run.conf = conf;
+        run.old_conf = old;
+        _pending_runs.push_back(run);
+    }
     _closure_queue->append_pending_closure(closure);
     return 0;
 }
@@ -140,7 +187,7 @@ int BallotBox::append_pending_task(const Configuration& conf,
 int BallotBox::set_last_committed_index(int64_t last_committed_index) {
     // FIXME: it seems that lock is not necessary here
     std::unique_lock<raft_mutex_t> lck(_mutex);
-    if (_pending_index != 0 || !_pending_meta_queue.empty()) {
+    if (_pending_index != 0 || !_pending_runs.empty()) {
         CHECK(last_committed_index < _pending_index)
             << "node changes to leader, pending_index=" << _pending_index
             << ", parameter last_committed_index=" << last_committed_index;
@@ -167,7 +214,7 @@ void BallotBox::describe(std::ostream& os, bool use_html) {
     size_t pending_queue_size = 0;
     if (_pending_index != 0) {
         pending_index = _pending_index;
-        pending_queue_size = _pending_meta_queue.size();
+        pending_queue_size = this->pending_queue_size();
     }
     lck.unlock();
     const char* newline = use_html ? "<br>" : "\r\n";
@@ -184,9 +231,9 @@ void BallotBox::get_status(BallotBoxStatus* status) {
     }
     std::unique_lock<raft_mutex_t> lck(_mutex);
     status->committed_index = _last_committed_index;
-    if (_pending_meta_queue.size() != 0) {
+    if (!_pending_runs.empty()) {
         status->pending_index = _pending_index;
-        status->pending_queue_size = _pending_meta_queue.size();
+        status->pending_queue_size = pending_queue_size();
     }
 }
 
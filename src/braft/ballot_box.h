@@ -21,9 +21,11 @@
 #include <stdint.h>           // int64_t
 
 #include <deque>
+#include <map>
 #include <set>  // std::set
+#include <vector>
 
-#include "braft/ballot.h"
+#include "braft/configuration.h"
 #include "braft/raft.h"
 #include "braft/util.h"
 
@@ -54,7 +56,10 @@ class BallotBox {
     int init(const BallotBoxOptions& options);
 
     // Called by leader, otherwise the behavior is undefined
-    // Set logs in [first_log_index, last_log_index] are stable at |peer|.
+    // Set logs in [first_log_index, last_log_index] are stable at |peer|,
+    // which implies all the logs before are stable at |peer| as well, so
+    // only the match index of |peer| is updated no matter how many logs
+    // there are.
     int commit_at(int64_t first_log_index, int64_t last_log_index,
                   const PeerId& peer);
 
@@ -89,12 +94,28 @@ class BallotBox {
     void get_status(BallotBoxStatus* ballot_box_status);
 
    private:
+    // Consecutive pending logs sharing the same configuration, starting
+    // right after the previous run or at _pending_index
+    struct PendingRun {
+        int64_t last_index;
+        Configuration conf;
+        Configuration old_conf;
+    };
+
+    int64_t pending_queue_size() const;
+    // The largest index stable at a quorum of |conf|
+    int64_t quorum_match_index(const Configuration& conf);
+
     FSMCaller* _waiter;
     ClosureQueue* _closure_queue;
     raft_mutex_t _mutex;
     butil::atomic<int64_t> _last_committed_index;
     int64_t _pending_index;
-    std::deque<Ballot> _pending_meta_queue;
+    std::deque<PendingRun> _pending_runs;
+    // The last log index known stable at each peer since the node became
+    // the leader
+    std::map<PeerId, int64_t> _match_indexes;
+    std::vector<int64_t> _quorum_buf;
 };
 
 }  //  namespace braft
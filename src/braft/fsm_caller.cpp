@@ -39,6 +39,11 @@ DEFINE_int32(
     "Max numbers of logs for the state machine to commit in a single batch");
 BRPC_VALIDATE_GFLAG(raft_fsm_caller_commit_batch, brpc::PositiveInteger);
 
+DEFINE_int32(raft_fsm_caller_read_batch_bytes, 1024 * 1024,
+             "Max bytes of the committed logs read from the log manager at a "
+             "time to apply");
+BRPC_VALIDATE_GFLAG(raft_fsm_caller_read_batch_bytes, brpc::PositiveInteger);
+
 FSMCaller::FSMCaller()
     : _log_manager(NULL),
       _fsm(NULL),
@@ -194,6 +199,7 @@ void FSMCaller::do_shutdown() {
         _node = NULL;
     }
     _fsm->on_shutdown();
+    fail_apply_waiters(butil::Status(ESHUTDOWN, "FSMCaller is shut down"));
     if (_after_shutdown) {
         google::protobuf::Closure* saved_done = _after_shutdown;
         _after_shutdown = NULL;
@@ -251,6 +257,7 @@ void FSMCaller::set_error(const Error& e) {
     if (_node) {
         _node->on_error(_error);
     }
+    fail_apply_waiters(_error.status());
 }
 
 void FSMCaller::do_committed(int64_t committed_index) {
@@ -311,6 +318,7 @@ void FSMCaller::do_committed(int64_t committed_index) {
     _last_applied_index.store(committed_index, butil::memory_order_release);
     _last_applied_term = last_term;
     _log_manager->set_applied_id(last_applied_id);
+    notify_apply_waiters(committed_index);
 }
 
 int FSMCaller::on_snapshot_save(SaveSnapshotClosure* done) {
@@ -423,6 +431,7 @@ void FSMCaller::do_snapshot_load(LoadSnapshotClosure* done) {
     _last_applied_index.store(meta.last_included_index(),
                               butil::memory_order_release);
     _last_applied_term = meta.last_included_term();
+    notify_apply_waiters(meta.last_included_index());
     done->Run();
 }
 
@@ -548,6 +557,56 @@ int64_t FSMCaller::applying_index() const {
     }
 }
 
+void FSMCaller::wait_applied(int64_t index, Closure* done) {
+    std::unique_lock<raft_mutex_t> lck(_apply_waiters_mutex);
+    if (!_apply_waiters_status.ok()) {
+        done->status() = _apply_waiters_status;
+        lck.unlock();
+        run_closure_in_bthread(done);
+        return;
+    }
+    // _last_applied_index is always stored before notify_apply_waiters takes
+    // the lock, so the waiter can't be missed.
+    if (_last_applied_index.load(butil::memory_order_acquire) >= index) {
+        lck.unlock();
+        run_closure_in_bthread(done);
+        return;
+    }
+    _apply_waiters.insert(std::make_pair(index, done));
+}
+
+void FSMCaller::notify_apply_waiters(int64_t applied_index) {
+    std::vector<Closure*> dones;
+    {
+        BAIDU_SCOPED_LOCK(_apply_waiters_mutex);
+        std::multimap<int64_t, Closure*>::iterator it = _apply_waiters.begin();
+        for (; it != _apply_waiters.end() && it->first <= applied_index; ++it) {
+            dones.push_back(it->second);
+        }
+        _apply_waiters.erase(_apply_waiters.begin(), it);
+    }
+    // Don't block the StateMachine with the user code of the waiters
+    for (size_t i = 0; i < dones.size(); ++i) {
+        run_closure_in_bthread(dones[i]);
+    }
+}
+
+void FSMCaller::fail_apply_waiters(const butil::Status& status) {
+    std::multimap<int64_t, Closure*> waiters;
+    {
+        BAIDU_SCOPED_LOCK(_apply_waiters_mutex);
+        if (_apply_waiters_status.ok()) {
+            _apply_waiters_status = status;
+        }
+        waiters.swap(_apply_waiters);
+    }
+    for (std::multimap<int64_t, Closure*>::iterator it = waiters.begin();
+         it != waiters.end(); ++it) {
+        it->second->status() = status;
+        run_closure_in_bthread(it->second);
+    }
+}
+
 void FSMCaller::join() {
     if (_queue_started) {
         bthread::execution_queue_join(_queue_id);
@@ -567,10 +626,27 @@ IteratorImpl::IteratorImpl(StateMachine* sm, LogManager* lm,
       _cur_index(last_applied_index),
       _committed_index(committed_index),
       _cur_entry(NULL),
+      _next_read_entry(0),
       _applying_index(applying_index) {
     next();
 }
 
+IteratorImpl::~IteratorImpl() {
+    if (_cur_entry) {
+        _cur_entry->Release();
+        _cur_entry = NULL;
+    }
+    clear_read_entries();
+}
+
+void IteratorImpl::clear_read_entries() {
+    for (size_t i = _next_read_entry; i < _read_entries.size(); ++i) {
+        _read_entries[i]->Release();
+    }
+    _read_entries.clear();
+    _next_read_entry = 0;
+}
+
 void IteratorImpl::next() {
     if (_cur_entry) {
         _cur_entry->Release();
@@ -579,7 +655,15 @@ void IteratorImpl::next() {
     if (_cur_index <= _committed_index) {
         ++_cur_index;
         if (_cur_index <= _committed_index) {
-            _cur_entry = _lm->get_entry(_cur_index);
+            if (_next_read_entry == _read_entries.size()) {
+                clear_read_entries();
+                _lm->get_entries(_cur_index, _committed_index,
+                                 FLAGS_raft_fsm_caller_read_batch_bytes,
+                                 &_read_entries);
+            }
+            if (_next_read_entry < _read_entries.size()) {
+                _cur_entry = _read_entries[_next_read_entry++];
+            }
             if (_cur_entry == NULL) {
                 _error.set_type(ERROR_TYPE_LOG);
                 _error.status().set_error(-1,
@@ -614,6 +698,7 @@ void IteratorImpl::set_error_and_rollback(size_t ntail,
         _cur_entry->Release();
         _cur_entry = NULL;
     }
+    clear_read_entries();
     _error.set_type(ERROR_TYPE_STATE_MACHINE);
     _error.status().set_error(
         ESTATEMACHINE,
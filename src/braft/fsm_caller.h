@@ -23,6 +23,8 @@
 #include <bthread/execution_queue.h>
 #include <butil/macros.h>  // BAIDU_CACHELINE_ALIGNMENT
 
+#include <map>
+
 #include "braft/ballot_box.h"
 #include "braft/closure_queue.h"
 #include "braft/lease.h"
@@ -62,8 +64,9 @@ class IteratorImpl {
                  std::vector<Closure*>* closure, int64_t first_closure_index,
                  int64_t last_applied_index, int64_t committed_index,
                  butil::atomic<int64_t>* applying_index);
-    ~IteratorImpl() {}
+    ~IteratorImpl();
     friend class FSMCaller;
+    void clear_read_entries();
     StateMachine* _sm;
     LogManager* _lm;
     std::vector<Closure*>* _closure;
@@ -71,6 +74,10 @@ class IteratorImpl {
     int64_t _cur_index;
     int64_t _committed_index;
     LogEntry* _cur_entry;
+    // the entries after _cur_entry read from LogManager at once, of which the
+    // ones before _next_read_entry have been moved to _cur_entry
+    std::vector<LogEntry*> _read_entries;
+    size_t _next_read_entry;
     butil::atomic<int64_t>* _applying_index;
     Error _error;
 };
@@ -123,6 +130,9 @@ class BAIDU_CACHELINE_ALIGNMENT FSMCaller {
         return _last_applied_index.load(butil::memory_order_relaxed);
     }
     int64_t applying_index() const;
+    // Run |done| once the StateMachine has applied all the logs up to |index|,
+    // or with an error if the StateMachine stops applying logs before that.
+    void wait_applied(int64_t index, Closure* done);
     void describe(std::ostream& os, bool use_html);
     void join();
 
@@ -183,6 +193,8 @@ class BAIDU_CACHELINE_ALIGNMENT FSMCaller {
     void do_stop_following(const LeaderChangeContext& stop_following_context);
     void set_error(const Error& e);
     bool pass_by_status(Closure* done);
+    void notify_apply_waiters(int64_t applied_index);
+    void fail_apply_waiters(const butil::Status& status);
 
     bthread::ExecutionQueueId<ApplyTask> _queue_id;
     LogManager* _log_manager;
@@ -196,6 +208,10 @@ class BAIDU_CACHELINE_ALIGNMENT FSMCaller {
     butil::atomic<int64_t> _applying_index;
     Error _error;
     bool _queue_started;
+
+    raft_mutex_t _apply_waiters_mutex;
+    std::multimap<int64_t, Closure*> _apply_waiters;
+    butil::Status _apply_waiters_status;
 };
 
 };  // namespace braft
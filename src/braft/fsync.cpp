@@ -17,6 +17,11 @@
 #include "braft/fsync.h"
 
 #include <brpc/reloadable_flags.h>  //BRPC_VALIDATE_GFLAG
+#include <bthread/bthread.h>           // bthread_usleep
+#include <bthread/condition_variable.h>
+#include <bthread/mutex.h>
+#include <butil/time.h>
+#include <bvar/bvar.h>
 
 namespace braft {
 
@@ -25,4 +30,120 @@ DEFINE_bool(raft_use_fsync_rather_than_fdatasync, true,
 
 BRPC_VALIDATE_GFLAG(raft_use_fsync_rather_than_fdatasync, brpc::PassValidate);
 
+DEFINE_bool(raft_enable_shared_fsync, false,
+            "Let the segments of all the groups on the same device share the "
+            "fsyncs issued by one leader");
+BRPC_VALIDATE_GFLAG(raft_enable_shared_fsync, brpc::PassValidate);
+
+DEFINE_int32(raft_shared_fsync_window_us, 200,
+             "Time the leader of a shared fsync waits for the other groups "
+             "to join before syncing");
+BRPC_VALIDATE_GFLAG(raft_shared_fsync_window_us, brpc::NonNegativeInteger);
+
+DEFINE_bool(raft_shared_fsync_use_syncfs, false,
+            "Flush the whole filesystem with one syncfs rather than syncing "
+            "the queued files one by one, only works on linux");
+BRPC_VALIDATE_GFLAG(raft_shared_fsync_use_syncfs, brpc::PassValidate);
+
+static bvar::CounterRecorder g_shared_fsync_batch_counter(
+    "raft_shared_fsync_batch_counter");
+
+struct FsyncCoordinator::Request {
+    Request(int fd_) : fd(fd_), ret(0), err(0), done(false) {}
+    int fd;
+    int ret;
+    int err;
+    bool done;
+};
+
+struct FsyncCoordinator::Device {
+    Device() : syncing(false) {}
+    bthread::Mutex mutex;
+    bthread::ConditionVariable cond;
+    std::vector<Request*> pending;
+    bool syncing;
+};
+
+FsyncCoordinator::~FsyncCoordinator() {
+    for (std::map<dev_t, Device*>::iterator it = _devices.begin();
+         it != _devices.end(); ++it) {
+        delete it->second;
+    }
+    _devices.clear();
+}
+
+FsyncCoordinator::Device* FsyncCoordinator::get_device(dev_t dev) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    Device*& device = _devices[dev];
+    if (device == NULL) {
+        device = new Device;
+    }
+    return device;
+}
+
+void FsyncCoordinator::sync_batch(const std::vector<Request*>& batch) {
+#ifdef __linux__
+    if (FLAGS_raft_shared_fsync_use_syncfs) {
+        const int ret = syncfs(batch[0]->fd);
+        const int err = ret == 0 ? 0 : errno;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            batch[i]->ret = ret;
+            batch[i]->err = err;
+        }
+        return;
+    }
+    // Kick off the writeback of all the files first so that the device sees
+    // the dirty pages of all the groups at once
+    for (size_t i = 0; i < batch.size(); ++i) {
+        sync_file_range(batch[i]->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+#endif
+    for (size_t i = 0; i < batch.size(); ++i) {
+        batch[i]->ret = raft_fsync(batch[i]->fd);
+        batch[i]->err = batch[i]->ret == 0 ? 0 : errno;
+    }
+}
+
+int FsyncCoordinator::sync(int fd, dev_t dev, int64_t* wait_time_us) {
+    const int64_t start_us = butil::cpuwide_time_us();
+    Device* device = get_device(dev);
+    Request req(fd);
+    std::unique_lock<bthread::Mutex> lck(device->mutex);
+    device->pending.push_back(&req);
+    while (!req.done) {
+        if (device->syncing) {
+            device->cond.wait(lck);
+            continue;
+        }
+        // Become the leader of the next batch
+        device->syncing = true;
+        lck.unlock();
+        if (FLAGS_raft_shared_fsync_window_us > 0) {
+            bthread_usleep(FLAGS_raft_shared_fsync_window_us);
+        }
+        std::vector<Request*> batch;
+        lck.lock();
+        batch.swap(device->pending);
+        lck.unlock();
+
+        g_shared_fsync_batch_counter << batch.size();
+        sync_batch(batch);
+
+        lck.lock();
+        for (size_t i = 0; i < batch.size(); ++i) {
+            batch[i]->done = true;
+        }
+        device->syncing = false;
+        device->cond.notify_all();
+    }
+    lck.unlock();
+    if (wait_time_us) {
+        *wait_time_us = butil::cpuwide_time_us() - start_us;
+    }
+    if (req.ret != 0) {
+        errno = req.err;
+    }
+    return req.ret;
+}
+
 }  //  namespace braft
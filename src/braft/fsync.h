@@ -20,13 +20,18 @@
 
 #include <fcntl.h>
 #include <gflags/gflags.h>
+#include <sys/types.h>
 #include <unistd.h>
 
+#include <map>
+
 #include "braft/storage.h"
+#include "braft/util.h"
 
 namespace braft {
 
 DECLARE_bool(raft_use_fsync_rather_than_fdatasync);
+DECLARE_bool(raft_enable_shared_fsync);
 
 inline int raft_fsync(int fd) {
     if (FLAGS_raft_use_fsync_rather_than_fdatasync) {
@@ -42,6 +47,41 @@ inline int raft_fsync(int fd) {
 
 inline bool raft_sync_meta() { return FLAGS_raft_sync || FLAGS_raft_sync_meta; }
 
+// Coordinate the fsyncs issued by the groups whose files are on the same
+// device. The first caller becomes the leader, which waits a short window for
+// the others to join, then syncs all the queued files in one pass and
+// releases all the waiters together.
+class FsyncCoordinator {
+   public:
+    static FsyncCoordinator* GetInstance() {
+        return Singleton<FsyncCoordinator>::get();
+    }
+
+    // Sync |fd| which is on the device |dev| along with the other queued
+    // files.
+    // Returns 0 on success, -1 otherwise and errno is set.
+    // |wait_time_us| is set to the time spent on the shared fsync if it's not
+    // NULL.
+    int sync(int fd, dev_t dev, int64_t* wait_time_us);
+
+   private:
+    FsyncCoordinator() {}
+    ~FsyncCoordinator();
+    DISALLOW_COPY_AND_ASSIGN(FsyncCoordinator);
+    friend struct DefaultSingletonTraits<FsyncCoordinator>;
+
+    struct Request;
+    struct Device;
+
+    Device* get_device(dev_t dev);
+    static void sync_batch(const std::vector<Request*>& batch);
+
+    raft_mutex_t _mutex;
+    std::map<dev_t, Device*> _devices;
+};
+
+#define global_fsync_coordinator FsyncCoordinator::GetInstance()
+
 }  //  namespace braft
 
 #endif  // BRAFT_FSYNC_H
@@ -0,0 +1,242 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "braft/heartbeat_batcher.h"
+
+#include <brpc/reloadable_flags.h>  // BRPC_VALIDATE_GFLAG
+#include <bthread/bthread.h>
+#include <bthread/unstable.h>  // bthread_timer_add
+#include <butil/time.h>
+#include <bvar/bvar.h>
+#include <gflags/gflags.h>
+
+#include <algorithm>
+
+#include "braft/replicator.h"  // Replicator
+
+namespace braft {
+
+DEFINE_bool(raft_enable_batch_heartbeat, false,
+            "Send the heartbeats of the groups sharing the same endpoints in "
+            "one BatchHeartbeat RPC, all the peers must support it");
+BRPC_VALIDATE_GFLAG(raft_enable_batch_heartbeat, ::brpc::PassValidate);
+
+DEFINE_int32(raft_batch_heartbeat_interval_ms, 5,
+             "Interval of the ticks to send BatchHeartbeat RPCs");
+BRPC_VALIDATE_GFLAG(raft_batch_heartbeat_interval_ms,
+                    ::brpc::NonNegativeInteger);
+
+DEFINE_int32(raft_batch_heartbeat_idle_destination_ms, 60 * 1000,
+             "Close the BatchHeartbeat channel to a destination if there's no "
+             "heartbeat to it for this long");
+BRPC_VALIDATE_GFLAG(raft_batch_heartbeat_idle_destination_ms,
+                    ::brpc::PositiveInteger);
+
+DECLARE_int32(raft_rpc_channel_connect_timeout_ms);
+
+static bvar::CounterRecorder g_batch_heartbeat_factor(
+    "raft_batch_heartbeat_factor");
+
+HeartbeatBatcher::HeartbeatBatcher() : _last_prune_ms(0) {}
+
+HeartbeatBatcher::~HeartbeatBatcher() {}
+
+scoped_refptr<HeartbeatBatcher::Destination> HeartbeatBatcher::get_destination(
+    const butil::EndPoint& local, const butil::EndPoint& remote) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    const int64_t now_ms = butil::monotonic_time_ms();
+    if (now_ms - _last_prune_ms >=
+        FLAGS_raft_batch_heartbeat_idle_destination_ms) {
+        prune_idle_destinations(now_ms);
+        _last_prune_ms = now_ms;
+    }
+    const EndPointPair key(local, remote);
+    DestinationMap::iterator it = _destinations.find(key);
+    if (it != _destinations.end()) {
+        return it->second;
+    }
+    scoped_refptr<Destination> dest(new Destination);
+    dest->last_active_ms = now_ms;
+    brpc::ChannelOptions channel_opt;
+    channel_opt.connect_timeout_ms = FLAGS_raft_rpc_channel_connect_timeout_ms;
+    channel_opt.timeout_ms = -1;  // Set by each BatchHeartbeat RPC
+    if (dest->channel.Init(remote, &channel_opt) != 0) {
+        LOG(ERROR) << "Fail to init heartbeat channel to " << remote;
+        return NULL;
+    }
+    _destinations[key] = dest;
+    return dest;
+}
+
+void HeartbeatBatcher::prune_idle_destinations(int64_t now_ms) {
+    for (DestinationMap::iterator it = _destinations.begin();
+         it != _destinations.end();) {
+        Destination* dest = it->second.get();
+        bool idle = false;
+        {
+            BAIDU_SCOPED_LOCK(dest->mutex);
+            idle = !dest->scheduled &&
+                   now_ms - dest->last_active_ms >=
+                       FLAGS_raft_batch_heartbeat_idle_destination_ms;
+        }
+        if (idle) {
+            // Freed once the BatchHeartbeat RPC in flight returns, if any
+            _destinations.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void HeartbeatBatcher::send_heartbeat(const butil::EndPoint& local,
+                                      const butil::EndPoint& remote,
+                                      ReplicatorId id,
+                                      AppendEntriesRequest* request,
+                                      int timeout_ms) {
+    PendingHeartbeat heartbeat;
+    heartbeat.id = id;
+    heartbeat.request = request;
+    heartbeat.send_time_ms = butil::monotonic_time_ms();
+
+    scoped_refptr<Destination> dest = get_destination(local, remote);
+    if (dest == NULL) {
+        return fail_heartbeat(heartbeat, EINVAL,
+                              "Fail to init heartbeat channel");
+    }
+
+    std::unique_lock<raft_mutex_t> lck(dest->mutex);
+    dest->pending.push_back(heartbeat);
+    dest->timeout_ms = std::max(dest->timeout_ms, timeout_ms);
+    dest->last_active_ms = heartbeat.send_time_ms;
+    if (dest->scheduled) {
+        return;
+    }
+    dest->scheduled = true;
+    lck.unlock();
+
+    // Released in flush
+    dest->AddRef();
+    if (FLAGS_raft_batch_heartbeat_interval_ms <= 0) {
+        flush(dest.get());
+        return;
+    }
+    bthread_timer_t timer;
+    const timespec due_time = butil::milliseconds_from_now(
+        FLAGS_raft_batch_heartbeat_interval_ms);
+    if (bthread_timer_add(&timer, due_time, on_tick, dest.get()) != 0) {
+        LOG(ERROR) << "Fail to add timer, flush heartbeats to " << remote
+                   << " immediately";
+        flush(dest.get());
+    }
+}
+
+void HeartbeatBatcher::on_tick(void* arg) {
+    bthread_t tid;
+    // Don't block the timer thread
+    if (bthread_start_background(&tid, NULL, flush, arg) != 0) {
+        PLOG(ERROR) << "Fail to start bthread";
+        flush(arg);
+    }
+}
+
+void* HeartbeatBatcher::flush(void* arg) {
+    // Adopt the reference added by send_heartbeat
+    scoped_refptr<Destination> dest((Destination*)arg);
+    dest->Release();
+    std::vector<PendingHeartbeat>* heartbeats =
+        new std::vector<PendingHeartbeat>;
+    int timeout_ms = 0;
+    {
+        BAIDU_SCOPED_LOCK(dest->mutex);
+        heartbeats->swap(dest->pending);
+        timeout_ms = dest->timeout_ms;
+        dest->timeout_ms = 0;
+        dest->scheduled = false;
+    }
+    if (heartbeats->empty()) {
+        delete heartbeats;
+        return NULL;
+    }
+    g_batch_heartbeat_factor << heartbeats->size();
+
+    brpc::Controller* cntl = new brpc::Controller;
+    BatchHeartbeatRequest* request = new BatchHeartbeatRequest;
+    BatchHeartbeatResponse* response = new BatchHeartbeatResponse;
+    for (size_t i = 0; i < heartbeats->size(); ++i) {
+        // Swapped back in on_batch_returned
+        request->add_heartbeats()->Swap((*heartbeats)[i].request);
+    }
+    cntl->set_timeout_ms(timeout_ms);
+    // Released in on_batch_returned
+    dest->AddRef();
+    RaftService_Stub stub(&dest->channel);
+    stub.batch_heartbeat(
+        cntl, request, response,
+        brpc::NewCallback(on_batch_returned, dest.get(), cntl, request,
+                          response, heartbeats));
+    return NULL;
+}
+
+void HeartbeatBatcher::fail_heartbeat(const PendingHeartbeat& heartbeat,
+                                      int error_code,
+                                      const std::string& error_text) {
+    brpc::Controller* cntl = new brpc::Controller;
+    cntl->SetFailed(error_code, "%s", error_text.c_str());
+    Replicator::_on_heartbeat_returned(heartbeat.id, cntl, heartbeat.request,
+                                       new AppendEntriesResponse,
+                                       heartbeat.send_time_ms, NULL);
+}
+
+void HeartbeatBatcher::on_batch_returned(
+    Destination* dest, brpc::Controller* cntl, BatchHeartbeatRequest* request,
+    BatchHeartbeatResponse* response,
+    std::vector<PendingHeartbeat>* heartbeats) {
+    dest->Release();
+    std::unique_ptr<brpc::Controller> cntl_guard(cntl);
+    std::unique_ptr<BatchHeartbeatRequest> req_guard(request);
+    std::unique_ptr<BatchHeartbeatResponse> res_guard(response);
+    std::unique_ptr<std::vector<PendingHeartbeat> > heartbeats_guard(
+        heartbeats);
+
+    const int count = (int)heartbeats->size();
+    const bool malformed = !cntl->Failed() &&
+                           (response->heartbeats_size() != count ||
+                            response->error_codes_size() != count);
+    for (int i = 0; i < count; ++i) {
+        PendingHeartbeat& heartbeat = (*heartbeats)[i];
+        heartbeat.request->Swap(request->mutable_heartbeats(i));
+        if (cntl->Failed()) {
+            fail_heartbeat(heartbeat, cntl->ErrorCode(), cntl->ErrorText());
+            continue;
+        }
+        if (malformed) {
+            fail_heartbeat(heartbeat, brpc::ERESPONSE,
+                           "Malformed BatchHeartbeatResponse");
+            continue;
+        }
+        const int error_code = response->error_codes(i);
+        if (error_code != 0) {
+            fail_heartbeat(heartbeat, error_code, berror(error_code));
+            continue;
+        }
+        AppendEntriesResponse* heartbeat_response = new AppendEntriesResponse;
+        heartbeat_response->Swap(response->mutable_heartbeats(i));
+        Replicator::_on_heartbeat_returned(heartbeat.id, new brpc::Controller,
+                                           heartbeat.request,
+                                           heartbeat_response,
+                                           heartbeat.send_time_ms, NULL);
+    }
+}
+
+}  //  namespace braft
@@ -0,0 +1,96 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BRAFT_HEARTBEAT_BATCHER_H
+#define BRAFT_HEARTBEAT_BATCHER_H
+
+#include <brpc/channel.h>               // brpc::Channel
+#include <brpc/controller.h>            // brpc::Controller
+#include <butil/endpoint.h>             // butil::EndPoint
+#include <butil/memory/ref_counted.h>  // butil::RefCountedThreadSafe
+
+#include <map>
+#include <vector>
+
+#include "braft/raft.pb.h"  // AppendEntriesRequest
+#include "braft/util.h"     // raft_mutex_t
+
+namespace braft {
+
+typedef uint64_t ReplicatorId;
+
+// Coalesce the periodic heartbeats of all the groups sharing the same
+// (source, destination) endpoints into one BatchHeartbeat RPC per tick, which
+// saves a lot of RPCs when a process hosts thousands of raft groups.
+class HeartbeatBatcher {
+   public:
+    HeartbeatBatcher();
+    ~HeartbeatBatcher();
+
+    // Queue the heartbeat |request| of the replicator |id| which is sent from
+    // |local| to |remote| at the next tick, Replicator::_on_heartbeat_returned
+    // is called with the result of this very heartbeat.
+    // The ownership of |request| is transferred to the batcher.
+    // Must not be called with the lock of the replicator held.
+    void send_heartbeat(const butil::EndPoint& local,
+                        const butil::EndPoint& remote, ReplicatorId id,
+                        AppendEntriesRequest* request, int timeout_ms);
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(HeartbeatBatcher);
+
+    struct PendingHeartbeat {
+        ReplicatorId id;
+        AppendEntriesRequest* request;
+        int64_t send_time_ms;
+    };
+
+    // Referenced by the map as well as the pending tick and the BatchHeartbeat
+    // RPC in flight, so that it can be pruned from the map at any time
+    struct Destination : public butil::RefCountedThreadSafe<Destination> {
+        Destination() : timeout_ms(0), scheduled(false), last_active_ms(0) {}
+        brpc::Channel channel;
+        raft_mutex_t mutex;
+        std::vector<PendingHeartbeat> pending;
+        int timeout_ms;
+        bool scheduled;
+        int64_t last_active_ms;
+    };
+
+    typedef std::pair<butil::EndPoint, butil::EndPoint> EndPointPair;
+    typedef std::map<EndPointPair, scoped_refptr<Destination> > DestinationMap;
+
+    scoped_refptr<Destination> get_destination(const butil::EndPoint& local,
+                                               const butil::EndPoint& remote);
+    // Remove the destinations which have no heartbeat for a while, e.g. the
+    // peers removed or the groups which are not leaders any more
+    void prune_idle_destinations(int64_t now_ms);
+
+    static void on_tick(void* arg);
+    static void* flush(void* arg);
+    static void on_batch_returned(Destination* dest, brpc::Controller* cntl,
+                                  BatchHeartbeatRequest* request,
+                                  BatchHeartbeatResponse* response,
+                                  std::vector<PendingHeartbeat>* heartbeats);
+    static void fail_heartbeat(const PendingHeartbeat& heartbeat,
+                               int error_code, const std::string& error_text);
+
+    raft_mutex_t _mutex;
+    DestinationMap _destinations;
+    int64_t _last_prune_ms;
+};
+
+}  //  namespace braft
+
+#endif  // BRAFT_HEARTBEAT_BATCHER_H
@@ -0,0 +1,279 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "braft/io_uring_writer.h"
+
+#include <bthread/countdown_event.h>
+#include <gflags/gflags.h>
+#include <limits.h>  // IOV_MAX
+#include <pthread.h>
+#ifdef BRAFT_WITH_IO_URING
+#include <liburing.h>
+#endif  // BRAFT_WITH_IO_URING
+
+#include <algorithm>
+#include <vector>
+
+#include "braft/fsync.h"  // raft_fsync
+
+namespace braft {
+
+DEFINE_int32(raft_io_uring_entries, 256,
+             "Number of the submission queue entries of the io_uring shared "
+             "by the segments, takes effect at start");
+
+struct IoUringWriter::IoUnit {
+    enum Op {
+        WRITEV,
+        FSYNC,
+        READ,
+    };
+    explicit IoUnit(Op op_, int fd_)
+        : op(op_),
+          fd(fd_),
+          iov(NULL),
+          iovcnt(0),
+          buf(NULL),
+          count(0),
+          offset(0),
+          res(0),
+          event(NULL) {}
+    Op op;
+    int fd;
+    const struct iovec* iov;
+    int iovcnt;
+    void* buf;
+    size_t count;  // bytes to write or read
+    off_t offset;
+    int res;
+    bthread::CountdownEvent* event;
+};
+
+IoUringWriter* IoUringWriter::GetInstance() {
+    // Leaky as the reaper thread keeps using the ring until exit
+    IoUringWriter* writer =
+        Singleton<IoUringWriter, LeakySingletonTraits<IoUringWriter> >::get();
+    return writer->_ring ? writer : NULL;
+}
+
+IoUringWriter::IoUringWriter() : _ring(NULL) {
+#ifdef BRAFT_WITH_IO_URING
+    struct io_uring* ring = new struct io_uring;
+    const int rc = io_uring_queue_init(FLAGS_raft_io_uring_entries, ring, 0);
+    if (rc < 0) {
+        LOG(WARNING) << "Fail to init io_uring, " << berror(-rc);
+        delete ring;
+        return;
+    }
+    _ring = ring;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, run_reaper, this) != 0) {
+        PLOG(WARNING) << "Fail to create the reaper thread of io_uring";
+        io_uring_queue_exit(ring);
+        delete ring;
+        _ring = NULL;
+        return;
+    }
+    pthread_detach(tid);
+    LOG(INFO) << "Init io_uring with " << FLAGS_raft_io_uring_entries
+              << " entries";
+#else
+    LOG(WARNING) << "braft is built without io_uring";
+#endif  // BRAFT_WITH_IO_URING
+}
+
+IoUringWriter::~IoUringWriter() {}
+
+void* IoUringWriter::run_reaper(void* arg) {
+#ifdef BRAFT_WITH_IO_URING
+    IoUringWriter* writer = (IoUringWriter*)arg;
+    while (true) {
+        struct io_uring_cqe* cqe = NULL;
+        const int rc = io_uring_wait_cqe(writer->_ring, &cqe);
+        if (rc < 0) {
+            LOG_IF(ERROR, rc != -EINTR)
+                << "Fail to wait io_uring completion, " << berror(-rc);
+            continue;
+        }
+        IoUnit* unit = (IoUnit*)io_uring_cqe_get_data(cqe);
+        unit->res = cqe->res;
+        io_uring_cqe_seen(writer->_ring, cqe);
+        // |unit| is invalid after signal as the submitter returns
+        unit->event->signal();
+    }
+#endif  // BRAFT_WITH_IO_URING
+    return NULL;
+}
+
+int IoUringWriter::submit_and_wait(IoUnit* units, int nunits) {
+#ifdef BRAFT_WITH_IO_URING
+    bthread::CountdownEvent event(nunits);
+    {
+        BAIDU_SCOPED_LOCK(_submit_mutex);
+        // All the SQEs are submitted right away, so the whole ring is free
+        // unless the chain is longer than it
+        if (io_uring_sq_space_left(_ring) < (unsigned)nunits) {
+            errno = E2BIG;
+            return -1;
+        }
+        for (int i = 0; i < nunits; ++i) {
+            IoUnit& unit = units[i];
+            struct io_uring_sqe* sqe = io_uring_get_sqe(_ring);
+            switch (unit.op) {
+                case IoUnit::WRITEV:
+                    io_uring_prep_writev(sqe, unit.fd, unit.iov, unit.iovcnt,
+                                         unit.offset);
+                    break;
+                case IoUnit::FSYNC:
+                    io_uring_prep_fsync(
+                        sqe, unit.fd,
+                        FLAGS_raft_use_fsync_rather_than_fdatasync
+                            ? 0
+                            : IORING_FSYNC_DATASYNC);
+                    break;
+                case IoUnit::READ:
+                    io_uring_prep_read(sqe, unit.fd, unit.buf, unit.count,
+                                       unit.offset);
+                    break;
+            }
+            unit.event = &event;
+            io_uring_sqe_set_data(sqe, &unit);
+            if (i + 1 < nunits) {
+                // The next one starts after this one succeeds, or is
+                // cancelled otherwise
+                io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+            }
+        }
+        int rc = 0;
+        do {
+            rc = io_uring_submit(_ring);
+        } while (rc == -EINTR || rc == -EAGAIN || rc == -EBUSY);
+        // The queued SQEs refer to |units|, which must not be given up
+        CHECK_GE(rc, 0) << "Fail to submit to io_uring, " << berror(-rc);
+    }
+    event.wait();
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif  // BRAFT_WITH_IO_URING
+}
+
+// Write what's left of |iov| after the first |done| bytes with blocking
+// syscalls
+static int pwritev_remaining(int fd, const struct iovec* iov, int iovcnt,
+                             off_t offset, size_t done) {
+    for (int i = 0; i < iovcnt; ++i) {
+        const char* p = (const char*)iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        if (done >= len) {
+            done -= len;
+            offset += len;
+            continue;
+        }
+        p += done;
+        offset += done;
+        len -= done;
+        done = 0;
+        while (len > 0) {
+            const ssize_t n = ::pwrite(fd, p, len, offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return -1;
+            }
+            p += n;
+            offset += n;
+            len -= n;
+        }
+    }
+    return 0;
+}
+
+int IoUringWriter::pwritev(int fd, const struct iovec* iov, int iovcnt,
+                           off_t offset, bool sync) {
+    std::vector<IoUnit> units;
+    off_t unit_offset = offset;
+    for (int i = 0; i < iovcnt; i += IOV_MAX) {
+        IoUnit unit(IoUnit::WRITEV, fd);
+        unit.iov = iov + i;
+        unit.iovcnt = std::min(iovcnt - i, IOV_MAX);
+        unit.offset = unit_offset;
+        for (int j = 0; j < unit.iovcnt; ++j) {
+            unit.count += unit.iov[j].iov_len;
+        }
+        unit_offset += unit.count;
+        units.push_back(unit);
+    }
+    if (sync) {
+        units.push_back(IoUnit(IoUnit::FSYNC, fd));
+    }
+    if (units.empty()) {
+        return 0;
+    }
+    if (submit_and_wait(&units[0], units.size()) != 0) {
+        return -1;
+    }
+    size_t done = 0;
+    for (size_t i = 0; i < units.size(); ++i) {
+        const IoUnit& unit = units[i];
+        if (unit.res < 0 && unit.res != -ECANCELED) {
+            errno = -unit.res;
+            return -1;
+        }
+        if (unit.op == IoUnit::FSYNC) {
+            continue;
+        }
+        if (unit.res == -ECANCELED || (size_t)unit.res < unit.count) {
+            // A short write breaks the chain, finish the rest in place
+            done += std::max(unit.res, 0);
+            if (pwritev_remaining(fd, iov, iovcnt, offset, done) != 0) {
+                return -1;
+            }
+            return sync ? raft_fsync(fd) : 0;
+        }
+        done += unit.res;
+    }
+    return 0;
+}
+
+ssize_t IoUringWriter::pread(int fd, void* buf, size_t count, off_t offset) {
+    IoUnit unit(IoUnit::READ, fd);
+    unit.buf = buf;
+    unit.count = count;
+    unit.offset = offset;
+    if (submit_and_wait(&unit, 1) != 0) {
+        return -1;
+    }
+    if (unit.res < 0) {
+        errno = -unit.res;
+        return -1;
+    }
+    return unit.res;
+}
+
+int IoUringWriter::fsync(int fd) {
+    IoUnit unit(IoUnit::FSYNC, fd);
+    if (submit_and_wait(&unit, 1) != 0) {
+        return -1;
+    }
+    if (unit.res < 0) {
+        errno = -unit.res;
+        return -1;
+    }
+    return 0;
+}
+
+}  //  namespace braft
@@ -0,0 +1,68 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BRAFT_IO_URING_WRITER_H
+#define BRAFT_IO_URING_WRITER_H
+
+#include <sys/uio.h>  // iovec
+
+#include "braft/util.h"
+
+struct io_uring;
+
+namespace braft {
+
+// Process-wide io_uring shared by all the segments. The callers are bthreads
+// which are suspended rather than blocking their workers while the io is in
+// flight, and a dedicated thread reaps the completions. A batch write and the
+// fdatasync after it are submitted as linked SQEs, so they cost one
+// submission.
+//
+// Only works when braft is built with WITH_IO_URING, GetInstance returns NULL
+// otherwise, as well as when the ring can't be set up.
+class IoUringWriter {
+   public:
+    static IoUringWriter* GetInstance();
+
+    // Write |iov| to |fd| at |offset|, and fdatasync |fd| right after the
+    // write if |sync| is true.
+    // Returns 0 on success, -1 otherwise and errno is set.
+    int pwritev(int fd, const struct iovec* iov, int iovcnt, off_t offset,
+                bool sync);
+
+    // Read at most |count| bytes of |fd| at |offset| into |buf|, return the
+    // number of bytes read, -1 on error and errno is set.
+    ssize_t pread(int fd, void* buf, size_t count, off_t offset);
+
+    // Returns 0 on success, -1 otherwise and errno is set.
+    int fsync(int fd);
+
+   private:
+    IoUringWriter();
+    ~IoUringWriter();
+    DISALLOW_COPY_AND_ASSIGN(IoUringWriter);
+    friend struct LeakySingletonTraits<IoUringWriter>;
+
+    struct IoUnit;
+
+    int submit_and_wait(IoUnit* units, int nunits);
+    static void* run_reaper(void* arg);
+
+    struct io_uring* _ring;
+    raft_mutex_t _submit_mutex;
+};
+
+}  //  namespace braft
+
+#endif  // BRAFT_IO_URING_WRITER_H
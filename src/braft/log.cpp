@@ -18,7 +18,10 @@
 
 #include "braft/log.h"
 
+#include <brpc/policy/gzip_compress.h>     // brpc::policy::ZlibCompress
+#include <brpc/policy/snappy_compress.h>   // brpc::policy::SnappyCompress
 #include <brpc/reloadable_flags.h>         //
+#include <butil/fd_guard.h>                // butil::fd_guard
 #include <butil/fd_utility.h>              // butil::make_close_on_exec
 #include <butil/file_util.h>               // butil::CreateDirectory
 #include <butil/files/dir_reader_posix.h>  // butil::DirReaderPosix
@@ -28,9 +31,11 @@
 #include <gflags/gflags.h>
 
 #include "braft/fsync.h"
+#include "braft/io_uring_writer.h"
 #include "braft/local_storage.pb.h"
 #include "braft/log_entry.h"
 #include "braft/protobuf_file.h"
+#include "braft/sync_point.h"
 #include "braft/util.h"
 
 // #define BRAFT_SEGMENT_OPEN_PATTERN "log_inprogress_%020ld"
@@ -38,6 +43,9 @@
 #define BRAFT_SEGMENT_OPEN_PATTERN "log_inprogress_%020" PRId64
 #define BRAFT_SEGMENT_CLOSED_PATTERN "log_%020" PRId64 "_%020" PRId64
 #define BRAFT_SEGMENT_META_FILE "log_meta"
+#define BRAFT_SEGMENT_POOL_PATTERN "log_pool_%020" PRId64
+#define BRAFT_SEGMENT_RECYCLE_PATTERN "log_recycle_%020" PRId64
+#define BRAFT_SEGMENT_INDEX_PATTERN "index_%020" PRId64 "_%020" PRId64
 
 namespace braft {
 
@@ -56,10 +64,60 @@ DEFINE_bool(raft_recover_log_from_corrupt, false,
             "recover log by truncating corrupted log");
 BRPC_VALIDATE_GFLAG(raft_recover_log_from_corrupt, ::brpc::PassValidate);
 
+DEFINE_int32(raft_segment_pool_size, 0,
+             "Number of preallocated segment files kept ready for each log "
+             "storage, 0 disables the pool");
+BRPC_VALIDATE_GFLAG(raft_segment_pool_size, brpc::NonNegativeInteger);
+
+DEFINE_bool(raft_segment_prealloc_zero_fill, false,
+            "Write zeros into the preallocated segment files rather than "
+            "fallocate, so that fdatasync doesn't have to flush the metadata "
+            "of unwritten extents");
+BRPC_VALIDATE_GFLAG(raft_segment_prealloc_zero_fill, brpc::PassValidate);
+
+DEFINE_bool(raft_segment_direct_io, false,
+            "Write segments with O_DIRECT in blocks padded to 4KB and read "
+            "them bypassing the page cache, segments written in this mode "
+            "can't be read by the versions without it");
+BRPC_VALIDATE_GFLAG(raft_segment_direct_io, brpc::PassValidate);
+
+DEFINE_bool(raft_segment_io_uring, false,
+            "Write, sync and read segments through io_uring without blocking "
+            "the bthread workers, only works when braft is built with "
+            "WITH_IO_URING");
+BRPC_VALIDATE_GFLAG(raft_segment_io_uring, brpc::PassValidate);
+
+DEFINE_int32(raft_segment_load_read_size, 1024 * 1024,
+             "Bytes read at a time when loading a segment at startup");
+BRPC_VALIDATE_GFLAG(raft_segment_load_read_size, brpc::PositiveInteger);
+
+DEFINE_int32(raft_segment_load_concurrency, 8,
+             "Max number of the closed segments of a log storage loaded in "
+             "parallel at startup");
+BRPC_VALIDATE_GFLAG(raft_segment_load_concurrency, brpc::PositiveInteger);
+
+DEFINE_bool(raft_segment_index_sidecar, true,
+            "Save the index of a segment into a sidecar file when it's "
+            "closed, which saves scanning the segment at startup");
+BRPC_VALIDATE_GFLAG(raft_segment_index_sidecar, brpc::PassValidate);
+
+DEFINE_int32(raft_segment_compress_type, 0,
+             "Compress the data of the entries appended to segments, 0: none, "
+             "1: snappy, 2: zlib. Segments with compressed entries can't be "
+             "read by the versions without it");
+BRPC_VALIDATE_GFLAG(raft_segment_compress_type, brpc::NonNegativeInteger);
+
+DEFINE_int32(raft_segment_compress_min_bytes, 4096,
+             "Only compress the data of entries not smaller than this");
+BRPC_VALIDATE_GFLAG(raft_segment_compress_min_bytes, brpc::NonNegativeInteger);
+
 static bvar::LatencyRecorder g_open_segment_latency("raft_open_segment");
+static bvar::Adder<int64_t> g_segment_pool_miss("raft_segment_pool_miss");
 static bvar::LatencyRecorder g_segment_append_entry_latency(
     "raft_segment_append_entry");
 static bvar::LatencyRecorder g_sync_segment_latency("raft_sync_segment");
+static bvar::Adder<int64_t> g_segment_compress_saved_bytes(
+    "raft_segment_compress_saved_bytes");
 
 int ftruncate_uninterrupted(int fd, off_t length) {
     int rc = 0;
@@ -74,6 +132,12 @@ enum CheckSumType {
     CHECKSUM_CRC32 = 1,
 };
 
+enum SegmentCompressType {
+    SEGMENT_COMPRESS_NONE = 0,
+    SEGMENT_COMPRESS_SNAPPY = 1,
+    SEGMENT_COMPRESS_ZLIB = 2,
+};
+
 enum RaftSyncPolicy {
     RAFT_SYNC_IMMEDIATELY = 0,
     RAFT_SYNC_BY_BYTES = 1,
@@ -81,16 +145,27 @@ enum RaftSyncPolicy {
 
 // Format of Header, all fields are in network order
 // | -------------------- term (64bits) -------------------------  |
-// | entry-type (8bits) | checksum_type (8bits) | reserved(16bits) |
+// | entry-type (8bits) | checksum_type (8bits) |
+// | compress_type (8bits) | reserved(8bits)                       |
 // | ------------------ data len (32bits) -----------------------  |
 // | data_checksum (32bits) | header checksum (32bits)             |
+//
+// data len and data_checksum are of the data stored, which is compressed
+// if compress_type is not SEGMENT_COMPRESS_NONE
 
 const static size_t ENTRY_HEADER_SIZE = 24;
 
+// Type of the records padding the batches written with direct io up to the
+// block boundary, which is never used by EntryType
+const static uint32_t SEGMENT_PADDING_TYPE = 0xff;
+
+const static int64_t DIRECT_IO_ALIGNMENT = 4096;
+
 struct Segment::EntryHeader {
     int64_t term;
     int type;
     int checksum_type;
+    int compress_type;
     uint32_t data_len;
     uint32_t data_checksum;
 };
@@ -98,11 +173,91 @@ struct Segment::EntryHeader {
 std::ostream& operator<<(std::ostream& os, const Segment::EntryHeader& h) {
     os << "{term=" << h.term << ", type=" << h.type
        << ", data_len=" << h.data_len << ", checksum_type=" << h.checksum_type
+       << ", compress_type=" << h.compress_type
        << ", data_checksum=" << h.data_checksum << '}';
     return os;
 }
 
-int Segment::create() {
+static bool compress_data(int compress_type, const butil::IOBuf& in,
+                          butil::IOBuf* out) {
+    switch (compress_type) {
+        case SEGMENT_COMPRESS_SNAPPY:
+            return brpc::policy::SnappyCompress(in, out);
+        case SEGMENT_COMPRESS_ZLIB:
+            return brpc::policy::ZlibCompress(in, out, NULL);
+        default:
+            return false;
+    }
+}
+
+static bool decompress_data(int compress_type, const butil::IOBuf& in,
+                            butil::IOBuf* out) {
+    switch (compress_type) {
+        case SEGMENT_COMPRESS_SNAPPY:
+            return brpc::policy::SnappyDecompress(in, out);
+        case SEGMENT_COMPRESS_ZLIB:
+            return brpc::policy::ZlibDecompress(in, out);
+        default:
+            LOG(ERROR) << "Unknown compress_type=" << compress_type;
+            return false;
+    }
+}
+
+Segment::~Segment() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    const int direct_fd = _direct_fd.load(butil::memory_order_relaxed);
+    if (direct_fd >= 0) {
+        ::close(direct_fd);
+    }
+    if (_recycle_pool) {
+        // No one reads the file any more
+        _recycle_pool->on_recycled(_recycle_path);
+    }
+}
+
+int Segment::_get_direct_fd() const {
+    int direct_fd = _direct_fd.load(butil::memory_order_acquire);
+    if (direct_fd != DIRECT_FD_UNOPENED) {
+        return direct_fd;
+    }
+    direct_fd = -1;
+#ifdef O_DIRECT
+    if (FLAGS_raft_segment_direct_io && _fd >= 0) {
+        // Reopen the file through |_fd| rather than its name, which changes
+        // when the segment is closed or truncated
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", _fd);
+        int flags = O_RDWR | O_DIRECT;
+        TEST_SYNC_POINT_CALLBACK("Segment::open:O_DIRECT", &flags);
+        direct_fd = ::open(path, flags);
+        if (direct_fd >= 0) {
+            butil::make_close_on_exec(direct_fd);
+        } else {
+            PLOG(WARNING) << "Fail to open segment " << _first_index << " in `"
+                          << _path << "' with O_DIRECT, fallback to buffered io";
+        }
+    }
+#else
+    if (FLAGS_raft_segment_direct_io) {
+        LOG_ONCE(WARNING) << "O_DIRECT is not supported, fallback to buffered io";
+    }
+#endif
+    int expected = DIRECT_FD_UNOPENED;
+    if (!_direct_fd.compare_exchange_strong(expected, direct_fd,
+                                            butil::memory_order_acq_rel)) {
+        // Opened by another thread at the same time
+        if (direct_fd >= 0) {
+            ::close(direct_fd);
+        }
+        return expected;
+    }
+    return direct_fd;
+}
+
+int Segment::create(const std::string& prealloc_path) {
     if (!_is_open) {
         CHECK(false) << "Create on a closed segment at first_index="
                      << _first_index << " in " << _path;
@@ -111,12 +266,29 @@ int Segment::create() {
 
     std::string path(_path);
     butil::string_appendf(&path, "/" BRAFT_SEGMENT_OPEN_PATTERN, _first_index);
-    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (!prealloc_path.empty()) {
+        if (::rename(prealloc_path.c_str(), path.c_str()) == 0) {
+            _fd = ::open(path.c_str(), O_RDWR);
+            _preallocated = _fd >= 0;
+        } else {
+            PLOG(WARNING) << "Fail to rename `" << prealloc_path << "' to `"
+                          << path << '\'';
+        }
+    }
+    if (_fd < 0) {
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    }
     if (_fd >= 0) {
         butil::make_close_on_exec(_fd);
+        struct stat st_buf;
+        if (fstat(_fd, &st_buf) == 0) {
+            _dev = st_buf.st_dev;
+        }
+        _direct_fd.store(DIRECT_FD_UNOPENED, butil::memory_order_release);
     }
     LOG_IF(INFO, _fd >= 0) << "Created new segment `" << path
-                           << "' with fd=" << _fd;
+                           << "' with fd=" << _fd
+                           << " preallocated=" << _preallocated;
     return _fd >= 0 ? 0 : -1;
 }
 
@@ -172,47 +344,125 @@ inline uint32_t get_checksum(int checksum_type, const butil::IOBuf& data) {
     }
 }
 
+// Term of any entry is positive, so an all-zero header is never written
+static bool is_zero_header(const char* p) {
+    for (size_t i = 0; i < ENTRY_HEADER_SIZE; ++i) {
+        if (p[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether the bytes of |fd| in [begin, end) are all zero
+static bool is_zero_range(int fd, int64_t begin, int64_t end) {
+    std::vector<char> buf(64 * 1024);
+    while (begin < end) {
+        const size_t to_read = std::min((int64_t)buf.size(), end - begin);
+        const ssize_t n = pread(fd, &buf[0], to_read, begin);
+        if (n <= 0) {
+            return false;
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            if (buf[i] != 0) {
+                return false;
+            }
+        }
+        begin += n;
+    }
+    return true;
+}
+
+static IoUringWriter* segment_io_uring() {
+    return FLAGS_raft_segment_io_uring ? IoUringWriter::GetInstance() : NULL;
+}
+
+// Read [offset, offset + size) of |fd| opened with O_DIRECT through an aligned
+// buffer, return the number of bytes read like file_pread
+static ssize_t direct_pread(butil::IOPortal* portal, int fd, off_t offset,
+                            size_t size) {
+    const off_t aligned_offset = offset & ~(DIRECT_IO_ALIGNMENT - 1);
+    const size_t skip = offset - aligned_offset;
+    const size_t aligned_size =
+        (skip + size + DIRECT_IO_ALIGNMENT - 1) & ~(DIRECT_IO_ALIGNMENT - 1);
+    void* mem = NULL;
+    if (posix_memalign(&mem, DIRECT_IO_ALIGNMENT, aligned_size) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    std::unique_ptr<char, void (*)(void*)> buf((char*)mem, free);
+    IoUringWriter* io_uring = segment_io_uring();
+    ssize_t n = 0;
+    do {
+        // Read at once as the offset of a retry must be aligned as well
+        n = io_uring ? io_uring->pread(fd, buf.get(), aligned_size,
+                                       aligned_offset)
+                     : pread(fd, buf.get(), aligned_size, aligned_offset);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return -1;
+    }
+    if ((size_t)n <= skip) {
+        return 0;
+    }
+    const size_t nread = std::min(size, (size_t)n - skip);
+    portal->append(buf.get() + skip, nread);
+    return nread;
+}
+
+ssize_t Segment::_pread(butil::IOPortal* portal, off_t offset,
+                        size_t size) const {
+    const int direct_fd = _get_direct_fd();
+    if (direct_fd >= 0) {
+        return direct_pread(portal, direct_fd, offset, size);
+    }
+    IoUringWriter* io_uring = segment_io_uring();
+    if (io_uring) {
+        std::unique_ptr<char[]> buf(new char[size]);
+        size_t nread = 0;
+        while (nread < size) {
+            const ssize_t n = io_uring->pread(_fd, buf.get() + nread,
+                                              size - nread, offset + nread);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            nread += n;
+        }
+        portal->append(buf.get(), nread);
+        return nread;
+    }
+    return file_pread(portal, _fd, offset, size);
+}
+
 int Segment::_load_entry(off_t offset, EntryHeader* head, butil::IOBuf* data,
                          size_t size_hint) const {
     butil::IOPortal buf;
     size_t to_read = std::max(size_hint, ENTRY_HEADER_SIZE);
-    const ssize_t n = file_pread(&buf, _fd, offset, to_read);
+    const ssize_t n = _pread(&buf, offset, to_read);
     if (n != (ssize_t)to_read) {
         return n < 0 ? -1 : 1;
     }
     char header_buf[ENTRY_HEADER_SIZE];
     const char* p = (const char*)buf.fetch(header_buf, ENTRY_HEADER_SIZE);
-    int64_t term = 0;
-    uint32_t meta_field;
-    uint32_t data_len = 0;
-    uint32_t data_checksum = 0;
-    uint32_t header_checksum = 0;
-    RawUnpacker(p)
-        .unpack64((uint64_t&)term)
-        .unpack32(meta_field)
-        .unpack32(data_len)
-        .unpack32(data_checksum)
-        .unpack32(header_checksum);
     EntryHeader tmp;
-    tmp.term = term;
-    tmp.type = meta_field >> 24;
-    tmp.checksum_type = (meta_field << 8) >> 24;
-    tmp.data_len = data_len;
-    tmp.data_checksum = data_checksum;
-    if (!verify_checksum(tmp.checksum_type, p, ENTRY_HEADER_SIZE - 4,
-                         header_checksum)) {
-        LOG(ERROR) << "Found corrupted header at offset=" << offset
-                   << ", header=" << tmp << ", path: " << _path;
-        return -1;
+    const int rc = _parse_header(p, offset, &tmp);
+    if (rc != 0) {
+        return rc;
     }
+    const uint32_t data_len = tmp.data_len;
     if (head != NULL) {
         *head = tmp;
     }
     if (data != NULL) {
         if (buf.length() < ENTRY_HEADER_SIZE + data_len) {
             const size_t to_read = ENTRY_HEADER_SIZE + data_len - buf.length();
-            const ssize_t n =
-                file_pread(&buf, _fd, offset + buf.length(), to_read);
+            const ssize_t n = _pread(&buf, offset + buf.length(), to_read);
             if (n != (ssize_t)to_read) {
                 return n < 0 ? -1 : 1;
             }
@@ -233,6 +483,38 @@ int Segment::_load_entry(off_t offset, EntryHeader* head, butil::IOBuf* data,
     return 0;
 }
 
+int Segment::_parse_header(const char* p, off_t offset,
+                           EntryHeader* head) const {
+    if (is_zero_header(p)) {
+        // Reach the preallocated tail which is never written
+        return 1;
+    }
+    int64_t term = 0;
+    uint32_t meta_field;
+    uint32_t data_len = 0;
+    uint32_t data_checksum = 0;
+    uint32_t header_checksum = 0;
+    RawUnpacker(p)
+        .unpack64((uint64_t&)term)
+        .unpack32(meta_field)
+        .unpack32(data_len)
+        .unpack32(data_checksum)
+        .unpack32(header_checksum);
+    head->term = term;
+    head->type = meta_field >> 24;
+    head->checksum_type = (meta_field << 8) >> 24;
+    head->compress_type = (meta_field << 16) >> 24;
+    head->data_len = data_len;
+    head->data_checksum = data_checksum;
+    if (!verify_checksum(head->checksum_type, p, ENTRY_HEADER_SIZE - 4,
+                         header_checksum)) {
+        LOG(ERROR) << "Found corrupted header at offset=" << offset
+                   << ", header=" << *head << ", path: " << _path;
+        return -1;
+    }
+    return 0;
+}
+
 int Segment::_get_meta(int64_t index, LogMeta* meta) const {
     BAIDU_SCOPED_LOCK(_mutex);
     if (index > _last_index.load(butil::memory_order_relaxed) ||
@@ -250,19 +532,101 @@ int Segment::_get_meta(int64_t index, LogMeta* meta) const {
         return -1;
     }
     int64_t meta_index = index - _first_index;
-    int64_t entry_cursor = _offset_and_term[meta_index].first;
+    int64_t entry_cursor = _offsets[meta_index];
     int64_t next_cursor =
         (index < _last_index.load(butil::memory_order_relaxed))
-            ? _offset_and_term[meta_index + 1].first
+            ? _offsets[meta_index + 1]
             : _bytes;
     DCHECK_LT(entry_cursor, next_cursor);
     meta->offset = entry_cursor;
-    meta->term = _offset_and_term[meta_index].second;
+    meta->term = _term_at(index);
     meta->length = next_cursor - entry_cursor;
     return 0;
 }
 
+void Segment::_push_meta(int64_t offset, int64_t term) {
+    CHECK_LE(offset, (int64_t)UINT32_MAX) << "path: " << _path;
+    const int64_t index = _first_index + _offsets.size();
+    _offsets.push_back(offset);
+    if (_term_runs.empty() || _term_runs.back().second != term) {
+        _term_runs.push_back(std::make_pair(index, term));
+    }
+}
+
+int64_t Segment::_term_at(int64_t index) const {
+    // The last run starting at or before |index|
+    std::vector<std::pair<int64_t, int64_t> >::const_iterator it =
+        std::upper_bound(_term_runs.begin(), _term_runs.end(),
+                         std::pair<int64_t, int64_t>(index, INT64_MAX));
+    DCHECK(it != _term_runs.begin());
+    return (--it)->second;
+}
+
+void Segment::_truncate_meta(size_t count) {
+    _offsets.resize(count);
+    const int64_t end_index = _first_index + count;
+    while (!_term_runs.empty() && _term_runs.back().first >= end_index) {
+        _term_runs.pop_back();
+    }
+}
+
+// Reads a segment file forward in large chunks at loading, so that the
+// entries are parsed from memory rather than with a pread each
+class SegmentFileReader {
+   public:
+    SegmentFileReader(int fd, int64_t file_size)
+        : _fd(fd), _file_size(file_size), _offset(0) {}
+
+    // Copy [offset, offset + size) of the file to |out|, |offset| never goes
+    // backwards. Returns 0 on success, 1 if the file ends before, -1 on error
+    int read(int64_t offset, size_t size, butil::IOBuf* out) {
+        CHECK_GE(offset, _offset);
+        const size_t skip =
+            std::min((size_t)(offset - _offset), _buf.length());
+        _buf.pop_front(skip);
+        _offset += skip;
+        if (offset > _offset) {
+            // Far beyond the buffer, e.g. skipping a large entry
+            _offset = offset;
+        }
+        while (_buf.length() < size) {
+            const int64_t read_offset = _offset + _buf.length();
+            if (read_offset >= _file_size) {
+                return 1;
+            }
+            size_t to_read = std::max((size_t)FLAGS_raft_segment_load_read_size,
+                                      size - _buf.length());
+            to_read = std::min(to_read, (size_t)(_file_size - read_offset));
+            const ssize_t n = file_pread(&_buf, _fd, read_offset, to_read);
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                return 1;
+            }
+        }
+        _buf.append_to(out, size);
+        return 0;
+    }
+
+   private:
+    int _fd;
+    int64_t _file_size;
+    // the file offset of _buf
+    int64_t _offset;
+    butil::IOPortal _buf;
+};
+
 int Segment::load(ConfigurationManager* configuration_manager) {
+    std::vector<ConfigurationEntry> configurations;
+    const int ret = load(&configurations);
+    for (size_t i = 0; i < configurations.size(); ++i) {
+        configuration_manager->add(std::move(configurations[i]));
+    }
+    return ret;
+}
+
+int Segment::load(std::vector<ConfigurationEntry>* configurations) {
     int ret = 0;
 
     std::string path(_path);
@@ -289,20 +653,62 @@ int Segment::load(ConfigurationManager* configuration_manager) {
         _fd = -1;
         return -1;
     }
+    _dev = st_buf.st_dev;
 
     // load entry index
     int64_t file_size = st_buf.st_size;
+    if (!_is_open && FLAGS_raft_segment_index_sidecar &&
+        _load_index(file_size, configurations) == 0) {
+        _bytes = file_size;
+        ::lseek(_fd, _bytes, SEEK_SET);
+        _direct_fd.store(DIRECT_FD_UNOPENED, butil::memory_order_release);
+        return 0;
+    }
     int64_t entry_off = 0;
     int64_t actual_last_index = _first_index - 1;
     bool is_entry_corrupted = false;
-    for (int64_t i = _first_index; entry_off < file_size; i++) {
+    // The size of a preallocated file doesn't tell how much was written, so
+    // the last unsynced entry before the zero-filled tail may be torn, check
+    // all the data of the open segment in this case. A bad entry followed by
+    // any written byte is corruption rather than a torn write.
+    bool has_zero_tail = false;
+    if (_is_open && file_size >= (int64_t)ENTRY_HEADER_SIZE) {
+        char tail[ENTRY_HEADER_SIZE];
+        has_zero_tail = pread(_fd, tail, sizeof(tail),
+                              file_size - ENTRY_HEADER_SIZE) ==
+                            (ssize_t)sizeof(tail) &&
+                        is_zero_header(tail);
+    }
+    SegmentFileReader reader(_fd, file_size);
+    while (entry_off < file_size) {
         EntryHeader header;
-        const int rc = _load_entry(entry_off, &header, NULL, ENTRY_HEADER_SIZE);
+        butil::IOBuf header_data;
+        int rc = reader.read(entry_off, ENTRY_HEADER_SIZE, &header_data);
+        bool bad_header = false;
+        if (rc == 0) {
+            char header_buf[ENTRY_HEADER_SIZE];
+            const char* p =
+                (const char*)header_data.fetch(header_buf, ENTRY_HEADER_SIZE);
+            rc = _parse_header(p, entry_off, &header);
+            bad_header = (rc < 0);
+        }
         if (rc > 0) {
             // The last log was not completely written, which should be
             // truncated
             break;
         }
+        if (bad_header && has_zero_tail) {
+            // The length in the torn header is not trusted beyond the file
+            int64_t entry_end = entry_off + ENTRY_HEADER_SIZE;
+            if (entry_end + header.data_len <= file_size) {
+                entry_end += header.data_len;
+            }
+            if (is_zero_range(_fd, entry_end, file_size)) {
+                LOG(WARNING) << "Truncate torn header in preallocated segment, "
+                             << "path: " << _path << " entry_off " << entry_off;
+                break;
+            }
+        }
         if (rc < 0) {
             is_entry_corrupted = true;
             ret = rc;
@@ -315,19 +721,40 @@ int Segment::load(ConfigurationManager* configuration_manager) {
             // truncated
             break;
         }
-        if (header.type == ENTRY_TYPE_CONFIGURATION) {
-            butil::IOBuf data;
-            // Header will be parsed again but it's fine as configuration
-            // changing is rare
-            if (_load_entry(entry_off, NULL, &data, skip_len) != 0) {
+        if (header.type == (int)SEGMENT_PADDING_TYPE) {
+            entry_off += skip_len;
+            continue;
+        }
+        butil::IOBuf data;
+        if (has_zero_tail || header.type == ENTRY_TYPE_CONFIGURATION) {
+            if (reader.read(entry_off + ENTRY_HEADER_SIZE, header.data_len,
+                            &data) != 0 ||
+                !verify_checksum(header.checksum_type, data,
+                                 header.data_checksum)) {
+                if (has_zero_tail &&
+                    !is_zero_range(_fd, entry_off + skip_len, file_size)) {
+                    LOG(ERROR) << "Found corrupted entry followed by written "
+                               << "data in preallocated segment, path: "
+                               << _path << " entry_off " << entry_off;
+                    is_entry_corrupted = true;
+                    ret = -1;
+                    break;
+                }
+                LOG_IF(WARNING, has_zero_tail)
+                    << "Truncate torn entry in preallocated segment, "
+                    << "path: " << _path << " entry_off " << entry_off;
                 break;
             }
+        }
+        if (header.type == ENTRY_TYPE_CONFIGURATION) {
             scoped_refptr<LogEntry> entry = new LogEntry();
-            entry->id.index = i;
+            entry->id.index = actual_last_index + 1;
             entry->id.term = header.term;
             butil::Status status = parse_configuration_meta(data, entry);
             if (status.ok()) {
-                configuration_manager->add({std::move(*entry)});
+                _configuration_indexes.push_back(entry->id.index);
+                configurations->push_back(
+                    ConfigurationEntry(std::move(*entry)));
             } else {
                 LOG(ERROR) << "fail to parse configuration meta, path: "
                            << _path << " entry_off " << entry_off;
@@ -335,7 +762,13 @@ int Segment::load(ConfigurationManager* configuration_manager) {
                 break;
             }
         }
-        _offset_and_term.push_back(std::make_pair(entry_off, header.term));
+        if (entry_off > (int64_t)UINT32_MAX) {
+            LOG(ERROR) << "Too large segment, path: " << _path
+                       << " entry_off " << entry_off;
+            ret = -1;
+            break;
+        }
+        _push_meta(entry_off, header.term);
         ++actual_last_index;
         entry_off += skip_len;
     }
@@ -384,29 +817,27 @@ int Segment::load(ConfigurationManager* configuration_manager) {
     ::lseek(_fd, entry_off, SEEK_SET);
 
     _bytes = entry_off;
+    if (ret == 0) {
+        // Loading reads the file in chunks, which is left to the page cache
+        _direct_fd.store(DIRECT_FD_UNOPENED, butil::memory_order_release);
+    }
     return ret;
 }
 
-int Segment::append(const LogEntry* entry) {
-    if (BAIDU_UNLIKELY(!entry || !_is_open)) {
-        return EINVAL;
-    } else if (entry->id.index !=
-               _last_index.load(butil::memory_order_consume) + 1) {
-        CHECK(false) << "entry->index=" << entry->id.index
-                     << " _last_index=" << _last_index
-                     << " _first_index=" << _first_index;
-        return ERANGE;
-    }
-
-    butil::IOBuf data;
+int Segment::_serialize_entry(const LogEntry* entry, char* header_buf,
+                              butil::IOBuf* buf,
+                              const butil::IOBuf** out) const {
+    // The data of the entry is written as is unless it's compressed, whose
+    // blocks are shared with the request attachment on followers
+    *out = buf;
     switch (entry->type) {
         case ENTRY_TYPE_DATA:
-            data.append(entry->data);
+            *out = &entry->data;
             break;
         case ENTRY_TYPE_NO_OP:
             break;
         case ENTRY_TYPE_CONFIGURATION: {
-            butil::Status status = serialize_configuration_meta(entry, data);
+            butil::Status status = serialize_configuration_meta(entry, *buf);
             if (!status.ok()) {
                 LOG(ERROR) << "Fail to serialize ConfigurationPBMeta, path: "
                            << _path;
@@ -418,57 +849,299 @@ int Segment::append(const LogEntry* entry) {
                        << ", path: " << _path;
             return -1;
     }
+    int compress_type = SEGMENT_COMPRESS_NONE;
+    const int compress_type_wanted = FLAGS_raft_segment_compress_type;
+    if (entry->type == ENTRY_TYPE_DATA &&
+        compress_type_wanted != SEGMENT_COMPRESS_NONE &&
+        entry->data.length() >=
+            (size_t)FLAGS_raft_segment_compress_min_bytes) {
+        if (compress_data(compress_type_wanted, entry->data, buf) &&
+            buf->length() < entry->data.length()) {
+            // Kept only if it saves space
+            g_segment_compress_saved_bytes
+                << entry->data.length() - buf->length();
+            compress_type = compress_type_wanted;
+            *out = buf;
+        } else {
+            buf->clear();
+        }
+    }
+    const butil::IOBuf& data = **out;
     CHECK_LE(data.length(), 1ul << 56ul);
-    char header_buf[ENTRY_HEADER_SIZE];
-    const uint32_t meta_field = (entry->type << 24) | (_checksum_type << 16);
+    const uint32_t meta_field = (entry->type << 24) | (_checksum_type << 16) |
+                                (compress_type << 8);
     RawPacker packer(header_buf);
     packer.pack64(entry->id.term)
         .pack32(meta_field)
         .pack32((uint32_t)data.length())
-        .pack32(get_checksum(_checksum_type, data));
+        .pack32(_checksum_type == CHECKSUM_CRC32 && &data == &entry->data
+                    ? entry->data_crc32c()
+                    : get_checksum(_checksum_type, data));
     packer.pack32(
         get_checksum(_checksum_type, header_buf, ENTRY_HEADER_SIZE - 4));
-    butil::IOBuf header;
-    header.append(header_buf, ENTRY_HEADER_SIZE);
-    const size_t to_write = header.length() + data.length();
-    butil::IOBuf* pieces[2] = {&header, &data};
-    size_t start = 0;
-    ssize_t written = 0;
-    while (written < (ssize_t)to_write) {
-        const ssize_t n = butil::IOBuf::cut_multiple_into_file_descriptor(
-            _fd, pieces + start, ARRAY_SIZE(pieces) - start);
-        if (n < 0) {
-            LOG(ERROR) << "Fail to write to fd=" << _fd << ", path: " << _path
-                       << berror();
+    return 0;
+}
+
+int Segment::append(const LogEntry* entry) {
+    return _append(&entry, 1, false, false);
+}
+
+int Segment::append_batch(const LogEntry* const* entries, size_t count,
+                          bool will_sync, bool has_conf) {
+    return _append(entries, count, will_sync, has_conf) == 0 ? count : 0;
+}
+
+int Segment::_append(const LogEntry* const* entries, size_t count,
+                     bool will_sync, bool has_conf) {
+    if (BAIDU_UNLIKELY(!_is_open)) {
+        return EINVAL;
+    }
+    // All the headers and checksums are computed before touching the file
+    const int64_t last_index = _last_index.load(butil::memory_order_consume);
+    std::vector<butil::IOBuf> bufs(count);
+    std::vector<const butil::IOBuf*> datas(count);
+    std::vector<char> headers(count * ENTRY_HEADER_SIZE);
+    for (size_t i = 0; i < count; ++i) {
+        if (BAIDU_UNLIKELY(!entries[i])) {
+            return EINVAL;
+        } else if (entries[i]->id.index != last_index + 1 + (int64_t)i) {
+            CHECK(false) << "entry->index=" << entries[i]->id.index
+                         << " _last_index=" << last_index + i
+                         << " _first_index=" << _first_index;
+            return ERANGE;
+        }
+        if (_serialize_entry(entries[i], &headers[i * ENTRY_HEADER_SIZE],
+                             &bufs[i], &datas[i]) != 0) {
             return -1;
         }
-        written += n;
-        for (; start < ARRAY_SIZE(pieces) && pieces[start]->empty(); ++start) {
+    }
+    // The offsets of the entries are kept in 32 bits
+    int64_t last_offset = _bytes;
+    for (size_t i = 0; i + 1 < count; ++i) {
+        last_offset += ENTRY_HEADER_SIZE + datas[i]->length();
+    }
+    if (last_offset > (int64_t)UINT32_MAX) {
+        LOG(ERROR) << "Too large batch of " << count
+                   << " entries appended to " << _path << " of " << _bytes
+                   << " bytes";
+        return EOVERFLOW;
+    }
+    const int direct_fd = _get_direct_fd();
+    if (direct_fd >= 0) {
+        return _append_direct(direct_fd, entries, count, headers, datas,
+                              will_sync, has_conf);
+    }
+
+    butil::IOBuf batch;
+    for (size_t i = 0; i < count; ++i) {
+        batch.append(&headers[i * ENTRY_HEADER_SIZE], ENTRY_HEADER_SIZE);
+        batch.append(*datas[i]);
+    }
+    const size_t to_write = batch.length();
+    IoUringWriter* io_uring = segment_io_uring();
+    // With io_uring the sync is linked right after the write, unless it's
+    // left to the fsync coordinator
+    const bool synced = io_uring && !FLAGS_raft_enable_shared_fsync &&
+                        _need_sync(will_sync, has_conf,
+                                   _unsynced_bytes + to_write);
+    int rc = 0;
+    if (io_uring) {
+        std::vector<struct iovec> iov(batch.backing_block_num());
+        for (size_t i = 0; i < iov.size(); ++i) {
+            const butil::StringPiece block = batch.backing_block(i);
+            iov[i].iov_base = (void*)block.data();
+            iov[i].iov_len = block.size();
+        }
+        rc = io_uring->pwritev(_fd, &iov[0], iov.size(), _bytes, synced);
+    } else {
+        // Write at the offset explicitly as the fd offset is not maintained
+        // by the other ways of writing
+        while (!batch.empty()) {
+            const ssize_t n = batch.pcut_into_file_descriptor(
+                _fd, _bytes + to_write - batch.length(), batch.length());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                rc = -1;
+                break;
+            }
         }
     }
+    if (rc != 0) {
+        LOG(ERROR) << "Fail to write to fd=" << _fd << ", path: " << _path
+                   << berror();
+        // Drop the partial write so that the next append starts right
+        // after the last complete entry
+        if (ftruncate_uninterrupted(_fd, _bytes) != 0) {
+            PLOG(ERROR) << "Fail to truncate fd=" << _fd
+                        << " to size=" << _bytes << ", path: " << _path;
+        }
+        return -1;
+    }
     BAIDU_SCOPED_LOCK(_mutex);
-    _offset_and_term.push_back(std::make_pair(_bytes, entry->id.term));
-    _last_index.fetch_add(1, butil::memory_order_relaxed);
+    int64_t offset = _bytes;
+    for (size_t i = 0; i < count; ++i) {
+        _push_meta(offset, entries[i]->id.term);
+        if (entries[i]->type == ENTRY_TYPE_CONFIGURATION) {
+            _configuration_indexes.push_back(entries[i]->id.index);
+        }
+        offset += ENTRY_HEADER_SIZE + datas[i]->length();
+    }
+    _last_index.fetch_add(count, butil::memory_order_relaxed);
     _bytes += to_write;
-    _unsynced_bytes += to_write;
+    _unsynced_bytes = synced ? 0 : _unsynced_bytes + to_write;
+    return 0;
+}
+
+// Fill |buf| of |len| bytes with a padding record, which is skipped when the
+// segment is loaded
+static void pack_padding(char* buf, size_t len, int checksum_type) {
+    memset(buf, 0, len);
+    const uint32_t data_len = len - ENTRY_HEADER_SIZE;
+    const uint32_t meta_field =
+        (SEGMENT_PADDING_TYPE << 24) | (checksum_type << 16);
+    RawPacker packer(buf);
+    packer.pack64(0)
+        .pack32(meta_field)
+        .pack32(data_len)
+        .pack32(get_checksum(checksum_type, buf + ENTRY_HEADER_SIZE, data_len));
+    packer.pack32(get_checksum(checksum_type, buf, ENTRY_HEADER_SIZE - 4));
+}
+
+int Segment::_append_direct(int direct_fd, const LogEntry* const* entries,
+                            size_t count,
+                            const std::vector<char>& headers,
+                            const std::vector<const butil::IOBuf*>& datas,
+                            bool will_sync, bool has_conf) {
+    size_t entries_size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        entries_size += ENTRY_HEADER_SIZE + datas[i]->length();
+    }
+
+    // The batch starts at a block boundary unless the last block was left
+    // partial by truncate or by buffered writes, which is rewritten then.
+    const int64_t aligned_offset = _bytes & ~(DIRECT_IO_ALIGNMENT - 1);
+    const size_t prefix = _bytes - aligned_offset;
+    size_t padding = (DIRECT_IO_ALIGNMENT -
+                      (prefix + entries_size) % DIRECT_IO_ALIGNMENT) %
+                     DIRECT_IO_ALIGNMENT;
+    if (padding != 0 && padding < ENTRY_HEADER_SIZE) {
+        padding += DIRECT_IO_ALIGNMENT;
+    }
+    const size_t to_write = prefix + entries_size + padding;
+    void* mem = NULL;
+    if (posix_memalign(&mem, DIRECT_IO_ALIGNMENT, to_write) != 0) {
+        LOG(ERROR) << "Fail to allocate " << to_write
+                   << " bytes aligned buffer, path: " << _path;
+        return -1;
+    }
+    std::unique_ptr<char, void (*)(void*)> buf((char*)mem, free);
+    if (prefix != 0) {
+        const ssize_t n = pread(direct_fd, buf.get(), DIRECT_IO_ALIGNMENT,
+                                aligned_offset);
+        if (n < (ssize_t)prefix) {
+            PLOG(ERROR) << "Fail to read the last block at offset="
+                        << aligned_offset << ", path: " << _path;
+            return -1;
+        }
+    }
+    size_t pos = prefix;
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(buf.get() + pos, &headers[i * ENTRY_HEADER_SIZE],
+               ENTRY_HEADER_SIZE);
+        pos += ENTRY_HEADER_SIZE;
+        datas[i]->copy_to(buf.get() + pos);
+        pos += datas[i]->length();
+    }
+    if (padding != 0) {
+        pack_padding(buf.get() + pos, padding, _checksum_type);
+    }
+
+    IoUringWriter* io_uring = segment_io_uring();
+    const bool synced = io_uring && !FLAGS_raft_enable_shared_fsync &&
+                        _need_sync(will_sync, has_conf,
+                                   _unsynced_bytes + to_write);
+    if (io_uring) {
+        struct iovec iov;
+        iov.iov_base = buf.get();
+        iov.iov_len = to_write;
+        if (io_uring->pwritev(direct_fd, &iov, 1, aligned_offset, synced) !=
+            0) {
+            LOG(ERROR) << "Fail to write to fd=" << direct_fd
+                       << ", path: " << _path << berror();
+            return -1;
+        }
+    }
+    size_t written = io_uring ? to_write : 0;
+    while (written < to_write) {
+        const ssize_t n = pwrite(direct_fd, buf.get() + written,
+                                 to_write - written, aligned_offset + written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            LOG(ERROR) << "Fail to write to fd=" << direct_fd
+                       << ", path: " << _path << berror();
+            return -1;
+        }
+        written += n;
+    }
 
+    BAIDU_SCOPED_LOCK(_mutex);
+    int64_t offset = _bytes;
+    for (size_t i = 0; i < count; ++i) {
+        _push_meta(offset, entries[i]->id.term);
+        if (entries[i]->type == ENTRY_TYPE_CONFIGURATION) {
+            _configuration_indexes.push_back(entries[i]->id.index);
+        }
+        offset += ENTRY_HEADER_SIZE + datas[i]->length();
+    }
+    _last_index.fetch_add(count, butil::memory_order_relaxed);
+    _bytes = aligned_offset + to_write;
+    _unsynced_bytes = synced ? 0 : _unsynced_bytes + to_write - prefix;
     return 0;
 }
 
-int Segment::sync(bool will_sync, bool has_conf) {
+bool Segment::_need_sync(bool will_sync, bool has_conf,
+                         int64_t unsynced_bytes) const {
+    if (!will_sync || !FLAGS_raft_sync) {
+        return false;
+    }
+    if (FLAGS_raft_sync_policy == RaftSyncPolicy::RAFT_SYNC_BY_BYTES &&
+        FLAGS_raft_sync_per_bytes > unsynced_bytes && !has_conf) {
+        return false;
+    }
+    return true;
+}
+
+int Segment::sync(bool will_sync, bool has_conf, IOMetric* metric) {
     if (_last_index < _first_index) {
         return 0;
     }
     // CHECK(_is_open);
     if (will_sync) {
-        if (!FLAGS_raft_sync) {
+        if (!_need_sync(will_sync, has_conf, _unsynced_bytes)) {
             return 0;
         }
-        if (FLAGS_raft_sync_policy == RaftSyncPolicy::RAFT_SYNC_BY_BYTES &&
-            FLAGS_raft_sync_per_bytes > _unsynced_bytes && !has_conf) {
+        if (_unsynced_bytes == 0) {
+            // Synced along with the last write
             return 0;
         }
         _unsynced_bytes = 0;
+        if (FLAGS_raft_enable_shared_fsync) {
+            int64_t wait_time_us = 0;
+            const int rc =
+                global_fsync_coordinator->sync(_fd, _dev, &wait_time_us);
+            if (metric) {
+                metric->sync_wait_time_us += wait_time_us;
+            }
+            return rc;
+        }
+        IoUringWriter* io_uring = segment_io_uring();
+        if (io_uring) {
+            return io_uring->fsync(_fd);
+        }
         return raft_fsync(_fd);
     }
     return 0;
@@ -479,29 +1152,113 @@ LogEntry* Segment::get(const int64_t index) const {
     if (_get_meta(index, &meta) != 0) {
         return NULL;
     }
+    EntryHeader header;
+    butil::IOBuf data;
+    if (_load_entry(meta.offset, &header, &data, meta.length) != 0) {
+        return NULL;
+    }
+    CHECK_EQ(meta.term, header.term);
+    return _decode_entry(index, header, &data);
+}
+
+int Segment::get_entries(const int64_t first_index, const int64_t last_index,
+                         size_t max_bytes,
+                         std::vector<LogEntry*>* entries) const {
+    if (first_index < _first_index) {
+        return 0;
+    }
+    std::vector<LogMeta> metas;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        const int64_t segment_last_index =
+            _last_index.load(butil::memory_order_relaxed);
+        const int64_t last = std::min(last_index, segment_last_index);
+        size_t bytes = 0;
+        for (int64_t index = first_index; index <= last && bytes < max_bytes;
+             ++index) {
+            const int64_t meta_index = index - _first_index;
+            LogMeta meta;
+            meta.offset = _offsets[meta_index];
+            meta.term = _term_at(index);
+            meta.length = (index < segment_last_index)
+                              ? _offsets[meta_index + 1] - meta.offset
+                              : _bytes - meta.offset;
+            metas.push_back(meta);
+            bytes += meta.length;
+        }
+    }
+    if (metas.empty()) {
+        return 0;
+    }
+    // Read the whole range at once
+    butil::IOPortal buf;
+    const size_t to_read =
+        metas.back().offset + metas.back().length - metas.front().offset;
+    const ssize_t n = _pread(&buf, metas.front().offset, to_read);
+    if (n != (ssize_t)to_read) {
+        LOG(ERROR) << "Fail to read " << to_read << " bytes at offset="
+                   << metas.front().offset << ", path: " << _path;
+        return 0;
+    }
+    for (size_t i = 0; i < metas.size(); ++i) {
+        butil::IOBuf piece;
+        buf.cutn(&piece, metas[i].length);
+        char header_buf[ENTRY_HEADER_SIZE];
+        const char* p = (const char*)piece.fetch(header_buf, ENTRY_HEADER_SIZE);
+        EntryHeader header;
+        if (p == NULL || _parse_header(p, metas[i].offset, &header) != 0 ||
+            ENTRY_HEADER_SIZE + header.data_len > piece.length()) {
+            return i;
+        }
+        CHECK_EQ(metas[i].term, header.term);
+        piece.pop_front(ENTRY_HEADER_SIZE);
+        // Drop the padding after the entry
+        piece.pop_back(piece.length() - header.data_len);
+        if (!verify_checksum(header.checksum_type, piece,
+                             header.data_checksum)) {
+            LOG(ERROR) << "Found corrupted data at offset="
+                       << metas[i].offset + ENTRY_HEADER_SIZE
+                       << " header=" << header << " path: " << _path;
+            return i;
+        }
+        LogEntry* entry = _decode_entry(first_index + i, header, &piece);
+        if (entry == NULL) {
+            return i;
+        }
+        entries->push_back(entry);
+    }
+    return metas.size();
+}
 
+LogEntry* Segment::_decode_entry(const int64_t index, const EntryHeader& header,
+                                 butil::IOBuf* data) const {
     bool ok = true;
     LogEntry* entry = NULL;
     do {
-        ConfigurationPBMeta configuration_meta;
-        EntryHeader header;
-        butil::IOBuf data;
-        if (_load_entry(meta.offset, &header, &data, meta.length) != 0) {
-            ok = false;
-            break;
-        }
-        CHECK_EQ(meta.term, header.term);
         entry = new LogEntry();
         entry->AddRef();
         switch (header.type) {
             case ENTRY_TYPE_DATA:
-                entry->data.swap(data);
+                if (header.compress_type != SEGMENT_COMPRESS_NONE) {
+                    if (!decompress_data(header.compress_type, *data,
+                                         &entry->data)) {
+                        LOG(ERROR) << "Fail to decompress entry of index="
+                                   << index << ", path: " << _path;
+                        ok = false;
+                    }
+                    break;
+                }
+                entry->data.swap(*data);
+                if (header.checksum_type == CHECKSUM_CRC32) {
+                    // Verified already, replicators send it as is
+                    entry->set_data_crc32c(header.data_checksum);
+                }
                 break;
             case ENTRY_TYPE_NO_OP:
-                CHECK(data.empty()) << "Data of NO_OP must be empty";
+                CHECK(data->empty()) << "Data of NO_OP must be empty";
                 break;
             case ENTRY_TYPE_CONFIGURATION: {
-                butil::Status status = parse_configuration_meta(data, entry);
+                butil::Status status = parse_configuration_meta(*data, entry);
                 if (!status.ok()) {
                     LOG(WARNING)
                         << "Fail to parse ConfigurationPBMeta, path: " << _path;
@@ -547,29 +1304,240 @@ int Segment::close(bool will_sync) {
     butil::string_appendf(&new_path, "/" BRAFT_SEGMENT_CLOSED_PATTERN,
                           _first_index, _last_index.load());
 
-    // TODO: optimize index memory usage by reconstruct vector
     LOG(INFO) << "close a full segment. Current first_index: " << _first_index
               << " last_index: " << _last_index
               << " raft_sync_segments: " << FLAGS_raft_sync_segments
               << " will_sync: " << will_sync << " path: " << new_path;
     int ret = 0;
-    if (_last_index > _first_index) {
+    if (_preallocated) {
+        // Closed segments never have the zero-filled tail
+        ret = ftruncate_uninterrupted(_fd, _bytes);
+        PLOG_IF(ERROR, ret != 0) << "Fail to truncate " << old_path
+                                 << " to size=" << _bytes;
+    }
+    if (ret == 0 && _last_index > _first_index) {
         if (FLAGS_raft_sync_segments && will_sync) {
             ret = raft_fsync(_fd);
         }
     }
     if (ret == 0) {
+        {
+            // Nothing is appended to a closed segment any more
+            BAIDU_SCOPED_LOCK(_mutex);
+            _offsets.shrink_to_fit();
+            _term_runs.shrink_to_fit();
+        }
         _is_open = false;
         const int rc = ::rename(old_path.c_str(), new_path.c_str());
         LOG_IF(INFO, rc == 0)
             << "Renamed `" << old_path << "' to `" << new_path << '\'';
         LOG_IF(ERROR, rc != 0) << "Fail to rename `" << old_path << "' to `"
                                << new_path << "\', " << berror();
+        if (rc == 0 && FLAGS_raft_segment_index_sidecar) {
+            // The segment is scanned at startup without the sidecar, so
+            // failing to save it is not an error
+            _save_index(FLAGS_raft_sync_segments && will_sync);
+        }
         return rc;
     }
     return ret;
 }
 
+std::string Segment::_index_path() const {
+    std::string path(_path);
+    butil::string_appendf(&path, "/" BRAFT_SEGMENT_INDEX_PATTERN, _first_index,
+                          _last_index.load());
+    return path;
+}
+
+// Layout of the index sidecar of a closed segment, all in big endian:
+//
+// | magic (32bits) | version (32bits) | first_index (64bits)              |
+// | last_index (64bits) | segment bytes (64bits) | nconf (32bits)         |
+// | checksum (32bits), crc32c of all the bytes except itself              |
+// | (offset (64bits), term (64bits)) of each entry                        |
+// | index (64bits) of each configuration entry                            |
+static const uint32_t SEGMENT_INDEX_MAGIC = 0x42524958;  // "BRIX"
+static const uint32_t SEGMENT_INDEX_VERSION = 1;
+static const size_t SEGMENT_INDEX_HEADER_SIZE = 40;
+
+int Segment::_save_index(bool sync) {
+    std::string buf;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        buf.resize(SEGMENT_INDEX_HEADER_SIZE +
+                   _offsets.size() * 16 +
+                   _configuration_indexes.size() * 8);
+        char* p = &buf[0];
+        butil::RawPacker(p)
+            .pack32(SEGMENT_INDEX_MAGIC)
+            .pack32(SEGMENT_INDEX_VERSION)
+            .pack64(_first_index)
+            .pack64(_last_index.load(butil::memory_order_relaxed))
+            .pack64(_bytes)
+            .pack32(_configuration_indexes.size());
+        p += SEGMENT_INDEX_HEADER_SIZE;
+        for (size_t i = 0; i < _offsets.size(); ++i) {
+            butil::RawPacker(p)
+                .pack64(_offsets[i])
+                .pack64(_term_at(_first_index + i));
+            p += 16;
+        }
+        for (size_t i = 0; i < _configuration_indexes.size(); ++i) {
+            butil::RawPacker(p).pack64(_configuration_indexes[i]);
+            p += 8;
+        }
+    }
+    uint32_t checksum =
+        butil::crc32c::Value(buf.data(), SEGMENT_INDEX_HEADER_SIZE - 4);
+    checksum = butil::crc32c::Extend(
+        checksum, buf.data() + SEGMENT_INDEX_HEADER_SIZE,
+        buf.size() - SEGMENT_INDEX_HEADER_SIZE);
+    butil::RawPacker(&buf[SEGMENT_INDEX_HEADER_SIZE - 4]).pack32(checksum);
+
+    const std::string path = _index_path();
+    const std::string tmp_path = path + ".tmp";
+    butil::fd_guard fd(::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                              0644));
+    if (fd < 0) {
+        PLOG(WARNING) << "Fail to open " << tmp_path;
+        return -1;
+    }
+    butil::IOBuf data;
+    data.append(buf);
+    if (file_pwrite(data, fd, 0) != (ssize_t)data.size() ||
+        (sync && raft_fsync(fd) != 0)) {
+        PLOG(WARNING) << "Fail to write " << tmp_path;
+        ::unlink(tmp_path.c_str());
+        return -1;
+    }
+    if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        PLOG(WARNING) << "Fail to rename " << tmp_path << " to " << path;
+        ::unlink(tmp_path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int Segment::_load_index(int64_t file_size,
+                         std::vector<ConfigurationEntry>* configurations) {
+    const std::string path = _index_path();
+    butil::fd_guard fd(::open(path.c_str(), O_RDONLY));
+    if (fd < 0) {
+        PLOG_IF(WARNING, errno != ENOENT) << "Fail to open " << path;
+        return -1;
+    }
+    const int64_t last_index = _last_index.load(butil::memory_order_relaxed);
+    if (last_index < _first_index) {
+        return -1;
+    }
+    const size_t nentries = last_index - _first_index + 1;
+    butil::IOPortal portal;
+    const size_t max_size = SEGMENT_INDEX_HEADER_SIZE + nentries * 24;
+    const ssize_t n = file_pread(&portal, fd, 0, max_size + 1);
+    if (n < (ssize_t)SEGMENT_INDEX_HEADER_SIZE) {
+        LOG(WARNING) << "Invalid index sidecar " << path << ", scan the segment";
+        return -1;
+    }
+    const std::string buf = portal.to_string();
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    int64_t first_index_in_file = 0;
+    int64_t last_index_in_file = 0;
+    int64_t bytes = 0;
+    uint32_t nconf = 0;
+    uint32_t checksum = 0;
+    butil::RawUnpacker(buf.data())
+        .unpack32(magic)
+        .unpack32(version)
+        .unpack64((uint64_t&)first_index_in_file)
+        .unpack64((uint64_t&)last_index_in_file)
+        .unpack64((uint64_t&)bytes)
+        .unpack32(nconf)
+        .unpack32(checksum);
+    uint32_t expected_checksum =
+        butil::crc32c::Value(buf.data(), SEGMENT_INDEX_HEADER_SIZE - 4);
+    expected_checksum = butil::crc32c::Extend(
+        expected_checksum, buf.data() + SEGMENT_INDEX_HEADER_SIZE,
+        buf.size() - SEGMENT_INDEX_HEADER_SIZE);
+    if (magic != SEGMENT_INDEX_MAGIC || version != SEGMENT_INDEX_VERSION ||
+        first_index_in_file != _first_index ||
+        last_index_in_file != last_index || bytes != file_size ||
+        buf.size() != SEGMENT_INDEX_HEADER_SIZE + nentries * 16 + nconf * 8 ||
+        checksum != expected_checksum) {
+        LOG(WARNING) << "Mismatched index sidecar " << path
+                     << ", scan the segment";
+        return -1;
+    }
+    const char* p = buf.data() + SEGMENT_INDEX_HEADER_SIZE;
+    std::vector<std::pair<int64_t, int64_t> > offset_and_term(nentries);
+    for (size_t i = 0; i < nentries; ++i) {
+        butil::RawUnpacker(p)
+            .unpack64((uint64_t&)offset_and_term[i].first)
+            .unpack64((uint64_t&)offset_and_term[i].second);
+        p += 16;
+        if (offset_and_term[i].first > (int64_t)UINT32_MAX) {
+            return -1;
+        }
+    }
+    std::vector<int64_t> configuration_indexes(nconf);
+    for (size_t i = 0; i < nconf; ++i) {
+        butil::RawUnpacker(p).unpack64((uint64_t&)configuration_indexes[i]);
+        p += 8;
+    }
+    // The segment might be rewritten by a version unaware of the sidecar,
+    // and the same term at the last index means the same log
+    EntryHeader header;
+    if (_load_entry(offset_and_term.back().first, &header, NULL,
+                    ENTRY_HEADER_SIZE) != 0 ||
+        header.term != offset_and_term.back().second ||
+        offset_and_term.back().first + (int64_t)ENTRY_HEADER_SIZE +
+                header.data_len > file_size) {
+        LOG(WARNING) << "Stale index sidecar " << path << ", scan the segment";
+        return -1;
+    }
+    std::vector<ConfigurationEntry> loaded;
+    for (size_t i = 0; i < configuration_indexes.size(); ++i) {
+        const int64_t index = configuration_indexes[i];
+        if (index < _first_index || index > last_index) {
+            return -1;
+        }
+        butil::IOBuf data;
+        const std::pair<int64_t, int64_t>& meta =
+            offset_and_term[index - _first_index];
+        if (_load_entry(meta.first, &header, &data, ENTRY_HEADER_SIZE) != 0 ||
+            header.type != ENTRY_TYPE_CONFIGURATION) {
+            return -1;
+        }
+        scoped_refptr<LogEntry> entry = new LogEntry();
+        entry->id.index = index;
+        entry->id.term = header.term;
+        if (!parse_configuration_meta(data, entry).ok()) {
+            return -1;
+        }
+        loaded.push_back(ConfigurationEntry(std::move(*entry)));
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    _offsets.clear();
+    _term_runs.clear();
+    _offsets.reserve(nentries);
+    for (size_t i = 0; i < nentries; ++i) {
+        _push_meta(offset_and_term[i].first, offset_and_term[i].second);
+    }
+    _configuration_indexes.swap(configuration_indexes);
+    for (size_t i = 0; i < loaded.size(); ++i) {
+        configurations->push_back(std::move(loaded[i]));
+    }
+    return 0;
+}
+
+void Segment::_unlink_index() {
+    const std::string path = _index_path();
+    if (::unlink(path.c_str()) != 0 && errno != ENOENT) {
+        PLOG(WARNING) << "Fail to unlink " << path;
+    }
+}
+
 std::string Segment::file_name() {
     if (!_is_open) {
         return butil::string_printf(BRAFT_SEGMENT_CLOSED_PATTERN, _first_index,
@@ -604,6 +1572,9 @@ int Segment::unlink() {
                                   _first_index, _last_index.load());
         }
 
+        if (!_is_open) {
+            _unlink_index();
+        }
         std::string tmp_path(path);
         tmp_path.append(".tmp");
         ret = ::rename(path.c_str(), tmp_path.c_str());
@@ -627,6 +1598,226 @@ int Segment::unlink() {
     return ret;
 }
 
+int Segment::recycle(SegmentFilePool* pool) {
+    std::string recycle_path;
+    if (!pool->reserve_recycle_path(&recycle_path)) {
+        return unlink();
+    }
+    if (!_is_open) {
+        _unlink_index();
+    }
+    std::string path(_path);
+    path.append("/");
+    path.append(file_name());
+    if (::rename(path.c_str(), recycle_path.c_str()) != 0) {
+        PLOG(ERROR) << "Fail to rename " << path << " to " << recycle_path;
+        pool->on_recycled(std::string());
+        return unlink();
+    }
+    LOG(INFO) << "Recycled segment `" << path << "' to `" << recycle_path
+              << '\'';
+    // The file is wiped after all the readers release this segment
+    _recycle_pool = pool;
+    _recycle_path = recycle_path;
+    return 0;
+}
+
+int SegmentFilePool::init() {
+    butil::DirReaderPosix dir_reader(_path.c_str());
+    if (!dir_reader.IsValid()) {
+        LOG(WARNING) << "directory reader failed, maybe NOEXIST or PERMISSION."
+                     << " path: " << _path;
+        return -1;
+    }
+    std::map<int64_t, std::string> ready;
+    BAIDU_SCOPED_LOCK(_mutex);
+    while (dir_reader.Next()) {
+        int64_t id = 0;
+        std::string file_name;
+        bool recycled = false;
+        if (sscanf(dir_reader.name(), BRAFT_SEGMENT_POOL_PATTERN, &id) == 1) {
+            file_name = butil::string_printf(BRAFT_SEGMENT_POOL_PATTERN, id);
+        } else if (sscanf(dir_reader.name(), BRAFT_SEGMENT_RECYCLE_PATTERN,
+                          &id) == 1) {
+            file_name = butil::string_printf(BRAFT_SEGMENT_RECYCLE_PATTERN, id);
+            recycled = true;
+        }
+        if (file_name.empty() || file_name != dir_reader.name()) {
+            continue;
+        }
+        std::string file_path(_path);
+        file_path.append("/");
+        file_path.append(file_name);
+        if (recycled) {
+            _recycled.push_back(file_path);
+        } else {
+            ready[id] = file_path;
+        }
+        _next_id = std::max(_next_id, id + 1);
+    }
+    for (std::map<int64_t, std::string>::const_iterator it = ready.begin();
+         it != ready.end(); ++it) {
+        _ready.push_back(it->second);
+    }
+    LOG(INFO) << "Init segment file pool, path: " << _path
+              << " ready: " << _ready.size()
+              << " recycled: " << _recycled.size();
+    start_refill_if_needed();
+    return 0;
+}
+
+int SegmentFilePool::take(std::string* file_path) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    int ret = -1;
+    if (!_ready.empty()) {
+        *file_path = _ready.front();
+        _ready.pop_front();
+        ret = 0;
+    }
+    start_refill_if_needed();
+    return ret;
+}
+
+bool SegmentFilePool::reserve_recycle_path(std::string* file_path) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (file_count() >= FLAGS_raft_segment_pool_size) {
+        return false;
+    }
+    *file_path = _path;
+    butil::string_appendf(file_path, "/" BRAFT_SEGMENT_RECYCLE_PATTERN,
+                          _next_id++);
+    ++_nreserved;
+    return true;
+}
+
+void SegmentFilePool::on_recycled(const std::string& file_path) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    --_nreserved;
+    if (!file_path.empty()) {
+        _recycled.push_back(file_path);
+    }
+    start_refill_if_needed();
+}
+
+void SegmentFilePool::start_refill_if_needed() {
+    // Called with _mutex held
+    if (_refilling || (_recycled.empty() &&
+                       file_count() >= FLAGS_raft_segment_pool_size)) {
+        return;
+    }
+    _refilling = true;
+    AddRef();
+    bthread_t tid;
+    if (bthread_start_background(&tid, &BTHREAD_ATTR_NORMAL, run_refill,
+                                 this) != 0) {
+        PLOG(ERROR) << "Fail to start bthread, path: " << _path;
+        _refilling = false;
+        Release();
+    }
+}
+
+void* SegmentFilePool::run_refill(void* arg) {
+    SegmentFilePool* pool = (SegmentFilePool*)arg;
+    pool->refill();
+    pool->Release();
+    return NULL;
+}
+
+void SegmentFilePool::refill() {
+    while (true) {
+        std::string file_path;
+        std::string ready_path(_path);
+        bool recycled = false;
+        {
+            BAIDU_SCOPED_LOCK(_mutex);
+            if (!_recycled.empty()) {
+                file_path = _recycled.back();
+                _recycled.pop_back();
+                recycled = true;
+            } else if (file_count() >= FLAGS_raft_segment_pool_size) {
+                _refilling = false;
+                return;
+            }
+            butil::string_appendf(&ready_path, "/" BRAFT_SEGMENT_POOL_PATTERN,
+                                  _next_id++);
+            ++_npreparing;
+        }
+        if (!recycled) {
+            // Temporary files are removed by list_segments after restart
+            file_path = ready_path + ".tmp";
+        }
+        int ret = prepare_file(file_path, recycled);
+        if (ret == 0) {
+            ret = ::rename(file_path.c_str(), ready_path.c_str());
+            PLOG_IF(ERROR, ret != 0)
+                << "Fail to rename " << file_path << " to " << ready_path;
+        }
+        if (ret != 0) {
+            ::unlink(file_path.c_str());
+        }
+        BAIDU_SCOPED_LOCK(_mutex);
+        --_npreparing;
+        if (ret != 0) {
+            // Try again at the next take
+            _refilling = false;
+            return;
+        }
+        _ready.push_back(ready_path);
+    }
+}
+
+int SegmentFilePool::prepare_file(const std::string& file_path,
+                                  bool recycled) {
+    butil::Timer timer;
+    timer.start();
+    butil::fd_guard fd(::open(file_path.c_str(), O_RDWR | O_CREAT, 0644));
+    if (fd < 0) {
+        PLOG(ERROR) << "Fail to open " << file_path;
+        return -1;
+    }
+    const off_t size = FLAGS_raft_max_segment_size;
+    int ret = 0;
+    if (FLAGS_raft_segment_prealloc_zero_fill) {
+        // Overwrite rather than truncate the recycled file to reuse its blocks
+        std::vector<char> zeros(std::min(size, (off_t)(1024 * 1024)), 0);
+        for (off_t offset = 0; offset < size;) {
+            const size_t to_write =
+                std::min((off_t)zeros.size(), size - offset);
+            const ssize_t nw = pwrite(fd, &zeros[0], to_write, offset);
+            if (nw < 0 && errno == EINTR) {
+                continue;
+            }
+            if (nw < 0) {
+                ret = -1;
+                break;
+            }
+            offset += nw;
+        }
+        if (ret == 0) {
+            ret = ftruncate_uninterrupted(fd, size);
+        }
+    } else {
+        // Drop the stale entries of the recycled file
+        ret = ftruncate_uninterrupted(fd, 0);
+        if (ret == 0) {
+#ifdef __linux__
+            ret = fallocate(fd, 0, 0, size);
+#else
+            ret = ftruncate_uninterrupted(fd, size);
+#endif
+        }
+    }
+    if (ret == 0) {
+        ret = raft_fsync(fd);
+    }
+    timer.stop();
+    PLOG_IF(ERROR, ret != 0) << "Fail to prepare segment file " << file_path;
+    LOG_IF(INFO, ret == 0) << "Prepared segment file `" << file_path
+                           << "' recycled: " << recycled
+                           << " time: " << timer.u_elapsed();
+    return ret;
+}
+
 int Segment::truncate(const int64_t last_index_kept) {
     int64_t truncate_size = 0;
     int64_t first_truncate_in_offset = 0;
@@ -635,7 +1826,7 @@ int Segment::truncate(const int64_t last_index_kept) {
         return 0;
     }
     first_truncate_in_offset = last_index_kept + 1 - _first_index;
-    truncate_size = _offset_and_term[first_truncate_in_offset].first;
+    truncate_size = _offsets[first_truncate_in_offset];
     BRAFT_VLOG << "Truncating " << _path << " first_index: " << _first_index
                << " last_index from " << _last_index << " to "
                << last_index_kept << " truncate size to " << truncate_size;
@@ -644,6 +1835,7 @@ int Segment::truncate(const int64_t last_index_kept) {
     // Truncate on a full segment need to rename back to inprogess segment
     // again, because the node may crash before truncate.
     if (!_is_open) {
+        _unlink_index();
         std::string old_path(_path);
         butil::string_appendf(&old_path, "/" BRAFT_SEGMENT_CLOSED_PATTERN,
                               _first_index, _last_index.load());
@@ -678,7 +1870,11 @@ int Segment::truncate(const int64_t last_index_kept) {
 
     lck.lock();
     // update memory var
-    _offset_and_term.resize(first_truncate_in_offset);
+    _truncate_meta(first_truncate_in_offset);
+    while (!_configuration_indexes.empty() &&
+           _configuration_indexes.back() > last_index_kept) {
+        _configuration_indexes.pop_back();
+    }
     _last_index.store(last_index_kept, butil::memory_order_relaxed);
     _bytes = truncate_size;
     return ret;
@@ -736,6 +1932,13 @@ int SegmentLogStorage::init(ConfigurationManager* configuration_manager) {
         _last_log_index.store(0);
         ret = save_meta(1);
     }
+    if (ret == 0 && FLAGS_raft_segment_pool_size > 0) {
+        _file_pool = new SegmentFilePool(_path);
+        if (_file_pool->init() != 0) {
+            LOG(WARNING) << "Fail to init segment file pool, path: " << _path;
+            _file_pool = NULL;
+        }
+    }
     return ret;
 }
 
@@ -759,9 +1962,8 @@ int SegmentLogStorage::append_entries(const std::vector<LogEntry*>& entries,
     int64_t now = 0;
     int64_t delta_time_us = 0;
     bool has_conf = false;
-    for (size_t i = 0; i < entries.size(); i++) {
+    for (size_t i = 0; i < entries.size();) {
         now = butil::cpuwide_time_us();
-        LogEntry* entry = entries[i];
 
         scoped_refptr<Segment> segment = open_segment();
         if (FLAGS_raft_trace_append_entry_latency && metric) {
@@ -772,23 +1974,38 @@ int SegmentLogStorage::append_entries(const std::vector<LogEntry*>& entries,
         if (NULL == segment) {
             return i;
         }
-        int ret = segment->append(entry);
-        if (0 != ret) {
-            return i;
+        // Take the entries as long as the segment is not full before each of
+        // them, which is where open_segment would switch to a new one
+        size_t end = i;
+        int64_t bytes = segment->bytes();
+        do {
+            bytes += ENTRY_HEADER_SIZE + entries[end]->data.length();
+            if (entries[end]->type == ENTRY_TYPE_CONFIGURATION) {
+                has_conf = true;
+            }
+            ++end;
+        } while (end < entries.size() &&
+                 bytes <= FLAGS_raft_max_segment_size);
+        const int appended = segment->append_batch(
+            &entries[i], end - i, end == entries.size() && _enable_sync,
+            has_conf);
+        if (appended > 0) {
+            _last_log_index.fetch_add(appended, butil::memory_order_release);
         }
-        if (entry->type == ENTRY_TYPE_CONFIGURATION) {
-            has_conf = true;
+        if ((size_t)appended != end - i) {
+            return i + appended;
         }
         if (FLAGS_raft_trace_append_entry_latency && metric) {
             delta_time_us = butil::cpuwide_time_us() - now;
             metric->append_entry_time_us += delta_time_us;
             g_segment_append_entry_latency << delta_time_us;
         }
-        _last_log_index.fetch_add(1, butil::memory_order_release);
         last_segment = segment;
+        i = end;
     }
     now = butil::cpuwide_time_us();
-    last_segment->sync(_enable_sync, has_conf);
+    last_segment->sync(_enable_sync, has_conf,
+                       FLAGS_raft_trace_append_entry_latency ? metric : NULL);
     if (FLAGS_raft_trace_append_entry_latency && metric) {
         delta_time_us = butil::cpuwide_time_us() - now;
         metric->sync_segment_time_us += delta_time_us;
@@ -822,6 +2039,30 @@ LogEntry* SegmentLogStorage::get_entry(const int64_t index) {
     return ptr->get(index);
 }
 
+int SegmentLogStorage::get_entries(const int64_t first_index,
+                                   const int64_t last_index, size_t max_bytes,
+                                   std::vector<LogEntry*>* entries) {
+    int64_t index = first_index;
+    size_t bytes = 0;
+    while (index <= last_index && bytes < max_bytes) {
+        scoped_refptr<Segment> ptr;
+        if (get_segment(index, &ptr) != 0) {
+            break;
+        }
+        const size_t old_size = entries->size();
+        const int n =
+            ptr->get_entries(index, last_index, max_bytes - bytes, entries);
+        if (n <= 0) {
+            break;
+        }
+        for (size_t i = old_size; i < entries->size(); ++i) {
+            bytes += (*entries)[i]->data.length();
+        }
+        index += n;
+    }
+    return index - first_index;
+}
+
 int64_t SegmentLogStorage::get_term(const int64_t index) {
     scoped_refptr<Segment> ptr;
     if (get_segment(index, &ptr) != 0) {
@@ -881,7 +2122,11 @@ int SegmentLogStorage::truncate_prefix(const int64_t first_index_kept) {
     std::vector<scoped_refptr<Segment> > popped;
     pop_segments(first_index_kept, &popped);
     for (size_t i = 0; i < popped.size(); ++i) {
-        popped[i]->unlink();
+        if (_file_pool) {
+            popped[i]->recycle(_file_pool.get());
+        } else {
+            popped[i]->unlink();
+        }
         popped[i] = NULL;
     }
     return 0;
@@ -1015,10 +2260,12 @@ int SegmentLogStorage::list_segments(bool is_empty) {
     }
 
     // restore segment meta
+    std::vector<std::pair<int64_t, int64_t> > indexes;
     while (dir_reader.Next()) {
         // unlink unneed segments and unfinished unlinked segments
         if ((is_empty &&
-             0 == strncmp(dir_reader.name(), "log_", strlen("log_"))) ||
+             (0 == strncmp(dir_reader.name(), "log_", strlen("log_")) ||
+              0 == strncmp(dir_reader.name(), "index_", strlen("index_")))) ||
             (0 == strncmp(dir_reader.name() +
                               (strlen(dir_reader.name()) - strlen(".tmp")),
                           ".tmp", strlen(".tmp")))) {
@@ -1047,6 +2294,13 @@ int SegmentLogStorage::list_segments(bool is_empty) {
             continue;
         }
 
+        match = sscanf(dir_reader.name(), BRAFT_SEGMENT_INDEX_PATTERN,
+                       &first_index, &last_index);
+        if (match == 2) {
+            indexes.push_back(std::make_pair(first_index, last_index));
+            continue;
+        }
+
         match =
             sscanf(dir_reader.name(), BRAFT_SEGMENT_OPEN_PATTERN, &first_index);
         if (match == 1) {
@@ -1063,6 +2317,20 @@ int SegmentLogStorage::list_segments(bool is_empty) {
         }
     }
 
+    // unlink the index sidecars left by the segments removed or truncated
+    for (size_t i = 0; i < indexes.size(); ++i) {
+        SegmentMap::iterator it = _segments.find(indexes[i].first);
+        if (it != _segments.end() &&
+            it->second->last_index() == indexes[i].second) {
+            continue;
+        }
+        std::string index_path(_path);
+        butil::string_appendf(&index_path, "/" BRAFT_SEGMENT_INDEX_PATTERN,
+                              indexes[i].first, indexes[i].second);
+        ::unlink(index_path.c_str());
+        LOG(WARNING) << "unlink orphan segment index, path: " << index_path;
+    }
+
     // check segment
     int64_t last_log_index = -1;
     SegmentMap::iterator it;
@@ -1124,22 +2392,71 @@ int SegmentLogStorage::list_segments(bool is_empty) {
     return 0;
 }
 
+struct SegmentLogStorage::LoadSegmentsArg {
+    LoadSegmentsArg() : next(0), failed(false) {}
+    std::vector<Segment*> segments;
+    std::vector<std::vector<ConfigurationEntry> > configurations;
+    std::vector<int> rets;
+    butil::atomic<size_t> next;
+    butil::atomic<bool> failed;
+};
+
+void* SegmentLogStorage::run_load_segments(void* arg) {
+    LoadSegmentsArg* a = (LoadSegmentsArg*)arg;
+    while (!a->failed.load(butil::memory_order_relaxed)) {
+        const size_t i = a->next.fetch_add(1, butil::memory_order_relaxed);
+        if (i >= a->segments.size()) {
+            break;
+        }
+        Segment* segment = a->segments[i];
+        LOG(INFO) << "load closed segment, file: " << segment->file_name()
+                  << " first_index: " << segment->first_index()
+                  << " last_index: " << segment->last_index();
+        a->rets[i] = segment->load(&a->configurations[i]);
+        if (a->rets[i] != 0) {
+            a->failed.store(true, butil::memory_order_relaxed);
+        }
+    }
+    return NULL;
+}
+
 int SegmentLogStorage::load_segments(
     ConfigurationManager* configuration_manager) {
     int ret = 0;
 
-    // closed segments
-    SegmentMap::iterator it;
-    for (it = _segments.begin(); it != _segments.end(); ++it) {
-        Segment* segment = it->second.get();
-        LOG(INFO) << "load closed segment, path: " << _path
-                  << " first_index: " << segment->first_index()
-                  << " last_index: " << segment->last_index();
-        ret = segment->load(configuration_manager);
-        if (ret != 0) {
-            return ret;
+    // closed segments are loaded in parallel, while the configurations are
+    // added in order of the segments
+    LoadSegmentsArg arg;
+    for (SegmentMap::iterator it = _segments.begin(); it != _segments.end();
+         ++it) {
+        arg.segments.push_back(it->second.get());
+    }
+    arg.configurations.resize(arg.segments.size());
+    arg.rets.resize(arg.segments.size(), 0);
+    const size_t nthreads = std::min(
+        (size_t)FLAGS_raft_segment_load_concurrency, arg.segments.size());
+    std::vector<bthread_t> tids;
+    for (size_t i = 1; i < nthreads; ++i) {
+        bthread_t tid;
+        if (bthread_start_background(&tid, &BTHREAD_ATTR_NORMAL,
+                                     run_load_segments, &arg) != 0) {
+            PLOG(WARNING) << "Fail to start bthread to load segments";
+            break;
         }
-        _last_log_index.store(segment->last_index(),
+        tids.push_back(tid);
+    }
+    run_load_segments(&arg);
+    for (size_t i = 0; i < tids.size(); ++i) {
+        bthread_join(tids[i], NULL);
+    }
+    for (size_t i = 0; i < arg.segments.size(); ++i) {
+        if (arg.rets[i] != 0) {
+            return arg.rets[i];
+        }
+        for (size_t j = 0; j < arg.configurations[i].size(); ++j) {
+            configuration_manager->add(std::move(arg.configurations[i][j]));
+        }
+        _last_log_index.store(arg.segments[i]->last_index(),
                               butil::memory_order_release);
     }
 
@@ -1213,14 +2530,23 @@ int SegmentLogStorage::load_meta() {
     return 0;
 }
 
+static std::string take_pool_file(SegmentFilePool* pool) {
+    std::string file_path;
+    if (pool && pool->take(&file_path) != 0) {
+        g_segment_pool_miss << 1;
+    }
+    return file_path;
+}
+
 scoped_refptr<Segment> SegmentLogStorage::open_segment() {
     scoped_refptr<Segment> prev_open_segment;
     {
         BAIDU_SCOPED_LOCK(_mutex);
         if (!_open_segment) {
+            const std::string prealloc_path = take_pool_file(_file_pool.get());
             _open_segment =
                 new Segment(_path, last_log_index() + 1, _checksum_type);
-            if (_open_segment->create() != 0) {
+            if (_open_segment->create(prealloc_path) != 0) {
                 _open_segment = NULL;
                 return NULL;
             }
@@ -1234,9 +2560,11 @@ scoped_refptr<Segment> SegmentLogStorage::open_segment() {
         if (prev_open_segment) {
             if (prev_open_segment->close(_enable_sync) == 0) {
                 BAIDU_SCOPED_LOCK(_mutex);
+                const std::string prealloc_path =
+                    take_pool_file(_file_pool.get());
                 _open_segment =
                     new Segment(_path, last_log_index() + 1, _checksum_type);
-                if (_open_segment->create() == 0) {
+                if (_open_segment->create(prealloc_path) == 0) {
                     // success
                     break;
                 }
@@ -24,6 +24,7 @@
 #include <butil/logging.h>
 #include <butil/memory/ref_counted.h>
 
+#include <deque>
 #include <map>
 #include <vector>
 
@@ -33,6 +34,62 @@
 
 namespace braft {
 
+// Pool of segment files which are preallocated by a background bthread, so
+// that rotating the open segment doesn't create and grow a new file on the
+// append path. The files of the segments dropped by truncate_prefix are
+// recycled into the pool as well.
+//
+// Files in the pool:
+//      log_pool_00000000000000000001: ready to be taken as the open segment
+//      log_recycle_00000000000000000002: dropped segment waiting to be wiped
+class SegmentFilePool : public butil::RefCountedThreadSafe<SegmentFilePool> {
+   public:
+    explicit SegmentFilePool(const std::string& path)
+        : _path(path),
+          _next_id(1),
+          _nreserved(0),
+          _npreparing(0),
+          _refilling(false) {}
+
+    // adopt the files left in |path| and start filling the pool
+    int init();
+
+    // take a ready file out of the pool, return 0 and set |file_path| on
+    // success, -1 if the pool is empty
+    int take(std::string* file_path);
+
+    // reserve a path for a segment file to be recycled, return false if the
+    // pool is full
+    bool reserve_recycle_path(std::string* file_path);
+
+    // the segment file renamed to the reserved |file_path| is not used any
+    // more and can be wiped, |file_path| is empty if renaming failed
+    void on_recycled(const std::string& file_path);
+
+   private:
+    friend class butil::RefCountedThreadSafe<SegmentFilePool>;
+    ~SegmentFilePool() {}
+    DISALLOW_COPY_AND_ASSIGN(SegmentFilePool);
+
+    static void* run_refill(void* arg);
+    void refill();
+    void start_refill_if_needed();
+    int prepare_file(const std::string& file_path, bool recycled);
+    int file_count() const {
+        return (int)(_ready.size() + _recycled.size()) + _nreserved +
+               _npreparing;
+    }
+
+    std::string _path;
+    raft_mutex_t _mutex;
+    int64_t _next_id;
+    std::deque<std::string> _ready;
+    std::vector<std::string> _recycled;
+    int _nreserved;
+    int _npreparing;
+    bool _refilling;
+};
+
 class BAIDU_CACHELINE_ALIGNMENT Segment
     : public butil::RefCountedThreadSafe<Segment> {
    public:
@@ -42,7 +99,10 @@ class BAIDU_CACHELINE_ALIGNMENT Segment
           _bytes(0),
           _unsynced_bytes(0),
           _fd(-1),
+          _direct_fd(-1),
+          _dev(0),
           _is_open(true),
+          _preallocated(false),
           _first_index(first_index),
           _last_index(first_index - 1),
           _checksum_type(checksum_type) {}
@@ -52,38 +112,64 @@ class BAIDU_CACHELINE_ALIGNMENT Segment
           _bytes(0),
           _unsynced_bytes(0),
           _fd(-1),
+          _direct_fd(-1),
+          _dev(0),
           _is_open(false),
+          _preallocated(false),
           _first_index(first_index),
           _last_index(last_index),
           _checksum_type(checksum_type) {}
 
     struct EntryHeader;
 
-    // create open segment
-    int create();
+    // create open segment, reuse the preallocated file at |prealloc_path| if
+    // it's not empty
+    int create(const std::string& prealloc_path = std::string());
 
     // load open or closed segment
     // open fd, load index, truncate uncompleted entry
     int load(ConfigurationManager* configuration_manager);
 
+    // load segment like above, and collect the configurations in it into
+    // |configurations| instead, which can be done in parallel
+    int load(std::vector<ConfigurationEntry>* configurations);
+
     // serialize entry, and append to open segment
     int append(const LogEntry* entry);
 
+    // serialize |count| entries, and append them to open segment with one
+    // vectored write, return the number of the appended entries. With
+    // io_uring the sync asked by |will_sync| and |has_conf| is submitted
+    // along with the write, and the following sync() is a no-op
+    int append_batch(const LogEntry* const* entries, size_t count,
+                     bool will_sync = false, bool has_conf = false);
+
     // get entry by index
     LogEntry* get(const int64_t index) const;
 
+    // get the entries in [first_index, last_index] with one read, stop once
+    // the entries read reach |max_bytes|, return the number of the entries
+    // appended to |entries|
+    int get_entries(const int64_t first_index, const int64_t last_index,
+                    size_t max_bytes, std::vector<LogEntry*>* entries) const;
+
     // get entry's term by index
     int64_t get_term(const int64_t index) const;
 
     // close open segment
     int close(bool will_sync = true);
 
-    // sync open segment
-    int sync(bool will_sync, bool has_conf = false);
+    // sync open segment, the time spent on the fsync shared with other groups
+    // is added to |metric| if it's not NULL
+    int sync(bool will_sync, bool has_conf = false, IOMetric* metric = NULL);
 
     // unlink segment
     int unlink();
 
+    // move the segment file into |pool|, which reuses it once the segment is
+    // destroyed, fallback to unlink if the pool is full
+    int recycle(SegmentFilePool* pool);
+
     // truncate segment to last_index_kept
     int truncate(const int64_t last_index_kept);
 
@@ -101,12 +187,7 @@ class BAIDU_CACHELINE_ALIGNMENT Segment
 
    private:
     friend class butil::RefCountedThreadSafe<Segment>;
-    ~Segment() {
-        if (_fd >= 0) {
-            ::close(_fd);
-            _fd = -1;
-        }
-    }
+    ~Segment();
 
     struct LogMeta {
         off_t offset;
@@ -117,21 +198,88 @@ class BAIDU_CACHELINE_ALIGNMENT Segment
     int _load_entry(off_t offset, EntryHeader* head, butil::IOBuf* body,
                     size_t size_hint) const;
 
+    ssize_t _pread(butil::IOPortal* portal, off_t offset, size_t size) const;
+
+    int _parse_header(const char* p, off_t offset, EntryHeader* head) const;
+
+    LogEntry* _decode_entry(const int64_t index, const EntryHeader& header,
+                            butil::IOBuf* data) const;
+
+    // pack the header of |entry| into |header_buf| and point |data| at what
+    // follows it, which is the data of |entry| itself or is serialized into
+    // |buf|
+    int _serialize_entry(const LogEntry* entry, char* header_buf,
+                         butil::IOBuf* buf, const butil::IOBuf** data) const;
+
+    // the O_DIRECT fd of the file, which is opened on the first read or
+    // write, -1 if it's not available
+    int _get_direct_fd() const;
+
+    int _append(const LogEntry* const* entries, size_t count, bool will_sync,
+                bool has_conf);
+
+    int _append_direct(int direct_fd, const LogEntry* const* entries,
+                       size_t count,
+                       const std::vector<char>& headers,
+                       const std::vector<const butil::IOBuf*>& datas,
+                       bool will_sync, bool has_conf);
+
+    bool _need_sync(bool will_sync, bool has_conf,
+                    int64_t unsynced_bytes) const;
+
     int _get_meta(int64_t index, LogMeta* meta) const;
 
     int _truncate_meta_and_get_last(int64_t last);
 
+    // append the offset and term of the entry next to the last one
+    void _push_meta(int64_t offset, int64_t term);
+
+    // term of |index| which must be in the segment
+    int64_t _term_at(int64_t index) const;
+
+    // keep the metas of the first |count| entries
+    void _truncate_meta(size_t count);
+
+    // path of the index sidecar of the closed segment
+    std::string _index_path() const;
+
+    // save the offsets, terms and configuration indexes into the sidecar
+    int _save_index(bool sync);
+
+    // load the index from the sidecar instead of scanning the segment,
+    // returns 0 on success, non-zero if the sidecar is missing or invalid
+    int _load_index(int64_t file_size,
+                    std::vector<ConfigurationEntry>* configurations);
+
+    void _unlink_index();
+
     std::string _path;
     int64_t _bytes;
     int64_t _unsynced_bytes;
     mutable raft_mutex_t _mutex;
     int _fd;
+    // opened with O_DIRECT if raft_segment_direct_io is on, -1 otherwise.
+    // Most segments are never read after loaded, so it's opened on demand
+    // once the segment is created or loaded
+    static const int DIRECT_FD_UNOPENED = -2;
+    mutable butil::atomic<int> _direct_fd;
+    dev_t _dev;
     bool _is_open;
+    // the file has a zero-filled tail past _bytes
+    bool _preallocated;
     const int64_t _first_index;
     butil::atomic<int64_t> _last_index;
     int _checksum_type;
-    std::vector<std::pair<int64_t /*offset*/, int64_t /*term*/> >
-        _offset_and_term;
+    // offset of each entry in the file, which fits in 32 bits as the segment
+    // is closed once it reaches raft_max_segment_size
+    std::vector<uint32_t> _offsets;
+    // (first index, term) of each run of the entries in the same term, there
+    // are only a few as the term rarely changes
+    std::vector<std::pair<int64_t, int64_t> > _term_runs;
+    // indexes of the configuration entries, saved into the sidecar
+    std::vector<int64_t> _configuration_indexes;
+    scoped_refptr<SegmentFilePool> _recycle_pool;
+    std::string _recycle_path;
 };
 
 // LogStorage use segmented append-only file, all data in disk, all index in
@@ -175,6 +323,10 @@ class SegmentLogStorage : public LogStorage {
     // get logentry by index
     virtual LogEntry* get_entry(const int64_t index);
 
+    // get the entries in [first_index, last_index], with one read per segment
+    virtual int get_entries(const int64_t first_index, const int64_t last_index,
+                            size_t max_bytes, std::vector<LogEntry*>* entries);
+
     // get logentry's term by index
     virtual int64_t get_term(const int64_t index);
 
@@ -213,6 +365,8 @@ class SegmentLogStorage : public LogStorage {
     int load_meta();
     int list_segments(bool is_empty);
     int load_segments(ConfigurationManager* configuration_manager);
+    struct LoadSegmentsArg;
+    static void* run_load_segments(void* arg);
     int get_segment(int64_t log_index, scoped_refptr<Segment>* ptr);
     void pop_segments(int64_t first_index_kept,
                       std::vector<scoped_refptr<Segment> >* poped);
@@ -228,6 +382,7 @@ class SegmentLogStorage : public LogStorage {
     scoped_refptr<Segment> _open_segment;
     int _checksum_type;
     bool _enable_sync;
+    scoped_refptr<SegmentFilePool> _file_pool;
 };
 
 }  //  namespace braft
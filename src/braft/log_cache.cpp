@@ -0,0 +1,191 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "braft/log_cache.h"
+
+#include <brpc/reloadable_flags.h>  // BRPC_VALIDATE_GFLAG
+#include <bvar/bvar.h>
+#include <gflags/gflags.h>
+
+namespace braft {
+
+DEFINE_int64(raft_log_cache_capacity_bytes, 0,
+             "Max bytes of the entries read back from the log storage cached "
+             "for the replicators of each node, 0 means disabled");
+BRPC_VALIDATE_GFLAG(raft_log_cache_capacity_bytes, brpc::NonNegativeInteger);
+
+static bvar::Adder<int64_t> g_log_cache_hit("raft_log_cache_hit");
+static bvar::Adder<int64_t> g_log_cache_miss("raft_log_cache_miss");
+
+struct LogEntryCache::Block {
+    Block() : bytes(0) {}
+    int64_t first_index() const { return entries.front()->id.index; }
+    int64_t last_index() const { return entries.back()->id.index; }
+    std::vector<LogEntry*> entries;
+    int64_t bytes;
+    std::list<Block*>::iterator lru_it;
+};
+
+static int64_t entry_bytes(const LogEntry* entry) {
+    return sizeof(LogEntry) + entry->data.length();
+}
+
+LogEntryCache::LogEntryCache() : _bytes(0), _version(0) {}
+
+LogEntryCache::~LogEntryCache() { clear(); }
+
+LogEntryCache::BlockMap::iterator LogEntryCache::find_block(
+    const int64_t index) {
+    BlockMap::iterator it = _blocks.upper_bound(index);
+    if (it == _blocks.begin()) {
+        return _blocks.end();
+    }
+    --it;
+    if (index > it->second->last_index()) {
+        return _blocks.end();
+    }
+    return it;
+}
+
+void LogEntryCache::erase_block(BlockMap::iterator it) {
+    Block* block = it->second;
+    for (size_t i = 0; i < block->entries.size(); ++i) {
+        block->entries[i]->Release();
+    }
+    _bytes -= block->bytes;
+    _lru.erase(block->lru_it);
+    _blocks.erase(it);
+    delete block;
+}
+
+LogEntry* LogEntryCache::get(const int64_t index) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    BlockMap::iterator it = find_block(index);
+    if (it == _blocks.end()) {
+        g_log_cache_miss << 1;
+        return NULL;
+    }
+    g_log_cache_hit << 1;
+    Block* block = it->second;
+    _lru.splice(_lru.begin(), _lru, block->lru_it);
+    LogEntry* entry = block->entries[index - block->first_index()];
+    entry->AddRef();
+    return entry;
+}
+
+bool LogEntryCache::contains(const int64_t index) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return find_block(index) != _blocks.end();
+}
+
+int64_t LogEntryCache::version() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _version;
+}
+
+void LogEntryCache::put(const std::vector<LogEntry*>& entries,
+                        const int64_t version) {
+    if (entries.empty()) {
+        return;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (version != _version) {
+        return;
+    }
+    const int64_t first_index = entries.front()->id.index;
+    const int64_t last_index = entries.back()->id.index;
+    // Replace the blocks overlapped, which happens when replicators miss the
+    // same range at the same time
+    BlockMap::iterator it = find_block(first_index);
+    if (it == _blocks.end()) {
+        it = _blocks.lower_bound(first_index);
+    }
+    while (it != _blocks.end() && it->first <= last_index) {
+        erase_block(it++);
+    }
+    Block* block = new Block;
+    block->entries = entries;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i]->AddRef();
+        block->bytes += entry_bytes(entries[i]);
+    }
+    _lru.push_front(block);
+    block->lru_it = _lru.begin();
+    _blocks[first_index] = block;
+    _bytes += block->bytes;
+    evict();
+}
+
+void LogEntryCache::evict() {
+    while (_bytes > FLAGS_raft_log_cache_capacity_bytes && !_lru.empty()) {
+        erase_block(_blocks.find(_lru.back()->first_index()));
+    }
+}
+
+void LogEntryCache::truncate_prefix(const int64_t first_index_kept) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    ++_version;
+    while (!_blocks.empty() &&
+           _blocks.begin()->second->last_index() < first_index_kept) {
+        erase_block(_blocks.begin());
+    }
+    if (_blocks.empty() || _blocks.begin()->first >= first_index_kept) {
+        return;
+    }
+    Block* block = _blocks.begin()->second;
+    _blocks.erase(_blocks.begin());
+    const size_t ndropped = first_index_kept - block->first_index();
+    for (size_t i = 0; i < ndropped; ++i) {
+        block->bytes -= entry_bytes(block->entries[i]);
+        _bytes -= entry_bytes(block->entries[i]);
+        block->entries[i]->Release();
+    }
+    block->entries.erase(block->entries.begin(),
+                         block->entries.begin() + ndropped);
+    _blocks[first_index_kept] = block;
+}
+
+void LogEntryCache::truncate_suffix(const int64_t last_index_kept) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    ++_version;
+    while (!_blocks.empty() && _blocks.rbegin()->first > last_index_kept) {
+        erase_block(--_blocks.end());
+    }
+    if (_blocks.empty()) {
+        return;
+    }
+    Block* block = _blocks.rbegin()->second;
+    while (block->last_index() > last_index_kept) {
+        LogEntry* entry = block->entries.back();
+        block->bytes -= entry_bytes(entry);
+        _bytes -= entry_bytes(entry);
+        entry->Release();
+        block->entries.pop_back();
+    }
+}
+
+void LogEntryCache::clear() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    ++_version;
+    while (!_blocks.empty()) {
+        erase_block(_blocks.begin());
+    }
+}
+
+int64_t LogEntryCache::bytes() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _bytes;
+}
+
+}  //  namespace braft
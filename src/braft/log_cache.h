@@ -0,0 +1,83 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BRAFT_LOG_CACHE_H
+#define BRAFT_LOG_CACHE_H
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include "braft/log_entry.h"  // LogEntry
+#include "braft/util.h"       // raft_mutex_t
+
+namespace braft {
+
+// Bounded LRU cache of the entries read back from LogStorage after they are
+// dropped from the memory of LogManager, shared by all the replicators of a
+// node so that the followers catching up over the same range read and verify
+// each entry from disk only once.
+//
+// Entries are cached in blocks of contiguous indexes, which are evicted as a
+// whole once the cache holds more than raft_log_cache_capacity_bytes.
+class LogEntryCache {
+   public:
+    LogEntryCache();
+    ~LogEntryCache();
+
+    // Returns the entry at |index| with a reference added, NULL if it's not
+    // cached
+    LogEntry* get(const int64_t index);
+
+    bool contains(const int64_t index);
+
+    // Changes whenever cached entries are invalidated, got before reading
+    // storage and passed to put()
+    int64_t version();
+
+    // Cache the contiguous |entries| read from storage, unless the cache is
+    // invalidated after |version| was got, as they might be stale.
+    void put(const std::vector<LogEntry*>& entries, const int64_t version);
+
+    // Drop the entries before |first_index_kept|
+    void truncate_prefix(const int64_t first_index_kept);
+
+    // Drop the entries after |last_index_kept|
+    void truncate_suffix(const int64_t last_index_kept);
+
+    void clear();
+
+    int64_t bytes();
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(LogEntryCache);
+
+    struct Block;
+    typedef std::map<int64_t /*first index*/, Block*> BlockMap;
+
+    BlockMap::iterator find_block(const int64_t index);
+    void erase_block(BlockMap::iterator it);
+    void evict();
+
+    raft_mutex_t _mutex;
+    BlockMap _blocks;
+    // the most recently used block is at the front
+    std::list<Block*> _lru;
+    int64_t _bytes;
+    int64_t _version;
+};
+
+}  //  namespace braft
+
+#endif  // BRAFT_LOG_CACHE_H
@@ -22,10 +22,23 @@ namespace braft {
 
 bvar::Adder<int64_t> g_nentries("raft_num_log_entries");
 
-LogEntry::LogEntry() : type(ENTRY_TYPE_UNKNOWN) { g_nentries << 1; }
+LogEntry::LogEntry() : type(ENTRY_TYPE_UNKNOWN), _data_crc32c(-1) {
+    g_nentries << 1;
+}
 
 LogEntry::~LogEntry() { g_nentries << -1; }
 
+uint32_t LogEntry::data_crc32c() const {
+    const int64_t cached = _data_crc32c.load(butil::memory_order_acquire);
+    if (cached >= 0) {
+        return (uint32_t)cached;
+    }
+    // Racing callers get the same value
+    const uint32_t checksum = crc32(data);
+    _data_crc32c.store(checksum, butil::memory_order_release);
+    return checksum;
+}
+
 butil::Status parse_configuration_meta(const butil::IOBuf& data,
                                        LogEntry* entry) {
     butil::Status status;
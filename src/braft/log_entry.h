@@ -17,6 +17,7 @@
 #ifndef BRAFT_LOG_ENTRY_H
 #define BRAFT_LOG_ENTRY_H
 
+#include <butil/atomicops.h>           // butil::atomic
 #include <butil/iobuf.h>               // butil::IOBuf
 #include <butil/memory/ref_counted.h>  // butil::RefCountedThreadSafe
 #include <butil/third_party/murmurhash3/murmurhash3.h>  // fmix64
@@ -46,10 +47,23 @@ struct LogEntry : public butil::RefCountedThreadSafe<LogEntry> {
 
     LogEntry();
 
+    // crc32c of |data|, computed at most once and shared by the segment and
+    // the replicators. |data| must not change after it's called.
+    uint32_t data_crc32c() const;
+
+    // Set the crc32c of |data| known already, sent by the leader or read from
+    // the segment, so that |data| is not hashed again
+    void set_data_crc32c(uint32_t checksum) {
+        _data_crc32c.store(checksum, butil::memory_order_release);
+    }
+
    private:
     DISALLOW_COPY_AND_ASSIGN(LogEntry);
     friend class butil::RefCountedThreadSafe<LogEntry>;
     virtual ~LogEntry();
+
+    // -1 if not known yet
+    mutable butil::atomic<int64_t> _data_crc32c;
 };
 
 // Comparators
@@ -23,6 +23,9 @@
 #include <butil/logging.h>            // LOG
 #include <butil/object_pool.h>        // butil::get_object
 
+#include <algorithm>  // std::upper_bound, std::lower_bound
+#include <atomic>     // std::atomic_thread_fence
+
 #include "braft/fsm_caller.h"  // FSMCaller
 #include "braft/storage.h"     // LogStorage
 
@@ -31,6 +34,19 @@ namespace braft {
 DEFINE_int32(raft_leader_batch, 256, "max leader io batch");
 BRPC_VALIDATE_GFLAG(raft_leader_batch, ::brpc::PositiveInteger);
 
+DECLARE_int64(raft_log_cache_capacity_bytes);
+DEFINE_int32(raft_log_cache_readahead, 64,
+             "Max number of entries read ahead into the log cache when a "
+             "replicator reads the log sequentially");
+BRPC_VALIDATE_GFLAG(raft_log_cache_readahead, ::brpc::PositiveInteger);
+
+DEFINE_bool(raft_share_replication_batch, true,
+            "Encode the logs appended by the leader once for all the "
+            "replicators");
+BRPC_VALIDATE_GFLAG(raft_share_replication_batch, ::brpc::PassValidate);
+
+DECLARE_bool(raft_send_data_checksum);
+
 static bvar::Adder<int64_t> g_read_entry_from_storage(
     "raft_read_entry_from_storage_count");
 static bvar::PerSecond<bvar::Adder<int64_t> > g_read_entry_from_storage_second(
@@ -55,6 +71,7 @@ void LogManager::StableClosure::update_metric(IOMetric* m) {
     metric.open_segment_time_us = m->open_segment_time_us;
     metric.append_entry_time_us = m->append_entry_time_us;
     metric.sync_segment_time_us = m->sync_segment_time_us;
+    metric.sync_wait_time_us = m->sync_wait_time_us;
 }
 
 LogManagerOptions::LogManagerOptions()
@@ -67,7 +84,10 @@ LogManager::LogManager()
       _has_error(false),
       _next_wait_id(0),
       _first_log_index(0),
-      _last_log_index(0) {
+      _last_log_index(0),
+      _term_index_dirty(true),
+      _published_last_log_index(0),
+      _term_index_seq(0) {
     CHECK_EQ(0, start_disk_thread());
 }
 
@@ -93,6 +113,8 @@ int LogManager::init(const LogManagerOptions& options) {
     // after snapshot load finish.
     _disk_id.term = _log_storage->get_term(_last_log_index);
     _fsm_caller = options.fsm_caller;
+    load_term_runs();
+    publish_term_index();
     return 0;
 }
 
@@ -132,6 +154,12 @@ void LogManager::clear_memory_logs(const LogId& id) {
                 entries_to_clear[nentries++] = entry;
                 _logs_in_memory.pop_front();
             }
+            while (!_replication_batches.empty() &&
+                   (_logs_in_memory.empty() ||
+                    _replication_batches.front()->last_index() <
+                        _logs_in_memory.front()->id.index)) {
+                _replication_batches.pop_front();
+            }
         }  // out of _mutex
         for (size_t i = 0; i < nentries; ++i) {
             entries_to_clear[i]->Release();
@@ -146,7 +174,7 @@ int64_t LogManager::first_log_index() {
 
 class LastLogIdClosure : public LogManager::StableClosure {
    public:
-    LastLogIdClosure() {}
+    LastLogIdClosure() : StableClosure(LAST_LOG_ID) {}
     void Run() { _event.signal(); }
     void set_last_log_id(const LogId& log_id) {
         CHECK(log_id.index == 0 || log_id.term != 0)
@@ -200,7 +228,7 @@ LogId LogManager::last_log_id(bool is_flush) {
 class TruncatePrefixClosure : public LogManager::StableClosure {
    public:
     explicit TruncatePrefixClosure(const int64_t first_index_kept)
-        : _first_index_kept(first_index_kept) {}
+        : StableClosure(TRUNCATE_PREFIX), _first_index_kept(first_index_kept) {}
     void Run() { delete this; }
     int64_t first_index_kept() const { return _first_index_kept; }
 
@@ -211,7 +239,9 @@ class TruncatePrefixClosure : public LogManager::StableClosure {
 class TruncateSuffixClosure : public LogManager::StableClosure {
    public:
     TruncateSuffixClosure(int64_t last_index_kept, int64_t last_term_kept)
-        : _last_index_kept(last_index_kept), _last_term_kept(last_term_kept) {}
+        : StableClosure(TRUNCATE_SUFFIX),
+          _last_index_kept(last_index_kept),
+          _last_term_kept(last_term_kept) {}
     void Run() { delete this; }
     int64_t last_index_kept() const { return _last_index_kept; }
     int64_t last_term_kept() const { return _last_term_kept; }
@@ -224,7 +254,7 @@ class TruncateSuffixClosure : public LogManager::StableClosure {
 class ResetClosure : public LogManager::StableClosure {
    public:
     explicit ResetClosure(int64_t next_log_index)
-        : _next_log_index(next_log_index) {}
+        : StableClosure(RESET), _next_log_index(next_log_index) {}
     void Run() { delete this; }
     int64_t next_log_index() const { return _next_log_index; }
 
@@ -259,7 +289,26 @@ int LogManager::truncate_prefix(const int64_t first_index_kept,
         // The entrie log is dropped
         _last_log_index = first_index_kept - 1;
     }
+    if (first_index_kept > _last_log_index) {
+        _term_runs.clear();
+    }
+    size_t nruns_dropped = 0;
+    while (nruns_dropped + 1 < _term_runs.size() &&
+           _term_runs[nruns_dropped + 1].first <= first_index_kept) {
+        ++nruns_dropped;
+    }
+    _term_runs.erase(_term_runs.begin(), _term_runs.begin() + nruns_dropped);
+    if (!_term_runs.empty() && _term_runs.front().first < first_index_kept) {
+        _term_runs.front().first = first_index_kept;
+    }
+    while (!_replication_batches.empty() &&
+           _replication_batches.front()->last_index() < first_index_kept) {
+        _replication_batches.pop_front();
+    }
+    _term_index_dirty = true;
+    publish_term_index();
     _config_manager->truncate_prefix(first_index_kept);
+    _log_cache.truncate_prefix(first_index_kept);
     TruncatePrefixClosure* c = new TruncatePrefixClosure(first_index_kept);
     const int rc = bthread::execution_queue_execute(_disk_queue, c);
     lck.unlock();
@@ -276,8 +325,13 @@ int LogManager::reset(const int64_t next_log_index,
     saved_logs_in_memory.swap(_logs_in_memory);
     _first_log_index = next_log_index;
     _last_log_index = next_log_index - 1;
+    _term_runs.clear();
+    _replication_batches.clear();
+    _term_index_dirty = true;
+    publish_term_index();
     _config_manager->truncate_prefix(_first_log_index);
     _config_manager->truncate_suffix(_last_log_index);
+    _log_cache.clear();
     ResetClosure* c = new ResetClosure(next_log_index);
     const int ret = bthread::execution_queue_execute(_disk_queue, c);
     lck.unlock();
@@ -307,10 +361,21 @@ void LogManager::unsafe_truncate_suffix(const int64_t last_index_kept) {
         }
     }
     _last_log_index = last_index_kept;
+    while (!_term_runs.empty() && _term_runs.back().first > last_index_kept) {
+        _term_runs.pop_back();
+        _term_index_dirty = true;
+    }
+    // get_term never sees the truncated logs from now on
+    publish_term_index();
+    while (!_replication_batches.empty() &&
+           _replication_batches.back()->last_index() > last_index_kept) {
+        _replication_batches.pop_back();
+    }
     const int64_t last_term_kept = unsafe_get_term(last_index_kept);
     CHECK(last_index_kept == 0 || last_term_kept != 0)
         << "last_index_kept=" << last_index_kept;
     _config_manager->truncate_suffix(last_index_kept);
+    _log_cache.truncate_suffix(last_index_kept);
     TruncateSuffixClosure* tsc =
         new TruncateSuffixClosure(last_index_kept, last_term_kept);
     CHECK_EQ(0, bthread::execution_queue_execute(_disk_queue, tsc));
@@ -393,6 +458,34 @@ int LogManager::check_and_resolve_conflict(std::vector<LogEntry*>* entries,
     return -1;
 }
 
+// Encode |entries| as the replicators do
+static ReplicationBatch* build_replication_batch(
+    const std::vector<LogEntry*>& entries) {
+    ReplicationBatch* batch = new ReplicationBatch;
+    batch->metas.resize(entries.size());
+    batch->data_offsets.reserve(entries.size() + 1);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const LogEntry* entry = entries[i];
+        EntryMeta& em = batch->metas[i];
+        em.set_term(entry->id.term);
+        em.set_type(entry->type);
+        for (size_t j = 0; j < entry->peers.size(); ++j) {
+            em.add_peers(entry->peers[j].to_string());
+        }
+        for (size_t j = 0; j < entry->old_peers.size(); ++j) {
+            em.add_old_peers(entry->old_peers[j].to_string());
+        }
+        em.set_data_len(entry->data.length());
+        if (FLAGS_raft_send_data_checksum && entry->type == ENTRY_TYPE_DATA) {
+            em.set_data_checksum(entry->data_crc32c());
+        }
+        batch->data_offsets.push_back(batch->data.length());
+        batch->data.append(entry->data);
+    }
+    batch->data_offsets.push_back(batch->data.length());
+    return batch;
+}
+
 void LogManager::append_entries(std::vector<LogEntry*>* entries,
                                 StableClosure* done) {
     CHECK(done);
@@ -404,6 +497,13 @@ void LogManager::append_entries(std::vector<LogEntry*>* entries,
         done->status().set_error(EIO, "Corrupted LogStorage");
         return run_closure_in_bthread(done);
     }
+    // Encode the logs from the leader out of the lock, the indexes of which
+    // are assigned later
+    scoped_refptr<ReplicationBatch> batch;
+    if (FLAGS_raft_share_replication_batch && !entries->empty() &&
+        entries->front()->id.index == 0) {
+        batch = build_replication_batch(*entries);
+    }
     std::unique_lock<raft_mutex_t> lck(_mutex);
     if (!entries->empty() && check_and_resolve_conflict(entries, done) != 0) {
         lck.unlock();
@@ -428,6 +528,12 @@ void LogManager::append_entries(std::vector<LogEntry*>* entries,
         _logs_in_memory.insert(_logs_in_memory.end(), entries->begin(),
                                entries->end());
     }
+    if (batch) {
+        batch->first_index = done->_first_log_index;
+        _replication_batches.push_back(batch);
+    }
+    append_term_runs(*entries);
+    publish_term_index();
 
     done->_entries.swap(*entries);
     int ret = bthread::execution_queue_execute(_disk_queue, done);
@@ -541,6 +647,9 @@ int LogManager::disk_thread(void* meta,
     LogId last_id = log_manager->_disk_id;
     StableClosure* storage[256];
     AppendBatcher ab(storage, ARRAY_SIZE(storage), &last_id, log_manager);
+    // The consecutive truncations of the prefix are done as the last one,
+    // which is deferred until another operation on the storage
+    int64_t first_index_kept = 0;
 
     for (; iter; ++iter) {
         // ^^^ Must iterate to the end to release to corresponding
@@ -548,68 +657,77 @@ int LogManager::disk_thread(void* meta,
         StableClosure* done = *iter;
         done->metric.bthread_queue_time_us =
             butil::cpuwide_time_us() - done->metric.start_time_us;
-        if (!done->_entries.empty()) {
+        if (first_index_kept != 0 &&
+            done->_type != StableClosure::TRUNCATE_PREFIX &&
+            done->_type != StableClosure::LAST_LOG_ID) {
+            log_manager->truncate_storage_prefix(first_index_kept);
+            first_index_kept = 0;
+        }
+        if (done->_type == StableClosure::APPEND && !done->_entries.empty()) {
             ab.append(done);
-        } else {
-            ab.flush();
-            int ret = 0;
-            do {
-                LastLogIdClosure* llic = dynamic_cast<LastLogIdClosure*>(done);
-                if (llic) {
-                    // Not used log_manager->get_disk_id() as it might be out of
-                    // date
-                    // FIXME: it's buggy
-                    llic->set_last_log_id(last_id);
-                    break;
-                }
-                TruncatePrefixClosure* tpc =
-                    dynamic_cast<TruncatePrefixClosure*>(done);
-                if (tpc) {
-                    BRAFT_VLOG << "Truncating storage to first_index_kept="
-                               << tpc->first_index_kept();
-                    ret = log_manager->_log_storage->truncate_prefix(
-                        tpc->first_index_kept());
-                    break;
-                }
+            continue;
+        }
+        ab.flush();
+        int ret = 0;
+        switch (done->_type) {
+            case StableClosure::APPEND:
+                break;
+            case StableClosure::LAST_LOG_ID:
+                // Not used log_manager->get_disk_id() as it might be out of
+                // date
+                // FIXME: it's buggy
+                static_cast<LastLogIdClosure*>(done)->set_last_log_id(last_id);
+                break;
+            case StableClosure::TRUNCATE_PREFIX:
+                first_index_kept =
+                    static_cast<TruncatePrefixClosure*>(done)
+                        ->first_index_kept();
+                break;
+            case StableClosure::TRUNCATE_SUFFIX: {
                 TruncateSuffixClosure* tsc =
-                    dynamic_cast<TruncateSuffixClosure*>(done);
-                if (tsc) {
-                    LOG(WARNING) << "Truncating storage to last_index_kept="
-                                 << tsc->last_index_kept();
-                    ret = log_manager->_log_storage->truncate_suffix(
-                        tsc->last_index_kept());
-                    if (ret == 0) {
-                        // update last_id after truncate_suffix
-                        last_id.index = tsc->last_index_kept();
-                        last_id.term = tsc->last_term_kept();
-                        CHECK(last_id.index == 0 || last_id.term != 0)
-                            << "last_id=" << last_id;
-                    }
-                    break;
-                }
-                ResetClosure* rc = dynamic_cast<ResetClosure*>(done);
-                if (rc) {
-                    LOG(INFO) << "Reseting storage to next_log_index="
-                              << rc->next_log_index();
-                    ret =
-                        log_manager->_log_storage->reset(rc->next_log_index());
-                    break;
+                    static_cast<TruncateSuffixClosure*>(done);
+                LOG(WARNING) << "Truncating storage to last_index_kept="
+                             << tsc->last_index_kept();
+                ret = log_manager->_log_storage->truncate_suffix(
+                    tsc->last_index_kept());
+                if (ret == 0) {
+                    // update last_id after truncate_suffix
+                    last_id.index = tsc->last_index_kept();
+                    last_id.term = tsc->last_term_kept();
+                    CHECK(last_id.index == 0 || last_id.term != 0)
+                        << "last_id=" << last_id;
                 }
-            } while (0);
+            } break;
+            case StableClosure::RESET: {
+                ResetClosure* rc = static_cast<ResetClosure*>(done);
+                LOG(INFO) << "Reseting storage to next_log_index="
+                          << rc->next_log_index();
+                ret = log_manager->_log_storage->reset(rc->next_log_index());
+            } break;
+        }
 
-            if (ret != 0) {
-                log_manager->report_error(ret,
-                                          "Failed operation on LogStorage");
-            }
-            done->Run();
+        if (ret != 0) {
+            log_manager->report_error(ret, "Failed operation on LogStorage");
         }
+        done->Run();
     }
     CHECK(!iter) << "Must iterate to the end";
     ab.flush();
+    if (first_index_kept != 0) {
+        log_manager->truncate_storage_prefix(first_index_kept);
+    }
     log_manager->set_disk_id(last_id);
     return 0;
 }
 
+void LogManager::truncate_storage_prefix(const int64_t first_index_kept) {
+    BRAFT_VLOG << "Truncating storage to first_index_kept=" << first_index_kept;
+    const int ret = _log_storage->truncate_prefix(first_index_kept);
+    if (ret != 0) {
+        report_error(ret, "Failed operation on LogStorage");
+    }
+}
+
 void LogManager::set_snapshot(const SnapshotMeta* meta) {
     BRAFT_VLOG << "Set snapshot last_included_index="
                << meta->last_included_index()
@@ -659,6 +777,9 @@ void LogManager::set_snapshot(const SnapshotMeta* meta) {
             // We have last snapshot index
             _virtual_first_log_id = last_but_one_snapshot_id;
             truncate_prefix(last_but_one_snapshot_id.index + 1, lck);
+        } else {
+            _term_index_dirty = true;
+            publish_term_index();
         }
         return;
     } else {
@@ -723,29 +844,222 @@ int64_t LogManager::get_term(const int64_t index) {
     if (index == 0) {
         return 0;
     }
-    std::unique_lock<raft_mutex_t> lck(_mutex);
+    const int64_t seq = _term_index_seq.load(butil::memory_order_acquire);
+    if ((seq & 1) == 0) {
+        const int64_t last_log_index =
+            _published_last_log_index.load(butil::memory_order_acquire);
+        int64_t term = -1;
+        {
+            butil::DoublyBufferedData<TermIndex>::ScopedPtr ptr;
+            if (_term_index.Read(&ptr) == 0) {
+                term = term_of(*ptr, last_log_index, index);
+            }
+        }
+        // Keep the reads above from sinking below the check of the sequence
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (term >= 0 &&
+            _term_index_seq.load(butil::memory_order_relaxed) == seq) {
+            return term;
+        }
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    return unsafe_get_term(index);
+}
+
+int64_t LogManager::term_of(const TermIndex& term_index,
+                            const int64_t last_log_index, const int64_t index) {
     // check virtual first log
-    if (index == _virtual_first_log_id.index) {
-        return _virtual_first_log_id.term;
+    if (index == term_index.virtual_first_log_id.index) {
+        return term_index.virtual_first_log_id.term;
     }
     // check last_snapshot_id
-    if (index == _last_snapshot_id.index) {
-        return _last_snapshot_id.term;
+    if (index == term_index.last_snapshot_id.index) {
+        return term_index.last_snapshot_id.term;
     }
     // out of range, direct return NULL
     // check this after check last_snapshot_id, because it is likely that
     // last_snapshot_id < first_log_index
-    if (index > _last_log_index || index < _first_log_index) {
+    if (index > last_log_index || index < term_index.first_log_index) {
         return 0;
     }
+    // The last run starting at or before |index|
+    const std::vector<std::pair<int64_t, int64_t> >& runs =
+        term_index.term_runs;
+    std::vector<std::pair<int64_t, int64_t> >::const_iterator it =
+        std::upper_bound(runs.begin(), runs.end(),
+                         std::pair<int64_t, int64_t>(index, INT64_MAX));
+    if (it == runs.begin()) {
+        return -1;
+    }
+    return (--it)->second;
+}
 
-    LogEntry* entry = get_entry_from_memory(index);
-    if (entry) {
-        return entry->id.term;
+int64_t LogManager::get_first_index_of_term(const int64_t index) {
+    TermIndex term_index;
+    int64_t last_log_index = 0;
+    copy_term_index(&term_index, &last_log_index);
+    return first_index_of_term(term_index, last_log_index, index);
+}
+
+int64_t LogManager::get_last_index_of_term(const int64_t term) {
+    TermIndex term_index;
+    int64_t last_log_index = 0;
+    copy_term_index(&term_index, &last_log_index);
+    return last_index_of_term(term_index, last_log_index, term);
+}
+
+int64_t LogManager::first_index_of_term(const TermIndex& term_index,
+                                        const int64_t last_log_index,
+                                        const int64_t index) {
+    if (index > last_log_index || index < term_index.first_log_index) {
+        return 0;
+    }
+    const std::vector<std::pair<int64_t, int64_t> >& runs =
+        term_index.term_runs;
+    std::vector<std::pair<int64_t, int64_t> >::const_iterator it =
+        std::upper_bound(runs.begin(), runs.end(),
+                         std::pair<int64_t, int64_t>(index, INT64_MAX));
+    if (it == runs.begin()) {
+        return 0;
+    }
+    return (--it)->first;
+}
+
+static bool term_of_run_less(const std::pair<int64_t, int64_t>& run,
+                             const int64_t term) {
+    return run.second < term;
+}
+
+int64_t LogManager::last_index_of_term(const TermIndex& term_index,
+                                       const int64_t last_log_index,
+                                       const int64_t term) {
+    // Terms never decrease along the runs
+    const std::vector<std::pair<int64_t, int64_t> >& runs =
+        term_index.term_runs;
+    std::vector<std::pair<int64_t, int64_t> >::const_iterator it =
+        std::lower_bound(runs.begin(), runs.end(), term, term_of_run_less);
+    if (it == runs.end() || it->second != term) {
+        return 0;
+    }
+    ++it;
+    return it != runs.end() ? it->first - 1 : last_log_index;
+}
+
+void LogManager::copy_term_index(TermIndex* term_index,
+                                 int64_t* last_log_index) {
+    const int64_t seq = _term_index_seq.load(butil::memory_order_acquire);
+    if ((seq & 1) == 0) {
+        *last_log_index =
+            _published_last_log_index.load(butil::memory_order_acquire);
+        bool copied = false;
+        {
+            butil::DoublyBufferedData<TermIndex>::ScopedPtr ptr;
+            if (_term_index.Read(&ptr) == 0) {
+                *term_index = *ptr;
+                copied = true;
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (copied &&
+            _term_index_seq.load(butil::memory_order_relaxed) == seq) {
+            return;
+        }
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    term_index->first_log_index = _first_log_index;
+    term_index->last_snapshot_id = _last_snapshot_id;
+    term_index->virtual_first_log_id = _virtual_first_log_id;
+    term_index->term_runs = _term_runs;
+    *last_log_index = _last_log_index;
+}
+
+static bool batch_starts_after(const int64_t index,
+                               const scoped_refptr<ReplicationBatch>& batch) {
+    return index < batch->first_index;
+}
+
+void LogManager::get_replication_batches(
+    const int64_t first_index, const int64_t max_entries,
+    std::vector<scoped_refptr<ReplicationBatch> >* batches) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    // The last batch starting at or before |first_index|
+    std::deque<scoped_refptr<ReplicationBatch> >::const_iterator it =
+        std::upper_bound(_replication_batches.begin(),
+                         _replication_batches.end(), first_index,
+                         batch_starts_after);
+    if (it == _replication_batches.begin()) {
+        return;
+    }
+    --it;
+    int64_t next_index = first_index;
+    while (it != _replication_batches.end() &&
+           (*it)->first_index <= next_index &&
+           (*it)->last_index() >= next_index &&
+           next_index - first_index < max_entries) {
+        batches->push_back(*it);
+        next_index = (*it)->last_index() + 1;
+        ++it;
+    }
+}
+
+size_t LogManager::assign_term_index(TermIndex& index,
+                                     const TermIndex& value) {
+    index = value;
+    return 1;
+}
+
+void LogManager::publish_term_index() {
+    if (!_term_index_dirty) {
+        // Appending to the last run or truncating inside it, which changes
+        // nothing else get_term relies on
+        _published_last_log_index.store(_last_log_index,
+                                        butil::memory_order_release);
+        return;
+    }
+    TermIndex index;
+    index.first_log_index = _first_log_index;
+    index.last_snapshot_id = _last_snapshot_id;
+    index.virtual_first_log_id = _virtual_first_log_id;
+    index.term_runs = _term_runs;
+    // An odd sequence tells the readers that the index is being replaced, and
+    // a changed one that it was replaced while they were reading it
+    _term_index_seq.fetch_add(1, butil::memory_order_acq_rel);
+    _term_index.Modify(assign_term_index, index);
+    _published_last_log_index.store(_last_log_index,
+                                    butil::memory_order_release);
+    _term_index_seq.fetch_add(1, butil::memory_order_release);
+    _term_index_dirty = false;
+}
+
+void LogManager::load_term_runs() {
+    _term_runs.clear();
+    int64_t index = _first_log_index;
+    while (index <= _last_log_index) {
+        const int64_t term = _log_storage->get_term(index);
+        _term_runs.push_back(std::make_pair(index, term));
+        // Terms never decrease along the log, find the last index in |term|
+        int64_t low = index;
+        int64_t high = _last_log_index;
+        while (low < high) {
+            const int64_t mid = low + (high - low + 1) / 2;
+            if (_log_storage->get_term(mid) == term) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+        index = low + 1;
+    }
+}
+
+void LogManager::append_term_runs(const std::vector<LogEntry*>& entries) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const LogId& id = entries[i]->id;
+        if (_term_runs.empty() || _term_runs.back().second != id.term) {
+            _term_runs.push_back(std::make_pair(id.index, id.term));
+            _term_index_dirty = true;
+        }
     }
-    lck.unlock();
-    g_read_term_from_storage << 1;
-    return _log_storage->get_term(index);
 }
 
 LogEntry* LogManager::get_entry(const int64_t index) {
@@ -761,7 +1075,18 @@ LogEntry* LogManager::get_entry(const int64_t index) {
         entry->AddRef();
         return entry;
     }
+    // The entries on disk after the ones in memory might be truncated and
+    // rewritten, so never read ahead into them
+    const int64_t last_index = _logs_in_memory.empty()
+                                   ? _last_log_index
+                                   : _logs_in_memory.front()->id.index - 1;
     lck.unlock();
+    if (FLAGS_raft_log_cache_capacity_bytes > 0) {
+        entry = get_entry_from_cache(index, last_index);
+        if (entry) {
+            return entry;
+        }
+    }
     g_read_entry_from_storage << 1;
     entry = _log_storage->get_entry(index);
     if (!entry) {
@@ -770,6 +1095,94 @@ LogEntry* LogManager::get_entry(const int64_t index) {
     return entry;
 }
 
+int LogManager::get_entries(const int64_t first_index,
+                            const int64_t last_index, size_t max_bytes,
+                            std::vector<LogEntry*>* entries) {
+    int64_t index = first_index;
+    size_t bytes = 0;
+    while (index <= last_index && bytes < max_bytes) {
+        std::unique_lock<raft_mutex_t> lck(_mutex);
+        if (index > _last_log_index || index < _first_log_index) {
+            break;
+        }
+        const int64_t last = std::min(last_index, _last_log_index);
+        if (!_logs_in_memory.empty() &&
+            index >= _logs_in_memory.front()->id.index) {
+            // The rest are all in memory
+            for (; index <= last && bytes < max_bytes; ++index) {
+                LogEntry* entry = get_entry_from_memory(index);
+                if (entry == NULL) {
+                    break;
+                }
+                entry->AddRef();
+                bytes += entry->data.length();
+                entries->push_back(entry);
+            }
+            break;
+        }
+        const int64_t storage_last_index =
+            _logs_in_memory.empty()
+                ? last
+                : std::min(last, _logs_in_memory.front()->id.index - 1);
+        lck.unlock();
+        int n = 0;
+        if (FLAGS_raft_log_cache_capacity_bytes > 0) {
+            for (; index + n <= storage_last_index && bytes < max_bytes; ++n) {
+                LogEntry* entry =
+                    get_entry_from_cache(index + n, storage_last_index);
+                if (entry == NULL) {
+                    break;
+                }
+                bytes += entry->data.length();
+                entries->push_back(entry);
+            }
+        } else {
+            const size_t old_size = entries->size();
+            n = _log_storage->get_entries(index, storage_last_index,
+                                          max_bytes - bytes, entries);
+            g_read_entry_from_storage << n;
+            for (size_t i = old_size; i < entries->size(); ++i) {
+                bytes += (*entries)[i]->data.length();
+            }
+        }
+        if (n <= 0) {
+            report_error(EIO, "Corrupted entry at index=%" PRId64, index);
+            break;
+        }
+        index += n;
+    }
+    return index - first_index;
+}
+
+LogEntry* LogManager::get_entry_from_cache(const int64_t index,
+                                           const int64_t last_index) {
+    LogEntry* entry = _log_cache.get(index);
+    if (entry) {
+        return entry;
+    }
+    const int64_t version = _log_cache.version();
+    int64_t end_index = index;
+    if (_log_cache.contains(index - 1)) {
+        end_index = std::min(index + FLAGS_raft_log_cache_readahead - 1,
+                             last_index);
+    }
+    // The whole block is read at once, no more than the cache holds
+    std::vector<LogEntry*> entries;
+    const int n = _log_storage->get_entries(
+        index, end_index, (size_t)FLAGS_raft_log_cache_capacity_bytes,
+        &entries);
+    g_read_entry_from_storage << n;
+    if (entries.empty()) {
+        return NULL;
+    }
+    _log_cache.put(entries, version);
+    entry = entries[0];
+    for (size_t i = 1; i < entries.size(); ++i) {
+        entries[i]->Release();
+    }
+    return entry;
+}
+
 void LogManager::get_configuration(const int64_t index,
                                    ConfigurationEntry* conf) {
     BAIDU_SCOPED_LOCK(_mutex);
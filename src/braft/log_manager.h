@@ -18,13 +18,15 @@
 #ifndef BRAFT_LOG_MANAGER_H
 #define BRAFT_LOG_MANAGER_H
 
-#include <bthread/execution_queue.h>    // bthread::ExecutionQueueId
-#include <butil/containers/flat_map.h>  // butil::FlatMap
+#include <bthread/execution_queue.h>                // bthread::ExecutionQueueId
+#include <butil/containers/doubly_buffered_data.h>  // butil::DoublyBufferedData
+#include <butil/containers/flat_map.h>              // butil::FlatMap
 #include <butil/macros.h>               // BAIDU_CACHELINE_ALIGNMENT
 
 #include <deque>  // std::deque
 
 #include "braft/configuration_manager.h"  // ConfigurationManager
+#include "braft/log_cache.h"              // LogEntryCache
 #include "braft/log_entry.h"              // LogEntry
 #include "braft/raft.h"                   // Closure
 #include "braft/storage.h"                // Storage
@@ -56,22 +58,52 @@ struct LogManagerStatus {
 
 class SnapshotMeta;
 
+// The metas and the data of the logs appended by the leader at once, encoded
+// once and shared by all the replicators, which is immutable after being
+// published by LogManager
+struct ReplicationBatch : public butil::RefCountedThreadSafe<ReplicationBatch> {
+    ReplicationBatch() : first_index(0) {}
+    int64_t last_index() const { return first_index + metas.size() - 1; }
+
+    int64_t first_index;
+    std::vector<EntryMeta> metas;
+    // The data of metas[i] is [data_offsets[i], data_offsets[i + 1]) of |data|
+    std::vector<size_t> data_offsets;
+    butil::IOBuf data;
+
+   private:
+    friend class butil::RefCountedThreadSafe<ReplicationBatch>;
+    ~ReplicationBatch() {}
+};
+
 class BAIDU_CACHELINE_ALIGNMENT LogManager {
    public:
     typedef int64_t WaitId;
 
     class StableClosure : public Closure {
        public:
-        StableClosure() : _first_log_index(0) {}
+        // What the disk thread does for the closure
+        enum Type {
+            APPEND = 0,
+            LAST_LOG_ID,
+            TRUNCATE_PREFIX,
+            TRUNCATE_SUFFIX,
+            RESET,
+        };
+
+        StableClosure() : _first_log_index(0), _type(APPEND) {}
         void update_metric(IOMetric* metric);
 
        protected:
+        explicit StableClosure(Type type) : _first_log_index(0), _type(type) {}
+
         int64_t _first_log_index;
         IOMetric metric;
 
        private:
         friend class LogManager;
         friend class AppendBatcher;
+        Type _type;
         std::vector<LogEntry*> _entries;
     };
 
@@ -99,11 +131,40 @@ class BAIDU_CACHELINE_ALIGNMENT LogManager {
     //  success return ptr, fail return null
     LogEntry* get_entry(const int64_t index);
 
-    // Get the log term at |index|
+    // Get the logs in [first_index, last_index] and append them to |entries|,
+    // stop once the data of the appended logs reaches |max_bytes|. The logs
+    // in memory are got with one lock, and the ones on disk are read in
+    // ranges from the storage.
+    // Returns:
+    //  the number of the appended logs
+    int get_entries(const int64_t first_index, const int64_t last_index,
+                    size_t max_bytes, std::vector<LogEntry*>* entries);
+
+    // Get the consecutive batches appended by the leader from the one
+    // containing |first_index|, until they contain |max_entries| logs after
+    // |first_index|. Nothing is got if the log at |first_index| is not in
+    // memory or not appended by the leader.
+    void get_replication_batches(
+        const int64_t first_index, const int64_t max_entries,
+        std::vector<scoped_refptr<ReplicationBatch> >* batches);
+
+    // Get the log term at |index|, which never blocks on the appending or
+    // the disk thread
     // Returns:
     //  success return term > 0, fail return 0
     int64_t get_term(const int64_t index);
 
+    // Get the first index of the logs in the same term as the log at |index|,
+    // which is not before the first log index
+    // Returns:
+    //  success return index > 0, out of range return 0
+    int64_t get_first_index_of_term(const int64_t index);
+
+    // Get the last index of the logs in |term|
+    // Returns:
+    //  success return index > 0, no log in |term| return 0
+    int64_t get_last_index_of_term(const int64_t term);
+
     // Get the first log index of log
     // Returns:
     //  success return first log index, empty return 0
@@ -161,12 +222,51 @@ class BAIDU_CACHELINE_ALIGNMENT LogManager {
         int error_code;
     };
 
+    // What get_term needs to know besides the last log index, published to
+    // the readers through _term_index whenever it changes. The last log index
+    // moves with almost every append, so it's published separately through
+    // _published_last_log_index
+    struct TermIndex {
+        TermIndex() : first_log_index(0) {}
+        int64_t first_log_index;
+        LogId last_snapshot_id;
+        LogId virtual_first_log_id;
+        std::vector<std::pair<int64_t, int64_t> > term_runs;
+    };
+
+    static size_t assign_term_index(TermIndex& index, const TermIndex& value);
+    // Returns -1 if |index| is in the range but not covered by the runs
+    static int64_t term_of(const TermIndex& term_index,
+                           const int64_t last_log_index, const int64_t index);
+    static int64_t first_index_of_term(const TermIndex& term_index,
+                                       const int64_t last_log_index,
+                                       const int64_t index);
+    static int64_t last_index_of_term(const TermIndex& term_index,
+                                      const int64_t last_log_index,
+                                      const int64_t term);
+    // Copy the published term index along with the last log index, or the
+    // latest ones under the lock if they are being published
+    void copy_term_index(TermIndex* term_index, int64_t* last_log_index);
+
+    // Publish the latest _last_log_index to get_term, along with _term_runs,
+    // the first log index and the snapshot ids if any of them has changed
+    // since the last time, as marked by _term_index_dirty
+    void publish_term_index();
+
+    // Build _term_runs from _log_storage at init
+    void load_term_runs();
+
+    void append_term_runs(const std::vector<LogEntry*>& entries);
+
     void append_to_storage(std::vector<LogEntry*>* to_append, LogId* last_id,
                            IOMetric* metric);
 
     static int disk_thread(void* meta,
                            bthread::TaskIterator<StableClosure*>& iter);
 
+    // Called in the disk thread
+    void truncate_storage_prefix(const int64_t first_index_kept);
+
     // delete logs from storage's head, [1, first_index_kept) will be discarded
     // Returns:
     //  success return 0, failed return -1
@@ -182,6 +282,11 @@ class BAIDU_CACHELINE_ALIGNMENT LogManager {
 
     LogEntry* get_entry_from_memory(const int64_t index);
 
+    // Read the entry at |index| from storage through _log_cache, and read
+    // ahead up to |last_index| if the reader is streaming forward
+    LogEntry* get_entry_from_cache(const int64_t index,
+                                   const int64_t last_index);
+
     WaitId notify_on_new_log(int64_t expected_last_log_index, WaitMeta* wm);
 
     int check_and_resolve_conflict(std::vector<LogEntry*>* entries,
@@ -219,6 +324,11 @@ class BAIDU_CACHELINE_ALIGNMENT LogManager {
     LogId _applied_id;
     // TODO(chenzhangyi01): replace deque with a thread-safe data structure
     std::deque<LogEntry* /*FIXME*/> _logs_in_memory;
+    // the entries read back from _log_storage after dropped from
+    // _logs_in_memory
+    LogEntryCache _log_cache;
+    // the batches appended by the leader in _logs_in_memory
+    std::deque<scoped_refptr<ReplicationBatch> > _replication_batches;
     int64_t _first_log_index;
     int64_t _last_log_index;
     // the last snapshot's log_id
@@ -229,6 +339,14 @@ class BAIDU_CACHELINE_ALIGNMENT LogManager {
     // [NOTICE] there should not be hole between this log_id and
     // _last_snapshot_id, or may cause some unexpect cases
     LogId _virtual_first_log_id;
+    // (first index, term) of each run of the logs in the same term
+    std::vector<std::pair<int64_t, int64_t> > _term_runs;
+    bool _term_index_dirty;
+    butil::DoublyBufferedData<TermIndex> _term_index;
+    butil::atomic<int64_t> _published_last_log_index;
+    // Odd while _term_index and _published_last_log_index are being published
+    // together, the readers retry under the lock if it changes during reading
+    butil::atomic<int64_t> _term_index_seq;
 
     bthread::ExecutionQueueId<StableClosure*> _disk_queue;
 };
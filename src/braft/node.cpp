@@ -172,6 +172,8 @@ NodeImpl::NodeImpl(const GroupId& group_id, const PeerId& peer_id)
       _waking_candidate(0),
       _append_entries_cache(NULL),
       _append_entries_cache_version(0),
+      _read_index_in_fly(false),
+      _read_index_version(0),
       _node_readonly(false),
       _majority_nodes_readonly(false) {
     butil::string_printf(&_v_group_id, "%s_%d", _group_id.c_str(),
@@ -199,6 +201,8 @@ NodeImpl::NodeImpl()
       _waking_candidate(0),
       _append_entries_cache(NULL),
       _append_entries_cache_version(0),
+      _read_index_in_fly(false),
+      _read_index_version(0),
       _node_readonly(false),
       _majority_nodes_readonly(false) {
     butil::string_printf(&_v_group_id, "%s_%d", _group_id.c_str(),
@@ -1861,6 +1865,12 @@ void NodeImpl::step_down(const int64_t term, bool wakeup_a_candidate,
     } else if (_state <= STATE_TRANSFERRING) {
         _stepdown_timer.stop();
         _ballot_box->clear_pending_tasks();
+        butil::Status st;
+        st.set_error(EPERM, "Leader stepped down");
+        fail_pending_read_index(st);
+        // The flying round finishes on its own, don't wait for it
+        _read_index_in_fly = false;
+        ++_read_index_version;
 
         // signal fsm leader stop immediately
         if (_state == STATE_LEADER) {
@@ -2556,6 +2566,15 @@ void NodeImpl::handle_append_entries_request(
         response->set_success(false);
         response->set_term(_current_term);
         response->set_last_log_index(last_index);
+        if (local_prev_log_term != 0) {
+            // Let the leader skip the whole conflicting term at once
+            const int64_t conflict_index =
+                _log_manager->get_first_index_of_term(prev_log_index);
+            if (conflict_index != 0) {
+                response->set_conflict_term(local_prev_log_term);
+                response->set_conflict_index(conflict_index);
+            }
+        }
         lck.unlock();
         if (local_prev_log_term != 0) {
             LOG(WARNING) << "node " << _group_id << ":" << _server_id
@@ -2614,6 +2633,11 @@ void NodeImpl::handle_append_entries_request(
             if (entry.has_data_len()) {
                 int len = entry.data_len();
                 data_buf.cutn(&log_entry->data, len);
+                if (entry.has_data_checksum()) {
+                    // Not hashed again when the entry is persisted, a
+                    // corrupted payload fails the verification on reading
+                    log_entry->set_data_crc32c(entry.data_checksum());
+                }
             }
             entries.push_back(log_entry);
         }
@@ -2778,6 +2802,319 @@ butil::Status NodeImpl::read_committed_user_log(const int64_t index,
                          cur_index);
 }
 
+// A round of leadership confirmation shared by all the reads coalesced into it.
+// The round succeeds once the majority of the configuration acknowledges the
+// term of the leader, and fails once that becomes impossible.
+class ReadIndexCtx : public butil::RefCountedThreadSafe<ReadIndexCtx> {
+   public:
+    ReadIndexCtx(NodeImpl* node, int64_t version, int64_t read_index,
+                 const ConfigurationEntry& conf,
+                 std::vector<PendingReadIndex>* reads)
+        : _node(node),
+          _version(version),
+          _read_index(read_index),
+          _nwaiting(0),
+          _finished(false) {
+        _node->AddRef();
+        _ballot.init(conf.conf, conf.old_conf.empty()
+                                    ? std::nullopt
+                                    : std::make_optional(conf.old_conf));
+        std::set<PeerId> peers;
+        conf.list_peers(&peers);
+        _nwaiting = peers.size();
+        _reads.swap(*reads);
+    }
+
+    void on_peer_returned(const PeerId& peer, const butil::Status& st) {
+        std::unique_lock<raft_mutex_t> lck(_mutex);
+        --_nwaiting;
+        if (_finished) {
+            return;
+        }
+        if (st.ok()) {
+            _ballot.grant(peer);
+        }
+        butil::Status result;
+        if (!_ballot.granted()) {
+            if (_nwaiting > 0) {
+                return;
+            }
+            result.set_error(ERAFTTIMEDOUT,
+                             "Fail to confirm the leadership with the majority");
+        }
+        _finished = true;
+        lck.unlock();
+        _node->on_read_index_confirmed(_version, _read_index, &_reads, result);
+    }
+
+   private:
+    friend class butil::RefCountedThreadSafe<ReadIndexCtx>;
+    ~ReadIndexCtx() {
+        CHECK(_reads.empty());
+        _node->Release();
+    }
+
+    raft_mutex_t _mutex;
+    NodeImpl* _node;
+    int64_t _version;
+    int64_t _read_index;
+    Ballot _ballot;
+    int _nwaiting;
+    bool _finished;
+    std::vector<PendingReadIndex> _reads;
+};
+
+class ReadIndexHeartbeatDone : public Closure {
+   public:
+    ReadIndexHeartbeatDone(ReadIndexCtx* ctx, const PeerId& peer)
+        : _ctx(ctx), _peer(peer) {}
+    void Run() {
+        _ctx->on_peer_returned(_peer, status());
+        delete this;
+    }
+
+   private:
+    scoped_refptr<ReadIndexCtx> _ctx;
+    PeerId _peer;
+};
+
+// Ask the leader to confirm the read index for the pending reads of a follower
+struct OnReadIndexRPCDone : public google::protobuf::Closure {
+    OnReadIndexRPCDone(NodeImpl* node_, const PeerId& leader_,
+                       int64_t version_, std::vector<PendingReadIndex>* reads_)
+        : node(node_), leader(leader_), version(version_) {
+        node->AddRef();
+        reads.swap(*reads_);
+    }
+    virtual ~OnReadIndexRPCDone() { node->Release(); }
+
+    void Run() {
+        butil::Status st;
+        if (cntl.Failed()) {
+            st.set_error(cntl.ErrorCode(), "Fail to get read index from %s, %s",
+                         leader.to_string().c_str(), cntl.ErrorText().c_str());
+        } else if (!response.success()) {
+            st.set_error(EPERM, "%s is not leader at term %" PRId64,
+                         leader.to_string().c_str(), response.term());
+        }
+        node->on_read_index_confirmed(version, response.index(), &reads, st);
+        delete this;
+    }
+
+    NodeImpl* node;
+    PeerId leader;
+    int64_t version;
+    std::vector<PendingReadIndex> reads;
+    ReadIndexRequest request;
+    ReadIndexResponse response;
+    brpc::Controller cntl;
+};
+
+// Respond the ReadIndex request of a follower once the leader confirms the
+// read index
+class ReadIndexResponseClosure : public ReadIndexClosure {
+   public:
+    ReadIndexResponseClosure(brpc::Controller* cntl,
+                             ReadIndexResponse* response,
+                             google::protobuf::Closure* done)
+        : _cntl(cntl), _response(response), _done(done) {}
+    void Run() {
+        if (status().ok()) {
+            _response->set_success(true);
+            _response->set_index(index());
+        } else {
+            _cntl->SetFailed(status().error_code(), "%s", status().error_cstr());
+        }
+        _done->Run();
+        delete this;
+    }
+
+   private:
+    brpc::Controller* _cntl;
+    ReadIndexResponse* _response;
+    google::protobuf::Closure* _done;
+};
+
+void NodeImpl::read_index(ReadIndexClosure* done) {
+    CHECK(done);
+    if (is_witness()) {
+        done->status().set_error(EPERM, "Witness can't serve reads");
+        run_closure_in_bthread(done);
+        return;
+    }
+    std::unique_lock<raft_mutex_t> lck(_mutex);
+    if (_state != STATE_LEADER &&
+        (_state != STATE_FOLLOWER || _leader_id.is_empty())) {
+        lck.unlock();
+        done->status().set_error(EPERM, "Not leader and no leader is known");
+        run_closure_in_bthread(done);
+        return;
+    }
+    _pending_read_index.push_back(PendingReadIndex(done, true));
+    if (_read_index_in_fly) {
+        // Will be confirmed by the next round when the flying one finishes
+        return;
+    }
+    start_read_index(&lck);
+}
+
+void NodeImpl::lease_read(ReadIndexClosure* done) {
+    CHECK(done);
+    LeaderLeaseStatus lease_status;
+    get_leader_lease_status(&lease_status);
+    if (lease_status.state != LEASE_VALID) {
+        return read_index(done);
+    }
+    // No other leader can commit any log until the lease expires, and the
+    // lease only starts after a log of this term is committed, so the current
+    // last_committed_index is safe to read.
+    const int64_t read_index = _ballot_box->last_committed_index();
+    done->_index = read_index;
+    _fsm_caller->wait_applied(read_index, done);
+}
+
+void NodeImpl::handle_read_index_request(brpc::Controller* controller,
+                                         const ReadIndexRequest* request,
+                                         ReadIndexResponse* response,
+                                         google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    std::unique_lock<raft_mutex_t> lck(_mutex);
+    response->set_term(_current_term);
+    response->set_success(false);
+    if (_state != STATE_LEADER) {
+        const State saved_state = _state;
+        lck.unlock();
+        BRAFT_VLOG << "node " << _group_id << ":" << _server_id
+                   << " received ReadIndex from " << request->server_id()
+                   << " while state is " << state2str(saved_state);
+        return;
+    }
+    _pending_read_index.push_back(PendingReadIndex(
+        new ReadIndexResponseClosure(controller, response,
+                                     done_guard.release()),
+        false));
+    if (_read_index_in_fly) {
+        return;
+    }
+    start_read_index(&lck);
+}
+
+void NodeImpl::start_read_index(std::unique_lock<raft_mutex_t>* lck) {
+    const int64_t version = ++_read_index_version;
+    if (_state == STATE_FOLLOWER && !_leader_id.is_empty()) {
+        _read_index_in_fly = true;
+        OnReadIndexRPCDone* done = new OnReadIndexRPCDone(
+            this, _leader_id, version, &_pending_read_index);
+        done->cntl.set_timeout_ms(_options.election_timeout_ms);
+        done->request.set_group_id(_group_id);
+        done->request.set_server_id(_server_id.to_string());
+        done->request.set_peer_id(_leader_id.to_string());
+        lck->unlock();
+
+        brpc::ChannelOptions options;
+        options.connection_type = brpc::CONNECTION_TYPE_SINGLE;
+        options.max_retry = 0;
+        options.connect_timeout_ms = FLAGS_raft_rpc_channel_connect_timeout_ms;
+        brpc::Channel channel;
+        if (0 != channel.Init(done->leader.addr, &options)) {
+            done->cntl.SetFailed(EINVAL, "Fail to init channel to %s",
+                                 done->leader.to_string().c_str());
+            return done->Run();
+        }
+        RaftService_Stub stub(&channel);
+        stub.read_index(&done->cntl, &done->request, &done->response, done);
+        return;
+    }
+    if (_state != STATE_LEADER) {
+        fail_pending_read_index(
+            butil::Status(EPERM, "Not leader and no leader is known"));
+        lck->unlock();
+        return;
+    }
+    // The leader may not know the latest committed index until a log of its
+    // own term is committed, see section 6.4 of the raft thesis.
+    const int64_t read_index = _ballot_box->last_committed_index();
+    if (_log_manager->get_term(read_index) != _current_term) {
+        butil::Status st;
+        st.set_error(EAGAIN,
+                     "Leader has not committed any log at term %" PRId64,
+                     _current_term);
+        fail_pending_read_index(st);
+        lck->unlock();
+        return;
+    }
+    _read_index_in_fly = true;
+    scoped_refptr<ReadIndexCtx> ctx(new ReadIndexCtx(
+        this, version, read_index, _conf, &_pending_read_index));
+    std::set<PeerId> peers;
+    _conf.list_peers(&peers);
+    std::vector<std::pair<PeerId, ReplicatorId> > replicators;
+    _replicator_group.list_replicators(&replicators);
+    lck->unlock();
+
+    std::map<PeerId, ReplicatorId> rmap(replicators.begin(),
+                                        replicators.end());
+    for (std::set<PeerId>::const_iterator iter = peers.begin();
+         iter != peers.end(); ++iter) {
+        if (*iter == _server_id) {
+            ctx->on_peer_returned(*iter, butil::Status());
+            continue;
+        }
+        std::map<PeerId, ReplicatorId>::const_iterator it = rmap.find(*iter);
+        if (it == rmap.end()) {
+            ctx->on_peer_returned(
+                *iter, butil::Status(EINVAL, "No replicator attached"));
+            continue;
+        }
+        Replicator::send_heartbeat(it->second,
+                                   new ReadIndexHeartbeatDone(ctx.get(), *iter));
+    }
+}
+
+void NodeImpl::on_read_index_confirmed(int64_t version, int64_t read_index,
+                                       std::vector<PendingReadIndex>* reads,
+                                       const butil::Status& st) {
+    std::unique_lock<raft_mutex_t> lck(_mutex);
+    if (version == _read_index_version) {
+        _read_index_in_fly = false;
+    }
+    if (!_pending_read_index.empty() && !_read_index_in_fly) {
+        // start_read_index unlocks |lck|
+        start_read_index(&lck);
+    } else {
+        lck.unlock();
+    }
+    if (!st.ok()) {
+        BRAFT_VLOG << "node " << _group_id << ":" << _server_id
+                   << " fail to confirm " << reads->size()
+                   << " reads, " << st;
+    }
+    for (size_t i = 0; i < reads->size(); ++i) {
+        ReadIndexClosure* done = (*reads)[i].done;
+        if (!st.ok()) {
+            done->status() = st;
+            run_closure_in_bthread(done);
+            continue;
+        }
+        done->_index = read_index;
+        if ((*reads)[i].wait_applied) {
+            _fsm_caller->wait_applied(read_index, done);
+        } else {
+            done->Run();
+        }
+    }
+    reads->clear();
+}
+
+void NodeImpl::fail_pending_read_index(const butil::Status& st) {
+    for (size_t i = 0; i < _pending_read_index.size(); ++i) {
+        ReadIndexClosure* done = _pending_read_index[i].done;
+        done->status() = st;
+        run_closure_in_bthread(done);
+    }
+    _pending_read_index.clear();
+}
+
 void NodeImpl::describe(std::ostream& os, bool use_html) {
     PeerId leader;
     std::vector<ReplicatorId> replicators;
@@ -27,6 +27,7 @@
 
 #include <set>
 
+#include "braft/ballot.h"
 #include "braft/ballot_box.h"
 #include "braft/closure_queue.h"
 #include "braft/configuration_manager.h"
@@ -47,6 +48,16 @@ class SnapshotStorage;
 class SnapshotExecutor;
 class StopTransferArg;
 
+// A read waiting for the next round of leadership confirmation
+struct PendingReadIndex {
+    PendingReadIndex(ReadIndexClosure* done_, bool wait_applied_)
+        : done(done_), wait_applied(wait_applied_) {}
+    ReadIndexClosure* done;
+    // Whether |done| waits for the local StateMachine to apply the confirmed
+    // index, false for the reads forwarded by followers
+    bool wait_applied;
+};
+
 class NodeImpl;
 class NodeTimer : public RepeatedTimerTask {
    public:
@@ -138,6 +149,15 @@ class BAIDU_CACHELINE_ALIGNMENT NodeImpl
     //
     void apply(const Task& task);
 
+    // linearizable read, the leader confirms the leadership with a round of
+    // heartbeats and a follower asks the leader for the committed index, |done|
+    // is run after the confirmed index is applied
+    void read_index(ReadIndexClosure* done);
+
+    // linearizable read served by the leader lease, fall back to read_index if
+    // the lease is not valid
+    void lease_read(ReadIndexClosure* done);
+
     butil::Status list_peers(std::vector<PeerId>* peers);
 
     // @Node configuration change
@@ -183,6 +203,12 @@ class BAIDU_CACHELINE_ALIGNMENT NodeImpl
                                     const TimeoutNowRequest* request,
                                     TimeoutNowResponse* response,
                                     google::protobuf::Closure* done);
+
+    // handle received ReadIndex from followers
+    void handle_read_index_request(brpc::Controller* controller,
+                                   const ReadIndexRequest* request,
+                                   ReadIndexResponse* response,
+                                   google::protobuf::Closure* done);
     // timer func
     void handle_election_timeout();
     void handle_vote_timeout();
@@ -200,6 +226,10 @@ class BAIDU_CACHELINE_ALIGNMENT NodeImpl
                                       const RequestVoteResponse& response);
     void on_caughtup(const PeerId& peer, int64_t term, int64_t version,
                      const butil::Status& st);
+    // called when the round |version| of read index confirmation finishes
+    void on_read_index_confirmed(int64_t version, int64_t read_index,
+                                 std::vector<PendingReadIndex>* reads,
+                                 const butil::Status& st);
     // other func
     //
     // called when leader change configuration done, ref with FSMCaller
@@ -313,6 +343,11 @@ class BAIDU_CACHELINE_ALIGNMENT NodeImpl
 
     void do_apply(butil::IOBuf& data, Closure* done);
 
+    // start a round of read index confirmation for the pending reads, |lck|
+    // is unlocked on return
+    void start_read_index(std::unique_lock<raft_mutex_t>* lck);
+    void fail_pending_read_index(const butil::Status& st);
+
     struct LogEntryAndClosure;
     static int execute_applying_tasks(
         void* meta, bthread::TaskIterator<LogEntryAndClosure>& iter);
@@ -542,6 +577,11 @@ class BAIDU_CACHELINE_ALIGNMENT NodeImpl
     AppendEntriesCache* _append_entries_cache;
     int64_t _append_entries_cache_version;
 
+    // reads waiting for the next round of read index confirmation
+    std::vector<PendingReadIndex> _pending_read_index;
+    bool _read_index_in_fly;
+    int64_t _read_index_version;
+
     // for readonly mode
     bool _node_readonly;
     bool _majority_nodes_readonly;
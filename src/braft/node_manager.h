@@ -20,6 +20,7 @@
 #include <butil/containers/doubly_buffered_data.h>
 #include <butil/memory/singleton.h>
 
+#include "braft/heartbeat_batcher.h"
 #include "braft/raft.h"
 #include "braft/util.h"
 
@@ -55,6 +56,9 @@ class NodeManager {
     // Remove the addr from _addr_set when the backing service is destroyed
     void remove_address(butil::EndPoint addr);
 
+    // Aggregate the heartbeats of all the nodes in this process
+    HeartbeatBatcher* heartbeat_batcher() { return &_heartbeat_batcher; }
+
    private:
     NodeManager();
     ~NodeManager();
@@ -78,6 +82,8 @@ class NodeManager {
 
     raft_mutex_t _mutex;
     std::set<butil::EndPoint> _addr_set;
+
+    HeartbeatBatcher _heartbeat_batcher;
 };
 
 #define global_node_manager NodeManager::GetInstance()
@@ -28,6 +28,7 @@
 #include "braft/node.h"
 #include "braft/node_manager.h"
 #include "braft/raft_meta.h"
+#include "braft/shared_log.h"
 #include "braft/snapshot.h"
 #include "braft/storage.h"
 
@@ -49,6 +50,8 @@ static pthread_once_t global_init_once = PTHREAD_ONCE_INIT;
 struct GlobalExtension {
     SegmentLogStorage local_log;
     MemoryLogStorage memory_log;
+    // share the log files among a batch of raft instances
+    SharedLogStorage shared_log;
 
     // manage only one raft instance
     FileBasedSingleMetaStorage single_meta;
@@ -65,6 +68,8 @@ static void global_init_or_die_impl() {
 
     log_storage_extension()->RegisterOrDie("local", &s_ext.local_log);
     log_storage_extension()->RegisterOrDie("memory", &s_ext.memory_log);
+    // uri = local-shared://shared_path={shared_path}&&group={group}
+    log_storage_extension()->RegisterOrDie("local-shared", &s_ext.shared_log);
 
     // uri = local://{single_path}
     // |single_path| usually ends with `/meta'
@@ -170,6 +175,10 @@ void Node::join() { _impl->join(); }
 
 void Node::apply(const Task& task) { _impl->apply(task); }
 
+void Node::read_index(ReadIndexClosure* done) { _impl->read_index(done); }
+
+void Node::lease_read(ReadIndexClosure* done) { _impl->lease_read(done); }
+
 butil::Status Node::list_peers(std::vector<PeerId>* peers) {
     return _impl->list_peers(peers);
 }
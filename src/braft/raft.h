@@ -61,6 +61,21 @@ class Closure : public google::protobuf::Closure {
     butil::Status _st;
 };
 
+// Closure of Node::read_index. If status() is OK when Run() is invoked, all the
+// logs committed before the read was issued have been applied to the
+// StateMachine, so that reading the StateMachine in Run() is linearizable.
+class ReadIndexClosure : public Closure {
+   public:
+    ReadIndexClosure() : _index(0) {}
+
+    // The committed index this read waited to be applied.
+    int64_t index() const { return _index; }
+
+   private:
+    friend class NodeImpl;
+    int64_t _index;
+};
+
 // Describe a specific error
 class Error {
    public:
@@ -701,6 +716,27 @@ class Node {
     //
     void apply(const Task& task);
 
+    // [Thread-safe and wait-free]
+    // Issue a linearizable read without writing any log. The leader records its
+    // last_committed_index, confirms its leadership with a round of heartbeats
+    // to the majority, and invokes done->Run() after the StateMachine has
+    // applied the recorded index. A follower asks the leader for the confirmed
+    // index instead and waits for its own StateMachine to apply it, so that
+    // reads can be served by any replica. Reads issued while a round is in
+    // flight are confirmed together by the next round.
+    // Fails with EPERM if neither this node nor its leader can serve the read,
+    // and EAGAIN if the leader hasn't committed any log at its term yet.
+    void read_index(ReadIndexClosure* done);
+
+    // [Thread-safe and wait-free]
+    // Same as read_index, but if the leader lease of this node is valid, the
+    // round of heartbeats is skipped and done->Run() is invoked right after the
+    // StateMachine has applied the last_committed_index. Falls back to
+    // read_index when the lease is disabled, expired or not ready.
+    // The linearizability relies on the leader lease, see
+    // is_leader_lease_valid for the situations it's not reliable.
+    void lease_read(ReadIndexClosure* done);
+
     // list peers of this raft group, only leader retruns ok
     // [NOTE] when list_peers concurrency with add_peer/remove_peer, maybe
     // return peers is staled. because add_peer/remove_peer immediately modify
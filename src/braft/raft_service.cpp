@@ -23,6 +23,8 @@
 #include "braft/node.h"
 #include "braft/node_manager.h"
 #include "braft/raft.h"
+#include "braft/replication_stream.h"
+#include "braft/sync_point.h"
 
 namespace braft {
 
@@ -163,4 +165,106 @@ void RaftServiceImpl::timeout_now(::google::protobuf::RpcController* controller,
     node->handle_timeout_now_request(cntl, request, response, done);
 }
 
+void RaftServiceImpl::read_index(::google::protobuf::RpcController* controller,
+                                 const ::braft::ReadIndexRequest* request,
+                                 ::braft::ReadIndexResponse* response,
+                                 ::google::protobuf::Closure* done) {
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+    PeerId peer_id;
+    if (0 != peer_id.parse(request->peer_id())) {
+        cntl->SetFailed(EINVAL, "peer_id invalid");
+        done->Run();
+        return;
+    }
+
+    scoped_refptr<NodeImpl> node_ptr =
+        global_node_manager->get(request->group_id(), peer_id);
+    NodeImpl* node = node_ptr.get();
+    if (!node) {
+        cntl->SetFailed(ENOENT, "peer_id not exist");
+        done->Run();
+        return;
+    }
+
+    node->handle_read_index_request(cntl, request, response, done);
+}
+
+void RaftServiceImpl::batch_heartbeat(
+    ::google::protobuf::RpcController* controller,
+    const ::braft::BatchHeartbeatRequest* request,
+    ::braft::BatchHeartbeatResponse* response,
+    ::google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    (void)controller;
+
+    for (int i = 0; i < request->heartbeats_size(); ++i) {
+        const AppendEntriesRequest& heartbeat = request->heartbeats(i);
+        AppendEntriesResponse* heartbeat_response = response->add_heartbeats();
+        // Fill the required fields in case that the heartbeat is rejected
+        // before reaching the node
+        heartbeat_response->set_term(0);
+        heartbeat_response->set_success(false);
+        // Errors of each heartbeat are set to its own controller and
+        // returned in |error_codes|, instead of failing the whole batch
+        brpc::Controller heartbeat_cntl;
+        PeerId peer_id;
+        if (0 != peer_id.parse(heartbeat.peer_id())) {
+            heartbeat_cntl.SetFailed(EINVAL, "peer_id invalid");
+        } else if (heartbeat.entries_size() != 0) {
+            heartbeat_cntl.SetFailed(EINVAL, "not a heartbeat");
+        } else {
+            scoped_refptr<NodeImpl> node_ptr =
+                global_node_manager->get(heartbeat.group_id(), peer_id);
+            NodeImpl* node = node_ptr.get();
+            if (!node) {
+                heartbeat_cntl.SetFailed(ENOENT, "peer_id not exist");
+            } else {
+                // Heartbeats carry no entries and are handled synchronously
+                node->handle_append_entries_request(
+                    &heartbeat_cntl, &heartbeat, heartbeat_response, NULL);
+            }
+        }
+        response->add_error_codes(heartbeat_cntl.ErrorCode());
+    }
+}
+
+void RaftServiceImpl::append_entries_stream(
+    ::google::protobuf::RpcController* controller,
+    const ::braft::AppendEntriesStreamRequest* request,
+    ::braft::AppendEntriesStreamResponse* response,
+    ::google::protobuf::Closure* done) {
+    brpc::ClosureGuard done_guard(done);
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+    response->set_success(false);
+    // Lets the tests act as a peer which can't open the stream
+    TEST_SYNC_POINT_CALLBACK("RaftServiceImpl::append_entries_stream", cntl);
+    if (cntl->Failed()) {
+        return;
+    }
+
+    PeerId peer_id;
+    if (0 != peer_id.parse(request->peer_id())) {
+        cntl->SetFailed(EINVAL, "peer_id invalid");
+        return;
+    }
+
+    scoped_refptr<NodeImpl> node_ptr =
+        global_node_manager->get(request->group_id(), peer_id);
+    NodeImpl* node = node_ptr.get();
+    if (!node) {
+        cntl->SetFailed(ENOENT, "peer_id not exist");
+        return;
+    }
+
+    // The requests on the stream are checked one by one as the RPCs, the
+    // stream is not bound to the term of the leader
+    brpc::StreamId stream_id;
+    if (ReplicationStreamServer::accept(cntl, &stream_id) != 0) {
+        cntl->SetFailed(EINVAL, "Fail to accept stream");
+        return;
+    }
+    response->set_success(true);
+}
+
 }  // namespace braft
@@ -50,6 +50,19 @@ class RaftServiceImpl : public RaftService {
                      const ::braft::TimeoutNowRequest* request,
                      ::braft::TimeoutNowResponse* response,
                      ::google::protobuf::Closure* done);
+    void read_index(::google::protobuf::RpcController* controller,
+                    const ::braft::ReadIndexRequest* request,
+                    ::braft::ReadIndexResponse* response,
+                    ::google::protobuf::Closure* done);
+    void batch_heartbeat(::google::protobuf::RpcController* controller,
+                         const ::braft::BatchHeartbeatRequest* request,
+                         ::braft::BatchHeartbeatResponse* response,
+                         ::google::protobuf::Closure* done);
+    void append_entries_stream(
+        ::google::protobuf::RpcController* controller,
+        const ::braft::AppendEntriesStreamRequest* request,
+        ::braft::AppendEntriesStreamResponse* response,
+        ::google::protobuf::Closure* done);
 
    private:
     butil::EndPoint _addr;
@@ -0,0 +1,256 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "braft/replication_stream.h"
+
+#include <brpc/reloadable_flags.h>  // BRPC_VALIDATE_GFLAG
+#include <butil/raw_pack.h>         // butil::RawPacker
+#include <butil/unique_ptr.h>       // std::unique_ptr
+#include <gflags/gflags.h>
+
+#include <vector>
+
+#include "braft/node.h"          // NodeImpl
+#include "braft/node_manager.h"  // global_node_manager
+#include "braft/replicator.h"    // Replicator
+
+namespace braft {
+
+DEFINE_bool(raft_enable_stream_replication, false,
+            "Replicate the logs over a stream to each follower, all the "
+            "peers must support it");
+BRPC_VALIDATE_GFLAG(raft_enable_stream_replication, ::brpc::PassValidate);
+
+DEFINE_int32(raft_stream_max_buf_size, 8 * 1024 * 1024,
+             "Max bytes written to the replication stream of a follower but "
+             "not consumed by it yet, beyond which the leader stops pushing");
+BRPC_VALIDATE_GFLAG(raft_stream_max_buf_size, ::brpc::PositiveInteger);
+
+DEFINE_int32(raft_max_stream_append_entries_num, 64,
+             "The max number of AppendEntries requests in flight over the "
+             "replication stream of a follower");
+BRPC_VALIDATE_GFLAG(raft_max_stream_append_entries_num,
+                    ::brpc::PositiveInteger);
+
+// seq(64) | request_len(32)
+static const size_t REQUEST_HEADER_SIZE = 12;
+// seq(64) | error_code(32) | len(32)
+static const size_t ACK_HEADER_SIZE = 16;
+
+static int parse_payload(butil::IOBuf* msg, size_t len,
+                         google::protobuf::Message* message) {
+    butil::IOBuf payload;
+    if (msg->cutn(&payload, len) != len) {
+        return -1;
+    }
+    butil::IOBufAsZeroCopyInputStream wrapper(payload);
+    return message->ParseFromZeroCopyStream(&wrapper) ? 0 : -1;
+}
+
+static int decode_ack(butil::IOBuf* msg, AppendEntriesAck* ack) {
+    char header[ACK_HEADER_SIZE];
+    if (msg->cutn(header, sizeof(header)) != sizeof(header)) {
+        return -1;
+    }
+    uint32_t error_code = 0;
+    uint32_t len = 0;
+    butil::RawUnpacker(header).unpack64(ack->seq).unpack32(error_code).unpack32(
+        len);
+    ack->error_code = (int)error_code;
+    if (ack->error_code == 0) {
+        return parse_payload(msg, len, &ack->response);
+    }
+    if (msg->cutn(&ack->error_text, len) != len) {
+        return -1;
+    }
+    return 0;
+}
+
+static bool is_successful(const AppendEntriesAck& ack) {
+    return ack.error_code == 0 && ack.response.success();
+}
+
+int ReplicationStreamClient::create(ReplicatorId id, brpc::Controller* cntl,
+                                    brpc::StreamId* stream_id) {
+    ReplicationStreamClient* handler = new ReplicationStreamClient(id);
+    brpc::StreamOptions options;
+    options.handler = handler;
+    options.max_buf_size = FLAGS_raft_stream_max_buf_size;
+    if (brpc::StreamCreate(stream_id, *cntl, &options) != 0) {
+        delete handler;
+        return -1;
+    }
+    return 0;
+}
+
+int ReplicationStreamClient::write(brpc::StreamId stream_id, uint64_t seq,
+                                   const AppendEntriesRequest& request,
+                                   const butil::IOBuf& data) {
+    butil::IOBuf msg;
+    char header[REQUEST_HEADER_SIZE];
+    butil::RawPacker(header).pack64(seq).pack32(request.ByteSizeLong());
+    msg.append(header, sizeof(header));
+    {
+        butil::IOBufAsZeroCopyOutputStream wrapper(&msg);
+        if (!request.SerializeToZeroCopyStream(&wrapper)) {
+            return EINVAL;
+        }
+    }
+    // Shares the blocks of |data|
+    msg.append(data);
+    return brpc::StreamWrite(stream_id, msg);
+}
+
+int ReplicationStreamClient::on_received_messages(
+    brpc::StreamId id, butil::IOBuf* const messages[], size_t size) {
+    std::vector<AppendEntriesAck> acks(size);
+    for (size_t i = 0; i < size; ++i) {
+        if (decode_ack(messages[i], &acks[i]) != 0) {
+            LOG(ERROR) << "Fail to decode the ack on stream=" << id;
+            // The replicator falls back to RPCs in on_closed
+            brpc::StreamClose(id);
+            return 0;
+        }
+    }
+    // The follower has all the logs before the request it appends
+    // successfully, so only the last one of the successive successful acks
+    // counts
+    for (size_t i = 0; i < size; ++i) {
+        if (i + 1 < size && is_successful(acks[i]) &&
+            is_successful(acks[i + 1])) {
+            continue;
+        }
+        Replicator::_on_stream_ack(_id, id, acks[i]);
+    }
+    return 0;
+}
+
+void ReplicationStreamClient::on_idle_timeout(brpc::StreamId id) {}
+
+void ReplicationStreamClient::on_closed(brpc::StreamId id) {
+    Replicator::_on_stream_closed(_id, id);
+    delete this;
+}
+
+// Owns the request received on the follower, and acks it when it's handled
+class StreamAppendEntriesClosure : public google::protobuf::Closure {
+   public:
+    StreamAppendEntriesClosure(brpc::StreamId stream_id, uint64_t seq)
+        : _stream_id(stream_id), _seq(seq) {}
+
+    void Run();
+
+    brpc::Controller* cntl() { return &_cntl; }
+    AppendEntriesRequest* request() { return &_request; }
+    AppendEntriesResponse* response() { return &_response; }
+
+   private:
+    brpc::StreamId _stream_id;
+    uint64_t _seq;
+    brpc::Controller _cntl;
+    AppendEntriesRequest _request;
+    AppendEntriesResponse _response;
+};
+
+void StreamAppendEntriesClosure::Run() {
+    std::unique_ptr<StreamAppendEntriesClosure> self_guard(this);
+    butil::IOBuf payload;
+    if (!_cntl.Failed()) {
+        butil::IOBufAsZeroCopyOutputStream wrapper(&payload);
+        if (!_response.SerializeToZeroCopyStream(&wrapper)) {
+            _cntl.SetFailed(EINVAL, "Fail to serialize AppendEntriesResponse");
+        }
+    }
+    if (_cntl.Failed()) {
+        payload.clear();
+        payload.append(_cntl.ErrorText());
+    }
+    char header[ACK_HEADER_SIZE];
+    butil::RawPacker(header)
+        .pack64(_seq)
+        .pack32(_cntl.ErrorCode())
+        .pack32(payload.size());
+    butil::IOBuf msg;
+    msg.append(header, sizeof(header));
+    msg.append(payload);
+    // The acks are not limited by the buffer size, this fails only if the
+    // stream is closed, after which the leader doesn't expect any acks
+    const int rc = brpc::StreamWrite(_stream_id, msg);
+    BRAFT_VLOG_IF(rc != 0) << "Fail to ack seq=" << _seq
+                           << " on stream=" << _stream_id << ", " << berror(rc);
+}
+
+int ReplicationStreamServer::accept(brpc::Controller* cntl,
+                                    brpc::StreamId* stream_id) {
+    ReplicationStreamServer* handler = new ReplicationStreamServer;
+    brpc::StreamOptions options;
+    options.handler = handler;
+    // The acks are small and bounded by the requests in flight
+    options.max_buf_size = 0;
+    if (brpc::StreamAccept(stream_id, *cntl, &options) != 0) {
+        delete handler;
+        return -1;
+    }
+    return 0;
+}
+
+int ReplicationStreamServer::on_received_messages(
+    brpc::StreamId id, butil::IOBuf* const messages[], size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        butil::IOBuf* msg = messages[i];
+        char header[REQUEST_HEADER_SIZE];
+        uint64_t seq = 0;
+        uint32_t request_len = 0;
+        if (msg->cutn(header, sizeof(header)) != sizeof(header)) {
+            LOG(ERROR) << "Fail to decode the request on stream=" << id;
+            brpc::StreamClose(id);
+            return 0;
+        }
+        butil::RawUnpacker(header).unpack64(seq).unpack32(request_len);
+        StreamAppendEntriesClosure* done =
+            new StreamAppendEntriesClosure(id, seq);
+        if (parse_payload(msg, request_len, done->request()) != 0) {
+            LOG(ERROR) << "Fail to parse the request on stream=" << id;
+            delete done;
+            brpc::StreamClose(id);
+            return 0;
+        }
+        done->cntl()->request_attachment().swap(*msg);
+
+        PeerId peer_id;
+        if (0 != peer_id.parse(done->request()->peer_id())) {
+            done->cntl()->SetFailed(EINVAL, "peer_id invalid");
+            done->Run();
+            continue;
+        }
+        scoped_refptr<NodeImpl> node_ptr =
+            global_node_manager->get(done->request()->group_id(), peer_id);
+        NodeImpl* node = node_ptr.get();
+        if (!node) {
+            done->cntl()->SetFailed(ENOENT, "peer_id not exist");
+            done->Run();
+            continue;
+        }
+        // The requests on the stream are handled one by one in order
+        node->handle_append_entries_request(done->cntl(), done->request(),
+                                            done->response(), done);
+    }
+    return 0;
+}
+
+void ReplicationStreamServer::on_idle_timeout(brpc::StreamId id) {}
+
+void ReplicationStreamServer::on_closed(brpc::StreamId id) { delete this; }
+
+}  //  namespace braft
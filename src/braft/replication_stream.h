@@ -0,0 +1,104 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BRAFT_REPLICATION_STREAM_H
+#define BRAFT_REPLICATION_STREAM_H
+
+#include <brpc/controller.h>  // brpc::Controller
+#include <brpc/stream.h>      // brpc::StreamInputHandler
+#include <butil/iobuf.h>      // butil::IOBuf
+
+#include <string>
+
+#include "braft/raft.pb.h"  // AppendEntriesRequest
+
+namespace braft {
+
+typedef uint64_t ReplicatorId;
+
+// Replicate the logs of a replicator over a brpc stream to its follower, which
+// is opened by the append_entries_stream RPC if raft_enable_stream_replication
+// is on. The leader keeps pushing AppendEntriesRequests as long as the stream
+// is not full, rather than waiting for the RPCs in flight, and the follower
+// acks each request over the same stream in order.
+//
+// Heartbeats, probes and snapshots are still sent by RPCs, and the replicator
+// falls back to the RPCs once the stream fails. It opens the stream again
+// later, unless the follower doesn't serve append_entries_stream at all.
+//
+// The messages are packed in network order:
+//   leader -> follower: seq(64) | request_len(32) | request | data
+//   follower -> leader: seq(64) | error_code(32) | len(32) | response or the
+//                       error text if error_code is not 0
+
+struct AppendEntriesAck {
+    AppendEntriesAck() : seq(0), error_code(0) {}
+    uint64_t seq;
+    int error_code;
+    std::string error_text;
+    AppendEntriesResponse response;
+};
+
+// Receives the acks on the leader, Replicator::_on_stream_ack is called with
+// each of them, and Replicator::_on_stream_closed once the stream is closed.
+class ReplicationStreamClient : public brpc::StreamInputHandler {
+   public:
+    // Create the stream of the replicator |id| with |cntl|, which is opened
+    // once the RPC with |cntl| succeeds.
+    // Returns 0 on success, -1 otherwise.
+    static int create(ReplicatorId id, brpc::Controller* cntl,
+                      brpc::StreamId* stream_id);
+
+    // Write |request| tagged with |seq| and the data of its entries.
+    // Returns 0 on success, EAGAIN if the stream is full, other error code
+    // if the stream is broken.
+    static int write(brpc::StreamId stream_id, uint64_t seq,
+                     const AppendEntriesRequest& request,
+                     const butil::IOBuf& data);
+
+    int on_received_messages(brpc::StreamId id,
+                             butil::IOBuf* const messages[], size_t size);
+    void on_idle_timeout(brpc::StreamId id);
+    // Deletes this handler
+    void on_closed(brpc::StreamId id);
+
+   private:
+    explicit ReplicationStreamClient(ReplicatorId id) : _id(id) {}
+    DISALLOW_COPY_AND_ASSIGN(ReplicationStreamClient);
+
+    ReplicatorId _id;
+};
+
+// Feeds the requests received on the follower to the nodes in order, and acks
+// each one once it's handled.
+class ReplicationStreamServer : public brpc::StreamInputHandler {
+   public:
+    // Accept the stream requested by the RPC with |cntl|.
+    // Returns 0 on success, -1 otherwise.
+    static int accept(brpc::Controller* cntl, brpc::StreamId* stream_id);
+
+    int on_received_messages(brpc::StreamId id,
+                             butil::IOBuf* const messages[], size_t size);
+    void on_idle_timeout(brpc::StreamId id);
+    // Deletes this handler
+    void on_closed(brpc::StreamId id);
+
+   private:
+    ReplicationStreamServer() {}
+    DISALLOW_COPY_AND_ASSIGN(ReplicationStreamServer);
+};
+
+}  //  namespace braft
+
+#endif  // BRAFT_REPLICATION_STREAM_H
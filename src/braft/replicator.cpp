@@ -19,18 +19,22 @@
 #include "braft/replicator.h"
 
 #include <brpc/controller.h>        // brpc::Controller
+#include <brpc/errno.pb.h>          // brpc::ENOMETHOD
 #include <brpc/reloadable_flags.h>  // BRPC_VALIDATE_GFLAG
 #include <butil/time.h>             // butil::gettimeofday_us
 #include <butil/unique_ptr.h>       // std::unique_ptr
 #include <gflags/gflags.h>          // DEFINE_int32
 
 #include <algorithm>
+#include <limits>
 #include <random>
 
-#include "braft/ballot_box.h"         // BallotBox
-#include "braft/log_entry.h"          // LogEntry
-#include "braft/node.h"               // NodeImpl
-#include "braft/snapshot_throttle.h"  // SnapshotThrottle
+#include "braft/ballot_box.h"          // BallotBox
+#include "braft/log_entry.h"           // LogEntry
+#include "braft/node.h"                // NodeImpl
+#include "braft/node_manager.h"        // global_node_manager
+#include "braft/replication_stream.h"  // ReplicationStreamClient
+#include "braft/snapshot_throttle.h"   // SnapshotThrottle
 
 namespace braft {
 
@@ -47,15 +51,35 @@ DEFINE_int32(raft_max_body_size, 512 * 1024,
              "The max byte size of AppendEntriesRequest");
 BRPC_VALIDATE_GFLAG(raft_max_body_size, ::brpc::PositiveInteger);
 
+DEFINE_bool(raft_adaptive_append_entries_window, false,
+            "Size the AppendEntries requests in flight to each follower to "
+            "twice the measured bandwidth-delay product, rather than "
+            "raft_max_parallel_append_entries_rpc_num");
+BRPC_VALIDATE_GFLAG(raft_adaptive_append_entries_window, brpc::PassValidate);
+
+DEFINE_int32(raft_max_adaptive_append_entries_rpc_num, 32,
+             "The max number of parallel AppendEntries requests to each "
+             "follower if raft_adaptive_append_entries_window is on");
+BRPC_VALIDATE_GFLAG(raft_max_adaptive_append_entries_rpc_num,
+                    ::brpc::PositiveInteger);
+
 DEFINE_int32(raft_retry_replicate_interval_ms, 1000,
              "Interval of retry to append entries or install snapshot");
 BRPC_VALIDATE_GFLAG(raft_retry_replicate_interval_ms, brpc::PositiveInteger);
 
+DEFINE_bool(raft_send_data_checksum, true,
+            "Send the crc32c of the data of each entry to followers, which "
+            "persist it rather than hashing the data again");
+BRPC_VALIDATE_GFLAG(raft_send_data_checksum, brpc::PassValidate);
+
 DECLARE_bool(raft_enable_witness_to_leader);
 DECLARE_int64(raft_append_entry_high_lat_us);
 DECLARE_bool(raft_trace_append_entry_latency);
 
 DECLARE_int32(raft_rpc_channel_connect_timeout_ms);
+DECLARE_bool(raft_enable_batch_heartbeat);
+DECLARE_bool(raft_enable_stream_replication);
+DECLARE_int32(raft_max_stream_append_entries_num);
 
 static bvar::LatencyRecorder g_send_entries_latency("raft_send_entries");
 static bvar::LatencyRecorder g_normalized_send_entries_latency(
@@ -75,6 +99,13 @@ ReplicatorOptions::ReplicatorOptions()
 Replicator::Replicator()
     : _next_index(0),
       _flying_append_entries_size(0),
+      _flying_append_entries_bytes(0),
+      _srtt_us(0),
+      _delivery_rate(0),
+      _rate_sample_start_us(0),
+      _rate_sample_bytes(0),
+      _window_bytes((int64_t)FLAGS_raft_max_body_size *
+                    FLAGS_raft_max_parallel_append_entries_rpc_num),
       _consecutive_error_times(0),
       _has_succeeded(false),
       _timeout_now_index(0),
@@ -84,6 +115,12 @@ Replicator::Replicator()
       _readonly_index(0),
       _wait_id(0),
       _is_waiter_canceled(false),
+      _stream_id(brpc::INVALID_STREAM_ID),
+      _stream_seq(0),
+      _stream_retry_time_ms(0),
+      _stream_opening(false),
+      _stream_waiting(false),
+      _stream_unsupported(false),
       _reader(NULL),
       _catchup_closure(NULL) {
     _install_snapshot_in_fly.value = 0;
@@ -277,14 +314,20 @@ void Replicator::_block(long start_time_us, int error_code) {
 void Replicator::_on_heartbeat_returned(ReplicatorId id, brpc::Controller* cntl,
                                         AppendEntriesRequest* request,
                                         AppendEntriesResponse* response,
-                                        int64_t rpc_send_time) {
+                                        int64_t rpc_send_time, Closure* done) {
     std::unique_ptr<brpc::Controller> cntl_guard(cntl);
     std::unique_ptr<AppendEntriesRequest> req_guard(request);
     std::unique_ptr<AppendEntriesResponse> res_guard(response);
+    // |done| is run after |dummy_id| is unlocked, as it may call into the
+    // node which invokes the Replicator with its lock held.
+    brpc::ClosureGuard done_guard(done);
     Replicator* r = NULL;
     bthread_id_t dummy_id = {id};
     const long start_time_us = butil::gettimeofday_us();
     if (bthread_id_lock(dummy_id, (void**)&r) != 0) {
+        if (done) {
+            done->status().set_error(EINVAL, "Replicator is stopped");
+        }
         return;
     }
 
@@ -304,7 +347,13 @@ void Replicator::_on_heartbeat_returned(ReplicatorId id, brpc::Controller* cntl,
             << r->_options.peer_id
             << " _consecutive_error_times=" << r->_consecutive_error_times
             << ", " << cntl->ErrorText();
-        r->_start_heartbeat_timer(start_time_us);
+        if (done) {
+            // The heartbeat timer is not bound to this RPC
+            done->status().set_error(cntl->ErrorCode(), "%s",
+                                     cntl->ErrorText().c_str());
+        } else {
+            r->_start_heartbeat_timer(start_time_us);
+        }
         CHECK_EQ(0, bthread_id_unlock(dummy_id))
             << "Fail to unlock " << dummy_id;
         return;
@@ -314,6 +363,11 @@ void Replicator::_on_heartbeat_returned(ReplicatorId id, brpc::Controller* cntl,
         ss << " fail, greater term " << response->term() << " expect term "
            << r->_options.term;
         BRAFT_VLOG << ss.str();
+        if (done) {
+            done->status().set_error(EHIGHERTERMRESPONSE,
+                                     "Peer %s responds with higher term",
+                                     r->_options.peer_id.to_string().c_str());
+        }
 
         NodeImpl* node_impl = r->_options.node;
         // Acquire a reference of Node here in case that Node is detroyed
@@ -336,7 +390,9 @@ void Replicator::_on_heartbeat_returned(ReplicatorId id, brpc::Controller* cntl,
     bool readonly = response->has_readonly() && response->readonly();
     BRAFT_VLOG << ss.str() << " readonly " << readonly;
     r->_update_last_rpc_send_timestamp(rpc_send_time);
-    r->_start_heartbeat_timer(start_time_us);
+    if (!done) {
+        r->_start_heartbeat_timer(start_time_us);
+    }
     NodeImpl* node_impl = NULL;
     // Check if readonly config changed
     if ((readonly && r->_readonly_index == 0) ||
@@ -371,17 +427,8 @@ void Replicator::_on_rpc_returned(ReplicatorId id, brpc::Controller* cntl,
         return;
     }
 
-    std::stringstream ss;
-    ss << "node " << r->_options.group_id << ":" << r->_options.server_id
-       << " received AppendEntriesResponse from " << r->_options.peer_id
-       << " prev_log_index " << request->prev_log_index() << " prev_log_term "
-       << request->prev_log_term() << " count " << request->entries_size();
-
     bool valid_rpc = false;
     int64_t rpc_first_index = request->prev_log_index() + 1;
-    int64_t min_flying_index = r->_min_flying_index();
-    CHECK_GT(min_flying_index, 0);
-
     for (std::deque<FlyingAppendEntriesRpc>::iterator rpc_it =
              r->_append_entries_in_fly.begin();
          rpc_it != r->_append_entries_in_fly.end(); ++rpc_it) {
@@ -393,147 +440,224 @@ void Replicator::_on_rpc_returned(ReplicatorId id, brpc::Controller* cntl,
         }
     }
     if (!valid_rpc) {
-        ss << " ignore invalid rpc";
-        BRAFT_VLOG << ss.str();
+        BRAFT_VLOG << "node " << r->_options.group_id << ":"
+                   << r->_options.server_id
+                   << " received AppendEntriesResponse from "
+                   << r->_options.peer_id << " prev_log_index "
+                   << request->prev_log_index() << " prev_log_term "
+                   << request->prev_log_term() << " count "
+                   << request->entries_size() << " ignore invalid rpc";
         CHECK_EQ(0, bthread_id_unlock(r->_id)) << "Fail to unlock " << r->_id;
         return;
     }
 
-    if (cntl->Failed()) {
+    AppendEntriesResult result;
+    result.prev_log_index = request->prev_log_index();
+    result.entries_size = request->entries_size();
+    result.data_size = cntl->request_attachment().size();
+    result.error_code = cntl->ErrorCode();
+    result.error_text = cntl->ErrorText();
+    result.latency_us = cntl->latency_us();
+    result.send_time_ms = rpc_send_time;
+    // dummy_id is unlock in _on_append_entries_returned
+    return r->_on_append_entries_returned(result, *response, start_time_us);
+}
+
+void Replicator::_on_stream_ack(ReplicatorId id, brpc::StreamId stream_id,
+                                const AppendEntriesAck& ack) {
+    Replicator* r = NULL;
+    bthread_id_t dummy_id = {id};
+    const long start_time_us = butil::gettimeofday_us();
+    if (bthread_id_lock(dummy_id, (void**)&r) != 0) {
+        return;
+    }
+
+    // The requests before the acked one are acked along with it
+    int64_t acked_bytes = 0;
+    std::deque<FlyingAppendEntriesRpc>::iterator rpc_it =
+        r->_append_entries_in_fly.begin();
+    for (; rpc_it != r->_append_entries_in_fly.end(); ++rpc_it) {
+        acked_bytes += rpc_it->bytes;
+        if (rpc_it->stream_seq != 0 && rpc_it->stream_seq == ack.seq) {
+            break;
+        }
+    }
+    if (rpc_it == r->_append_entries_in_fly.end()) {
+        BRAFT_VLOG << "node " << r->_options.group_id << ":"
+                   << r->_options.server_id << " received ack seq " << ack.seq
+                   << " on stream " << stream_id << " from "
+                   << r->_options.peer_id << " ignore invalid ack";
+        CHECK_EQ(0, bthread_id_unlock(r->_id)) << "Fail to unlock " << r->_id;
+        return;
+    }
+
+    AppendEntriesResult result;
+    result.prev_log_index = rpc_it->log_index - 1;
+    result.entries_size = rpc_it->entries_size;
+    result.data_size = acked_bytes;
+    result.error_code = ack.error_code;
+    result.error_text = ack.error_text;
+    result.latency_us = butil::monotonic_time_us() - rpc_it->send_time_us;
+    result.send_time_ms = rpc_it->send_time_us / 1000;
+    // dummy_id is unlock in _on_append_entries_returned
+    return r->_on_append_entries_returned(result, ack.response, start_time_us);
+}
+
+void Replicator::_on_append_entries_returned(
+    const AppendEntriesResult& result, const AppendEntriesResponse& response,
+    long start_time_us) {
+    std::stringstream ss;
+    ss << "node " << _options.group_id << ":" << _options.server_id
+       << " received AppendEntriesResponse from " << _options.peer_id
+       << " prev_log_index " << result.prev_log_index << " count "
+       << result.entries_size;
+
+    int64_t rpc_first_index = result.prev_log_index + 1;
+    int64_t min_flying_index = _min_flying_index();
+    CHECK_GT(min_flying_index, 0);
+
+    if (result.error_code != 0) {
         ss << " fail, sleep.";
         BRAFT_VLOG << ss.str();
 
         // TODO: Should it be VLOG?
-        LOG_IF(WARNING, (r->_consecutive_error_times++) % 10 == 0)
-            << "Group " << r->_options.group_id << " fail to issue RPC to "
-            << r->_options.peer_id
-            << " _consecutive_error_times=" << r->_consecutive_error_times
-            << ", " << cntl->ErrorText();
+        LOG_IF(WARNING, (_consecutive_error_times++) % 10 == 0)
+            << "Group " << _options.group_id << " fail to issue RPC to "
+            << _options.peer_id
+            << " _consecutive_error_times=" << _consecutive_error_times
+            << ", " << result.error_text;
         // If the follower crashes, any RPC to the follower fails immediately,
         // so we need to block the follower for a while instead of looping until
         // it comes back or be removed
-        // dummy_id is unlock in block
-        r->_reset_next_index();
-        return r->_block(start_time_us, cntl->ErrorCode());
-    }
-    r->_consecutive_error_times = 0;
-    if (!response->success()) {
-        if (response->term() > r->_options.term) {
-            BRAFT_VLOG << " fail, greater term " << response->term()
-                       << " expect term " << r->_options.term;
-            r->_reset_next_index();
+        // _id is unlock in block
+        _reset_next_index();
+        _shrink_window();
+        return _block(start_time_us, result.error_code);
+    }
+    _consecutive_error_times = 0;
+    if (!response.success()) {
+        if (response.term() > _options.term) {
+            BRAFT_VLOG << " fail, greater term " << response.term()
+                       << " expect term " << _options.term;
+            _reset_next_index();
 
-            NodeImpl* node_impl = r->_options.node;
+            NodeImpl* node_impl = _options.node;
             // Acquire a reference of Node here in case that Node is destroyed
             // after _notify_on_caught_up.
             node_impl->AddRef();
-            r->_notify_on_caught_up(EPERM, true);
+            _notify_on_caught_up(EPERM, true);
             butil::Status status;
             status.set_error(EHIGHERTERMRESPONSE,
                              "Leader receives higher term "
                              "%s from peer:%s",
-                             response->GetTypeName().c_str(),
-                             r->_options.peer_id.to_string().c_str());
-            r->_destroy();
-            node_impl->increase_term_to(response->term(), status);
+                             response.GetTypeName().c_str(),
+                             _options.peer_id.to_string().c_str());
+            _destroy();
+            node_impl->increase_term_to(response.term(), status);
             node_impl->Release();
             return;
         }
         ss << " fail, find next_index remote last_log_index "
-           << response->last_log_index() << " local next_index "
-           << r->_next_index << " rpc prev_log_index "
-           << request->prev_log_index();
+           << response.last_log_index() << " local next_index " << _next_index
+           << " rpc prev_log_index " << result.prev_log_index;
         BRAFT_VLOG << ss.str();
-        r->_update_last_rpc_send_timestamp(rpc_send_time);
+        _update_last_rpc_send_timestamp(result.send_time_ms);
         // prev_log_index and prev_log_term doesn't match
-        r->_reset_next_index();
-        if (response->last_log_index() + 1 < r->_next_index) {
-            BRAFT_VLOG << "Group " << r->_options.group_id
-                       << " last_log_index at peer=" << r->_options.peer_id
-                       << " is " << response->last_log_index();
+        _reset_next_index();
+        if (response.last_log_index() + 1 < _next_index) {
+            BRAFT_VLOG << "Group " << _options.group_id
+                       << " last_log_index at peer=" << _options.peer_id
+                       << " is " << response.last_log_index();
             // The peer contains less logs than leader
-            r->_next_index = response->last_log_index() + 1;
+            _next_index = response.last_log_index() + 1;
         } else {
             // The peer contains logs from old term which should be truncated,
-            // decrease _last_log_at_peer by one to test the right index to keep
-            if (BAIDU_LIKELY(r->_next_index > 1)) {
-                BRAFT_VLOG << "Group " << r->_options.group_id
-                           << " log_index=" << r->_next_index << " mismatch";
+            // decrease _last_log_at_peer by one, or by the whole conflicting
+            // term the peer tells, to test the right index to keep
+            if (BAIDU_LIKELY(_next_index > 1)) {
+                BRAFT_VLOG << "Group " << _options.group_id
+                           << " log_index=" << _next_index << " mismatch";
                 // Decrease the |_next_index| when the request with the minimum
                 // log index mismatch. Because when we enable pipeline
                 // replication and disable cache, the request with larger log
                 // index would be handled before the smaller request, we should
                 // ignore it. See https://github.com/baidu/braft/issues/421
-                if (request->prev_log_index() == r->_next_index - 1) {
-                    --r->_next_index;
+                if (result.prev_log_index == _next_index - 1) {
+                    if (response.has_conflict_term()) {
+                        _next_index = _next_index_on_conflict(
+                            result.prev_log_index, response.conflict_term(),
+                            response.conflict_index());
+                    } else {
+                        --_next_index;
+                    }
                 }
             } else {
-                LOG(ERROR) << "Group " << r->_options.group_id
-                           << " peer=" << r->_options.peer_id
+                LOG(ERROR) << "Group " << _options.group_id
+                           << " peer=" << _options.peer_id
                            << " declares that log at index=0 doesn't match,"
                               " which is not supposed to happen";
             }
         }
-        // dummy_id is unlock in _send_heartbeat
-        r->_send_empty_entries(false);
+        // _id is unlock in _send_heartbeat
+        _send_empty_entries(false);
         return;
     }
 
     ss << " success";
     BRAFT_VLOG << ss.str();
 
-    if (response->term() != r->_options.term) {
-        LOG(ERROR) << "Group " << r->_options.group_id
-                   << " fail, response term " << response->term()
-                   << " mismatch, expect term " << r->_options.term;
-        r->_reset_next_index();
-        CHECK_EQ(0, bthread_id_unlock(r->_id)) << "Fail to unlock " << r->_id;
+    if (response.term() != _options.term) {
+        LOG(ERROR) << "Group " << _options.group_id << " fail, response term "
+                   << response.term() << " mismatch, expect term "
+                   << _options.term;
+        _reset_next_index();
+        CHECK_EQ(0, bthread_id_unlock(_id)) << "Fail to unlock " << _id;
         return;
     }
-    r->_update_last_rpc_send_timestamp(rpc_send_time);
-    const int entries_size = request->entries_size();
-    const int64_t rpc_last_log_index = request->prev_log_index() + entries_size;
+    _update_last_rpc_send_timestamp(result.send_time_ms);
+    const int entries_size = result.entries_size;
+    const int64_t rpc_last_log_index = result.prev_log_index + entries_size;
     BRAFT_VLOG_IF(entries_size > 0)
-        << "Group " << r->_options.group_id << " replicated logs in ["
+        << "Group " << _options.group_id << " replicated logs in ["
         << min_flying_index << ", " << rpc_last_log_index << "] to peer "
-        << r->_options.peer_id;
+        << _options.peer_id;
     if (entries_size > 0) {
-        r->_options.ballot_box->commit_at(min_flying_index, rpc_last_log_index,
-                                          r->_options.peer_id);
-        int64_t rpc_latency_us = cntl->latency_us();
+        _options.ballot_box->commit_at(min_flying_index, rpc_last_log_index,
+                                       _options.peer_id);
+        const int64_t rpc_latency_us = result.latency_us;
         if (FLAGS_raft_trace_append_entry_latency &&
             rpc_latency_us > FLAGS_raft_append_entry_high_lat_us) {
             LOG(WARNING) << "append entry rpc latency us " << rpc_latency_us
                          << " greater than "
                          << FLAGS_raft_append_entry_high_lat_us << " Group "
-                         << r->_options.group_id << " to peer  "
-                         << r->_options.peer_id << " request entry size "
+                         << _options.group_id << " to peer  "
+                         << _options.peer_id << " request entry size "
                          << entries_size << " request data size "
-                         << cntl->request_attachment().size();
+                         << result.data_size;
         }
-        g_send_entries_latency << cntl->latency_us();
-        if (cntl->request_attachment().size() > 0) {
+        g_send_entries_latency << rpc_latency_us;
+        _on_append_entries_acked(result.data_size, rpc_latency_us);
+        if (result.data_size > 0) {
             g_normalized_send_entries_latency
-                << cntl->latency_us() * 1024 /
-                       cntl->request_attachment().size();
+                << rpc_latency_us * 1024 / result.data_size;
         }
     }
     // A rpc is marked as success, means all request before it are success,
     // erase them sequentially.
-    while (!r->_append_entries_in_fly.empty() &&
-           r->_append_entries_in_fly.front().log_index <= rpc_first_index) {
-        r->_flying_append_entries_size -=
-            r->_append_entries_in_fly.front().entries_size;
-        r->_append_entries_in_fly.pop_front();
-    }
-    r->_has_succeeded = true;
-    r->_notify_on_caught_up(0, false);
-    // dummy_id is unlock in _send_entries
-    if (r->_timeout_now_index > 0 &&
-        r->_timeout_now_index < r->_min_flying_index()) {
-        r->_send_timeout_now(false, false);
-    }
-    r->_send_entries();
+    while (!_append_entries_in_fly.empty() &&
+           _append_entries_in_fly.front().log_index <= rpc_first_index) {
+        _flying_append_entries_size -=
+            _append_entries_in_fly.front().entries_size;
+        _flying_append_entries_bytes -= _append_entries_in_fly.front().bytes;
+        _append_entries_in_fly.pop_front();
+    }
+    _has_succeeded = true;
+    _notify_on_caught_up(0, false);
+    // _id is unlock in _send_entries
+    if (_timeout_now_index > 0 && _timeout_now_index < _min_flying_index()) {
+        _send_timeout_now(false, false);
+    }
+    _send_entries();
     return;
 }
 
@@ -566,7 +690,8 @@ int Replicator::_fill_common_fields(AppendEntriesRequest* request,
     return 0;
 }
 
-void Replicator::_send_empty_entries(bool is_heartbeat) {
+void Replicator::_send_empty_entries(bool is_heartbeat,
+                                     Closure* heartbeat_done) {
     std::unique_ptr<brpc::Controller> cntl(new brpc::Controller);
     std::unique_ptr<AppendEntriesRequest> request(new AppendEntriesRequest);
     std::unique_ptr<AppendEntriesResponse> response(new AppendEntriesResponse);
@@ -577,7 +702,11 @@ void Replicator::_send_empty_entries(bool is_heartbeat) {
         return _install_snapshot();
     }
     if (is_heartbeat) {
-        _heartbeat_in_fly = cntl->call_id();
+        // Heartbeats with |heartbeat_done| are not issued by the heartbeat
+        // timer, leave _heartbeat_in_fly to the periodic one.
+        if (heartbeat_done == NULL && !FLAGS_raft_enable_batch_heartbeat) {
+            _heartbeat_in_fly = cntl->call_id();
+        }
         _heartbeat_counter++;
         // set RPC timeout for heartbeat, how long should timeout be is waiting
         // to be optimized.
@@ -588,8 +717,8 @@ void Replicator::_send_empty_entries(bool is_heartbeat) {
         _st.last_log_index = _next_index - 1;
         CHECK(_append_entries_in_fly.empty());
         CHECK_EQ(_flying_append_entries_size, 0);
-        _append_entries_in_fly.push_back(
-            FlyingAppendEntriesRpc(_next_index, 0, cntl->call_id()));
+        _append_entries_in_fly.push_back(FlyingAppendEntriesRpc(
+            _next_index, 0, 0, cntl->call_id(), 0, butil::monotonic_time_us()));
         _append_entries_counter++;
     }
 
@@ -599,9 +728,29 @@ void Replicator::_send_empty_entries(bool is_heartbeat) {
                << request->prev_log_index() << " last_committed_index "
                << request->committed_index();
 
-    google::protobuf::Closure* done = brpc::NewCallback(
-        is_heartbeat ? _on_heartbeat_returned : _on_rpc_returned, _id.value,
-        cntl.get(), request.get(), response.get(), butil::monotonic_time_ms());
+    if (is_heartbeat && heartbeat_done == NULL &&
+        FLAGS_raft_enable_batch_heartbeat) {
+        const butil::EndPoint local = _options.server_id.addr;
+        const butil::EndPoint remote = _options.peer_id.addr;
+        const int timeout_ms = *_options.election_timeout_ms / 2;
+        const ReplicatorId id = _id.value;
+        CHECK_EQ(0, bthread_id_unlock(_id)) << "Fail to unlock " << _id;
+        // The batcher may call _on_heartbeat_returned in place, which requires
+        // _id to be unlocked
+        return global_node_manager->heartbeat_batcher()->send_heartbeat(
+            local, remote, id, request.release(), timeout_ms);
+    }
+
+    google::protobuf::Closure* done = NULL;
+    if (is_heartbeat) {
+        done = brpc::NewCallback(_on_heartbeat_returned, _id.value, cntl.get(),
+                                 request.get(), response.get(),
+                                 butil::monotonic_time_ms(), heartbeat_done);
+    } else {
+        done = brpc::NewCallback(_on_rpc_returned, _id.value, cntl.get(),
+                                 request.get(), response.get(),
+                                 butil::monotonic_time_ms());
+    }
 
     RaftService_Stub stub(&_sending_channel);
     stub.append_entries(cntl.release(), request.release(), response.release(),
@@ -609,22 +758,18 @@ void Replicator::_send_empty_entries(bool is_heartbeat) {
     CHECK_EQ(0, bthread_id_unlock(_id)) << "Fail to unlock " << _id;
 }
 
-int Replicator::_prepare_entry(int offset, EntryMeta* em, butil::IOBuf* data) {
+int Replicator::_prepare_entry(int offset, const LogEntry* entry,
+                               EntryMeta* em, butil::IOBuf* data) {
     if (data->length() >= (size_t)FLAGS_raft_max_body_size) {
         return ERANGE;
     }
     const int64_t log_index = _next_index + offset;
-    LogEntry* entry = _options.log_manager->get_entry(log_index);
-    if (entry == NULL) {
-        return ENOENT;
-    }
     // When leader become readonly, no new user logs can submit. On the other
     // side, if any user log are accepted after this replicator become readonly,
     // the leader still have enough followers to commit logs, we can safely stop
     // waiting new logs until the replicator leave readonly mode.
     if (_readonly_index != 0 && log_index >= _readonly_index) {
         if (entry->type != ENTRY_TYPE_CONFIGURATION) {
-            entry->Release();
             return EREADONLY;
         }
         _readonly_index = log_index + 1;
@@ -647,17 +792,44 @@ int Replicator::_prepare_entry(int offset, EntryMeta* em, butil::IOBuf* data) {
     }
     if (!is_witness() || FLAGS_raft_enable_witness_to_leader) {
         em->set_data_len(entry->data.length());
+        if (FLAGS_raft_send_data_checksum && entry->type == ENTRY_TYPE_DATA) {
+            em->set_data_checksum(entry->data_crc32c());
+        }
         data->append(entry->data);
     }
-    entry->Release();
     return 0;
 }
 
+void Replicator::_append_shared_entries(
+    const std::vector<scoped_refptr<ReplicationBatch> >& batches,
+    int max_entries_size, size_t max_body_size, AppendEntriesRequest* request,
+    butil::IOBuf* data) {
+    int64_t index = _next_index;
+    for (size_t i = 0; i < batches.size(); ++i) {
+        const ReplicationBatch& batch = *batches[i];
+        const size_t begin = index - batch.first_index;
+        const size_t data_begin = batch.data_offsets[begin];
+        const size_t data_length = data->length();
+        size_t end = begin;
+        // Stops once the data reaches |max_body_size| as _prepare_entry
+        while (end < batch.metas.size() &&
+               request->entries_size() < max_entries_size &&
+               data_length + batch.data_offsets[end] - data_begin <
+                   max_body_size) {
+            request->add_entries()->CopyFrom(batch.metas[end]);
+            ++end;
+        }
+        batch.data.append_to(data, batch.data_offsets[end] - data_begin,
+                             data_begin);
+        index += end - begin;
+        if (end < batch.metas.size()) {
+            break;
+        }
+    }
+}
+
 void Replicator::_send_entries() {
-    if (_flying_append_entries_size >= FLAGS_raft_max_entries_size ||
-        _append_entries_in_fly.size() >=
-            (size_t)FLAGS_raft_max_parallel_append_entries_rpc_num ||
-        _st.st == BLOCKING) {
+    if (_is_pipeline_full() || _st.st == BLOCKING) {
         BRAFT_VLOG
             << "node " << _options.group_id << ":" << _options.server_id
             << " skip sending AppendEntriesRequest to " << _options.peer_id
@@ -667,26 +839,61 @@ void Replicator::_send_entries() {
         CHECK_EQ(0, bthread_id_unlock(_id)) << "Fail to unlock " << _id;
         return;
     }
+    // Opened in the background, the requests are sent by RPCs until then
+    _open_stream();
 
-    std::unique_ptr<brpc::Controller> cntl(new brpc::Controller);
     std::unique_ptr<AppendEntriesRequest> request(new AppendEntriesRequest);
-    std::unique_ptr<AppendEntriesResponse> response(new AppendEntriesResponse);
+    butil::IOBuf data;
     if (_fill_common_fields(request.get(), _next_index - 1, false) != 0) {
         _reset_next_index();
         return _install_snapshot();
     }
     EntryMeta em;
-    const int max_entries_size =
-        FLAGS_raft_max_entries_size - _flying_append_entries_size;
+    const int max_entries_size = std::min<int64_t>(
+        FLAGS_raft_max_entries_size,
+        _max_flying_entries_size() - _flying_append_entries_size);
     int prepare_entry_rc = 0;
     CHECK_GT(max_entries_size, 0);
-    for (int i = 0; i < max_entries_size; ++i) {
-        prepare_entry_rc = _prepare_entry(i, &em, &cntl->request_attachment());
+    // The data of the entries is not sent to witness, which is not bounded
+    // by raft_max_body_size then
+    size_t max_body_size =
+        (!is_witness() || FLAGS_raft_enable_witness_to_leader)
+            ? (size_t)FLAGS_raft_max_body_size
+            : std::numeric_limits<size_t>::max();
+    if (FLAGS_raft_adaptive_append_entries_window &&
+        max_body_size != std::numeric_limits<size_t>::max()) {
+        // What's left of the window
+        max_body_size = std::min<size_t>(
+            max_body_size, _window_bytes - _flying_append_entries_bytes);
+    }
+    // The logs in the steady state are encoded by the leader once for all
+    // the replicators, unless the data is not sent or each log has to be
+    // checked for the readonly mode
+    std::vector<scoped_refptr<ReplicationBatch> > batches;
+    if (_readonly_index == 0 &&
+        max_body_size != std::numeric_limits<size_t>::max()) {
+        _options.log_manager->get_replication_batches(
+            _next_index, max_entries_size, &batches);
+    }
+    std::vector<LogEntry*> entries;
+    if (!batches.empty()) {
+        _append_shared_entries(batches, max_entries_size, max_body_size,
+                               request.get(), &data);
+    } else {
+        _options.log_manager->get_entries(_next_index,
+                                          _next_index + max_entries_size - 1,
+                                          max_body_size, &entries);
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+        prepare_entry_rc = _prepare_entry(i, entries[i], &em, &data);
         if (prepare_entry_rc != 0) {
             break;
         }
         request->add_entries()->Swap(&em);
     }
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i]->Release();
+    }
     if (request->entries_size() == 0) {
         // _id is unlock in _wait_more
         if (_next_index < _options.log_manager->first_log_index()) {
@@ -706,11 +913,44 @@ void Replicator::_send_entries() {
         return _wait_more_entries();
     }
 
+    const int64_t data_size = data.size();
+    uint64_t stream_seq = 0;
+    if (_is_streaming()) {
+        const int rc = ReplicationStreamClient::write(
+            _stream_id, _stream_seq + 1, *request, data);
+        if (rc == EAGAIN) {
+            // _id is unlock in _wait_stream_writable
+            return _wait_stream_writable();
+        }
+        if (rc != 0) {
+            LOG(WARNING) << "Group " << _options.group_id
+                         << " fail to write replication stream to "
+                         << _options.peer_id << ", " << berror(rc)
+                         << ", fall back to RPCs";
+            _close_stream();
+            // The requests in flight over the stream are never acked, start
+            // over from the next index the follower tells
+            _reset_next_index();
+            _shrink_window();
+            // _id is unlock in _send_empty_entries
+            return _send_empty_entries(false);
+        }
+        stream_seq = ++_stream_seq;
+    }
+    std::unique_ptr<brpc::Controller> cntl;
+    brpc::CallId call_id = INVALID_BTHREAD_ID;
+    if (stream_seq == 0) {
+        cntl.reset(new brpc::Controller);
+        cntl->request_attachment().swap(data);
+        call_id = cntl->call_id();
+    }
     _append_entries_in_fly.push_back(FlyingAppendEntriesRpc(
-        _next_index, request->entries_size(), cntl->call_id()));
+        _next_index, request->entries_size(), data_size, call_id, stream_seq,
+        butil::monotonic_time_us()));
     _append_entries_counter++;
     _next_index += request->entries_size();
     _flying_append_entries_size += request->entries_size();
+    _flying_append_entries_bytes += data_size;
 
     g_send_entries_batch_counter << request->entries_size();
 
@@ -724,12 +964,16 @@ void Replicator::_send_entries() {
     _st.st = APPENDING_ENTRIES;
     _st.first_log_index = _min_flying_index();
     _st.last_log_index = _next_index - 1;
-    google::protobuf::Closure* done = brpc::NewCallback(
-        _on_rpc_returned, _id.value, cntl.get(), request.get(), response.get(),
-        butil::monotonic_time_ms());
-    RaftService_Stub stub(&_sending_channel);
-    stub.append_entries(cntl.release(), request.release(), response.release(),
-                        done);
+    if (stream_seq == 0) {
+        std::unique_ptr<AppendEntriesResponse> response(
+            new AppendEntriesResponse);
+        google::protobuf::Closure* done = brpc::NewCallback(
+            _on_rpc_returned, _id.value, cntl.get(), request.get(),
+            response.get(), butil::monotonic_time_ms());
+        RaftService_Stub stub(&_sending_channel);
+        stub.append_entries(cntl.release(), request.release(),
+                            response.release(), done);
+    }
     _wait_more_entries();
 }
 
@@ -776,10 +1020,7 @@ int Replicator::_continue_sending(void* arg, int error_code) {
 }
 
 void Replicator::_wait_more_entries() {
-    if (_wait_id == 0 &&
-        FLAGS_raft_max_entries_size > _flying_append_entries_size &&
-        (size_t)FLAGS_raft_max_parallel_append_entries_rpc_num >
-            _append_entries_in_fly.size()) {
+    if (_wait_id == 0 && !_is_pipeline_full()) {
         _wait_id = _options.log_manager->wait(
             _next_index - 1, _continue_sending, (void*)_id.value);
         _is_waiter_canceled = false;
@@ -792,6 +1033,166 @@ void Replicator::_wait_more_entries() {
     CHECK_EQ(0, bthread_id_unlock(_id)) << "Fail to unlock " << _id;
 }
 
+void Replicator::_open_stream() {
+    if (!FLAGS_raft_enable_stream_replication || _is_streaming() ||
+        _stream_opening || _stream_unsupported ||
+        butil::monotonic_time_ms() < _stream_retry_time_ms) {
+        return;
+    }
+    std::unique_ptr<brpc::Controller> cntl(new brpc::Controller);
+    brpc::StreamId stream_id = brpc::INVALID_STREAM_ID;
+    if (ReplicationStreamClient::create(_id.value, cntl.get(), &stream_id) !=
+        0) {
+        LOG_EVERY_SECOND(WARNING) << "Group " << _options.group_id
+                                  << " fail to create replication stream to "
+                                  << _options.peer_id;
+        _stream_retry_time_ms =
+            butil::monotonic_time_ms() + FLAGS_raft_retry_replicate_interval_ms;
+        return;
+    }
+    std::unique_ptr<AppendEntriesStreamRequest> request(
+        new AppendEntriesStreamRequest);
+    std::unique_ptr<AppendEntriesStreamResponse> response(
+        new AppendEntriesStreamResponse);
+    request->set_group_id(_options.group_id);
+    request->set_server_id(_options.server_id.to_string());
+    request->set_peer_id(_options.peer_id.to_string());
+    request->set_term(_options.term);
+    _stream_opening = true;
+    google::protobuf::Closure* done = brpc::NewCallback(
+        _on_stream_opened, _id.value, cntl.get(), request.get(),
+        response.get(), stream_id);
+    RaftService_Stub stub(&_sending_channel);
+    stub.append_entries_stream(cntl.release(), request.release(),
+                               response.release(), done);
+}
+
+void Replicator::_on_stream_opened(ReplicatorId id, brpc::Controller* cntl,
+                                   AppendEntriesStreamRequest* request,
+                                   AppendEntriesStreamResponse* response,
+                                   brpc::StreamId stream_id) {
+    std::unique_ptr<brpc::Controller> cntl_guard(cntl);
+    std::unique_ptr<AppendEntriesStreamRequest> req_guard(request);
+    std::unique_ptr<AppendEntriesStreamResponse> res_guard(response);
+    Replicator* r = NULL;
+    bthread_id_t dummy_id = {id};
+    if (bthread_id_lock(dummy_id, (void**)&r) != 0) {
+        brpc::StreamClose(stream_id);
+        return;
+    }
+    r->_stream_opening = false;
+    if (cntl->Failed() &&
+        (cntl->ErrorCode() == brpc::ENOMETHOD ||
+         cntl->ErrorCode() == brpc::ENOSERVICE)) {
+        // The peer runs a version without append_entries_stream, which won't
+        // change until it restarts and the replicator is created again
+        LOG(WARNING) << "Group " << r->_options.group_id << " peer "
+                     << r->_options.peer_id
+                     << " doesn't support replication stream, "
+                     << cntl->ErrorText() << ", replicate by RPCs";
+        r->_stream_unsupported = true;
+        brpc::StreamClose(stream_id);
+        CHECK_EQ(0, bthread_id_unlock(dummy_id))
+            << "Fail to unlock " << dummy_id;
+        return;
+    }
+    if (cntl->Failed() || !response->success()) {
+        // Retried every raft_retry_replicate_interval_ms as long as the peer
+        // is unreachable, which is logged by the RPCs as well
+        LOG_EVERY_SECOND(WARNING)
+            << "Group " << r->_options.group_id
+            << " fail to open replication stream to " << r->_options.peer_id
+            << ", " << cntl->ErrorText() << ", fall back to RPCs";
+        // Might be closed by brpc already if the RPC fails
+        brpc::StreamClose(stream_id);
+        r->_stream_retry_time_ms =
+            butil::monotonic_time_ms() + FLAGS_raft_retry_replicate_interval_ms;
+        CHECK_EQ(0, bthread_id_unlock(dummy_id))
+            << "Fail to unlock " << dummy_id;
+        return;
+    }
+    BRAFT_VLOG << "Group " << r->_options.group_id
+               << " opened replication stream=" << stream_id << " to "
+               << r->_options.peer_id;
+    // Taken by the next _send_entries
+    r->_stream_id = stream_id;
+    CHECK_EQ(0, bthread_id_unlock(dummy_id)) << "Fail to unlock " << dummy_id;
+}
+
+void Replicator::_close_stream() {
+    if (!_is_streaming()) {
+        return;
+    }
+    brpc::StreamClose(_stream_id);
+    _stream_id = brpc::INVALID_STREAM_ID;
+    _stream_waiting = false;
+    _stream_retry_time_ms =
+        butil::monotonic_time_ms() + FLAGS_raft_retry_replicate_interval_ms;
+}
+
+void Replicator::_on_stream_closed(ReplicatorId id, brpc::StreamId stream_id) {
+    Replicator* r = NULL;
+    bthread_id_t dummy_id = {id};
+    if (bthread_id_lock(dummy_id, (void**)&r) != 0) {
+        return;
+    }
+    if (r->_stream_id != stream_id) {
+        CHECK_EQ(0, bthread_id_unlock(dummy_id))
+            << "Fail to unlock " << dummy_id;
+        return;
+    }
+    LOG(WARNING) << "Group " << r->_options.group_id
+                 << " replication stream to " << r->_options.peer_id
+                 << " is closed, fall back to RPCs";
+    r->_close_stream();
+    if (r->_st.st == BLOCKING || r->_st.st == INSTALLING_SNAPSHOT) {
+        // Replication starts over with RPCs after that
+        CHECK_EQ(0, bthread_id_unlock(dummy_id))
+            << "Fail to unlock " << dummy_id;
+        return;
+    }
+    // The requests in flight over the stream are never acked, start over
+    // from the next index the follower tells
+    r->_reset_next_index();
+    r->_shrink_window();
+    // dummy_id is unlock in _send_empty_entries
+    return r->_send_empty_entries(false);
+}
+
+void Replicator::_wait_stream_writable() {
+    if (!_stream_waiting) {
+        _stream_waiting = true;
+        brpc::StreamWait(_stream_id, NULL, _on_stream_writable,
+                         (void*)_id.value);
+    }
+    if (_flying_append_entries_size == 0) {
+        _st.st = IDLE;
+    }
+    CHECK_EQ(0, bthread_id_unlock(_id)) << "Fail to unlock " << _id;
+}
+
+void Replicator::_on_stream_writable(brpc::StreamId stream_id, void* arg,
+                                     int error_code) {
+    Replicator* r = NULL;
+    bthread_id_t id = {(uint64_t)arg};
+    if (bthread_id_lock(id, (void**)&r) != 0) {
+        return;
+    }
+    // The waiting is canceled once the replicator starts over
+    if (r->_stream_id != stream_id || !r->_stream_waiting) {
+        CHECK_EQ(0, bthread_id_unlock(id)) << "Fail to unlock " << id;
+        return;
+    }
+    r->_stream_waiting = false;
+    if (error_code != 0) {
+        // Handled in _on_stream_closed
+        CHECK_EQ(0, bthread_id_unlock(id)) << "Fail to unlock " << id;
+        return;
+    }
+    // id is unlock in _send_entries
+    r->_send_entries();
+}
+
 void Replicator::_install_snapshot() {
     NodeImpl* node_impl = _options.node;
     if (node_impl->is_witness()) {
@@ -1005,6 +1406,18 @@ void Replicator::_start_heartbeat_timer(long start_time_us) {
     }
 }
 
+void Replicator::send_heartbeat(ReplicatorId id, Closure* done) {
+    Replicator* r = NULL;
+    bthread_id_t dummy_id = {id};
+    if (bthread_id_lock(dummy_id, (void**)&r) != 0) {
+        done->status().set_error(EINVAL, "Replicator is stopped");
+        run_closure_in_bthread(done);
+        return;
+    }
+    // dummy_id is unlock in _send_empty_entries
+    r->_send_empty_entries(true, done);
+}
+
 void* Replicator::_send_heartbeat(void* arg) {
     Replicator* r = NULL;
     bthread_id_t id = {(uint64_t)arg};
@@ -1024,6 +1437,7 @@ int Replicator::_on_error(bthread_id_t id, void* arg, int error_code) {
         brpc::StartCancel(r->_heartbeat_in_fly);
         brpc::StartCancel(r->_timeout_now_in_fly);
         r->_cancel_append_entries_rpcs();
+        r->_close_stream();
         bthread_timer_del(r->_heartbeat_timer);
         r->_options.log_manager->remove_waiter(r->_wait_id);
         r->_notify_on_caught_up(error_code, true);
@@ -1104,7 +1518,11 @@ void Replicator::_cancel_append_entries_rpcs() {
     for (std::deque<FlyingAppendEntriesRpc>::iterator rpc_it =
              _append_entries_in_fly.begin();
          rpc_it != _append_entries_in_fly.end(); ++rpc_it) {
-        brpc::StartCancel(rpc_it->call_id);
+        // The acks of the requests over the stream are ignored once they
+        // are not in flight
+        if (rpc_it->stream_seq == 0) {
+            brpc::StartCancel(rpc_it->call_id);
+        }
     }
     _append_entries_in_fly.clear();
 }
@@ -1112,14 +1530,111 @@ void Replicator::_cancel_append_entries_rpcs() {
 void Replicator::_reset_next_index() {
     _next_index -= _flying_append_entries_size;
     _flying_append_entries_size = 0;
+    _flying_append_entries_bytes = 0;
     _cancel_append_entries_rpcs();
     _is_waiter_canceled = true;
+    _stream_waiting = false;
     if (_wait_id != 0) {
         _options.log_manager->remove_waiter(_wait_id);
         _wait_id = 0;
     }
 }
 
+int Replicator::_max_parallel_rpc_num() const {
+    if (_is_streaming()) {
+        // Also limited by raft_stream_max_buf_size
+        return FLAGS_raft_max_stream_append_entries_num;
+    }
+    if (!FLAGS_raft_adaptive_append_entries_window) {
+        return FLAGS_raft_max_parallel_append_entries_rpc_num;
+    }
+    const int64_t max_body_size = FLAGS_raft_max_body_size;
+    const int64_t rpc_num = (_window_bytes + max_body_size - 1) / max_body_size;
+    return std::max<int64_t>(
+        1, std::min<int64_t>(rpc_num,
+                             FLAGS_raft_max_adaptive_append_entries_rpc_num));
+}
+
+int64_t Replicator::_max_flying_entries_size() const {
+    if (!FLAGS_raft_adaptive_append_entries_window && !_is_streaming()) {
+        return FLAGS_raft_max_entries_size;
+    }
+    // raft_max_entries_size for each request in flight
+    return (int64_t)FLAGS_raft_max_entries_size * _max_parallel_rpc_num();
+}
+
+bool Replicator::_is_pipeline_full() const {
+    if (_is_streaming() && !_append_entries_in_fly.empty() &&
+        _append_entries_in_fly.back().stream_seq == 0) {
+        // Switch to the stream after the RPCs in flight return, so that the
+        // follower receives the requests in order
+        return true;
+    }
+    if (_flying_append_entries_size >= _max_flying_entries_size() ||
+        _append_entries_in_fly.size() >= (size_t)_max_parallel_rpc_num()) {
+        return true;
+    }
+    return FLAGS_raft_adaptive_append_entries_window &&
+           _flying_append_entries_bytes >= _window_bytes;
+}
+
+void Replicator::_on_append_entries_acked(int64_t bytes, int64_t latency_us) {
+    _srtt_us = _srtt_us == 0 ? latency_us : (7 * _srtt_us + latency_us) / 8;
+    const int64_t now_us = butil::monotonic_time_us();
+    if (_rate_sample_start_us == 0 ||
+        now_us - _rate_sample_start_us > 2 * _srtt_us + latency_us) {
+        // Idle for a while, which says nothing about the bandwidth
+        _rate_sample_start_us = now_us - latency_us;
+        _rate_sample_bytes = 0;
+    }
+    _rate_sample_bytes += bytes;
+    const int64_t elapsed_us = now_us - _rate_sample_start_us;
+    if (elapsed_us < std::max<int64_t>(_srtt_us, 1000)) {
+        return;
+    }
+    // Sample the delivery rate about once per RTT, which follows the raises
+    // at once and the drops slowly as the requests in flight are limited by
+    // the window as well
+    const int64_t rate = _rate_sample_bytes * 1000000 / elapsed_us;
+    _delivery_rate =
+        rate >= _delivery_rate ? rate : (7 * _delivery_rate + rate) / 8;
+    _rate_sample_start_us = now_us;
+    _rate_sample_bytes = 0;
+    // Twice the bandwidth-delay product leaves room for the rate to grow
+    const int64_t max_body_size = FLAGS_raft_max_body_size;
+    _window_bytes = std::max(
+        max_body_size,
+        std::min(2 * _delivery_rate * _srtt_us / 1000000,
+                 max_body_size *
+                     FLAGS_raft_max_adaptive_append_entries_rpc_num));
+}
+
+void Replicator::_shrink_window() {
+    _window_bytes = std::max<int64_t>(_window_bytes / 2,
+                                      FLAGS_raft_max_body_size);
+    _delivery_rate /= 2;
+    _rate_sample_start_us = 0;
+    _rate_sample_bytes = 0;
+}
+
+int64_t Replicator::_next_index_on_conflict(int64_t prev_log_index,
+                                            int64_t conflict_term,
+                                            int64_t conflict_index) {
+    if (conflict_index <= 0 || conflict_index > prev_log_index) {
+        return prev_log_index;
+    }
+    // The logs of |conflict_term| at the peer are in [conflict_index,
+    // prev_log_index], and the ones of the same term here are the same logs,
+    // so the first index to probe is after the last of them, or the first of
+    // the term at the peer if there's none
+    const int64_t last_index =
+        _options.log_manager->get_last_index_of_term(conflict_term);
+    if (last_index >= conflict_index) {
+        return std::min(last_index + 1, prev_log_index);
+    }
+    return conflict_index;
+}
+
 void Replicator::_send_timeout_now(bool unlock_id, bool old_leader_stepped_down,
                                    int timeout_ms) {
     TimeoutNowRequest* request = new TimeoutNowRequest;
@@ -1309,12 +1824,22 @@ void Replicator::_describe(std::ostream& os, bool use_html) {
     const int64_t append_entries_counter = _append_entries_counter;
     const int64_t install_snapshot_counter = _install_snapshot_counter;
     const int64_t readonly_index = _readonly_index;
+    const int64_t srtt_us = _srtt_us;
+    const int64_t window_bytes = _window_bytes;
+    const bool streaming = _is_streaming();
     CHECK_EQ(0, bthread_id_unlock(_id));
     // Don't touch *this ever after
     const char* new_line = use_html ? "<br>" : "\r\n";
     os << "replicator_" << id << '@' << peer_id << ':';
     os << " next_index=" << next_index << ' ';
     os << " flying_append_entries_size=" << flying_append_entries_size << ' ';
+    if (FLAGS_raft_adaptive_append_entries_window) {
+        os << " srtt_us=" << srtt_us << " window_bytes=" << window_bytes
+           << ' ';
+    }
+    if (streaming) {
+        os << " streaming ";
+    }
     if (readonly_index != 0) {
         os << " readonly_index=" << readonly_index << ' ';
     }
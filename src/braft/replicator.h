@@ -20,6 +20,7 @@
 #define BRAFT_REPLICATOR_H
 
 #include <brpc/channel.h>     // brpc::Channel
+#include <brpc/stream.h>      // brpc::StreamId
 #include <bthread/bthread.h>  // bthread_id
 
 #include "braft/configuration.h"  // Configuration
@@ -34,6 +35,7 @@ class LogManager;
 class BallotBox;
 class NodeImpl;
 class SnapshotThrottle;
+struct AppendEntriesAck;
 
 // A shared structure to store some high-frequency replicator statuses, for
 // reducing the lock contention between Replicator and NodeImpl.
@@ -107,6 +109,11 @@ class BAIDU_CACHELINE_ALIGNMENT Replicator {
     // finishes no matter it succes or fails.
     static int send_timeout_now_and_stop(ReplicatorId id, int timeout_ms);
 
+    // Send a heartbeat to the very follower immediately, regardless of the
+    // heartbeat timer. |done| is invoked when the RPC finishes, and its status
+    // is OK only if the follower accepted the term of this replicator.
+    static void send_heartbeat(ReplicatorId id, Closure* done);
+
     // Get the next index of this Replica if we know the correct value is
     // Return the correct value on success, 0 otherwise.
     static int64_t get_next_index(ReplicatorId id);
@@ -128,6 +135,9 @@ class BAIDU_CACHELINE_ALIGNMENT Replicator {
     static bool readonly(ReplicatorId id);
 
    private:
+    friend class HeartbeatBatcher;
+    friend class ReplicationStreamClient;
+
     enum St {
         IDLE,
         BLOCKING,
@@ -146,12 +156,32 @@ class BAIDU_CACHELINE_ALIGNMENT Replicator {
         };
     };
 
+    // What's needed to handle the result of an AppendEntries request,
+    // returned by either the RPC or the replication stream
+    struct AppendEntriesResult {
+        int64_t prev_log_index;
+        int entries_size;
+        // Bytes of the data acked
+        int64_t data_size;
+        int error_code;
+        std::string error_text;
+        int64_t latency_us;
+        int64_t send_time_ms;
+    };
+
     Replicator();
     ~Replicator();
 
-    int _prepare_entry(int offset, EntryMeta* em, butil::IOBuf* data);
+    int _prepare_entry(int offset, const LogEntry* entry, EntryMeta* em,
+                       butil::IOBuf* data);
+    // Fill |request| and |data| with the logs from _next_index encoded in
+    // |batches| already, bounded as _prepare_entry does
+    void _append_shared_entries(
+        const std::vector<scoped_refptr<ReplicationBatch> >& batches,
+        int max_entries_size, size_t max_body_size,
+        AppendEntriesRequest* request, butil::IOBuf* data);
     void _wait_more_entries();
-    void _send_empty_entries(bool is_heartbeat);
+    void _send_empty_entries(bool is_heartbeat, Closure* heartbeat_done = NULL);
     void _send_entries();
     void _notify_on_caught_up(int error_code, bool);
     int _fill_common_fields(AppendEntriesRequest* request,
@@ -164,19 +194,55 @@ class BAIDU_CACHELINE_ALIGNMENT Replicator {
     int _transfer_leadership(int64_t log_index);
     void _cancel_append_entries_rpcs();
     void _reset_next_index();
+    // The next index to probe after the peer rejects the request at
+    // |prev_log_index| with a conflicting term, which skips the whole term
+    int64_t _next_index_on_conflict(int64_t prev_log_index,
+                                    int64_t conflict_term,
+                                    int64_t conflict_index);
     int64_t _min_flying_index() {
         return _next_index - _flying_append_entries_size;
     }
+    // Limits of the AppendEntries requests in flight, which follow the
+    // bandwidth-delay product to the peer if
+    // raft_adaptive_append_entries_window is on
+    int _max_parallel_rpc_num() const;
+    int64_t _max_flying_entries_size() const;
+    bool _is_pipeline_full() const;
+    // Update the estimation of RTT and the delivery rate with a request of
+    // |bytes| acknowledged after |latency_us|
+    void _on_append_entries_acked(int64_t bytes, int64_t latency_us);
+    void _shrink_window();
     int _change_readonly_config(bool readonly);
+    // Called with _id locked, which is unlocked in this method
+    void _on_append_entries_returned(const AppendEntriesResult& result,
+                                     const AppendEntriesResponse& response,
+                                     long start_time_us);
+    bool _is_streaming() const {
+        return _stream_id != brpc::INVALID_STREAM_ID;
+    }
+    // Open the replication stream in the background if it's enabled and not
+    // opened yet
+    void _open_stream();
+    void _close_stream();
+    void _wait_stream_writable();
 
     static void _on_rpc_returned(ReplicatorId id, brpc::Controller* cntl,
                                  AppendEntriesRequest* request,
                                  AppendEntriesResponse* response, int64_t);
+    static void _on_stream_opened(ReplicatorId id, brpc::Controller* cntl,
+                                  AppendEntriesStreamRequest* request,
+                                  AppendEntriesStreamResponse* response,
+                                  brpc::StreamId stream_id);
+    static void _on_stream_ack(ReplicatorId id, brpc::StreamId stream_id,
+                               const AppendEntriesAck& ack);
+    static void _on_stream_closed(ReplicatorId id, brpc::StreamId stream_id);
+    static void _on_stream_writable(brpc::StreamId stream_id, void* arg,
+                                    int error_code);
 
     static void _on_heartbeat_returned(ReplicatorId id, brpc::Controller* cntl,
                                        AppendEntriesRequest* request,
                                        AppendEntriesResponse* response,
-                                       int64_t);
+                                       int64_t, Closure* done);
 
     static void _on_timeout_now_returned(ReplicatorId id,
                                          brpc::Controller* cntl,
@@ -228,14 +294,32 @@ class BAIDU_CACHELINE_ALIGNMENT Replicator {
     struct FlyingAppendEntriesRpc {
         int64_t log_index;
         int entries_size;
+        int64_t bytes;
         brpc::CallId call_id;
-        FlyingAppendEntriesRpc(int64_t index, int size, brpc::CallId id)
-            : log_index(index), entries_size(size), call_id(id) {}
+        // Non-zero if sent over the replication stream
+        uint64_t stream_seq;
+        int64_t send_time_us;
+        FlyingAppendEntriesRpc(int64_t index, int size, int64_t nbytes,
+                               brpc::CallId id, uint64_t seq, int64_t send_us)
+            : log_index(index),
+              entries_size(size),
+              bytes(nbytes),
+              call_id(id),
+              stream_seq(seq),
+              send_time_us(send_us) {}
     };
 
     brpc::Channel _sending_channel;
     int64_t _next_index;
     int64_t _flying_append_entries_size;
+    int64_t _flying_append_entries_bytes;
+    // Smoothed RTT and delivery rate (bytes per second) of AppendEntries
+    int64_t _srtt_us;
+    int64_t _delivery_rate;
+    int64_t _rate_sample_start_us;
+    int64_t _rate_sample_bytes;
+    // Bytes allowed in flight
+    int64_t _window_bytes;
     int _consecutive_error_times;
     bool _has_succeeded;
     int64_t _timeout_now_index;
@@ -253,6 +337,14 @@ class BAIDU_CACHELINE_ALIGNMENT Replicator {
     bthread_id_t _id;
     ReplicatorOptions _options;
     bthread_timer_t _heartbeat_timer;
+    // Valid once the replication stream is opened
+    brpc::StreamId _stream_id;
+    uint64_t _stream_seq;
+    int64_t _stream_retry_time_ms;
+    bool _stream_opening;
+    bool _stream_waiting;
+    // Set once the peer turns out not to serve append_entries_stream
+    bool _stream_unsupported;
     SnapshotReader* _reader;
     CatchupClosure* _catchup_closure;
 };
@@ -0,0 +1,1354 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "braft/shared_log.h"
+
+#include <brpc/reloadable_flags.h>         // BRPC_VALIDATE_GFLAG
+#include <bthread/condition_variable.h>    // bthread::ConditionVariable
+#include <bthread/mutex.h>                 // bthread::Mutex
+#include <butil/fd_utility.h>              // butil::make_close_on_exec
+#include <butil/file_util.h>               // butil::CreateDirectory
+#include <butil/files/dir_reader_posix.h>  // butil::DirReaderPosix
+#include <butil/memory/singleton.h>        // Singleton
+#include <butil/raw_pack.h>                // butil::RawPacker
+#include <butil/string_printf.h>           // butil::string_appendf
+#include <butil/time.h>
+#include <bvar/bvar.h>
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+
+#include "braft/fsync.h"
+#include "braft/local_storage.pb.h"
+#include "braft/protobuf_file.h"
+
+#define BRAFT_SHARED_LOG_FILE_PATTERN "wal_%020" PRId64
+#define BRAFT_SHARED_LOG_META_SUFFIX ".meta"
+
+namespace braft {
+
+using ::butil::RawPacker;
+using ::butil::RawUnpacker;
+
+DECLARE_bool(raft_trace_append_entry_latency);
+DECLARE_bool(raft_recover_log_from_corrupt);
+
+DEFINE_int32(raft_shared_log_file_size, 64 * 1024 * 1024 /*64M*/,
+             "Max size of one file of the shared log");
+BRPC_VALIDATE_GFLAG(raft_shared_log_file_size, brpc::PositiveInteger);
+
+static bvar::LatencyRecorder g_shared_log_append_latency(
+    "raft_shared_log_append");
+static bvar::LatencyRecorder g_shared_log_sync_latency("raft_shared_log_sync");
+static bvar::CounterRecorder g_shared_log_sync_batch_counter(
+    "raft_shared_log_sync_batch_counter");
+
+enum SharedLogCheckSumType {
+    SHARED_LOG_CHECKSUM_MURMURHASH32 = 0,
+    SHARED_LOG_CHECKSUM_CRC32 = 1,
+};
+
+// Types of the records which change the index of a group, other than the
+// ones of EntryType
+enum SharedLogRecordType {
+    SHARED_LOG_RECORD_TRUNCATE_SUFFIX = 0x80,
+    SHARED_LOG_RECORD_RESET = 0x81,
+    SHARED_LOG_RECORD_DROP = 0x82,
+};
+
+// Format of the record header, all fields are in network order
+// | -------------------------- term (64bits) -------------------------- |
+// | -------------------------- index (64bits) ------------------------- |
+// | record-type (8bits) | checksum_type (8bits) | group length (16bits) |
+// | ------------------------ data len (32bits) ------------------------ |
+// | data_checksum (32bits) | header checksum (32bits)                   |
+// The header is followed by the name of the group and then the data, the
+// header checksum covers the name of the group as well.
+
+const static size_t SHARED_LOG_HEADER_SIZE = 32;
+
+struct SharedLogRecord {
+    int64_t term;
+    int64_t index;
+    int type;
+    int checksum_type;
+    std::string group;
+    uint32_t data_len;
+    uint32_t data_checksum;
+
+    size_t length() const {
+        return SHARED_LOG_HEADER_SIZE + group.size() + data_len;
+    }
+};
+
+inline uint32_t shared_log_checksum(int checksum_type, const char* data,
+                                    size_t len) {
+    if (checksum_type == SHARED_LOG_CHECKSUM_CRC32) {
+        return crc32(data, len);
+    }
+    return murmurhash32(data, len);
+}
+
+inline uint32_t shared_log_checksum(int checksum_type,
+                                    const butil::IOBuf& data) {
+    if (checksum_type == SHARED_LOG_CHECKSUM_CRC32) {
+        return crc32(data);
+    }
+    return murmurhash32(data);
+}
+
+static void encode_record(int64_t term, int64_t index, int type,
+                          int checksum_type, const std::string& group,
+                          const butil::IOBuf& data, butil::IOBuf* out) {
+    char header_buf[SHARED_LOG_HEADER_SIZE];
+    const uint32_t meta_field =
+        (type << 24) | (checksum_type << 16) | (uint32_t)group.size();
+    RawPacker packer(header_buf);
+    packer.pack64(term)
+        .pack64(index)
+        .pack32(meta_field)
+        .pack32((uint32_t)data.length())
+        .pack32(shared_log_checksum(checksum_type, data));
+    std::string checked(header_buf, SHARED_LOG_HEADER_SIZE - 4);
+    checked.append(group);
+    packer.pack32(
+        shared_log_checksum(checksum_type, checked.data(), checked.size()));
+    out->append(header_buf, SHARED_LOG_HEADER_SIZE);
+    out->append(group);
+    out->append(data);
+}
+
+// Load the record at |offset| of |fd|, the data is not loaded if |data| is
+// NULL.
+// Returns 0 on success, 1 if the record is not completely written, -1 if it's
+// corrupted.
+static int load_record(int fd, off_t offset, size_t size_hint,
+                       SharedLogRecord* record, butil::IOBuf* data) {
+    butil::IOPortal buf;
+    const ssize_t n = file_pread(&buf, fd, offset,
+                                 std::max(size_hint, SHARED_LOG_HEADER_SIZE));
+    if (n < 0) {
+        return -1;
+    }
+    if (buf.length() < SHARED_LOG_HEADER_SIZE) {
+        return 1;
+    }
+    char header_buf[SHARED_LOG_HEADER_SIZE];
+    buf.cutn(header_buf, SHARED_LOG_HEADER_SIZE);
+    uint32_t meta_field = 0;
+    uint32_t header_checksum = 0;
+    RawUnpacker(header_buf)
+        .unpack64((uint64_t&)record->term)
+        .unpack64((uint64_t&)record->index)
+        .unpack32(meta_field)
+        .unpack32(record->data_len)
+        .unpack32(record->data_checksum)
+        .unpack32(header_checksum);
+    record->type = meta_field >> 24;
+    record->checksum_type = (meta_field >> 16) & 0xFF;
+    const size_t group_len = meta_field & 0xFFFF;
+    const size_t body_len =
+        group_len + (data != NULL ? record->data_len : 0);
+    if (buf.length() < body_len) {
+        const size_t to_read = body_len - buf.length();
+        const ssize_t n = file_pread(
+            &buf, fd, offset + SHARED_LOG_HEADER_SIZE + buf.length(), to_read);
+        if (n < 0) {
+            return -1;
+        }
+        if (buf.length() < body_len) {
+            return 1;
+        }
+    }
+    record->group.resize(group_len);
+    buf.cutn(&record->group[0], group_len);
+    std::string checked(header_buf, SHARED_LOG_HEADER_SIZE - 4);
+    checked.append(record->group);
+    if (header_checksum != shared_log_checksum(record->checksum_type,
+                                               checked.data(),
+                                               checked.size())) {
+        LOG(ERROR) << "Found corrupted header at offset=" << offset
+                   << " fd=" << fd;
+        return -1;
+    }
+    if (data != NULL) {
+        if (buf.length() > record->data_len) {
+            buf.pop_back(buf.length() - record->data_len);
+        }
+        if (record->data_checksum !=
+            shared_log_checksum(record->checksum_type, buf)) {
+            LOG(ERROR) << "Found corrupted data at offset=" << offset
+                       << " fd=" << fd << " group=" << record->group
+                       << " index=" << record->index;
+            return -1;
+        }
+        data->swap(buf);
+    }
+    return 0;
+}
+
+class SharedLogFile : public butil::RefCountedThreadSafe<SharedLogFile> {
+   public:
+    SharedLogFile(const std::string& path, int64_t id)
+        : _id(id), _fd(-1), _bytes(0) {
+        butil::string_printf(&_path, "%s/" BRAFT_SHARED_LOG_FILE_PATTERN,
+                             path.c_str(), id);
+    }
+
+    // Create the file, or open the existing one if |create| is false
+    int open(bool create) {
+        const int flags = create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR;
+        _fd = ::open(_path.c_str(), flags, 0644);
+        if (_fd < 0) {
+            PLOG(ERROR) << "Fail to open " << _path;
+            return -1;
+        }
+        butil::make_close_on_exec(_fd);
+        LOG_IF(INFO, create)
+            << "Created new shared log file `" << _path << "' with fd=" << _fd;
+        return 0;
+    }
+
+    int64_t id() const { return _id; }
+    int fd() const { return _fd; }
+    const std::string& path() const { return _path; }
+    // Only accessed with the write lock of the shared log held
+    int64_t bytes() const { return _bytes; }
+    void set_bytes(int64_t bytes) { _bytes = bytes; }
+
+   private:
+    friend class butil::RefCountedThreadSafe<SharedLogFile>;
+    ~SharedLogFile() {
+        if (_fd >= 0) {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    std::string _path;
+    const int64_t _id;
+    int _fd;
+    int64_t _bytes;
+};
+
+struct SharedLogGroup {
+    struct EntryLocation {
+        int64_t file_id;
+        int64_t offset;
+        int64_t term;
+        uint32_t length;
+        bool is_conf;
+    };
+
+    explicit SharedLogGroup(const std::string& name_)
+        : name(name_),
+          first_index(1),
+          last_index(0),
+          is_open(false),
+          is_broken(false) {}
+
+    // Following functions are called with |mutex| held
+
+    void push_back(const EntryLocation& location, int64_t index) {
+        if (entries.empty()) {
+            first_index.store(index, butil::memory_order_release);
+        }
+        entries.push_back(location);
+        last_index.store(index, butil::memory_order_release);
+    }
+
+    // Discard the entries after |last_index_kept|
+    void pop_back(int64_t last_index_kept,
+                  std::vector<EntryLocation>* removed) {
+        const int64_t first = first_index.load(butil::memory_order_relaxed);
+        while (!entries.empty() &&
+               first + (int64_t)entries.size() - 1 > last_index_kept) {
+            removed->push_back(entries.back());
+            entries.pop_back();
+        }
+        last_index.store(last_index_kept, butil::memory_order_release);
+        if (last_index_kept < first) {
+            first_index.store(last_index_kept + 1, butil::memory_order_release);
+        }
+    }
+
+    // Discard the entries before |first_index_kept|
+    void pop_front(int64_t first_index_kept,
+                   std::vector<EntryLocation>* removed) {
+        int64_t first = first_index.load(butil::memory_order_relaxed);
+        while (!entries.empty() && first < first_index_kept) {
+            removed->push_back(entries.front());
+            entries.pop_front();
+            ++first;
+        }
+        first_index.store(first_index_kept, butil::memory_order_release);
+        if (last_index.load(butil::memory_order_relaxed) < first_index_kept) {
+            last_index.store(first_index_kept - 1, butil::memory_order_release);
+        }
+    }
+
+    // Discard all the entries and the next entry is |next_log_index|
+    void clear(int64_t next_log_index, std::vector<EntryLocation>* removed) {
+        removed->insert(removed->end(), entries.begin(), entries.end());
+        entries.clear();
+        first_index.store(next_log_index, butil::memory_order_release);
+        last_index.store(next_log_index - 1, butil::memory_order_release);
+    }
+
+    const std::string name;
+    raft_mutex_t mutex;
+    butil::atomic<int64_t> first_index;
+    butil::atomic<int64_t> last_index;
+    // entries[i] is the location of the entry at first_index + i
+    std::deque<EntryLocation> entries;
+    // Protected by the mutex of SharedLogStorageImpl
+    bool is_open;
+    // Some entries of the group are lost in the corrupted files, which is
+    // found in replay if raft_recover_log_from_corrupt is on. The group can't
+    // be opened any more unless it's dropped
+    bool is_broken;
+};
+
+typedef SharedLogGroup::EntryLocation EntryLocation;
+
+// Inner class of SharedLogStorage, shared by all the groups on the same path
+class SharedLogStorageImpl
+    : public butil::RefCountedThreadSafe<SharedLogStorageImpl> {
+   public:
+    explicit SharedLogStorageImpl(const std::string& path)
+        : _path(path),
+          _checksum_type(SHARED_LOG_CHECKSUM_MURMURHASH32),
+          _written_lsn(0),
+          _synced_lsn(0),
+          _syncing(false),
+          _sync_requests(0),
+          _open_file_id(0) {}
+
+    // Load all the files and rebuild the index of all the groups
+    int init();
+
+    // Open |group| and add the configurations of it to
+    // |configuration_manager|
+    int open_group(const std::string& group,
+                   ConfigurationManager* configuration_manager,
+                   SharedLogGroup** log_group);
+    void close_group(SharedLogGroup* log_group);
+    // Discard all the entries and the meta of |group|
+    int drop_group(const std::string& group);
+
+    LogEntry* get_entry(SharedLogGroup* log_group, const int64_t index);
+    int64_t get_term(SharedLogGroup* log_group, const int64_t index);
+    int append_entries(SharedLogGroup* log_group,
+                       const std::vector<LogEntry*>& entries, IOMetric* metric);
+    int truncate_prefix(SharedLogGroup* log_group,
+                        const int64_t first_index_kept);
+    int truncate_suffix(SharedLogGroup* log_group,
+                        const int64_t last_index_kept);
+    int reset(SharedLogGroup* log_group, const int64_t next_log_index);
+
+   private:
+    friend class butil::RefCountedThreadSafe<SharedLogStorageImpl>;
+    ~SharedLogStorageImpl() {
+        for (std::map<std::string, SharedLogGroup*>::iterator it =
+                 _groups.begin();
+             it != _groups.end(); ++it) {
+            delete it->second;
+        }
+    }
+
+    struct FileInfo {
+        FileInfo() : live_entries(0) {}
+        scoped_refptr<SharedLogFile> file;
+        // Number of the entries in the file which are still in the index
+        int64_t live_entries;
+    };
+
+    int replay_file(SharedLogFile* file, bool is_last_file);
+    int replay_record(const SharedLogRecord& record,
+                      const EntryLocation& location);
+    void mark_broken(SharedLogGroup* group, const std::string& reason);
+    SharedLogGroup* get_group(const std::string& group, bool create);
+    int encode_entry(const std::string& group, const LogEntry* entry,
+                     butil::IOBuf* out);
+    // Append |data| to the open file and return the lsn after it
+    int write(const butil::IOBuf& data, int64_t* file_id, int64_t* offset,
+              int64_t* lsn);
+    int write_control_record(SharedLogGroup* log_group, int type,
+                             int64_t index);
+    int rotate();
+    int sync(int64_t lsn);
+    void release_locations(const std::vector<EntryLocation>& locations);
+    scoped_refptr<SharedLogFile> get_file(int64_t file_id);
+    std::string meta_path(const std::string& group) const {
+        return _path + "/" + group + BRAFT_SHARED_LOG_META_SUFFIX;
+    }
+    int save_meta(const std::string& group, const int64_t log_index);
+    int load_meta(const std::string& group, int64_t* log_index);
+
+    const std::string _path;
+    int _checksum_type;
+
+    // Serialize the writes of all the groups
+    raft_mutex_t _write_mutex;
+    scoped_refptr<SharedLogFile> _open_file;
+    int64_t _written_lsn;
+
+    // One fsync covers all the writes before it, the following waiters
+    // just wait for the on-going fsync instead of issuing their own
+    bthread::Mutex _sync_mutex;
+    bthread::ConditionVariable _sync_cond;
+    int64_t _synced_lsn;
+    bool _syncing;
+    int64_t _sync_requests;
+
+    raft_mutex_t _mutex;
+    std::map<std::string, SharedLogGroup*> _groups;
+    std::map<int64_t, FileInfo> _files;
+    int64_t _open_file_id;
+};
+
+int SharedLogStorageImpl::init() {
+    butil::FilePath dir_path(_path);
+    butil::File::Error e;
+    if (!butil::CreateDirectoryAndGetError(
+            dir_path, &e, FLAGS_raft_create_parent_directories)) {
+        LOG(ERROR) << "Fail to create " << dir_path.value() << " : " << e;
+        return -1;
+    }
+    if (butil::crc32c::IsFastCrc32Supported()) {
+        _checksum_type = SHARED_LOG_CHECKSUM_CRC32;
+    }
+
+    butil::DirReaderPosix dir_reader(_path.c_str());
+    if (!dir_reader.IsValid()) {
+        LOG(WARNING) << "directory reader failed, maybe NOEXIST or PERMISSION."
+                     << " path: " << _path;
+        return -1;
+    }
+    std::map<int64_t, scoped_refptr<SharedLogFile> > files;
+    while (dir_reader.Next()) {
+        int64_t file_id = 0;
+        if (sscanf(dir_reader.name(), BRAFT_SHARED_LOG_FILE_PATTERN,
+                   &file_id) != 1) {
+            continue;
+        }
+        scoped_refptr<SharedLogFile> file = new SharedLogFile(_path, file_id);
+        if (file->path() != _path + "/" + dir_reader.name()) {
+            continue;
+        }
+        files[file_id] = file;
+    }
+
+    // Only the last written file may end with an incomplete record, the empty
+    // files after it were created right before the crash
+    int64_t last_written_file_id = 0;
+    for (std::map<int64_t, scoped_refptr<SharedLogFile> >::reverse_iterator
+             it = files.rbegin();
+         it != files.rend(); ++it) {
+        int64_t file_size = 0;
+        if (!butil::GetFileSize(butil::FilePath(it->second->path()),
+                                &file_size) ||
+            file_size > 0) {
+            last_written_file_id = it->first;
+            break;
+        }
+    }
+
+    // Files are replayed in the order they were written, so that the records
+    // changing the index take effect on the entries before them
+    int64_t last_file_id = 0;
+    for (std::map<int64_t, scoped_refptr<SharedLogFile> >::iterator it =
+             files.begin();
+         it != files.end(); ++it) {
+        if (it->second->open(false) != 0 ||
+            replay_file(it->second.get(),
+                        it->first >= last_written_file_id) != 0) {
+            return -1;
+        }
+        _files[it->first].file = it->second;
+        last_file_id = it->first;
+    }
+    for (std::map<std::string, SharedLogGroup*>::iterator it = _groups.begin();
+         it != _groups.end(); ++it) {
+        const std::deque<EntryLocation>& entries = it->second->entries;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            ++_files[entries[i].file_id].live_entries;
+        }
+    }
+
+    // Always start a new file instead of appending to the replayed one
+    _open_file = new SharedLogFile(_path, last_file_id + 1);
+    if (_open_file->open(true) != 0) {
+        return -1;
+    }
+    _files[_open_file->id()].file = _open_file;
+    _open_file_id = _open_file->id();
+    LOG(INFO) << "Loaded shared log " << _path << " with " << files.size()
+              << " files and " << _groups.size() << " groups";
+    // Remove the files without any live entry
+    release_locations(std::vector<EntryLocation>());
+    return 0;
+}
+
+int SharedLogStorageImpl::replay_file(SharedLogFile* file,
+                                      bool is_last_file) {
+    struct stat st_buf;
+    if (fstat(file->fd(), &st_buf) != 0) {
+        PLOG(ERROR) << "Fail to get the stat of " << file->path();
+        return -1;
+    }
+    const int64_t file_size = st_buf.st_size;
+    int64_t offset = 0;
+    bool corrupted = false;
+    while (offset < file_size) {
+        SharedLogRecord record;
+        const int rc =
+            load_record(file->fd(), offset, SHARED_LOG_HEADER_SIZE, &record,
+                        NULL);
+        if (rc < 0 ||
+            (rc == 0 && offset + (int64_t)record.length() > file_size)) {
+            corrupted = true;
+            break;
+        }
+        if (rc > 0) {
+            // Incomplete header or group name
+            corrupted = !is_last_file;
+            break;
+        }
+        EntryLocation location;
+        location.file_id = file->id();
+        location.offset = offset;
+        location.term = record.term;
+        location.length = record.length();
+        location.is_conf = (record.type == ENTRY_TYPE_CONFIGURATION);
+        if (replay_record(record, location) != 0) {
+            return -1;
+        }
+        offset += record.length();
+    }
+    if (offset == file_size) {
+        file->set_bytes(offset);
+        return 0;
+    }
+    if (!corrupted) {
+        // Only the last record of the last file may be not completely written
+        // before crash, the following files are started after it's synced
+        LOG(INFO) << "truncate last uncompleted record, path: " << file->path()
+                  << " old_size: " << file_size << " new_size: " << offset;
+        if (::ftruncate(file->fd(), offset) != 0) {
+            PLOG(ERROR) << "Fail to truncate " << file->path();
+            return -1;
+        }
+        file->set_bytes(offset);
+        return 0;
+    }
+    if (!FLAGS_raft_recover_log_from_corrupt) {
+        LOG(ERROR) << "Found corrupted record in " << file->path()
+                   << " offset: " << offset << " size: " << file_size;
+        return -1;
+    }
+    // The records after |offset| can't be delimited, any group may have lost
+    // entries in them. The file is kept as is since the other groups still
+    // refer to the entries before |offset|
+    LOG(ERROR) << "Found corrupted record in " << file->path()
+               << " offset: " << offset << " size: " << file_size
+               << ", mark all the groups broken";
+    for (std::map<std::string, SharedLogGroup*>::iterator it = _groups.begin();
+         it != _groups.end(); ++it) {
+        mark_broken(it->second, "corrupted record in " + file->path());
+    }
+    file->set_bytes(file_size);
+    return 0;
+}
+
+int SharedLogStorageImpl::replay_record(const SharedLogRecord& record,
+                                        const EntryLocation& location) {
+    std::vector<EntryLocation> removed;
+    if (record.type == SHARED_LOG_RECORD_DROP) {
+        std::map<std::string, SharedLogGroup*>::iterator it =
+            _groups.find(record.group);
+        if (it != _groups.end()) {
+            delete it->second;
+            _groups.erase(it);
+        }
+        return 0;
+    }
+    SharedLogGroup* group = get_group(record.group, true);
+    if (group->is_broken) {
+        return 0;
+    }
+    switch (record.type) {
+        case SHARED_LOG_RECORD_TRUNCATE_SUFFIX:
+            group->pop_back(record.index, &removed);
+            return 0;
+        case SHARED_LOG_RECORD_RESET:
+            group->clear(record.index, &removed);
+            return 0;
+        default:
+            break;
+    }
+    const int64_t last_index = group->last_index.load();
+    if (!group->entries.empty() && record.index != last_index + 1) {
+        if (record.index > group->first_index.load() &&
+            record.index <= last_index) {
+            // Overwritten without a truncating record
+            group->pop_back(record.index - 1, &removed);
+        } else {
+            // The entries in between are lost
+            if (!FLAGS_raft_recover_log_from_corrupt) {
+                LOG(ERROR) << "Found discontinuous entry of group "
+                           << record.group << " index: " << record.index
+                           << " last_index: " << last_index << " in file "
+                           << location.file_id << " offset: "
+                           << location.offset;
+                return -1;
+            }
+            mark_broken(group, "discontinuous entry");
+            return 0;
+        }
+    }
+    group->push_back(location, record.index);
+    return 0;
+}
+
+void SharedLogStorageImpl::mark_broken(SharedLogGroup* group,
+                                       const std::string& reason) {
+    if (!group->is_broken) {
+        LOG(ERROR) << "Group " << group->name << " in shared log " << _path
+                   << " is broken because of " << reason
+                   << ", last_log_index: " << group->last_index.load();
+        group->is_broken = true;
+    }
+}
+
+SharedLogGroup* SharedLogStorageImpl::get_group(const std::string& group,
+                                                bool create) {
+    std::map<std::string, SharedLogGroup*>::iterator it = _groups.find(group);
+    if (it != _groups.end()) {
+        return it->second;
+    }
+    if (!create) {
+        return NULL;
+    }
+    SharedLogGroup* log_group = new SharedLogGroup(group);
+    _groups[group] = log_group;
+    return log_group;
+}
+
+int SharedLogStorageImpl::open_group(
+    const std::string& group, ConfigurationManager* configuration_manager,
+    SharedLogGroup** log_group) {
+    SharedLogGroup* g = NULL;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        g = get_group(group, true);
+        if (g->is_broken) {
+            LOG(ERROR) << "Group " << group << " is broken in " << _path
+                       << ", drop it and recover from the other peers";
+            return -1;
+        }
+        if (g->is_open) {
+            LOG(ERROR) << "Group " << group << " is already opened in "
+                       << _path;
+            return -1;
+        }
+        g->is_open = true;
+    }
+
+    int64_t first_log_index = 0;
+    if (load_meta(group, &first_log_index) != 0) {
+        if (errno != ENOENT) {
+            close_group(g);
+            return -1;
+        }
+        first_log_index = g->first_index.load(butil::memory_order_relaxed);
+        if (save_meta(group, first_log_index) != 0) {
+            close_group(g);
+            return -1;
+        }
+    }
+
+    std::vector<EntryLocation> removed;
+    std::vector<int64_t> conf_indexes;
+    {
+        BAIDU_SCOPED_LOCK(g->mutex);
+        if (first_log_index > g->first_index.load(butil::memory_order_relaxed)) {
+            g->pop_front(first_log_index, &removed);
+        }
+        const int64_t first = g->first_index.load(butil::memory_order_relaxed);
+        for (size_t i = 0; i < g->entries.size(); ++i) {
+            if (g->entries[i].is_conf) {
+                conf_indexes.push_back(first + i);
+            }
+        }
+    }
+    release_locations(removed);
+
+    for (size_t i = 0; i < conf_indexes.size(); ++i) {
+        LogEntry* entry = get_entry(g, conf_indexes[i]);
+        if (entry == NULL) {
+            LOG(ERROR) << "Fail to load configuration of group " << group
+                       << " at index " << conf_indexes[i];
+            close_group(g);
+            return -1;
+        }
+        configuration_manager->add({std::move(*entry)});
+        entry->Release();
+    }
+    *log_group = g;
+    LOG(INFO) << "Opened group " << group << " in shared log " << _path
+              << " first_log_index: " << g->first_index.load()
+              << " last_log_index: " << g->last_index.load();
+    return 0;
+}
+
+void SharedLogStorageImpl::close_group(SharedLogGroup* log_group) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    log_group->is_open = false;
+}
+
+int SharedLogStorageImpl::drop_group(const std::string& group) {
+    SharedLogGroup* g = NULL;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        g = get_group(group, false);
+        if (g && g->is_open) {
+            LOG(ERROR) << "Fail to drop group " << group
+                       << " which is still opened in " << _path;
+            return EBUSY;
+        }
+        if (g) {
+            _groups.erase(group);
+        }
+    }
+    if (g) {
+        std::vector<EntryLocation> removed(g->entries.begin(),
+                                           g->entries.end());
+        // The records of the dropped group must not be replayed again, in
+        // case that a new group with the same name is created
+        if (write_control_record(g, SHARED_LOG_RECORD_DROP, 0) != 0) {
+            BAIDU_SCOPED_LOCK(_mutex);
+            _groups[group] = g;
+            return EIO;
+        }
+        release_locations(removed);
+        delete g;
+    }
+    const std::string path = meta_path(group);
+    if (::unlink(path.c_str()) != 0 && errno != ENOENT) {
+        PLOG(ERROR) << "Fail to unlink " << path;
+        return EIO;
+    }
+    LOG(INFO) << "Dropped group " << group << " from shared log " << _path;
+    return 0;
+}
+
+scoped_refptr<SharedLogFile> SharedLogStorageImpl::get_file(int64_t file_id) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    std::map<int64_t, FileInfo>::iterator it = _files.find(file_id);
+    if (it == _files.end()) {
+        return NULL;
+    }
+    return it->second.file;
+}
+
+LogEntry* SharedLogStorageImpl::get_entry(SharedLogGroup* log_group,
+                                          const int64_t index) {
+    EntryLocation location;
+    {
+        BAIDU_SCOPED_LOCK(log_group->mutex);
+        const int64_t first =
+            log_group->first_index.load(butil::memory_order_relaxed);
+        if (index < first || index >= first + (int64_t)log_group->entries.size()) {
+            return NULL;
+        }
+        location = log_group->entries[index - first];
+    }
+    scoped_refptr<SharedLogFile> file = get_file(location.file_id);
+    if (file == NULL) {
+        return NULL;
+    }
+    SharedLogRecord record;
+    butil::IOBuf data;
+    if (load_record(file->fd(), location.offset, location.length, &record,
+                    &data) != 0) {
+        return NULL;
+    }
+    CHECK_EQ(index, record.index) << "group " << log_group->name;
+    CHECK_EQ(location.term, record.term) << "group " << log_group->name;
+    LogEntry* entry = new LogEntry();
+    entry->AddRef();
+    switch (record.type) {
+        case ENTRY_TYPE_DATA:
+            entry->data.swap(data);
+            break;
+        case ENTRY_TYPE_NO_OP:
+            CHECK(data.empty()) << "Data of NO_OP must be empty";
+            break;
+        case ENTRY_TYPE_CONFIGURATION: {
+            butil::Status status = parse_configuration_meta(data, entry);
+            if (!status.ok()) {
+                LOG(WARNING) << "Fail to parse ConfigurationPBMeta, group: "
+                             << log_group->name << " path: " << _path;
+                entry->Release();
+                return NULL;
+            }
+        } break;
+        default:
+            CHECK(false) << "Unknown entry type, path: " << _path;
+            break;
+    }
+    entry->id.index = index;
+    entry->id.term = record.term;
+    entry->type = (EntryType)record.type;
+    return entry;
+}
+
+int64_t SharedLogStorageImpl::get_term(SharedLogGroup* log_group,
+                                       const int64_t index) {
+    BAIDU_SCOPED_LOCK(log_group->mutex);
+    const int64_t first =
+        log_group->first_index.load(butil::memory_order_relaxed);
+    if (index < first || index >= first + (int64_t)log_group->entries.size()) {
+        return 0;
+    }
+    return log_group->entries[index - first].term;
+}
+
+int SharedLogStorageImpl::encode_entry(const std::string& group,
+                                       const LogEntry* entry,
+                                       butil::IOBuf* out) {
+    butil::IOBuf data;
+    switch (entry->type) {
+        case ENTRY_TYPE_DATA:
+            data.append(entry->data);
+            break;
+        case ENTRY_TYPE_NO_OP:
+            break;
+        case ENTRY_TYPE_CONFIGURATION: {
+            butil::Status status = serialize_configuration_meta(entry, data);
+            if (!status.ok()) {
+                LOG(ERROR) << "Fail to serialize ConfigurationPBMeta, group: "
+                           << group << " path: " << _path;
+                return -1;
+            }
+        } break;
+        default:
+            LOG(FATAL) << "unknow entry type: " << entry->type
+                       << ", path: " << _path;
+            return -1;
+    }
+    encode_record(entry->id.term, entry->id.index, entry->type, _checksum_type,
+                  group, data, out);
+    return 0;
+}
+
+int SharedLogStorageImpl::rotate() {
+    // Make sure the records in the closed file are durable, as sync() only
+    // cares about the open file
+    if (FLAGS_raft_sync && raft_fsync(_open_file->fd()) != 0) {
+        PLOG(ERROR) << "Fail to sync " << _open_file->path();
+        return -1;
+    }
+    scoped_refptr<SharedLogFile> file =
+        new SharedLogFile(_path, _open_file->id() + 1);
+    if (file->open(true) != 0) {
+        return -1;
+    }
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        _files[file->id()].file = file;
+        _open_file_id = file->id();
+    }
+    _open_file.swap(file);
+    // The previous open file may be removed now if it has no live entry
+    release_locations(std::vector<EntryLocation>());
+    return 0;
+}
+
+int SharedLogStorageImpl::write(const butil::IOBuf& data, int64_t* file_id,
+                                int64_t* offset, int64_t* lsn) {
+    if (_open_file->bytes() >= FLAGS_raft_shared_log_file_size &&
+        rotate() != 0) {
+        return -1;
+    }
+    const int64_t start = _open_file->bytes();
+    const ssize_t n = file_pwrite(data, _open_file->fd(), start);
+    if (n != (ssize_t)data.size()) {
+        LOG(ERROR) << "Fail to write to " << _open_file->path();
+        // Discard the partial record so that the following ones are still
+        // continuous
+        if (::ftruncate(_open_file->fd(), start) != 0) {
+            PLOG(ERROR) << "Fail to truncate " << _open_file->path();
+        }
+        return -1;
+    }
+    _open_file->set_bytes(start + data.size());
+    _written_lsn += data.size();
+    *file_id = _open_file->id();
+    *offset = start;
+    *lsn = _written_lsn;
+    return 0;
+}
+
+int SharedLogStorageImpl::sync(int64_t lsn) {
+    if (!FLAGS_raft_sync) {
+        return 0;
+    }
+    std::unique_lock<bthread::Mutex> lck(_sync_mutex);
+    ++_sync_requests;
+    while (_synced_lsn < lsn) {
+        if (_syncing) {
+            _sync_cond.wait(lck);
+            continue;
+        }
+        // Become the one to sync on behalf of all the waiting groups
+        _syncing = true;
+        const int64_t nrequests = _sync_requests;
+        _sync_requests = 0;
+        lck.unlock();
+
+        int64_t target_lsn = 0;
+        scoped_refptr<SharedLogFile> file;
+        {
+            BAIDU_SCOPED_LOCK(_write_mutex);
+            target_lsn = _written_lsn;
+            file = _open_file;
+        }
+        const int64_t start_time_us = butil::cpuwide_time_us();
+        const int rc = raft_fsync(file->fd());
+        g_shared_log_sync_latency << butil::cpuwide_time_us() - start_time_us;
+        g_shared_log_sync_batch_counter << nrequests;
+
+        lck.lock();
+        _syncing = false;
+        if (rc == 0 && target_lsn > _synced_lsn) {
+            _synced_lsn = target_lsn;
+        }
+        _sync_cond.notify_all();
+        if (rc != 0) {
+            PLOG(ERROR) << "Fail to sync " << file->path();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int SharedLogStorageImpl::append_entries(SharedLogGroup* log_group,
+                                         const std::vector<LogEntry*>& entries,
+                                         IOMetric* metric) {
+    if (entries.empty()) {
+        return 0;
+    }
+    if (log_group->last_index.load(butil::memory_order_relaxed) + 1 !=
+        entries.front()->id.index) {
+        LOG(FATAL)
+            << "There's gap between appending entries and last_log_index"
+            << " group: " << log_group->name << " path: " << _path;
+        return -1;
+    }
+    int64_t now = butil::cpuwide_time_us();
+    butil::IOBuf data;
+    std::vector<EntryLocation> locations(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const int64_t offset = data.size();
+        if (encode_entry(log_group->name, entries[i], &data) != 0) {
+            return 0;
+        }
+        locations[i].offset = offset;
+        locations[i].length = data.size() - offset;
+        locations[i].term = entries[i]->id.term;
+        locations[i].is_conf = entries[i]->type == ENTRY_TYPE_CONFIGURATION;
+    }
+
+    int64_t lsn = 0;
+    {
+        BAIDU_SCOPED_LOCK(_write_mutex);
+        int64_t file_id = 0;
+        int64_t offset = 0;
+        if (write(data, &file_id, &offset, &lsn) != 0) {
+            return 0;
+        }
+        {
+            BAIDU_SCOPED_LOCK(log_group->mutex);
+            for (size_t i = 0; i < locations.size(); ++i) {
+                locations[i].file_id = file_id;
+                locations[i].offset += offset;
+                log_group->push_back(locations[i], entries[i]->id.index);
+            }
+        }
+        BAIDU_SCOPED_LOCK(_mutex);
+        _files[file_id].live_entries += locations.size();
+    }
+    int64_t delta_time_us = butil::cpuwide_time_us() - now;
+    g_shared_log_append_latency << delta_time_us;
+    if (FLAGS_raft_trace_append_entry_latency && metric) {
+        metric->append_entry_time_us += delta_time_us;
+    }
+
+    now = butil::cpuwide_time_us();
+    if (sync(lsn) != 0) {
+        return 0;
+    }
+    if (FLAGS_raft_trace_append_entry_latency && metric) {
+        metric->sync_segment_time_us += butil::cpuwide_time_us() - now;
+    }
+    return entries.size();
+}
+
+int SharedLogStorageImpl::write_control_record(SharedLogGroup* log_group,
+                                               int type, int64_t index) {
+    butil::IOBuf data;
+    encode_record(0, index, type, _checksum_type, log_group->name,
+                  butil::IOBuf(), &data);
+    int64_t lsn = 0;
+    {
+        BAIDU_SCOPED_LOCK(_write_mutex);
+        int64_t file_id = 0;
+        int64_t offset = 0;
+        if (write(data, &file_id, &offset, &lsn) != 0) {
+            return -1;
+        }
+    }
+    return sync(lsn);
+}
+
+int SharedLogStorageImpl::truncate_prefix(SharedLogGroup* log_group,
+                                          const int64_t first_index_kept) {
+    if (log_group->first_index.load(butil::memory_order_acquire) >=
+        first_index_kept) {
+        return 0;
+    }
+    // NOTE: same as SegmentLogStorage, save meta on the disk first so that
+    // the new process would see the latest `first_log_index'
+    if (save_meta(log_group->name, first_index_kept) != 0) {
+        PLOG(ERROR) << "Fail to save meta, group: " << log_group->name
+                    << " path: " << _path;
+        return -1;
+    }
+    std::vector<EntryLocation> removed;
+    {
+        BAIDU_SCOPED_LOCK(log_group->mutex);
+        log_group->pop_front(first_index_kept, &removed);
+    }
+    release_locations(removed);
+    return 0;
+}
+
+int SharedLogStorageImpl::truncate_suffix(SharedLogGroup* log_group,
+                                          const int64_t last_index_kept) {
+    if (log_group->last_index.load(butil::memory_order_acquire) <=
+        last_index_kept) {
+        return 0;
+    }
+    // The entries are not removed from the files, so the truncating must be
+    // recorded before the following entries to be replayed correctly
+    if (write_control_record(log_group, SHARED_LOG_RECORD_TRUNCATE_SUFFIX,
+                             last_index_kept) != 0) {
+        return -1;
+    }
+    std::vector<EntryLocation> removed;
+    {
+        BAIDU_SCOPED_LOCK(log_group->mutex);
+        log_group->pop_back(last_index_kept, &removed);
+    }
+    release_locations(removed);
+    return 0;
+}
+
+int SharedLogStorageImpl::reset(SharedLogGroup* log_group,
+                                const int64_t next_log_index) {
+    if (write_control_record(log_group, SHARED_LOG_RECORD_RESET,
+                             next_log_index) != 0) {
+        return -1;
+    }
+    std::vector<EntryLocation> removed;
+    {
+        BAIDU_SCOPED_LOCK(log_group->mutex);
+        log_group->clear(next_log_index, &removed);
+    }
+    // The reset record may be removed along with its file, keep the first
+    // log index in the meta as well
+    if (save_meta(log_group->name, next_log_index) != 0) {
+        PLOG(ERROR) << "Fail to save meta, group: " << log_group->name
+                    << " path: " << _path;
+        return -1;
+    }
+    release_locations(removed);
+    return 0;
+}
+
+void SharedLogStorageImpl::release_locations(
+    const std::vector<EntryLocation>& locations) {
+    std::vector<scoped_refptr<SharedLogFile> > purged;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        for (size_t i = 0; i < locations.size(); ++i) {
+            std::map<int64_t, FileInfo>::iterator it =
+                _files.find(locations[i].file_id);
+            if (it != _files.end()) {
+                --it->second.live_entries;
+            }
+        }
+        // Files are removed from the oldest one, as the records in the later
+        // files may change the index of the entries in the former ones
+        while (!_files.empty() && _files.begin()->first != _open_file_id &&
+               _files.begin()->second.live_entries <= 0) {
+            purged.push_back(_files.begin()->second.file);
+            _files.erase(_files.begin());
+        }
+    }
+    for (size_t i = 0; i < purged.size(); ++i) {
+        // The readers holding the file are not affected
+        if (::unlink(purged[i]->path().c_str()) != 0) {
+            PLOG(ERROR) << "Fail to unlink " << purged[i]->path();
+        } else {
+            LOG(INFO) << "Unlinked shared log file `" << purged[i]->path()
+                      << '\'';
+        }
+    }
+}
+
+int SharedLogStorageImpl::save_meta(const std::string& group,
+                                    const int64_t log_index) {
+    LogPBMeta meta;
+    meta.set_first_log_index(log_index);
+    ProtoBufFile pb_file(meta_path(group));
+    const int ret = pb_file.save(&meta, raft_sync_meta());
+    PLOG_IF(ERROR, ret != 0) << "Fail to save meta to " << meta_path(group);
+    return ret;
+}
+
+int SharedLogStorageImpl::load_meta(const std::string& group,
+                                    int64_t* log_index) {
+    ProtoBufFile pb_file(meta_path(group));
+    LogPBMeta meta;
+    if (0 != pb_file.load(&meta)) {
+        PLOG_IF(ERROR, errno != ENOENT)
+            << "Fail to load meta from " << meta_path(group);
+        return -1;
+    }
+    *log_index = meta.first_log_index();
+    return 0;
+}
+
+// SharedLogStorageManager
+//
+// To manage all SharedLogStorageImpl of all the raft instances, the groups
+// on the same path share one SharedLogStorageImpl which is destroyed along
+// with the last group.
+class SharedLogStorageManager {
+   public:
+    static SharedLogStorageManager* GetInstance() {
+        return Singleton<SharedLogStorageManager>::get();
+    }
+
+    scoped_refptr<SharedLogStorageImpl> acquire(const std::string& path) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::map<std::string, Ref>::iterator it = _impls.find(path);
+        if (it != _impls.end()) {
+            ++it->second.nref;
+            return it->second.impl;
+        }
+        scoped_refptr<SharedLogStorageImpl> impl =
+            new SharedLogStorageImpl(path);
+        if (impl->init() != 0) {
+            LOG(ERROR) << "Fail to init shared log, path: " << path;
+            return NULL;
+        }
+        Ref& ref = _impls[path];
+        ref.impl = impl;
+        ref.nref = 1;
+        return impl;
+    }
+
+    void release(const std::string& path) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::map<std::string, Ref>::iterator it = _impls.find(path);
+        if (it != _impls.end() && --it->second.nref == 0) {
+            _impls.erase(it);
+        }
+    }
+
+   private:
+    SharedLogStorageManager() {}
+    ~SharedLogStorageManager() {}
+    DISALLOW_COPY_AND_ASSIGN(SharedLogStorageManager);
+    friend struct DefaultSingletonTraits<SharedLogStorageManager>;
+
+    struct Ref {
+        scoped_refptr<SharedLogStorageImpl> impl;
+        int64_t nref;
+    };
+
+    raft_mutex_t _mutex;
+    std::map<std::string, Ref> _impls;
+};
+
+#define global_shared_log_manager SharedLogStorageManager::GetInstance()
+
+SharedLogStorage::SharedLogStorage(const std::string& uri)
+    : _is_bad(false), _log_group(NULL) {
+    if (parse_shared_path(uri, &_shared_path, &_group) != 0) {
+        LOG(ERROR) << "Fail to parse shared log uri " << uri;
+        _is_bad = true;
+    }
+}
+
+SharedLogStorage::SharedLogStorage() : _is_bad(true), _log_group(NULL) {}
+
+SharedLogStorage::~SharedLogStorage() {
+    if (_impl) {
+        if (_log_group) {
+            _impl->close_group(_log_group);
+            _log_group = NULL;
+        }
+        _impl = NULL;
+        global_shared_log_manager->release(_shared_path);
+    }
+}
+
+int SharedLogStorage::parse_shared_path(const std::string& uri,
+                                        std::string* shared_path,
+                                        std::string* group) {
+    // here uri has removed protocol already, check just for safety
+    butil::StringPiece copied_uri(uri);
+    size_t pos = copied_uri.find("://");
+    if (pos != butil::StringPiece::npos) {
+        copied_uri.remove_prefix(pos + 3 /* length of '://' */);
+    }
+
+    pos = copied_uri.find("shared_path=");
+    if (pos == butil::StringPiece::npos) {
+        return -1;
+    }
+    copied_uri.remove_prefix(pos + 12 /* length of 'shared_path=' */);
+
+    pos = copied_uri.find("&&group=");
+    if (pos == butil::StringPiece::npos) {
+        return -1;
+    }
+    *shared_path = copied_uri.substr(0, pos).as_string();
+    copied_uri.remove_prefix(pos + 8 /* length of '&&group=' */);
+    *group = copied_uri.as_string();
+    if (shared_path->empty() || group->empty() || group->size() > 0xFFFF ||
+        group->find('/') != std::string::npos) {
+        return -1;
+    }
+    return 0;
+}
+
+int SharedLogStorage::init(ConfigurationManager* configuration_manager) {
+    if (_is_bad) {
+        LOG(ERROR) << "SharedLogStorage is bad, path: " << _shared_path
+                   << " group: " << _group;
+        return -1;
+    }
+    if (_impl) {
+        LOG(ERROR) << "SharedLogStorage is already inited, path: "
+                   << _shared_path << " group: " << _group;
+        return -1;
+    }
+    _impl = global_shared_log_manager->acquire(_shared_path);
+    if (!_impl) {
+        return -1;
+    }
+    if (_impl->open_group(_group, configuration_manager, &_log_group) != 0) {
+        _impl = NULL;
+        global_shared_log_manager->release(_shared_path);
+        return -1;
+    }
+    return 0;
+}
+
+int64_t SharedLogStorage::first_log_index() {
+    return _log_group->first_index.load(butil::memory_order_acquire);
+}
+
+int64_t SharedLogStorage::last_log_index() {
+    return _log_group->last_index.load(butil::memory_order_acquire);
+}
+
+LogEntry* SharedLogStorage::get_entry(const int64_t index) {
+    return _impl->get_entry(_log_group, index);
+}
+
+int64_t SharedLogStorage::get_term(const int64_t index) {
+    return _impl->get_term(_log_group, index);
+}
+
+int SharedLogStorage::append_entry(const LogEntry* entry) {
+    std::vector<LogEntry*> entries(1, const_cast<LogEntry*>(entry));
+    return append_entries(entries, NULL) == 1 ? 0 : EIO;
+}
+
+int SharedLogStorage::append_entries(const std::vector<LogEntry*>& entries,
+                                     IOMetric* metric) {
+    return _impl->append_entries(_log_group, entries, metric);
+}
+
+int SharedLogStorage::truncate_prefix(const int64_t first_index_kept) {
+    return _impl->truncate_prefix(_log_group, first_index_kept);
+}
+
+int SharedLogStorage::truncate_suffix(const int64_t last_index_kept) {
+    return _impl->truncate_suffix(_log_group, last_index_kept);
+}
+
+int SharedLogStorage::reset(const int64_t next_log_index) {
+    if (next_log_index <= 0) {
+        LOG(ERROR) << "Invalid next_log_index=" << next_log_index
+                   << " path: " << _shared_path << " group: " << _group;
+        return EINVAL;
+    }
+    return _impl->reset(_log_group, next_log_index);
+}
+
+LogStorage* SharedLogStorage::new_instance(const std::string& uri) const {
+    return new SharedLogStorage(uri);
+}
+
+butil::Status SharedLogStorage::gc_instance(const std::string& uri) const {
+    butil::Status status;
+    std::string shared_path;
+    std::string group;
+    if (parse_shared_path(uri, &shared_path, &group) != 0) {
+        status.set_error(EINVAL, "Invalid shared log uri %s", uri.c_str());
+        return status;
+    }
+    scoped_refptr<SharedLogStorageImpl> impl =
+        global_shared_log_manager->acquire(shared_path);
+    if (!impl) {
+        status.set_error(EIO, "Fail to open shared log in path %s",
+                         shared_path.c_str());
+        return status;
+    }
+    const int rc = impl->drop_group(group);
+    impl = NULL;
+    global_shared_log_manager->release(shared_path);
+    if (rc != 0) {
+        LOG(WARNING) << "Failed to gc group " << group
+                     << " from shared log in path " << shared_path;
+        status.set_error(rc, "Failed to gc group %s from path %s",
+                         group.c_str(), shared_path.c_str());
+        return status;
+    }
+    LOG(INFO) << "Succeed to gc group " << group << " from shared log in path "
+              << shared_path;
+    return status;
+}
+
+}  //  namespace braft
@@ -0,0 +1,100 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BRAFT_SHARED_LOG_H
+#define BRAFT_SHARED_LOG_H
+
+#include <butil/memory/ref_counted.h>
+
+#include <string>
+#include <vector>
+
+#include "braft/log_entry.h"
+#include "braft/storage.h"
+#include "braft/util.h"
+
+namespace braft {
+
+class SharedLogStorageImpl;
+struct SharedLogGroup;
+
+// LogStorage multiplexing the entries of many raft groups into one shared
+// stream of segment files, so that one fsync covers all the groups appending
+// at the same time, which is the same sharing KVBasedMergedMetaStorage gives
+// raft_meta. Each group keeps its own index in memory, while the first log
+// index of each group is saved in its own meta file.
+//
+// Uri of the shared log is:
+//     local-shared://shared_path={shared_path}&&group={group}
+// |group| must be unique among the groups sharing |shared_path| and must be a
+// valid file name.
+//
+// SharedLog layout:
+//      {group}.meta: record first_log_index of the group
+//      wal_00000000000000000001: segment of records of all the groups
+class SharedLogStorage : public LogStorage {
+   public:
+    explicit SharedLogStorage(const std::string& uri);
+    SharedLogStorage();
+    virtual ~SharedLogStorage();
+
+    // init logstorage, check consistency and integrity
+    virtual int init(ConfigurationManager* configuration_manager);
+
+    // first log index in log
+    virtual int64_t first_log_index();
+
+    // last log index in log
+    virtual int64_t last_log_index();
+
+    // get logentry by index
+    virtual LogEntry* get_entry(const int64_t index);
+
+    // get logentry's term by index
+    virtual int64_t get_term(const int64_t index);
+
+    // append entry to log
+    virtual int append_entry(const LogEntry* entry);
+
+    // append entries to log and update IOMetric, return success append number
+    virtual int append_entries(const std::vector<LogEntry*>& entries,
+                               IOMetric* metric);
+
+    // delete logs from storage's head, [1, first_index_kept) will be discarded
+    virtual int truncate_prefix(const int64_t first_index_kept);
+
+    // delete uncommitted logs from storage's tail, (last_index_kept, infinity)
+    // will be discarded
+    virtual int truncate_suffix(const int64_t last_index_kept);
+
+    virtual int reset(const int64_t next_log_index);
+
+    virtual LogStorage* new_instance(const std::string& uri) const;
+
+    virtual butil::Status gc_instance(const std::string& uri) const;
+
+    static int parse_shared_path(const std::string& uri,
+                                 std::string* shared_path, std::string* group);
+
+   private:
+    std::string _shared_path;
+    std::string _group;
+    bool _is_bad;
+    scoped_refptr<SharedLogStorageImpl> _impl;
+    SharedLogGroup* _log_group;
+};
+
+}  //  namespace braft
+
+#endif  // BRAFT_SHARED_LOG_H
@@ -62,6 +62,22 @@ LogStorage* LogStorage::create(const std::string& uri) {
     return type->new_instance(parameter);
 }
 
+int LogStorage::get_entries(const int64_t first_index,
+                            const int64_t last_index, size_t max_bytes,
+                            std::vector<LogEntry*>* entries) {
+    int64_t index = first_index;
+    size_t bytes = 0;
+    for (; index <= last_index && bytes < max_bytes; ++index) {
+        LogEntry* entry = get_entry(index);
+        if (entry == NULL) {
+            break;
+        }
+        bytes += entry->data.length();
+        entries->push_back(entry);
+    }
+    return index - first_index;
+}
+
 butil::Status LogStorage::destroy(const std::string& uri) {
     butil::Status status;
     butil::StringPiece copied_uri(uri);
@@ -53,20 +53,25 @@ struct IOMetric {
           bthread_queue_time_us(0),
           open_segment_time_us(0),
           append_entry_time_us(0),
-          sync_segment_time_us(0) {}
+          sync_segment_time_us(0),
+          sync_wait_time_us(0) {}
 
     int64_t start_time_us;
     int64_t bthread_queue_time_us;
     int64_t open_segment_time_us;
     int64_t append_entry_time_us;
     int64_t sync_segment_time_us;
+    // time spent waiting on the fsync shared with other groups, which is
+    // included in sync_segment_time_us
+    int64_t sync_wait_time_us;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const IOMetric& m) {
     return os << " bthread_queue_time_us: " << m.bthread_queue_time_us
               << " open_segment_time_us: " << m.open_segment_time_us
               << " append_entry_time_us: " << m.append_entry_time_us
-              << " sync_segment_time_us: " << m.sync_segment_time_us;
+              << " sync_segment_time_us: " << m.sync_segment_time_us
+              << " sync_wait_time_us: " << m.sync_wait_time_us;
 }
 
 inline butil::StringPiece parse_uri(butil::StringPiece* uri,
@@ -140,6 +145,13 @@ class LogStorage {
     // get logentry by index
     virtual LogEntry* get_entry(const int64_t index) = 0;
 
+    // get the logentries in [first_index, last_index] and append them to
+    // |entries|, stop once the data of the appended entries reaches
+    // |max_bytes| or an entry is missing. Returns the number of appended
+    // entries. The default implementation calls get_entry one by one
+    virtual int get_entries(const int64_t first_index, const int64_t last_index,
+                            size_t max_bytes, std::vector<LogEntry*>* entries);
+
     // get logentry's term by index
     virtual int64_t get_term(const int64_t index) = 0;
 
@@ -214,5 +214,16 @@ void SyncPoint::Data::Process(const std::string& point, void* cb_arg) {
     cleared_points_.insert(point);
     cv_.notify_all();
 }
+
+void SetupSyncPointsToMockDirectIO() {
+#ifdef O_DIRECT
+    SyncPoint::GetInstance()->SetCallBack(
+        "Segment::open:O_DIRECT", [&](void* arg) {
+            int* val = static_cast<int*>(arg);
+            *val &= ~O_DIRECT;
+        });
+    SyncPoint::GetInstance()->EnableProcessing();
+#endif
+}
 }  // namespace braft
 #endif  // NDEBUG
@@ -157,3 +157,60 @@ TEST_F(BallotBoxTest, even_cluster) {
     ASSERT_EQ(100, caller.committed_index());
 }
 
+
+TEST_F(BallotBoxTest, joint_configuration) {
+    DummyCaller caller;
+    braft::ClosureQueue cq(false);
+    braft::BallotBoxOptions opt;
+    opt.waiter = &caller;
+    opt.closure_queue = &cq;
+    braft::BallotBox cm;
+    ASSERT_EQ(0, cm.init(opt));
+    ASSERT_EQ(0, cm.reset_pending_index(1));
+    std::vector<braft::PeerId> peers;
+    for (int i = 1; i <= 4; ++i) {
+        std::string peer_addr;
+        butil::string_printf(&peer_addr, "192.168.1.%d:8888", i);
+        peers.push_back(braft::PeerId(peer_addr));
+    }
+    // peers[2] is replaced by peers[3]
+    braft::Configuration old_conf(peers);
+    old_conf.remove_peer(peers[3]);
+    braft::Configuration new_conf(peers);
+    new_conf.remove_peer(peers[2]);
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(0, cm.append_pending_task(new_conf, &old_conf, NULL));
+    }
+    braft::BallotBoxStatus status;
+    cm.get_status(&status);
+    ASSERT_EQ(1, status.pending_index);
+    ASSERT_EQ(10, status.pending_queue_size);
+
+    ASSERT_EQ(0, cm.commit_at(1, 10, peers[0]));
+    ASSERT_EQ(0, cm.commit_at(1, 10, peers[3]));
+    // A quorum of the new configuration only
+    ASSERT_EQ(0, caller.committed_index());
+    ASSERT_EQ(0, cm.commit_at(1, 5, peers[2]));
+    ASSERT_EQ(5, caller.committed_index());
+
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(0, cm.append_pending_task(new_conf, NULL, NULL));
+    }
+    ASSERT_EQ(0, cm.commit_at(6, 15, peers[3]));
+    ASSERT_EQ(5, caller.committed_index());
+    // The logs before are committed along with the ones of the new
+    // configuration
+    ASSERT_EQ(0, cm.commit_at(11, 15, peers[0]));
+    ASSERT_EQ(15, caller.committed_index());
+    // Acked already
+    ASSERT_EQ(0, cm.commit_at(1, 12, peers[0]));
+    ASSERT_EQ(15, caller.committed_index());
+    ASSERT_EQ(ERANGE, cm.commit_at(16, 21, peers[1]));
+    ASSERT_EQ(0, cm.commit_at(1, 20, peers[1]));
+    ASSERT_EQ(15, caller.committed_index());
+    ASSERT_EQ(0, cm.commit_at(16, 20, peers[3]));
+    ASSERT_EQ(20, caller.committed_index());
+    braft::BallotBoxStatus final_status;
+    cm.get_status(&final_status);
+    ASSERT_EQ(0, final_status.pending_queue_size);
+}
@@ -3,14 +3,17 @@
 // Author: Zhangyi Chen (chenzhangyi01@baidu.com)
 // Date: 2016/02/23 16:22:15
 
+#include <bthread/bthread.h>
 #include <butil/fd_guard.h>
 #include <butil/logging.h>
+#include <butil/string_printf.h>
 #include <butil/time.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "braft/fsync.h"
 #include "common.h"
 
 class FsyncTest : public testing::Test {
@@ -56,3 +59,56 @@ TEST_F(FsyncTest, benchmark_append) {
 
 TEST_F(FsyncTest, benchmark_randomly_write) {
 }
+
+struct SharedFsyncArg {
+    int index;
+    int64_t wait_time_us;
+    int ret;
+};
+
+static void* shared_fsync_thread(void* arg) {
+    SharedFsyncArg* a = (SharedFsyncArg*)arg;
+    std::string path = butil::string_printf("fsync.data.%d", a->index);
+    butil::fd_guard fd(::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644));
+    struct stat st_buf;
+    if (fd < 0 || fstat(fd, &st_buf) != 0) {
+        a->ret = -1;
+        return NULL;
+    }
+    char buf[1024] = {0};
+    for (int i = 0; i < 100 && a->ret == 0; ++i) {
+        if (write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+            a->ret = -1;
+            break;
+        }
+        int64_t wait_time_us = 0;
+        a->ret = braft::global_fsync_coordinator->sync(fd, st_buf.st_dev,
+                                                        &wait_time_us);
+        a->wait_time_us += wait_time_us;
+    }
+    ::unlink(path.c_str());
+    return NULL;
+}
+
+TEST_F(FsyncTest, shared_fsync) {
+    const int N = 8;
+    SharedFsyncArg args[N];
+    bthread_t tids[N];
+    butil::Timer timer;
+    timer.start();
+    for (int i = 0; i < N; ++i) {
+        args[i].index = i;
+        args[i].wait_time_us = 0;
+        args[i].ret = 0;
+        ASSERT_EQ(0, bthread_start_background(&tids[i], NULL,
+                                              shared_fsync_thread, &args[i]));
+    }
+    for (int i = 0; i < N; ++i) {
+        bthread_join(tids[i], NULL);
+        ASSERT_EQ(0, args[i].ret);
+        ASSERT_GT(args[i].wait_time_us, 0);
+    }
+    timer.stop();
+    LOG(INFO) << "shared fsync of " << N << " files takes "
+              << timer.u_elapsed();
+}
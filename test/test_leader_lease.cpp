@@ -237,6 +237,86 @@ TEST_F(BaseLeaseTest, triple_node) {
     cluster.stop_all();
 }
 
+class LeaseReadClosure : public braft::ReadIndexClosure {
+public:
+    LeaseReadClosure(bthread::CountdownEvent* cond, int64_t min_index)
+        : _cond(cond), _min_index(min_index) {}
+    void Run() {
+        EXPECT_TRUE(status().ok()) << status();
+        EXPECT_GE(index(), _min_index);
+        _cond->signal();
+        delete this;
+    }
+private:
+    bthread::CountdownEvent* _cond;
+    int64_t _min_index;
+};
+
+TEST_F(BaseLeaseTest, lease_read) {
+    ::system("rm -rf data");
+    std::vector<braft::PeerId> peers;
+    for (int i = 0; i < 3; i++) {
+        braft::PeerId peer;
+        peer.addr.ip = butil::my_ip();
+        peer.addr.port = 5006 + i;
+        peer.idx = 0;
+
+        peers.push_back(peer);
+    }
+
+    // start cluster
+    Cluster cluster("unittest", peers, 500, 10);
+    for (size_t i = 0; i < peers.size(); i++) {
+        ASSERT_EQ(0, cluster.start(peers[i].addr));
+    }
+
+    // elect leader
+    cluster.wait_leader();
+    braft::Node* leader = cluster.leader();
+    ASSERT_TRUE(leader != NULL);
+    LOG(WARNING) << "leader is elected " << leader->node_id();
+
+    braft::LeaderLeaseStatus lease_status;
+    leader->get_leader_lease_status(&lease_status);
+    while (lease_status.state == braft::LEASE_NOT_READY) {
+        BRAFT_VLOG << "waiting lease become valid";
+        bthread_usleep(100 * 1000);
+        leader->get_leader_lease_status(&lease_status);
+    }
+    ASSERT_EQ(lease_status.state, braft::LEASE_VALID);
+
+    bthread::CountdownEvent cond(10);
+    for (int i = 0; i < 10; i++) {
+        butil::IOBuf data;
+        data.append("hello");
+        braft::Task task;
+        task.data = &data;
+        task.done = NEW_APPLYCLOSURE(&cond, 0);
+        leader->apply(task);
+    }
+    cond.wait();
+    const int64_t committed_index =
+            leader->_impl->_ballot_box->last_committed_index();
+
+    // served by the lease without any round of heartbeats
+    cond.reset(10);
+    for (int i = 0; i < 10; i++) {
+        leader->lease_read(new LeaseReadClosure(&cond, committed_index));
+    }
+    cond.wait();
+    ASSERT_EQ(0, leader->_impl->_read_index_version);
+
+    // followers have no lease and fall back to read_index
+    std::vector<braft::Node*> followers;
+    cluster.followers(&followers);
+    cond.reset(1);
+    followers[0]->lease_read(new LeaseReadClosure(&cond, committed_index));
+    cond.wait();
+    ASSERT_LT(0, leader->_impl->_read_index_version);
+
+    cluster.stop_all();
+}
+
 TEST_F(BaseLeaseTest, change_peers) {
     ::system("rm -rf data");
     std::vector<braft::PeerId> peers;
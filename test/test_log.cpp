@@ -17,6 +17,7 @@
 
 #include "braft/log.h"
 #include "braft/storage.h"
+#include "braft/sync_point.h"
 #include "braft/util.h"
 #include "common.h"
 
@@ -1370,3 +1371,700 @@ TEST_F(LogStorageTest, data_corrupt) {
     delete configuration_manager;
 }
 
+
+static void corrupt_byte(const std::string& path, off_t offset) {
+    int fd = ::open(path.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    char c = 0;
+    ASSERT_EQ(1, pread(fd, &c, 1, offset));
+    c = ~c;
+    ASSERT_EQ(1, pwrite(fd, &c, 1, offset));
+    ::close(fd);
+}
+
+TEST_F(LogStorageTest, torn_entry_in_preallocated_segment) {
+    braft::FLAGS_raft_recover_log_from_corrupt = false;
+    ::system("rm -rf data && mkdir data");
+    braft::Segment* seg = new braft::Segment("./data", 1, 0);
+    ASSERT_EQ(0, seg->create());
+    for (int i = 1; i <= 10; i++) {
+        braft::LogEntry* entry = new braft::LogEntry();
+        entry->type = braft::ENTRY_TYPE_DATA;
+        entry->id.term = 1;
+        entry->id.index = i;
+        char data_buf[128];
+        snprintf(data_buf, sizeof(data_buf), "hello, world: %d", i);
+        entry->data.append(data_buf);
+        ASSERT_EQ(0, seg->append(entry));
+        entry->Release();
+    }
+    braft::Segment::LogMeta meta9;
+    braft::Segment::LogMeta meta10;
+    braft::Segment::LogMeta meta5;
+    ASSERT_EQ(0, seg->_get_meta(9, &meta9));
+    ASSERT_EQ(0, seg->_get_meta(10, &meta10));
+    ASSERT_EQ(0, seg->_get_meta(5, &meta5));
+    const std::string path = "./data/" + seg->file_name();
+    delete seg;
+
+    // the last entry before the zero-filled tail is torn
+    ASSERT_EQ(0, ::truncate(path.c_str(), meta10.offset + meta10.length + 4096));
+    corrupt_byte(path, meta10.offset + meta10.length - 1);
+    braft::ConfigurationManager configuration_manager;
+    seg = new braft::Segment("./data", 1, 0);
+    ASSERT_EQ(0, seg->load(&configuration_manager));
+    ASSERT_EQ(9, seg->last_index());
+    delete seg;
+
+    // an entry followed by the written ones is corrupted
+    ASSERT_EQ(0, ::truncate(path.c_str(), meta9.offset + meta9.length + 4096));
+    corrupt_byte(path, meta5.offset + meta5.length - 1);
+    seg = new braft::Segment("./data", 1, 0);
+    ASSERT_NE(0, seg->load(&configuration_manager));
+    delete seg;
+    braft::FLAGS_raft_recover_log_from_corrupt = true;
+    seg = new braft::Segment("./data", 1, 0);
+    ASSERT_EQ(0, seg->load(&configuration_manager));
+    ASSERT_EQ(4, seg->last_index());
+    delete seg;
+    braft::FLAGS_raft_recover_log_from_corrupt = false;
+}
+
+namespace braft {
+DECLARE_int32(raft_segment_pool_size);
+DECLARE_bool(raft_segment_prealloc_zero_fill);
+}
+
+static int count_files_with_prefix(const char* path, const char* prefix) {
+    int count = 0;
+    butil::DirReaderPosix dir_reader(path);
+    while (dir_reader.Next()) {
+        if (strncmp(dir_reader.name(), prefix, strlen(prefix)) == 0) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+static void wait_pool_files(const char* path, int expected) {
+    for (int i = 0; i < 500; ++i) {
+        if (count_files_with_prefix(path, "log_pool_") == expected &&
+            count_files_with_prefix(path, "log_recycle_") == 0) {
+            return;
+        }
+        ::usleep(10 * 1000);
+    }
+}
+
+TEST_F(LogStorageTest, segment_file_pool) {
+    int32_t saved_max_segment_size = braft::FLAGS_raft_max_segment_size;
+    braft::FLAGS_raft_max_segment_size = 4096;
+    braft::FLAGS_raft_segment_pool_size = 2;
+    for (int zero_fill = 0; zero_fill < 2; ++zero_fill) {
+        braft::FLAGS_raft_segment_prealloc_zero_fill = zero_fill;
+        system("rm -rf ./data");
+        braft::SegmentLogStorage* storage =
+                new braft::SegmentLogStorage("./data");
+        braft::ConfigurationManager* configuration_manager =
+                new braft::ConfigurationManager;
+        ASSERT_EQ(0, storage->init(configuration_manager));
+        wait_pool_files("./data", 2);
+        ASSERT_EQ(2, count_files_with_prefix("./data", "log_pool_"));
+
+        const int N = 1000;
+        for (int i = 1; i <= N; ++i) {
+            braft::LogEntry* entry = new braft::LogEntry;
+            entry->type = braft::ENTRY_TYPE_DATA;
+            entry->id.term = 1;
+            entry->id.index = i;
+            std::string data;
+            butil::string_printf(&data, "hello_%d", i);
+            entry->data.append(data);
+            ASSERT_EQ(0, storage->append_entry(entry));
+            entry->Release();
+        }
+        ASSERT_GT(storage->segments().size(), 2u);
+        wait_pool_files("./data", 2);
+
+        // The dropped segments go back to the pool while it has room, the
+        // others are unlinked
+        braft::FLAGS_raft_segment_pool_size = 4;
+        const size_t nsegments = storage->segments().size();
+        ASSERT_EQ(0, storage->truncate_prefix(N / 2));
+        ASSERT_GT(nsegments - storage->segments().size(), 2u);
+        wait_pool_files("./data", 4);
+        ASSERT_EQ(4, count_files_with_prefix("./data", "log_pool_"));
+        ASSERT_EQ(0, count_files_with_prefix("./data", "log_recycle_"));
+        braft::FLAGS_raft_segment_pool_size = 2;
+
+        // Restart with the zero-filled tail of the open segment
+        delete storage;
+        delete configuration_manager;
+        storage = new braft::SegmentLogStorage("./data");
+        configuration_manager = new braft::ConfigurationManager;
+        ASSERT_EQ(0, storage->init(configuration_manager));
+        ASSERT_EQ(N / 2, storage->first_log_index());
+        ASSERT_EQ(N, storage->last_log_index());
+        for (int i = N / 2; i <= N; ++i) {
+            braft::LogEntry* entry = storage->get_entry(i);
+            ASSERT_TRUE(entry != NULL);
+            ASSERT_EQ(i, entry->id.index);
+            std::string data;
+            butil::string_printf(&data, "hello_%d", i);
+            ASSERT_EQ(data, entry->data.to_string());
+            entry->Release();
+        }
+        delete storage;
+        delete configuration_manager;
+    }
+    braft::FLAGS_raft_segment_pool_size = 0;
+    braft::FLAGS_raft_segment_prealloc_zero_fill = false;
+    braft::FLAGS_raft_max_segment_size = saved_max_segment_size;
+}
+
+namespace braft {
+DECLARE_bool(raft_segment_direct_io);
+}
+
+static void append_direct_io_entries(braft::LogStorage* storage,
+                                     int64_t first_index, int64_t last_index,
+                                     int64_t term) {
+    std::vector<braft::LogEntry*> entries;
+    for (int64_t i = first_index; i <= last_index; ++i) {
+        braft::LogEntry* entry = new braft::LogEntry();
+        entry->type = braft::ENTRY_TYPE_DATA;
+        entry->id.term = term;
+        entry->id.index = i;
+        // Entries of various sizes cross the block boundaries
+        entry->data.append(std::string(i % 5000, 'a' + i % 26));
+        entries.push_back(entry);
+    }
+    ASSERT_EQ((int)entries.size(), storage->append_entries(entries, NULL));
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i]->Release();
+    }
+}
+
+static void check_direct_io_entries(braft::LogStorage* storage,
+                                    int64_t first_index, int64_t last_index,
+                                    int64_t term) {
+    for (int64_t i = first_index; i <= last_index; ++i) {
+        braft::LogEntry* entry = storage->get_entry(i);
+        ASSERT_TRUE(entry != NULL);
+        ASSERT_EQ(term, entry->id.term);
+        ASSERT_EQ(std::string(i % 5000, 'a' + i % 26), entry->data.to_string());
+        entry->Release();
+    }
+}
+
+TEST_F(LogStorageTest, direct_io) {
+    // tmpfs doesn't support O_DIRECT, the aligned writes are still issued
+    braft::SetupSyncPointsToMockDirectIO();
+    int32_t saved_max_segment_size = braft::FLAGS_raft_max_segment_size;
+    braft::FLAGS_raft_max_segment_size = 64 * 1024;
+    braft::FLAGS_raft_segment_direct_io = true;
+    system("rm -rf ./data");
+    braft::SegmentLogStorage* storage = new braft::SegmentLogStorage("./data");
+    braft::ConfigurationManager* configuration_manager =
+            new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+
+    for (int64_t i = 1; i <= 200; i += 10) {
+        append_direct_io_entries(storage, i, i + 9, 1);
+        // Each batch is padded to the block boundary
+        ASSERT_EQ(0, storage->_open_segment->bytes() % 4096);
+    }
+    braft::LogEntry* conf = new braft::LogEntry();
+    conf->type = braft::ENTRY_TYPE_CONFIGURATION;
+    conf->id = braft::LogId(201, 1);
+    conf->peers.push_back(braft::PeerId("1.1.1.1:1000:0"));
+    ASSERT_EQ(0, storage->append_entry(conf));
+    conf->Release();
+    ASSERT_GT(storage->segments().size(), 1u);
+    check_direct_io_entries(storage, 1, 200, 1);
+
+    // Truncate in the middle of a block, the partial block is rewritten by
+    // the next append
+    ASSERT_EQ(0, storage->truncate_suffix(195));
+    append_direct_io_entries(storage, 196, 210, 2);
+    check_direct_io_entries(storage, 1, 195, 1);
+    check_direct_io_entries(storage, 196, 210, 2);
+
+    // Padding records are skipped after restart
+    delete storage;
+    delete configuration_manager;
+    storage = new braft::SegmentLogStorage("./data");
+    configuration_manager = new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+    ASSERT_EQ(1, storage->first_log_index());
+    ASSERT_EQ(210, storage->last_log_index());
+    // The closed segments open their O_DIRECT fds on the first read
+    scoped_refptr<braft::Segment> first_segment =
+            storage->segments().begin()->second;
+    ASSERT_EQ(braft::Segment::DIRECT_FD_UNOPENED,
+              first_segment->_direct_fd.load());
+    check_direct_io_entries(storage, 1, 195, 1);
+    ASSERT_GE(first_segment->_direct_fd.load(), 0);
+    check_direct_io_entries(storage, 196, 210, 2);
+    append_direct_io_entries(storage, 211, 220, 2);
+    check_direct_io_entries(storage, 196, 220, 2);
+
+    delete storage;
+    delete configuration_manager;
+    braft::FLAGS_raft_segment_direct_io = false;
+    braft::FLAGS_raft_max_segment_size = saved_max_segment_size;
+    braft::SyncPoint::GetInstance()->ClearAllCallBacks();
+    braft::SyncPoint::GetInstance()->DisableProcessing();
+}
+
+TEST_F(LogStorageTest, append_batch) {
+    int32_t saved_max_segment_size = braft::FLAGS_raft_max_segment_size;
+    braft::FLAGS_raft_max_segment_size = 16 * 1024;
+    system("rm -rf ./data");
+    braft::SegmentLogStorage* storage = new braft::SegmentLogStorage("./data");
+    braft::ConfigurationManager* configuration_manager =
+            new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+
+    // Batches larger than a segment are split at the segment size
+    const int N = 256;
+    for (int64_t first = 1; first <= 4 * N; first += N) {
+        std::vector<braft::LogEntry*> entries;
+        for (int64_t i = first; i < first + N; ++i) {
+            braft::LogEntry* entry = new braft::LogEntry();
+            entry->type = braft::ENTRY_TYPE_DATA;
+            entry->id.term = 1;
+            entry->id.index = i;
+            entry->data.append(butil::string_printf("hello_%" PRId64, i));
+            entries.push_back(entry);
+        }
+        ASSERT_EQ(N, storage->append_entries(entries, NULL));
+        for (size_t i = 0; i < entries.size(); ++i) {
+            entries[i]->Release();
+        }
+    }
+    ASSERT_EQ(4 * N, storage->last_log_index());
+    braft::SegmentLogStorage::SegmentMap segments = storage->segments();
+    ASSERT_GT(segments.size(), 1u);
+    for (braft::SegmentLogStorage::SegmentMap::const_iterator it =
+                segments.begin(); it != segments.end(); ++it) {
+        // Never exceeds the limit by more than one entry
+        ASSERT_LT(it->second->bytes(), braft::FLAGS_raft_max_segment_size + 64);
+    }
+
+    delete storage;
+    delete configuration_manager;
+    storage = new braft::SegmentLogStorage("./data");
+    configuration_manager = new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+    ASSERT_EQ(4 * N, storage->last_log_index());
+    for (int64_t i = 1; i <= 4 * N; ++i) {
+        braft::LogEntry* entry = storage->get_entry(i);
+        ASSERT_TRUE(entry != NULL);
+        ASSERT_EQ(butil::string_printf("hello_%" PRId64, i),
+                  entry->data.to_string());
+        entry->Release();
+    }
+    delete storage;
+    delete configuration_manager;
+    braft::FLAGS_raft_max_segment_size = saved_max_segment_size;
+}
+
+namespace braft {
+DECLARE_bool(raft_segment_io_uring);
+DECLARE_bool(raft_sync);
+}
+
+TEST_F(LogStorageTest, io_uring) {
+    // Falls back to the blocking syscalls if io_uring is not available
+    int32_t saved_max_segment_size = braft::FLAGS_raft_max_segment_size;
+    bool saved_raft_sync = braft::FLAGS_raft_sync;
+    braft::FLAGS_raft_max_segment_size = 16 * 1024;
+    braft::FLAGS_raft_segment_io_uring = true;
+    braft::FLAGS_raft_sync = true;
+    system("rm -rf ./data");
+    braft::SegmentLogStorage* storage = new braft::SegmentLogStorage("./data");
+    braft::ConfigurationManager* configuration_manager =
+            new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+
+    for (int64_t i = 1; i <= 1000; i += 100) {
+        append_direct_io_entries(storage, i, i + 99, 1);
+    }
+    ASSERT_GT(storage->segments().size(), 1u);
+    check_direct_io_entries(storage, 1, 1000, 1);
+    ASSERT_EQ(0, storage->truncate_suffix(950));
+    append_direct_io_entries(storage, 951, 1000, 2);
+
+    delete storage;
+    delete configuration_manager;
+    storage = new braft::SegmentLogStorage("./data");
+    configuration_manager = new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+    ASSERT_EQ(1000, storage->last_log_index());
+    check_direct_io_entries(storage, 1, 950, 1);
+    check_direct_io_entries(storage, 951, 1000, 2);
+
+    delete storage;
+    delete configuration_manager;
+    braft::FLAGS_raft_segment_io_uring = false;
+    braft::FLAGS_raft_sync = saved_raft_sync;
+    braft::FLAGS_raft_max_segment_size = saved_max_segment_size;
+}
+
+TEST_F(LogStorageTest, get_entries) {
+    int32_t saved_max_segment_size = braft::FLAGS_raft_max_segment_size;
+    braft::FLAGS_raft_max_segment_size = 16 * 1024;
+    system("rm -rf ./data");
+    braft::SegmentLogStorage* storage = new braft::SegmentLogStorage("./data");
+    braft::ConfigurationManager* configuration_manager =
+            new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+    for (int64_t i = 1; i <= 1000; i += 100) {
+        append_direct_io_entries(storage, i, i + 99, 1);
+    }
+    braft::LogEntry* conf = new braft::LogEntry();
+    conf->type = braft::ENTRY_TYPE_CONFIGURATION;
+    conf->id = braft::LogId(1001, 1);
+    conf->peers.push_back(braft::PeerId("1.1.1.1:1000:0"));
+    ASSERT_EQ(0, storage->append_entry(conf));
+    conf->Release();
+    ASSERT_GT(storage->segments().size(), 10u);
+
+    // Across the segments
+    std::vector<braft::LogEntry*> entries;
+    ASSERT_EQ(1001, storage->get_entries(1, 2000, SIZE_MAX, &entries));
+    ASSERT_EQ(1001u, entries.size());
+    for (size_t i = 0; i < 1000; ++i) {
+        const int64_t index = i + 1;
+        ASSERT_EQ(index, entries[i]->id.index);
+        ASSERT_EQ(1, entries[i]->id.term);
+        ASSERT_EQ(std::string(index % 5000, 'a' + index % 26),
+                  entries[i]->data.to_string());
+    }
+    ASSERT_EQ(braft::ENTRY_TYPE_CONFIGURATION, entries[1000]->type);
+    ASSERT_EQ(1u, entries[1000]->peers.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i]->Release();
+    }
+    entries.clear();
+
+    // Stop once max_bytes is reached
+    const int n = storage->get_entries(500, 1000, 2000, &entries);
+    ASSERT_GT(n, 0);
+    ASSERT_LT(n, 501);
+    ASSERT_EQ((size_t)n, entries.size());
+    size_t bytes = 0;
+    const size_t last_bytes = entries.back()->data.length();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        ASSERT_EQ(500 + (int64_t)i, entries[i]->id.index);
+        bytes += entries[i]->data.length();
+        entries[i]->Release();
+    }
+    ASSERT_GE(bytes, 2000u);
+    ASSERT_LT(bytes - last_bytes, 2000u);
+    entries.clear();
+
+    // Out of range
+    ASSERT_EQ(0, storage->get_entries(1002, 1010, SIZE_MAX, &entries));
+    ASSERT_EQ(0, storage->truncate_prefix(101));
+    ASSERT_EQ(0, storage->get_entries(1, 10, SIZE_MAX, &entries));
+    ASSERT_TRUE(entries.empty());
+
+    delete storage;
+    delete configuration_manager;
+    braft::FLAGS_raft_max_segment_size = saved_max_segment_size;
+}
+
+namespace braft {
+DECLARE_int32(raft_segment_load_read_size);
+DECLARE_int32(raft_segment_load_concurrency);
+}
+
+TEST_F(LogStorageTest, parallel_load) {
+    int32_t saved_max_segment_size = braft::FLAGS_raft_max_segment_size;
+    braft::FLAGS_raft_max_segment_size = 8 * 1024;
+    system("rm -rf ./data");
+    braft::SegmentLogStorage* storage = new braft::SegmentLogStorage("./data");
+    braft::ConfigurationManager* configuration_manager =
+            new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+    int64_t index = 1;
+    for (int i = 0; i < 50; ++i) {
+        append_direct_io_entries(storage, index, index + 19, 1);
+        index += 20;
+        // A configuration in each segment
+        braft::LogEntry* conf = new braft::LogEntry();
+        conf->type = braft::ENTRY_TYPE_CONFIGURATION;
+        conf->id = braft::LogId(index, 1);
+        conf->peers.push_back(braft::PeerId(butil::EndPoint(), i));
+        ASSERT_EQ(0, storage->append_entry(conf));
+        conf->Release();
+        ++index;
+    }
+    const int64_t last_index = index - 1;
+    ASSERT_GT(storage->segments().size(), 20u);
+    delete storage;
+    delete configuration_manager;
+
+    // Small reads cross the entries
+    braft::FLAGS_raft_segment_load_read_size = 100;
+    braft::FLAGS_raft_segment_load_concurrency = 4;
+    storage = new braft::SegmentLogStorage("./data");
+    configuration_manager = new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+    ASSERT_EQ(last_index, storage->last_log_index());
+    for (int i = 0; i < 50; ++i) {
+        const int64_t conf_index = (i + 1) * 21;
+        braft::ConfigurationEntry conf;
+        configuration_manager->get(conf_index, &conf);
+        ASSERT_EQ(conf_index, conf.id.index);
+        ASSERT_TRUE(conf.conf.contains(braft::PeerId(butil::EndPoint(), i)));
+    }
+    for (int64_t i = 1; i <= last_index; ++i) {
+        if (i % 21 != 0) {
+            check_direct_io_entries(storage, i, i, 1);
+        }
+    }
+    delete storage;
+    delete configuration_manager;
+
+    // A broken segment fails the loading
+    braft::SegmentLogStorage::SegmentMap segments;
+    storage = new braft::SegmentLogStorage("./data");
+    configuration_manager = new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+    segments = storage->segments();
+    std::string victim = "./data/" + (++segments.begin())->second->file_name();
+    segments.clear();
+    delete storage;
+    delete configuration_manager;
+    ASSERT_EQ(0, truncate(victim.c_str(), 10));
+    storage = new braft::SegmentLogStorage("./data");
+    configuration_manager = new braft::ConfigurationManager;
+    ASSERT_NE(0, storage->init(configuration_manager));
+    delete storage;
+    delete configuration_manager;
+
+    braft::FLAGS_raft_segment_load_read_size = 1024 * 1024;
+    braft::FLAGS_raft_segment_load_concurrency = 8;
+    braft::FLAGS_raft_max_segment_size = saved_max_segment_size;
+}
+
+TEST_F(LogStorageTest, index_sidecar) {
+    int32_t saved_max_segment_size = braft::FLAGS_raft_max_segment_size;
+    braft::FLAGS_raft_max_segment_size = 8 * 1024;
+    system("rm -rf ./data");
+    braft::SegmentLogStorage* storage = new braft::SegmentLogStorage("./data");
+    braft::ConfigurationManager* configuration_manager =
+            new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+    int64_t index = 1;
+    for (int i = 0; i < 10; ++i) {
+        append_direct_io_entries(storage, index, index + 19, 1);
+        index += 20;
+        braft::LogEntry* conf = new braft::LogEntry();
+        conf->type = braft::ENTRY_TYPE_CONFIGURATION;
+        conf->id = braft::LogId(index, 1);
+        conf->peers.push_back(braft::PeerId(butil::EndPoint(), i));
+        ASSERT_EQ(0, storage->append_entry(conf));
+        conf->Release();
+        ++index;
+    }
+    const int64_t last_index = index - 1;
+    std::vector<std::string> index_paths;
+    braft::SegmentLogStorage::SegmentMap segments = storage->segments();
+    for (braft::SegmentLogStorage::SegmentMap::iterator it = segments.begin();
+            it != segments.end(); ++it) {
+        index_paths.push_back(it->second->_index_path());
+        ASSERT_EQ(0, access(index_paths.back().c_str(), F_OK));
+    }
+    ASSERT_GT(index_paths.size(), 3u);
+    segments.clear();
+    delete storage;
+    delete configuration_manager;
+
+    // Corrupt one sidecar and remove another, both segments are scanned
+    int fd = ::open(index_paths[0].c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(1, pwrite(fd, "x", 1, 50));
+    ::close(fd);
+    ASSERT_EQ(0, ::unlink(index_paths[1].c_str()));
+
+    storage = new braft::SegmentLogStorage("./data");
+    configuration_manager = new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+    ASSERT_EQ(last_index, storage->last_log_index());
+    for (int i = 0; i < 10; ++i) {
+        const int64_t conf_index = (i + 1) * 21;
+        braft::ConfigurationEntry conf;
+        configuration_manager->get(conf_index, &conf);
+        ASSERT_EQ(conf_index, conf.id.index);
+        ASSERT_TRUE(conf.conf.contains(braft::PeerId(butil::EndPoint(), i)));
+    }
+    for (int64_t i = 1; i <= last_index; ++i) {
+        if (i % 21 != 0) {
+            check_direct_io_entries(storage, i, i, 1);
+        }
+    }
+
+    // Truncating a closed segment drops its sidecar and the ones after
+    segments = storage->segments();
+    scoped_refptr<braft::Segment> segment = (++segments.begin())->second;
+    segments.clear();
+    const std::string truncated_path = segment->_index_path();
+    const int64_t last_index_kept = segment->first_index() + 5;
+    ASSERT_EQ(0, access(truncated_path.c_str(), F_OK));
+    ASSERT_EQ(0, storage->truncate_suffix(last_index_kept));
+    ASSERT_NE(0, access(truncated_path.c_str(), F_OK));
+    ASSERT_NE(0, access(index_paths.back().c_str(), F_OK));
+    segment = NULL;
+    delete storage;
+    delete configuration_manager;
+
+    storage = new braft::SegmentLogStorage("./data");
+    configuration_manager = new braft::ConfigurationManager;
+    ASSERT_EQ(0, storage->init(configuration_manager));
+    ASSERT_EQ(last_index_kept, storage->last_log_index());
+    check_direct_io_entries(storage, last_index_kept, last_index_kept, 1);
+    delete storage;
+    delete configuration_manager;
+
+    braft::FLAGS_raft_max_segment_size = saved_max_segment_size;
+}
+
+TEST_F(LogStorageTest, term_runs) {
+    system("rm -rf ./data");
+    ::system("mkdir data/");
+    scoped_refptr<braft::Segment> seg = new braft::Segment("./data", 1L, 0);
+    ASSERT_EQ(0, seg->create());
+    // terms of the entries 1-30 are 1, 1, 1, 2, 2, 2, 3, 3, 3, ...
+    for (int64_t i = 1; i <= 30; ++i) {
+        braft::LogEntry* entry = new braft::LogEntry();
+        entry->type = braft::ENTRY_TYPE_DATA;
+        entry->id = braft::LogId(i, (i + 2) / 3);
+        entry->data.append(std::string(i, 'a'));
+        ASSERT_EQ(0, seg->append(entry));
+        entry->Release();
+    }
+    ASSERT_EQ(10u, seg->_term_runs.size());
+    for (int64_t i = 1; i <= 30; ++i) {
+        ASSERT_EQ((i + 2) / 3, seg->get_term(i));
+        braft::LogEntry* entry = seg->get(i);
+        ASSERT_TRUE(entry != NULL);
+        ASSERT_EQ(std::string(i, 'a'), entry->data.to_string());
+        entry->Release();
+    }
+    ASSERT_EQ(0, seg->get_term(31));
+
+    // Truncate in the middle of a run and right after a run
+    ASSERT_EQ(0, seg->truncate(20));
+    ASSERT_EQ(7u, seg->_term_runs.size());
+    ASSERT_EQ(7, seg->get_term(20));
+    ASSERT_EQ(0, seg->truncate(18));
+    ASSERT_EQ(6u, seg->_term_runs.size());
+    ASSERT_EQ(6, seg->get_term(18));
+
+    // Appending the same term extends the last run
+    for (int64_t i = 19; i <= 20; ++i) {
+        braft::LogEntry* entry = new braft::LogEntry();
+        entry->type = braft::ENTRY_TYPE_DATA;
+        entry->id = braft::LogId(i, i == 19 ? 6 : 10);
+        ASSERT_EQ(0, seg->append(entry));
+        entry->Release();
+    }
+    ASSERT_EQ(7u, seg->_term_runs.size());
+    ASSERT_EQ(6, seg->get_term(19));
+    ASSERT_EQ(10, seg->get_term(20));
+
+    // Loading the segment rebuilds the same runs
+    scoped_refptr<braft::Segment> loaded = new braft::Segment("./data", 1L, 0);
+    braft::ConfigurationManager configuration_manager;
+    ASSERT_EQ(0, loaded->load(&configuration_manager));
+    ASSERT_EQ(seg->_term_runs, loaded->_term_runs);
+    ASSERT_EQ(seg->_offsets, loaded->_offsets);
+}
+
+TEST_F(LogStorageTest, reuse_data_checksum) {
+    system("rm -rf ./data");
+    ::system("mkdir data/");
+    // CHECKSUM_CRC32
+    scoped_refptr<braft::Segment> seg = new braft::Segment("./data", 1L, 1);
+    ASSERT_EQ(0, seg->create());
+    for (int64_t i = 1; i <= 3; ++i) {
+        braft::LogEntry* entry = new braft::LogEntry();
+        entry->type = braft::ENTRY_TYPE_DATA;
+        entry->id = braft::LogId(i, 1);
+        entry->data.append(std::string(100, 'a' + i));
+        if (i == 2) {
+            // A checksum from the leader is persisted as is
+            entry->set_data_crc32c(braft::crc32(entry->data) + 1);
+        } else if (i == 3) {
+            entry->set_data_crc32c(braft::crc32(entry->data));
+        }
+        ASSERT_EQ(0, seg->append(entry));
+        entry->Release();
+    }
+    braft::LogEntry* entry = seg->get(1);
+    ASSERT_TRUE(entry != NULL);
+    // The checksum verified on reading is kept in the entry
+    ASSERT_EQ(braft::crc32(entry->data),
+              (uint32_t)entry->_data_crc32c.load());
+    entry->Release();
+    ASSERT_TRUE(seg->get(2) == NULL);
+    entry = seg->get(3);
+    ASSERT_TRUE(entry != NULL);
+    ASSERT_EQ(std::string(100, 'd'), entry->data.to_string());
+    entry->Release();
+}
+
+namespace braft {
+DECLARE_int32(raft_segment_compress_type);
+DECLARE_int32(raft_segment_compress_min_bytes);
+}
+
+TEST_F(LogStorageTest, compression) {
+    for (int compress_type = 1; compress_type <= 2; ++compress_type) {
+        system("rm -rf ./data");
+        ::system("mkdir data/");
+        braft::FLAGS_raft_segment_compress_type = compress_type;
+        braft::FLAGS_raft_segment_compress_min_bytes = 1024;
+        scoped_refptr<braft::Segment> seg =
+            new braft::Segment("./data", 1L, compress_type - 1);
+        ASSERT_EQ(0, seg->create());
+        for (int64_t i = 1; i <= 10; ++i) {
+            braft::LogEntry* entry = new braft::LogEntry();
+            entry->type = braft::ENTRY_TYPE_DATA;
+            entry->id = braft::LogId(i, 1);
+            // Entries below the threshold are stored as is
+            entry->data.append(std::string(i % 2 ? 100 : 64 * 1024, 'a' + i));
+            ASSERT_EQ(0, seg->append(entry));
+            entry->Release();
+        }
+        ASSERT_LT(seg->bytes(), 5 * 64 * 1024);
+        for (int64_t i = 1; i <= 10; ++i) {
+            braft::LogEntry* entry = seg->get(i);
+            ASSERT_TRUE(entry != NULL);
+            ASSERT_EQ(std::string(i % 2 ? 100 : 64 * 1024, 'a' + i),
+                      entry->data.to_string());
+            entry->Release();
+        }
+        ASSERT_EQ(0, seg->close());
+
+        // Readable whatever the flag is
+        braft::FLAGS_raft_segment_compress_type = 0;
+        braft::ConfigurationManager configuration_manager;
+        scoped_refptr<braft::Segment> loaded =
+            new braft::Segment("./data", 1L, 10L, compress_type - 1);
+        ASSERT_EQ(0, loaded->load(&configuration_manager));
+        for (int64_t i = 1; i <= 10; ++i) {
+            braft::LogEntry* entry = loaded->get(i);
+            ASSERT_TRUE(entry != NULL);
+            ASSERT_EQ(std::string(i % 2 ? 100 : 64 * 1024, 'a' + i),
+                      entry->data.to_string());
+            entry->Release();
+        }
+    }
+    braft::FLAGS_raft_segment_compress_type = 0;
+    braft::FLAGS_raft_segment_compress_min_bytes = 4096;
+}
@@ -686,3 +686,463 @@ TEST_F(LogManagerTest, set_snapshot_and_get_log_term) {
     ASSERT_EQ(1L, lm->get_term(N - 1));
     LOG(INFO) << "Last_index=" << lm->last_log_index();
 }
+
+namespace braft {
+DECLARE_int64(raft_log_cache_capacity_bytes);
+DECLARE_int32(raft_log_cache_readahead);
+}
+
+TEST_F(LogManagerTest, log_cache) {
+    system("rm -rf ./data");
+    braft::FLAGS_raft_log_cache_capacity_bytes = 1024 * 1024;
+    scoped_ptr<braft::ConfigurationManager> cm(
+            new braft::ConfigurationManager);
+    scoped_ptr<braft::SegmentLogStorage> storage(
+            new braft::SegmentLogStorage("./data"));
+    scoped_ptr<braft::LogManager> lm(new braft::LogManager());
+    braft::LogManagerOptions opt;
+    opt.log_storage = storage.get();
+    opt.configuration_manager = cm.get();
+    ASSERT_EQ(0, lm->init(opt));
+    const int N = 1000;
+    for (int i = 1; i <= N; ++i) {
+        std::string buf;
+        butil::string_printf(&buf, "hello_%d", i);
+        ASSERT_EQ(0, append_entry(lm.get(), buf, i, 1));
+    }
+    // Drop the entries from memory
+    lm->set_applied_id(braft::LogId(N, 1));
+    ASSERT_EQ(1u, lm->_logs_in_memory.size());
+    ASSERT_EQ(0, lm->_log_cache.bytes());
+
+    // Replicators streaming forward read ahead into the cache
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 1; i <= N; ++i) {
+            braft::LogEntry* entry = lm->get_entry(i);
+            ASSERT_TRUE(entry != NULL);
+            std::string buf;
+            butil::string_printf(&buf, "hello_%d", i);
+            ASSERT_EQ(buf, entry->data.to_string());
+            entry->Release();
+        }
+    }
+    ASSERT_TRUE(lm->_log_cache.contains(1));
+    ASSERT_TRUE(lm->_log_cache.contains(N - 1));
+    // The entry in memory is never cached
+    ASSERT_FALSE(lm->_log_cache.contains(N));
+    ASSERT_GT(lm->_log_cache.bytes(), 0);
+
+    // Bounded by the capacity
+    braft::FLAGS_raft_log_cache_capacity_bytes = 10 * sizeof(braft::LogEntry);
+    for (int i = 1; i <= 200; ++i) {
+        braft::LogEntry* entry = lm->get_entry(i);
+        ASSERT_TRUE(entry != NULL);
+        entry->Release();
+    }
+    ASSERT_LE(lm->_log_cache.bytes(),
+              braft::FLAGS_raft_log_cache_capacity_bytes);
+    braft::FLAGS_raft_log_cache_capacity_bytes = 1024 * 1024;
+
+    // Stale entries are dropped along with the log
+    braft::SnapshotMeta meta;
+    meta.set_last_included_index(500);
+    meta.set_last_included_term(1);
+    lm->set_snapshot(&meta);
+    lm->set_snapshot(&meta);
+    ASSERT_FALSE(lm->_log_cache.contains(499));
+
+    braft::LogEntryCache cache;
+    std::vector<braft::LogEntry*> entries;
+    for (int i = 1; i <= 10; ++i) {
+        braft::LogEntry* entry = new braft::LogEntry;
+        entry->AddRef();
+        entry->id = braft::LogId(i, 1);
+        entries.push_back(entry);
+    }
+    int64_t version = cache.version();
+    cache.truncate_suffix(10);
+    // Invalidated after the version was got
+    cache.put(entries, version);
+    ASSERT_FALSE(cache.contains(1));
+    cache.put(entries, cache.version());
+    ASSERT_TRUE(cache.contains(1));
+    ASSERT_TRUE(cache.contains(10));
+    cache.truncate_suffix(5);
+    cache.truncate_prefix(3);
+    ASSERT_FALSE(cache.contains(2));
+    ASSERT_FALSE(cache.contains(6));
+    for (int i = 3; i <= 5; ++i) {
+        braft::LogEntry* entry = cache.get(i);
+        ASSERT_TRUE(entry != NULL);
+        ASSERT_EQ(i, entry->id.index);
+        entry->Release();
+    }
+    cache.clear();
+    ASSERT_EQ(0, cache.bytes());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        ASSERT_EQ(1u, entries[i]->ref_count_);
+        entries[i]->Release();
+    }
+    braft::FLAGS_raft_log_cache_capacity_bytes = 0;
+}
+
+TEST_F(LogManagerTest, get_entries) {
+    system("rm -rf ./data");
+    scoped_ptr<braft::ConfigurationManager> cm(
+            new braft::ConfigurationManager);
+    scoped_ptr<braft::SegmentLogStorage> storage(
+            new braft::SegmentLogStorage("./data"));
+    scoped_ptr<braft::LogManager> lm(new braft::LogManager());
+    braft::LogManagerOptions opt;
+    opt.log_storage = storage.get();
+    opt.configuration_manager = cm.get();
+    ASSERT_EQ(0, lm->init(opt));
+    const int N = 1000;
+    for (int i = 1; i <= N; ++i) {
+        std::string buf;
+        butil::string_printf(&buf, "hello_%d", i);
+        ASSERT_EQ(0, append_entry(lm.get(), buf, i, 1));
+    }
+    // The first half is only on disk
+    lm->set_applied_id(braft::LogId(N / 2, 1));
+    ASSERT_EQ(N / 2, lm->_logs_in_memory.front()->id.index);
+
+    for (int round = 0; round < 2; ++round) {
+        std::vector<braft::LogEntry*> entries;
+        ASSERT_EQ(N, lm->get_entries(1, N + 100, SIZE_MAX, &entries));
+        ASSERT_EQ((size_t)N, entries.size());
+        for (int i = 1; i <= N; ++i) {
+            std::string buf;
+            butil::string_printf(&buf, "hello_%d", i);
+            ASSERT_EQ(braft::LogId(i, 1), entries[i - 1]->id);
+            ASSERT_EQ(buf, entries[i - 1]->data.to_string());
+            entries[i - 1]->Release();
+        }
+        // Through the log cache as well
+        braft::FLAGS_raft_log_cache_capacity_bytes = 1024 * 1024;
+    }
+    braft::FLAGS_raft_log_cache_capacity_bytes = 0;
+
+    // Bounded by bytes
+    std::vector<braft::LogEntry*> entries;
+    const int n = lm->get_entries(N / 2 - 10, N, 50, &entries);
+    ASSERT_EQ(n, (int)entries.size());
+    ASSERT_GT(n, 1);
+    ASSERT_LT(n, 10);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        ASSERT_EQ(N / 2 - 10 + (int64_t)i, entries[i]->id.index);
+        entries[i]->Release();
+    }
+    entries.clear();
+
+    // Out of range
+    ASSERT_EQ(0, lm->get_entries(N + 1, N + 10, SIZE_MAX, &entries));
+    ASSERT_EQ(0, lm->get_entries(0, N, SIZE_MAX, &entries));
+    ASSERT_TRUE(entries.empty());
+}
+
+TEST_F(LogManagerTest, get_term_without_lock) {
+    system("rm -rf ./data");
+    scoped_ptr<braft::ConfigurationManager> cm(
+            new braft::ConfigurationManager);
+    scoped_ptr<braft::SegmentLogStorage> storage(
+            new braft::SegmentLogStorage("./data"));
+    scoped_ptr<braft::LogManager> lm(new braft::LogManager());
+    braft::LogManagerOptions opt;
+    opt.log_storage = storage.get();
+    opt.configuration_manager = cm.get();
+    ASSERT_EQ(0, lm->init(opt));
+    // terms of the logs 1-30 are 1, 1, 1, 2, 2, 2, 3, 3, 3, ...
+    for (int64_t i = 1; i <= 30; ++i) {
+        ASSERT_EQ(0, append_entry(lm.get(), "test", i, (i + 2) / 3));
+    }
+    ASSERT_EQ(10u, lm->_term_runs.size());
+    for (int64_t i = 0; i <= 31; ++i) {
+        ASSERT_EQ(i <= 30 ? (i + 2) / 3 : 0, lm->get_term(i)) << i;
+    }
+
+    // A conflicting log truncates the runs after it
+    ASSERT_EQ(0, append_entry(lm.get(), "test", 20, 20));
+    ASSERT_EQ(8u, lm->_term_runs.size());
+    ASSERT_EQ(7, lm->get_term(19));
+    ASSERT_EQ(20, lm->get_term(20));
+    ASSERT_EQ(0, lm->get_term(21));
+
+    // Appending to the last run only publishes the last log index
+    const int64_t seq = lm->_term_index_seq.load();
+    ASSERT_EQ(0, seq % 2);
+    ASSERT_EQ(0, append_entry(lm.get(), "test", 21, 20));
+    ASSERT_EQ(seq, lm->_term_index_seq.load());
+    ASSERT_EQ(20, lm->get_term(21));
+    ASSERT_EQ(0, append_entry(lm.get(), "test", 22, 21));
+    ASSERT_EQ(seq + 2, lm->_term_index_seq.load());
+    ASSERT_EQ(21, lm->get_term(22));
+
+    // The index not covered by the published runs is read under the lock
+    {
+        std::unique_lock<braft::raft_mutex_t> lck(lm->_mutex);
+        lm->_term_runs.clear();
+        lm->_term_index_dirty = true;
+        lm->publish_term_index();
+    }
+    ASSERT_EQ(7, lm->get_term(19));
+    ASSERT_EQ(21, lm->get_term(22));
+    {
+        std::unique_lock<braft::raft_mutex_t> lck(lm->_mutex);
+        lm->load_term_runs();
+        lm->_term_index_dirty = true;
+        lm->publish_term_index();
+    }
+    ASSERT_EQ(9u, lm->_term_runs.size());
+
+    // The logs before the snapshot are dropped
+    lm->set_applied_id(braft::LogId(20, 20));
+    braft::SnapshotMeta meta;
+    meta.set_last_included_index(10);
+    meta.set_last_included_term(4);
+    lm->set_snapshot(&meta);
+    lm->clear_bufferred_logs();
+    ASSERT_EQ(0, lm->get_term(9));
+    ASSERT_EQ(4, lm->get_term(10));
+    ASSERT_EQ(4, lm->get_term(11));
+    ASSERT_EQ(20, lm->get_term(20));
+    ASSERT_EQ(braft::LogId(22, 21), lm->last_log_id(true));
+    lm.reset();
+    storage.reset();
+    cm.reset();
+
+    // The runs are rebuilt from the storage
+    cm.reset(new braft::ConfigurationManager);
+    storage.reset(new braft::SegmentLogStorage("./data"));
+    lm.reset(new braft::LogManager());
+    opt.log_storage = storage.get();
+    opt.configuration_manager = cm.get();
+    ASSERT_EQ(0, lm->init(opt));
+    ASSERT_EQ(6u, lm->_term_runs.size());
+    for (int64_t i = 11; i <= 20; ++i) {
+        ASSERT_EQ(i < 20 ? (i + 2) / 3 : 20, lm->get_term(i)) << i;
+    }
+    ASSERT_EQ(21, lm->get_term(22));
+}
+
+TEST_F(LogManagerTest, index_of_term) {
+    system("rm -rf ./data");
+    scoped_ptr<braft::ConfigurationManager> cm(
+            new braft::ConfigurationManager);
+    scoped_ptr<braft::SegmentLogStorage> storage(
+            new braft::SegmentLogStorage("./data"));
+    scoped_ptr<braft::LogManager> lm(new braft::LogManager());
+    braft::LogManagerOptions opt;
+    opt.log_storage = storage.get();
+    opt.configuration_manager = cm.get();
+    ASSERT_EQ(0, lm->init(opt));
+    // terms of the logs 1-30 are 1, 1, 1, 3, 3, 3, 5, 5, 5, ...
+    for (int64_t i = 1; i <= 30; ++i) {
+        ASSERT_EQ(0, append_entry(lm.get(), "test", i, (i + 2) / 3 * 2 - 1));
+    }
+    ASSERT_EQ(0, lm->get_first_index_of_term(0));
+    ASSERT_EQ(0, lm->get_first_index_of_term(31));
+    for (int64_t i = 1; i <= 30; ++i) {
+        ASSERT_EQ((i - 1) / 3 * 3 + 1, lm->get_first_index_of_term(i)) << i;
+    }
+    ASSERT_EQ(0, lm->get_last_index_of_term(0));
+    ASSERT_EQ(3, lm->get_last_index_of_term(1));
+    ASSERT_EQ(0, lm->get_last_index_of_term(2));
+    ASSERT_EQ(15, lm->get_last_index_of_term(9));
+    ASSERT_EQ(30, lm->get_last_index_of_term(19));
+    ASSERT_EQ(0, lm->get_last_index_of_term(20));
+
+    // The first run starts at the first log index after the snapshot
+    lm->set_applied_id(braft::LogId(30, 19));
+    braft::SnapshotMeta meta;
+    meta.set_last_included_index(14);
+    meta.set_last_included_term(9);
+    lm->set_snapshot(&meta);
+    lm->clear_bufferred_logs();
+    ASSERT_EQ(0, lm->get_first_index_of_term(14));
+    ASSERT_EQ(15, lm->get_first_index_of_term(15));
+    ASSERT_EQ(16, lm->get_first_index_of_term(18));
+    ASSERT_EQ(0, lm->get_last_index_of_term(7));
+    ASSERT_EQ(15, lm->get_last_index_of_term(9));
+}
+
+static void append_leader_entries(braft::LogManager* lm, size_t count,
+                                  bool with_conf) {
+    std::vector<braft::LogEntry*> entries;
+    for (size_t i = 0; i < count; ++i) {
+        braft::LogEntry* entry = new braft::LogEntry;
+        entry->AddRef();
+        entry->id.term = 1;
+        if (with_conf && i == 0) {
+            entry->type = braft::ENTRY_TYPE_CONFIGURATION;
+            entry->peers.push_back(braft::PeerId("127.0.0.1:8888"));
+        } else {
+            entry->type = braft::ENTRY_TYPE_DATA;
+            entry->data.append(std::string(i + 1, 'a'));
+        }
+        entries.push_back(entry);
+    }
+    SyncClosure sc;
+    lm->append_entries(&entries, &sc);
+    sc.join();
+    ASSERT_TRUE(sc.status().ok()) << sc.status();
+}
+
+TEST_F(LogManagerTest, replication_batch) {
+    system("rm -rf ./data");
+    scoped_ptr<braft::ConfigurationManager> cm(
+            new braft::ConfigurationManager);
+    scoped_ptr<braft::SegmentLogStorage> storage(
+            new braft::SegmentLogStorage("./data"));
+    scoped_ptr<braft::LogManager> lm(new braft::LogManager());
+    braft::LogManagerOptions opt;
+    opt.log_storage = storage.get();
+    opt.configuration_manager = cm.get();
+    ASSERT_EQ(0, lm->init(opt));
+    append_leader_entries(lm.get(), 2, true);
+    append_leader_entries(lm.get(), 3, false);
+    append_leader_entries(lm.get(), 1, false);
+
+    std::vector<scoped_refptr<braft::ReplicationBatch> > batches;
+    lm->get_replication_batches(1, 100, &batches);
+    ASSERT_EQ(3u, batches.size());
+    ASSERT_EQ(1, batches[0]->first_index);
+    ASSERT_EQ(3, batches[1]->first_index);
+    ASSERT_EQ(6, batches[2]->first_index);
+    const braft::EntryMeta& conf_meta = batches[0]->metas[0];
+    ASSERT_EQ(braft::ENTRY_TYPE_CONFIGURATION, conf_meta.type());
+    ASSERT_EQ(1, conf_meta.peers_size());
+    ASSERT_EQ("127.0.0.1:8888:0:0", conf_meta.peers(0));
+    ASSERT_EQ(0, conf_meta.data_len());
+    // The data of each log is sliced out of the batch
+    const braft::ReplicationBatch& batch = *batches[1];
+    ASSERT_EQ(4u, batch.data_offsets.size());
+    for (size_t i = 0; i < batch.metas.size(); ++i) {
+        ASSERT_EQ((int64_t)i + 1, batch.metas[i].data_len());
+        ASSERT_EQ(batch.data_offsets[i] + i + 1, batch.data_offsets[i + 1]);
+        braft::LogEntry* entry = lm->get_entry(batch.first_index + i);
+        ASSERT_EQ(entry->data_crc32c(), batch.metas[i].data_checksum());
+        entry->Release();
+    }
+    ASSERT_EQ(std::string(6, 'a'), batch.data.to_string());
+    batches.clear();
+    lm->get_replication_batches(4, 2, &batches);
+    ASSERT_EQ(1u, batches.size());
+    ASSERT_EQ(3, batches[0]->first_index);
+    batches.clear();
+    lm->get_replication_batches(7, 100, &batches);
+    ASSERT_TRUE(batches.empty());
+
+    // Logs from the leader are not encoded at followers
+    ASSERT_EQ(0, append_entry(lm.get(), "follower", 7));
+    lm->get_replication_batches(7, 100, &batches);
+    ASSERT_TRUE(batches.empty());
+
+    // The batches after a conflicting log are dropped
+    ASSERT_EQ(0, append_entry(lm.get(), "conflict", 4, 2));
+    lm->get_replication_batches(1, 100, &batches);
+    ASSERT_EQ(1u, batches.size());
+    ASSERT_EQ(2, batches[0]->last_index());
+    batches.clear();
+    lm->get_replication_batches(3, 100, &batches);
+    ASSERT_TRUE(batches.empty());
+}
+
+class CountingLogStorage : public braft::SegmentLogStorage {
+public:
+    explicit CountingLogStorage(const std::string& path)
+        : braft::SegmentLogStorage(path), ntruncate_prefix(0), nget_entry(0)
+        , nget_entries(0) {}
+    int truncate_prefix(const int64_t first_index_kept) {
+        ++ntruncate_prefix;
+        return braft::SegmentLogStorage::truncate_prefix(first_index_kept);
+    }
+    braft::LogEntry* get_entry(const int64_t index) {
+        ++nget_entry;
+        return braft::SegmentLogStorage::get_entry(index);
+    }
+    int get_entries(const int64_t first_index, const int64_t last_index,
+                    size_t max_bytes, std::vector<braft::LogEntry*>* entries) {
+        ++nget_entries;
+        return braft::SegmentLogStorage::get_entries(first_index, last_index,
+                                                     max_bytes, entries);
+    }
+    int ntruncate_prefix;
+    int nget_entry;
+    int nget_entries;
+};
+
+TEST_F(LogManagerTest, coalesce_truncate_prefix) {
+    system("rm -rf ./data");
+    scoped_ptr<braft::ConfigurationManager> cm(
+            new braft::ConfigurationManager);
+    scoped_ptr<CountingLogStorage> storage(new CountingLogStorage("./data"));
+    scoped_ptr<braft::LogManager> lm(new braft::LogManager());
+    braft::LogManagerOptions opt;
+    opt.log_storage = storage.get();
+    opt.configuration_manager = cm.get();
+    ASSERT_EQ(0, lm->init(opt));
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(0, append_entry(lm.get(), "test", i + 1, 1));
+    }
+    ASSERT_EQ(braft::LogId(100, 1), lm->last_log_id(true));
+
+    // Block the disk thread so that the truncations are queued together
+    bool stuck = true;
+    StuckClosure* c = new StuckClosure;
+    c->_stuck = &stuck;
+    braft::LogEntry* entry = new braft::LogEntry;
+    entry->type = braft::ENTRY_TYPE_DATA;
+    entry->id = braft::LogId(101, 1);
+    std::vector<braft::LogEntry*> entries(1, entry);
+    lm->append_entries(&entries, c);
+    usleep(100 * 1000);
+    for (int i = 1; i <= 4; ++i) {
+        braft::SnapshotMeta meta;
+        meta.set_last_included_index(i * 10);
+        meta.set_last_included_term(1);
+        lm->set_snapshot(&meta);
+    }
+    stuck = false;
+    lm.reset();
+    ASSERT_EQ(1, storage->ntruncate_prefix);
+    ASSERT_EQ(31, storage->first_log_index());
+    ASSERT_EQ(101, storage->last_log_index());
+}
+
+TEST_F(LogManagerTest, log_cache_readahead) {
+    system("rm -rf ./data");
+    braft::FLAGS_raft_log_cache_capacity_bytes = 1024 * 1024;
+    scoped_ptr<braft::ConfigurationManager> cm(
+            new braft::ConfigurationManager);
+    scoped_ptr<CountingLogStorage> storage(new CountingLogStorage("./data"));
+    scoped_ptr<braft::LogManager> lm(new braft::LogManager());
+    braft::LogManagerOptions opt;
+    opt.log_storage = storage.get();
+    opt.configuration_manager = cm.get();
+    ASSERT_EQ(0, lm->init(opt));
+    const int N = 1000;
+    for (int i = 1; i <= N; ++i) {
+        std::string buf;
+        butil::string_printf(&buf, "hello_%d", i);
+        ASSERT_EQ(0, append_entry(lm.get(), buf, i, 1));
+    }
+    lm->set_applied_id(braft::LogId(N, 1));
+    const int nget_entry = storage->nget_entry;
+    const int nget_entries = storage->nget_entries;
+
+    // Each block read ahead is loaded by one ranged read
+    for (int i = 1; i < N; ++i) {
+        braft::LogEntry* entry = lm->get_entry(i);
+        ASSERT_TRUE(entry != NULL);
+        std::string buf;
+        butil::string_printf(&buf, "hello_%d", i);
+        ASSERT_EQ(buf, entry->data.to_string());
+        entry->Release();
+    }
+    ASSERT_EQ(nget_entry, storage->nget_entry);
+    ASSERT_LE(storage->nget_entries - nget_entries,
+              2 + (N - 1) / braft::FLAGS_raft_log_cache_readahead);
+    lm.reset();
+    braft::FLAGS_raft_log_cache_capacity_bytes = 0;
+}
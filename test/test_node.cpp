@@ -4,8 +4,12 @@
 // Author: WangYao (fisherman), wangyao02@baidu.com
 // Date: 2015/10/08 17:00:05
 
+#include <braft/log.h>
+#include <braft/node_manager.h>
 #include <braft/sync_point.h>
 #include <brpc/closure_guard.h>
+#include <brpc/errno.pb.h>
+#include <brpc/stream.h>
 #include <bthread/bthread.h>
 #include <bthread/countdown_event.h>
 #include <butil/fast_rand.h>
@@ -30,6 +34,12 @@ DECLARE_int32(raft_max_parallel_append_entries_rpc_num);
 DECLARE_bool(raft_enable_append_entries_cache);
 DECLARE_int32(raft_max_append_entries_cache_size);
 DECLARE_bool(raft_enable_witness_to_leader);
+DECLARE_bool(raft_enable_batch_heartbeat);
+DECLARE_int32(raft_batch_heartbeat_interval_ms);
+DECLARE_int32(raft_batch_heartbeat_idle_destination_ms);
+DECLARE_bool(raft_adaptive_append_entries_window);
+DECLARE_bool(raft_enable_stream_replication);
+DECLARE_int32(raft_stream_max_buf_size);
 
 }
 
@@ -49,6 +59,12 @@ protected:
         //logging::FLAGS_v = 90;
         // GFLAGS_NS::SetCommandLineOption("minloglevel", "1");
         GFLAGS_NS::SetCommandLineOption("crash_on_fatal_log", "true");
+        braft::FLAGS_raft_adaptive_append_entries_window = false;
+        braft::FLAGS_raft_enable_stream_replication = false;
+        braft::FLAGS_raft_stream_max_buf_size = 8 * 1024 * 1024;
+        braft::FLAGS_raft_enable_batch_heartbeat = false;
+        braft::FLAGS_raft_batch_heartbeat_interval_ms = 5;
+        braft::FLAGS_raft_batch_heartbeat_idle_destination_ms = 60 * 1000;
         if (GetParam() == std::string("NoReplication")) {
             braft::FLAGS_raft_max_parallel_append_entries_rpc_num = 1;
             braft::FLAGS_raft_enable_append_entries_cache = false;
@@ -59,6 +75,14 @@ protected:
             braft::FLAGS_raft_max_parallel_append_entries_rpc_num = 32;
             braft::FLAGS_raft_enable_append_entries_cache = true;
             braft::FLAGS_raft_max_append_entries_cache_size = 8;
+        } else if (GetParam() == std::string("AdaptiveWindow")) {
+            braft::FLAGS_raft_adaptive_append_entries_window = true;
+            braft::FLAGS_raft_enable_append_entries_cache = true;
+            braft::FLAGS_raft_max_append_entries_cache_size = 8;
+        } else if (GetParam() == std::string("Stream")) {
+            braft::FLAGS_raft_enable_stream_replication = true;
+            braft::FLAGS_raft_enable_append_entries_cache = true;
+            braft::FLAGS_raft_max_append_entries_cache_size = 8;
         }
         LOG(INFO) << "Start unitests: " << GetParam();
         ::system("rm -rf data");
@@ -66,6 +90,11 @@ protected:
         ASSERT_EQ(0, braft::g_num_nodes.get_value());
     }
     void TearDown() {
+        // Don't leak the flags set by the failed cases to the others
+        braft::FLAGS_raft_stream_max_buf_size = 8 * 1024 * 1024;
+        braft::FLAGS_raft_enable_batch_heartbeat = false;
+        braft::FLAGS_raft_batch_heartbeat_interval_ms = 5;
+        braft::FLAGS_raft_batch_heartbeat_idle_destination_ms = 60 * 1000;
         ::system("rm -rf data");
         // Sleep for a while to wait all timer has stopped
         if (braft::g_num_nodes.get_value() != 0) {
@@ -2748,6 +2777,582 @@ TEST_P(NodeTest, read_committed_user_log) {
     cluster.stop_all();
 }
 
+class ReadIndexExpectClosure : public braft::ReadIndexClosure {
+public:
+    ReadIndexExpectClosure(bthread::CountdownEvent* cond, int expect_err_code,
+                           braft::Node* node)
+        : _cond(cond), _expect_err_code(expect_err_code), _node(node) {}
+    void Run() {
+        if (_expect_err_code >= 0) {
+            EXPECT_EQ(_expect_err_code, status().error_code()) << status();
+        } else {
+            EXPECT_FALSE(status().ok());
+        }
+        if (status().ok()) {
+            EXPECT_LE(index(), _node->_impl->_fsm_caller->last_applied_index());
+        }
+        _cond->signal();
+        delete this;
+    }
+private:
+    bthread::CountdownEvent* _cond;
+    int _expect_err_code;
+    braft::Node* _node;
+};
+
+TEST_P(NodeTest, read_index) {
+    std::vector<braft::PeerId> peers;
+    for (int i = 0; i < 3; i++) {
+        braft::PeerId peer;
+        peer.addr.ip = butil::my_ip();
+        peer.addr.port = 5006 + i;
+        peer.idx = 0;
+        peers.push_back(peer);
+    }
+
+    // start cluster
+    Cluster cluster("unittest", peers);
+    for (size_t i = 0; i < peers.size(); i++) {
+        ASSERT_EQ(0, cluster.start(peers[i].addr));
+    }
+
+    cluster.wait_leader();
+    braft::Node* leader = cluster.leader();
+    ASSERT_TRUE(leader != NULL);
+    LOG(WARNING) << "leader is " << leader->node_id();
+
+    // apply something
+    bthread::CountdownEvent cond(10);
+    for (int i = 0; i < 10; i++) {
+        butil::IOBuf data;
+        char data_buf[128];
+        snprintf(data_buf, sizeof(data_buf), "hello: %d", i + 1);
+        data.append(data_buf);
+        braft::Task task;
+        task.data = &data;
+        task.done = NEW_APPLYCLOSURE(&cond, 0);
+        leader->apply(task);
+    }
+    cond.wait();
+
+    // concurrent reads are confirmed by the same or the next round
+    const int64_t committed_index =
+            leader->_impl->_ballot_box->last_committed_index();
+    cond.reset(100);
+    for (int i = 0; i < 100; i++) {
+        leader->read_index(new ReadIndexExpectClosure(&cond, 0, leader));
+    }
+    cond.wait();
+    ASSERT_GE(leader->_impl->_fsm_caller->last_applied_index(), committed_index);
+
+    // followers get the read index from the leader
+    std::vector<braft::Node*> followers;
+    cluster.followers(&followers);
+    ASSERT_EQ(2, followers.size());
+    cond.reset(20);
+    for (int i = 0; i < 10; i++) {
+        followers[0]->read_index(new ReadIndexExpectClosure(&cond, 0, followers[0]));
+        followers[1]->read_index(new ReadIndexExpectClosure(&cond, 0, followers[1]));
+    }
+    cond.wait();
+    ASSERT_GE(followers[0]->_impl->_fsm_caller->last_applied_index(), committed_index);
+    ASSERT_GE(followers[1]->_impl->_fsm_caller->last_applied_index(), committed_index);
+
+    // the leadership can't be confirmed without the majority
+    const butil::EndPoint follower_addr0 = followers[0]->node_id().peer_id.addr;
+    const butil::EndPoint follower_addr1 = followers[1]->node_id().peer_id.addr;
+    cluster.stop(follower_addr0);
+    cluster.stop(follower_addr1);
+    cond.reset(1);
+    leader->read_index(new ReadIndexExpectClosure(&cond, -1, leader));
+    cond.wait();
+
+    cluster.stop_all();
+}
+
+TEST_P(NodeTest, batch_heartbeat) {
+    braft::FLAGS_raft_enable_batch_heartbeat = true;
+    std::vector<braft::PeerId> peers;
+    for (int i = 0; i < 3; i++) {
+        braft::PeerId peer;
+        peer.addr.ip = butil::my_ip();
+        peer.addr.port = 5006 + i;
+        peer.idx = 0;
+        peers.push_back(peer);
+    }
+
+    // start cluster
+    Cluster cluster("unittest", peers, 500);
+    for (size_t i = 0; i < peers.size(); i++) {
+        ASSERT_EQ(0, cluster.start(peers[i].addr));
+    }
+
+    cluster.wait_leader();
+    braft::Node* leader = cluster.leader();
+    ASSERT_TRUE(leader != NULL);
+    LOG(WARNING) << "leader is " << leader->node_id();
+    const braft::PeerId leader_id = leader->node_id().peer_id;
+    const int64_t term = leader->_impl->_current_term;
+
+    // the batched heartbeats keep the followers from electing
+    bthread_usleep(5 * 500 * 1000);
+    ASSERT_EQ(leader_id, cluster.leader()->node_id().peer_id);
+    ASSERT_EQ(term, leader->_impl->_current_term);
+    std::vector<braft::Node*> followers;
+    cluster.followers(&followers);
+    ASSERT_EQ(2, followers.size());
+    for (size_t i = 0; i < followers.size(); i++) {
+        ASSERT_EQ(leader_id, followers[i]->leader_id());
+        ASSERT_EQ(term, followers[i]->_impl->_current_term);
+    }
+
+    // apply something
+    bthread::CountdownEvent cond(10);
+    for (int i = 0; i < 10; i++) {
+        butil::IOBuf data;
+        char data_buf[128];
+        snprintf(data_buf, sizeof(data_buf), "hello: %d", i + 1);
+        data.append(data_buf);
+        braft::Task task;
+        task.data = &data;
+        task.done = NEW_APPLYCLOSURE(&cond, 0);
+        leader->apply(task);
+    }
+    cond.wait();
+
+    // failed heartbeats to the stopped follower don't affect the others
+    cluster.stop(followers[0]->node_id().peer_id.addr);
+    bthread_usleep(5 * 500 * 1000);
+    ASSERT_EQ(leader_id, cluster.leader()->node_id().peer_id);
+    ASSERT_EQ(term, leader->_impl->_current_term);
+
+    cluster.stop_all();
+}
+
+// Transfer the leaderships of all the |groups| to their |target|-th nodes
+static void move_leaders_to(std::vector<std::vector<braft::Node*> >* groups,
+                            size_t target) {
+    for (size_t g = 0; g < groups->size(); g++) {
+        std::vector<braft::Node*>& nodes = (*groups)[g];
+        while (!nodes[target]->is_leader()) {
+            for (size_t i = 0; i < nodes.size(); i++) {
+                if (i != target && nodes[i]->is_leader()) {
+                    nodes[i]->transfer_leadership_to(
+                        nodes[target]->node_id().peer_id);
+                }
+            }
+            usleep(100 * 1000);
+        }
+    }
+}
+
+TEST_P(NodeTest, batch_heartbeat_multiple_groups) {
+    braft::FLAGS_raft_enable_batch_heartbeat = true;
+    // long enough to coalesce the heartbeats of all the groups
+    braft::FLAGS_raft_batch_heartbeat_interval_ms = 20;
+    const int ngroups = 4;
+    std::vector<braft::PeerId> peers;
+    for (int i = 0; i < 3; i++) {
+        braft::PeerId peer;
+        peer.addr.ip = butil::my_ip();
+        peer.addr.port = 5006 + i;
+        peer.idx = 0;
+        peers.push_back(peer);
+    }
+
+    // all the groups share the same servers
+    std::vector<brpc::Server*> servers;
+    for (size_t i = 0; i < peers.size(); i++) {
+        brpc::Server* server = new brpc::Server;
+        ASSERT_EQ(0, braft::add_service(server, peers[i].addr));
+        ASSERT_EQ(0, server->Start(peers[i].addr, NULL));
+        servers.push_back(server);
+    }
+    std::vector<std::vector<braft::Node*> > groups(ngroups);
+    for (int g = 0; g < ngroups; g++) {
+        std::string group_id;
+        butil::string_printf(&group_id, "batch_group_%d", g);
+        for (size_t i = 0; i < peers.size(); i++) {
+            braft::NodeOptions options;
+            options.election_timeout_ms = 500;
+            options.initial_conf = braft::Configuration(peers);
+            options.fsm = new MockFSM(peers[i].addr);
+            options.node_owns_fsm = true;
+            std::string endpoint_str = butil::endpoint2str(peers[i].addr).c_str();
+            butil::string_printf(&options.log_uri,
+                                 "local://./data/group%d/%s/log", g,
+                                 endpoint_str.c_str());
+            butil::string_printf(&options.raft_meta_uri,
+                                 "local://./data/group%d/%s/raft_meta", g,
+                                 endpoint_str.c_str());
+            butil::string_printf(&options.snapshot_uri,
+                                 "local://./data/group%d/%s/snapshot", g,
+                                 endpoint_str.c_str());
+            braft::Node* node = new braft::Node(group_id, peers[i]);
+            ASSERT_EQ(0, node->init(options));
+            groups[g].push_back(node);
+        }
+    }
+
+    move_leaders_to(&groups, 0);
+    std::vector<int64_t> terms;
+    for (int g = 0; g < ngroups; g++) {
+        terms.push_back(groups[g][0]->_impl->_current_term);
+    }
+
+    // the heartbeats of all the groups to the same follower are sent in one
+    // BatchHeartbeat RPC, and keep the followers from electing
+    bthread_usleep(5 * 500 * 1000);
+    std::string max_factor;
+    ASSERT_EQ(0, bvar::Variable::describe_exposed(
+                     "raft_batch_heartbeat_factor_max_counter", &max_factor));
+    LOG(WARNING) << "max batch heartbeat factor is " << max_factor;
+    ASSERT_GE(atoi(max_factor.c_str()), ngroups);
+    for (int g = 0; g < ngroups; g++) {
+        ASSERT_TRUE(groups[g][0]->is_leader());
+        ASSERT_EQ(terms[g], groups[g][0]->_impl->_current_term);
+        for (size_t i = 1; i < peers.size(); i++) {
+            ASSERT_EQ(peers[0], groups[g][i]->leader_id());
+        }
+    }
+
+    // the destinations of the old leader are pruned once idle
+    braft::FLAGS_raft_batch_heartbeat_idle_destination_ms = 500;
+    move_leaders_to(&groups, 1);
+    bthread_usleep(3 * 500 * 1000);
+    braft::HeartbeatBatcher* batcher =
+        braft::global_node_manager->heartbeat_batcher();
+    {
+        BAIDU_SCOPED_LOCK(batcher->_mutex);
+        ASSERT_EQ(2u, batcher->_destinations.size());
+        for (braft::HeartbeatBatcher::DestinationMap::iterator it =
+                 batcher->_destinations.begin();
+             it != batcher->_destinations.end(); ++it) {
+            ASSERT_EQ(peers[1].addr, it->first.first);
+        }
+    }
+
+    for (int g = 0; g < ngroups; g++) {
+        for (size_t i = 0; i < peers.size(); i++) {
+            groups[g][i]->shutdown(NULL);
+        }
+    }
+    for (int g = 0; g < ngroups; g++) {
+        for (size_t i = 0; i < peers.size(); i++) {
+            groups[g][i]->join();
+            delete groups[g][i];
+        }
+    }
+    for (size_t i = 0; i < servers.size(); i++) {
+        servers[i]->Stop(0);
+        servers[i]->Join();
+        delete servers[i];
+    }
+}
+
+static void apply_tasks(braft::Node* leader, int begin, int n,
+                        bthread::CountdownEvent* cond) {
+    for (int i = begin; i < begin + n; i++) {
+        butil::IOBuf data;
+        char data_buf[128];
+        snprintf(data_buf, sizeof(data_buf), "hello: %d", i + 1);
+        data.append(data_buf);
+        braft::Task task;
+        task.data = &data;
+        task.done = NEW_APPLYCLOSURE(cond, 0);
+        leader->apply(task);
+    }
+}
+
+// Returns the ids of the replication streams from |leader| to its followers
+static std::vector<brpc::StreamId> leader_streams(braft::Node* leader) {
+    std::vector<braft::ReplicatorId> ids;
+    {
+        // Don't lock the replicators with the node locked, which is the
+        // other way around in the replicators
+        BAIDU_SCOPED_LOCK(leader->_impl->_mutex);
+        leader->_impl->_replicator_group.list_replicators(&ids);
+    }
+    std::vector<brpc::StreamId> streams;
+    for (size_t i = 0; i < ids.size(); i++) {
+        braft::Replicator* r = NULL;
+        bthread_id_t id = {ids[i]};
+        if (bthread_id_lock(id, (void**)&r) != 0) {
+            continue;
+        }
+        if (r->_is_streaming()) {
+            streams.push_back(r->_stream_id);
+        }
+        bthread_id_unlock(id);
+    }
+    return streams;
+}
+
+static bool wait_leader_streams(braft::Node* leader, size_t nstreams) {
+    for (int i = 0; i < 50; i++) {
+        if (leader_streams(leader).size() == nstreams) {
+            return true;
+        }
+        usleep(100 * 1000);
+    }
+    return false;
+}
+
+TEST_P(NodeTest, stream_replication_unsupported) {
+    braft::FLAGS_raft_enable_stream_replication = true;
+    // The followers act as the versions without append_entries_stream
+    butil::atomic<int> nopen(0);
+    SyncPoint::GetInstance()->SetCallBack(
+        "RaftServiceImpl::append_entries_stream", [&nopen](void* arg) {
+            nopen.fetch_add(1);
+            static_cast<brpc::Controller*>(arg)->SetFailed(
+                brpc::ENOMETHOD, "Fail to find method");
+        });
+    SyncPoint::GetInstance()->EnableProcessing();
+
+    std::vector<braft::PeerId> peers;
+    for (int i = 0; i < 3; i++) {
+        braft::PeerId peer;
+        peer.addr.ip = butil::my_ip();
+        peer.addr.port = 5006 + i;
+        peer.idx = 0;
+        peers.push_back(peer);
+    }
+    Cluster cluster("unittest", peers);
+    for (size_t i = 0; i < peers.size(); i++) {
+        ASSERT_EQ(0, cluster.start(peers[i].addr));
+    }
+    cluster.wait_leader();
+    braft::Node* leader = cluster.leader();
+    ASSERT_TRUE(leader != NULL);
+
+    bthread::CountdownEvent cond(10);
+    apply_tasks(leader, 0, 10, &cond);
+    cond.wait();
+    // Longer than raft_retry_replicate_interval_ms, the leader doesn't try
+    // the streams again
+    usleep(2500 * 1000);
+    cond.reset(10);
+    apply_tasks(leader, 10, 10, &cond);
+    cond.wait();
+    ASSERT_TRUE(cluster.ensure_same());
+    ASSERT_EQ(2, nopen.load());
+    ASSERT_TRUE(leader_streams(leader).empty());
+
+    SyncPoint::GetInstance()->DisableProcessing();
+    SyncPoint::GetInstance()->ClearAllCallBacks();
+    cluster.stop_all();
+}
+
+TEST_P(NodeTest, stream_replication_closed) {
+    braft::FLAGS_raft_enable_stream_replication = true;
+    std::vector<braft::PeerId> peers;
+    for (int i = 0; i < 3; i++) {
+        braft::PeerId peer;
+        peer.addr.ip = butil::my_ip();
+        peer.addr.port = 5006 + i;
+        peer.idx = 0;
+        peers.push_back(peer);
+    }
+    Cluster cluster("unittest", peers);
+    for (size_t i = 0; i < peers.size(); i++) {
+        ASSERT_EQ(0, cluster.start(peers[i].addr));
+    }
+    cluster.wait_leader();
+    braft::Node* leader = cluster.leader();
+    ASSERT_TRUE(leader != NULL);
+
+    bthread::CountdownEvent cond(10);
+    apply_tasks(leader, 0, 10, &cond);
+    cond.wait();
+    ASSERT_TRUE(wait_leader_streams(leader, 2));
+
+    // Close the streams with the requests in flight, the followers get the
+    // logs by RPCs until the streams are opened again
+    cond.reset(100);
+    apply_tasks(leader, 10, 100, &cond);
+    std::vector<brpc::StreamId> streams = leader_streams(leader);
+    for (size_t i = 0; i < streams.size(); i++) {
+        brpc::StreamClose(streams[i]);
+    }
+    cond.wait();
+    ASSERT_TRUE(cluster.ensure_same());
+    cond.reset(10);
+    apply_tasks(leader, 110, 10, &cond);
+    cond.wait();
+    ASSERT_TRUE(wait_leader_streams(leader, 2));
+
+    // The stream to a follower is closed once it stops
+    std::vector<braft::Node*> followers;
+    cluster.followers(&followers);
+    ASSERT_EQ(2u, followers.size());
+    const butil::EndPoint follower_addr = followers[0]->_impl->_server_id.addr;
+    ASSERT_EQ(0, cluster.stop(follower_addr));
+    cond.reset(100);
+    apply_tasks(leader, 120, 100, &cond);
+    cond.wait();
+    ASSERT_TRUE(wait_leader_streams(leader, 1));
+    ASSERT_EQ(0, cluster.start(follower_addr));
+    ASSERT_TRUE(cluster.ensure_same());
+    cond.reset(10);
+    apply_tasks(leader, 220, 10, &cond);
+    cond.wait();
+    ASSERT_TRUE(cluster.ensure_same());
+
+    cluster.stop_all();
+}
+
+TEST_P(NodeTest, stream_replication_full) {
+    braft::FLAGS_raft_enable_stream_replication = true;
+    // Every request fills up the stream, the leader waits for the followers
+    // to consume it before pushing the next one
+    braft::FLAGS_raft_stream_max_buf_size = 64;
+    std::vector<braft::PeerId> peers;
+    for (int i = 0; i < 3; i++) {
+        braft::PeerId peer;
+        peer.addr.ip = butil::my_ip();
+        peer.addr.port = 5006 + i;
+        peer.idx = 0;
+        peers.push_back(peer);
+    }
+    Cluster cluster("unittest", peers);
+    for (size_t i = 0; i < peers.size(); i++) {
+        ASSERT_EQ(0, cluster.start(peers[i].addr));
+    }
+    cluster.wait_leader();
+    braft::Node* leader = cluster.leader();
+    ASSERT_TRUE(leader != NULL);
+
+    bthread::CountdownEvent cond(10);
+    apply_tasks(leader, 0, 10, &cond);
+    cond.wait();
+    ASSERT_TRUE(wait_leader_streams(leader, 2));
+    cond.reset(1000);
+    apply_tasks(leader, 10, 1000, &cond);
+    cond.wait();
+    ASSERT_TRUE(cluster.ensure_same());
+
+    cluster.stop_all();
+}
+
+// Returns the number of AppendEntries requests, other than the heartbeats,
+// sent by the replicator of |leader| to |peer|
+static int64_t append_entries_sent(braft::Node* leader,
+                                   const braft::PeerId& peer) {
+    std::vector<std::pair<braft::PeerId, braft::ReplicatorId> > ids;
+    {
+        BAIDU_SCOPED_LOCK(leader->_impl->_mutex);
+        leader->_impl->_replicator_group.list_replicators(&ids);
+    }
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (ids[i].first != peer) {
+            continue;
+        }
+        braft::Replicator* r = NULL;
+        bthread_id_t id = {ids[i].second};
+        if (bthread_id_lock(id, (void**)&r) != 0) {
+            return -1;
+        }
+        const int64_t counter = r->_append_entries_counter;
+        bthread_id_unlock(id);
+        return counter;
+    }
+    return -1;
+}
+
+TEST_P(NodeTest, repair_divergent_follower) {
+    std::vector<braft::PeerId> peers;
+    for (int i = 0; i < 3; i++) {
+        braft::PeerId peer;
+        peer.addr.ip = butil::my_ip();
+        peer.addr.port = 5006 + i;
+        peer.idx = 0;
+        peers.push_back(peer);
+    }
+    Cluster cluster("unittest", peers);
+    for (size_t i = 0; i < peers.size(); i++) {
+        ASSERT_EQ(0, cluster.start(peers[i].addr));
+    }
+    cluster.wait_leader();
+    braft::Node* leader = cluster.leader();
+    ASSERT_TRUE(leader != NULL);
+    bthread::CountdownEvent cond(10);
+    apply_tasks(leader, 0, 10, &cond);
+    cond.wait();
+    ASSERT_TRUE(cluster.ensure_same());
+    const int64_t base_term = leader->_impl->_current_term;
+
+    std::vector<braft::Node*> followers;
+    cluster.followers(&followers);
+    ASSERT_EQ(2u, followers.size());
+    const braft::PeerId follower = followers[0]->node_id().peer_id;
+    ASSERT_EQ(0, cluster.stop(follower.addr));
+
+    // Each new leader appends a log in its term, so the terms of the logs
+    // after the stopped follower are above base_term, and reach base_term + 4
+    // soon after them
+    for (int i = 0; i < 20 && leader->_impl->_current_term < base_term + 4;
+         i++) {
+        cluster.followers(&followers);
+        ASSERT_EQ(1u, followers.size());
+        ASSERT_EQ(0, leader->transfer_leadership_to(
+                         followers[0]->node_id().peer_id));
+        usleep(10 * 1000);
+        cluster.wait_leader();
+        leader = cluster.leader();
+        ASSERT_TRUE(leader != NULL);
+    }
+    ASSERT_GE(leader->_impl->_current_term, base_term + 4);
+    cond.reset(40);
+    apply_tasks(leader, 10, 40, &cond);
+    cond.wait();
+
+    // The stopped follower holds 60 divergent logs in base_term,
+    // base_term + 1 and base_term + 2, none of which is in the same term as
+    // the log at the same index of the leader
+    const int kDivergentTermNum = 3;
+    const int kLogsPerTerm = 20;
+    {
+        std::string log_path;
+        butil::string_printf(&log_path, "./data/%s/log",
+                             butil::endpoint2str(follower.addr).c_str());
+        braft::ConfigurationManager cm;
+        braft::SegmentLogStorage storage(log_path);
+        ASSERT_EQ(0, storage.init(&cm));
+        int64_t index = storage.last_log_index();
+        ASSERT_EQ(base_term, storage.get_term(index));
+        for (int t = 0; t < kDivergentTermNum; t++) {
+            for (int i = 0; i < kLogsPerTerm; i++) {
+                braft::LogEntry* entry = new braft::LogEntry;
+                entry->AddRef();
+                entry->type = braft::ENTRY_TYPE_DATA;
+                entry->data.append("divergent");
+                entry->id = braft::LogId(++index, base_term + t);
+                ASSERT_EQ(0, storage.append_entry(entry));
+                entry->Release();
+            }
+        }
+    }
+
+    // The follower rejects the probes with the term of its log and the first
+    // index of that term, so the leader skips a whole term each time rather
+    // than a single log
+    const int64_t nsent = append_entries_sent(leader, follower);
+    ASSERT_GE(nsent, 0);
+    ASSERT_EQ(0, cluster.start(follower.addr));
+    ASSERT_TRUE(cluster.ensure_same());
+    const int64_t nrepair = append_entries_sent(leader, follower) - nsent;
+    LOG(WARNING) << "repaired follower with " << nrepair
+                 << " AppendEntries requests";
+    ASSERT_LT(nrepair, kDivergentTermNum * kLogsPerTerm / 4);
+    cond.reset(10);
+    apply_tasks(leader, 50, 10, &cond);
+    cond.wait();
+    ASSERT_TRUE(cluster.ensure_same());
+
+    cluster.stop_all();
+}
+
 TEST_P(NodeTest, boostrap_with_snapshot) {
     butil::EndPoint addr;
     ASSERT_EQ(0, butil::str2endpoint("127.0.0.1:5006", &addr));
@@ -3527,6 +4132,74 @@ TEST_P(NodeTest, follower_handle_out_of_order_append_entries) {
     cluster.stop_all();
 }
 
+TEST_P(NodeTest, follower_reject_with_conflict_term) {
+    std::vector<braft::PeerId> peers;
+    for (int i = 0; i < 3; i++) {
+        braft::PeerId peer;
+        peer.addr.ip = butil::my_ip();
+        peer.addr.port = 5006 + i;
+        peer.idx = 0;
+        peers.push_back(peer);
+    }
+    Cluster cluster("unittest", peers);
+    for (size_t i = 0; i < peers.size(); i++) {
+        ASSERT_EQ(0, cluster.start(peers[i].addr));
+    }
+    cluster.wait_leader();
+    braft::Node* leader = cluster.leader();
+    ASSERT_TRUE(leader != NULL);
+    bthread::CountdownEvent cond(10);
+    apply_tasks(leader, 0, 10, &cond);
+    cond.wait();
+    ASSERT_TRUE(cluster.ensure_same());
+
+    std::vector<braft::Node*> followers;
+    cluster.followers(&followers);
+    ASSERT_FALSE(followers.empty());
+    braft::Node* follower = followers[0];
+    follower->_impl->_mutex.lock();
+    const int64_t local_index = follower->_impl->_log_manager->last_log_index();
+    const int64_t local_term =
+        follower->_impl->_log_manager->get_term(local_index);
+    braft::AppendEntriesRequest request_template;
+    request_template.set_term(follower->_impl->_current_term);
+    request_template.set_group_id(follower->_impl->_group_id);
+    request_template.set_server_id(follower->_impl->_leader_id.to_string());
+    request_template.set_peer_id("");
+    request_template.set_committed_index(
+        follower->_impl->_ballot_box->last_committed_index());
+    follower->_impl->_mutex.unlock();
+    // All the logs are written by the first leader
+    ASSERT_EQ(leader->_impl->_current_term, local_term);
+
+    // A mismatch is answered with the local term there and the first index of
+    // that term
+    request_template.set_prev_log_term(local_term + 1);
+    AppendEntriesSyncClosure closure1;
+    follower_append_entries(request_template, 0, local_index, closure1,
+                            follower);
+    closure1.wait();
+    ASSERT_FALSE(closure1.response().success());
+    ASSERT_TRUE(closure1.response().has_conflict_term());
+    ASSERT_EQ(local_term, closure1.response().conflict_term());
+    ASSERT_EQ(1, closure1.response().conflict_index());
+    ASSERT_EQ(local_index, closure1.response().last_log_index());
+
+    // Nothing conflicts with a missing log
+    request_template.set_prev_log_term(local_term);
+    AppendEntriesSyncClosure closure2;
+    follower_append_entries(request_template, 0, local_index + 5, closure2,
+                            follower);
+    closure2.wait();
+    ASSERT_FALSE(closure2.response().success());
+    ASSERT_FALSE(closure2.response().has_conflict_term());
+    ASSERT_FALSE(closure2.response().has_conflict_index());
+    ASSERT_EQ(local_index, closure2.response().last_log_index());
+
+    ASSERT_TRUE(cluster.ensure_same());
+    cluster.stop_all();
+}
+
 TEST_P(NodeTest, readonly) {
     std::vector<braft::PeerId> peers;
     for (int i = 0; i < 3; i++) {
@@ -3724,7 +4397,8 @@ INSTANTIATE_TEST_SUITE_P(NodeTestWithoutPipelineReplication,
 
 INSTANTIATE_TEST_SUITE_P(NodeTestWithPipelineReplication,
                         NodeTest,
-                        ::testing::Values("NoCache", "HasCache"));
+                        ::testing::Values("NoCache", "HasCache",
+                                          "AdaptiveWindow", "Stream"));
 
 int main(int argc, char* argv[]) {
     ::testing::AddGlobalTestEnvironment(new TestEnvironment());
@@ -0,0 +1,187 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <bthread/countdown_event.h>
+#include <butil/memory/scoped_ptr.h>
+#include <butil/time.h>
+
+#include "braft/log.h"
+#include "braft/log_manager.h"
+#include "braft/replicator.h"
+#include "common.h"
+
+namespace braft {
+DECLARE_bool(raft_adaptive_append_entries_window);
+DECLARE_int32(raft_max_adaptive_append_entries_rpc_num);
+DECLARE_int32(raft_max_body_size);
+}
+
+class ReplicatorTest : public testing::Test {
+protected:
+    void SetUp() {
+        braft::FLAGS_raft_adaptive_append_entries_window = true;
+        braft::FLAGS_raft_max_adaptive_append_entries_rpc_num = 32;
+        braft::FLAGS_raft_max_body_size = 512 * 1024;
+    }
+    void TearDown() {
+        braft::FLAGS_raft_adaptive_append_entries_window = false;
+        braft::FLAGS_raft_max_adaptive_append_entries_rpc_num = 32;
+        braft::FLAGS_raft_max_body_size = 512 * 1024;
+    }
+};
+
+// Acknowledge |bytes| sent in a sample which started |latency_us| ago, so that
+// the delivery rate is about |bytes| per |latency_us|
+static void ack_in_one_rtt(braft::Replicator* r, int64_t bytes,
+                           int64_t latency_us) {
+    r->_rate_sample_start_us = butil::monotonic_time_us() - latency_us;
+    r->_rate_sample_bytes = 0;
+    r->_on_append_entries_acked(bytes, latency_us);
+}
+
+TEST_F(ReplicatorTest, adaptive_window) {
+    const int64_t max_body_size = braft::FLAGS_raft_max_body_size;
+    const int64_t max_window =
+        max_body_size * braft::FLAGS_raft_max_adaptive_append_entries_rpc_num;
+    const int64_t rtt_us = 100 * 1000;
+    scoped_ptr<braft::Replicator> r(new braft::Replicator);
+
+    // 1MB per RTT, the window is twice of it
+    const int64_t bdp = 1024 * 1024;
+    ack_in_one_rtt(r.get(), bdp, rtt_us);
+    ASSERT_EQ(rtt_us, r->_srtt_us);
+    ASSERT_LE(r->_window_bytes, 2 * bdp);
+    ASSERT_GT(r->_window_bytes, 2 * bdp * 9 / 10);
+    ASSERT_EQ(4, r->_max_parallel_rpc_num());
+
+    // The window follows the raising rate at once, up to the max number of
+    // requests in flight
+    ack_in_one_rtt(r.get(), 4 * bdp, rtt_us);
+    ASSERT_LE(r->_window_bytes, 8 * bdp);
+    ASSERT_GT(r->_window_bytes, 8 * bdp * 9 / 10);
+    ack_in_one_rtt(r.get(), 100 * bdp, rtt_us);
+    ASSERT_EQ(max_window, r->_window_bytes);
+    ASSERT_EQ(braft::FLAGS_raft_max_adaptive_append_entries_rpc_num,
+              r->_max_parallel_rpc_num());
+
+    // Each failure halves the window, but never below one request
+    int64_t window = max_window;
+    while (window / 2 >= max_body_size) {
+        r->_shrink_window();
+        window /= 2;
+        ASSERT_EQ(window, r->_window_bytes);
+    }
+    r->_shrink_window();
+    ASSERT_EQ(max_body_size, r->_window_bytes);
+    r->_shrink_window();
+    ASSERT_EQ(max_body_size, r->_window_bytes);
+    ASSERT_EQ(1, r->_max_parallel_rpc_num());
+    // The rate sample restarts after the failure
+    ASSERT_EQ(0, r->_rate_sample_start_us);
+    ASSERT_EQ(0, r->_rate_sample_bytes);
+
+    // A slow follower still gets one request at a time
+    r.reset(new braft::Replicator);
+    ack_in_one_rtt(r.get(), 1024, rtt_us);
+    ASSERT_EQ(max_body_size, r->_window_bytes);
+    ASSERT_EQ(1, r->_max_parallel_rpc_num());
+}
+
+TEST_F(ReplicatorTest, adaptive_window_sample) {
+    const int64_t rtt_us = 100 * 1000;
+    scoped_ptr<braft::Replicator> r(new braft::Replicator);
+    const int64_t window = r->_window_bytes;
+
+    // No estimation until the sample lasts for an RTT
+    r->_srtt_us = rtt_us;
+    r->_rate_sample_start_us = butil::monotonic_time_us();
+    r->_on_append_entries_acked(64 * 1024 * 1024, rtt_us);
+    ASSERT_EQ(window, r->_window_bytes);
+    ASSERT_EQ(0, r->_delivery_rate);
+    ASSERT_EQ(64 * 1024 * 1024, r->_rate_sample_bytes);
+
+    // An ack after being idle for a while starts a new sample, rather than
+    // taking the idle time and the bytes before as the delivery
+    r->_rate_sample_start_us = butil::monotonic_time_us() - 100 * rtt_us;
+    r->_on_append_entries_acked(1024 * 1024, rtt_us);
+    ASSERT_LE(r->_delivery_rate, 10 * 1024 * 1024);
+    ASSERT_GT(r->_delivery_rate, 9 * 1024 * 1024);
+    ASSERT_EQ(0, r->_rate_sample_bytes);
+}
+
+class SyncClosure : public braft::LogManager::StableClosure {
+public:
+    SyncClosure() : _event(1) {}
+    void Run() { _event.signal(); }
+    void join() { _event.wait(); }
+private:
+    bthread::CountdownEvent _event;
+};
+
+static void append_entry(braft::LogManager* lm, int64_t index, int64_t term) {
+    braft::LogEntry* entry = new braft::LogEntry;
+    entry->AddRef();
+    entry->type = braft::ENTRY_TYPE_DATA;
+    entry->data.append("test");
+    entry->id = braft::LogId(index, term);
+    std::vector<braft::LogEntry*> entries;
+    entries.push_back(entry);
+    SyncClosure sc;
+    lm->append_entries(&entries, &sc);
+    sc.join();
+    ASSERT_TRUE(sc.status().ok()) << sc.status();
+}
+
+TEST_F(ReplicatorTest, next_index_on_conflict) {
+    system("rm -rf ./data");
+    scoped_ptr<braft::ConfigurationManager> cm(
+            new braft::ConfigurationManager);
+    scoped_ptr<braft::SegmentLogStorage> storage(
+            new braft::SegmentLogStorage("./data"));
+    scoped_ptr<braft::LogManager> lm(new braft::LogManager());
+    braft::LogManagerOptions opt;
+    opt.log_storage = storage.get();
+    opt.configuration_manager = cm.get();
+    ASSERT_EQ(0, lm->init(opt));
+    // terms of the logs 1-9 of the leader are 1, 1, 1, 3, 3, 3, 5, 5, 5
+    for (int64_t i = 1; i <= 9; ++i) {
+        append_entry(lm.get(), i, (i + 2) / 3 * 2 - 1);
+    }
+    scoped_ptr<braft::Replicator> r(new braft::Replicator);
+    r->_options.log_manager = lm.get();
+
+    // The peer has logs of term 3 in [4, 9], and the ones before 7 are the
+    // same as here
+    ASSERT_EQ(7, r->_next_index_on_conflict(9, 3, 4));
+    // but no further back than the probe
+    ASSERT_EQ(5, r->_next_index_on_conflict(5, 3, 4));
+
+    // The logs of term 1 here end before the first of it at the peer, the
+    // ones in [5, 8] at the peer are all different
+    ASSERT_EQ(5, r->_next_index_on_conflict(8, 1, 5));
+
+    // None of the logs in term 2 of the peer is here
+    ASSERT_EQ(4, r->_next_index_on_conflict(8, 2, 4));
+    ASSERT_EQ(7, r->_next_index_on_conflict(8, 4, 7));
+
+    // Invalid conflict_index falls back to probing the previous one
+    ASSERT_EQ(8, r->_next_index_on_conflict(8, 3, 0));
+    ASSERT_EQ(8, r->_next_index_on_conflict(8, 3, 9));
+    ASSERT_EQ(8, r->_next_index_on_conflict(8, 3, -1));
+
+    r.reset();
+    lm.reset();
+    storage.reset();
+    cm.reset();
+}
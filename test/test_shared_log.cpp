@@ -0,0 +1,301 @@
+// Copyright (c) 2015 Baidu.com, Inc. All Rights Reserved
+
+#include <butil/file_util.h>
+#include <butil/files/dir_reader_posix.h>
+#include <butil/logging.h>
+#include <butil/string_printf.h>
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include "braft/shared_log.h"
+#include "braft/storage.h"
+#include "braft/util.h"
+#include "common.h"
+
+namespace braft {
+extern void global_init_once_or_die();
+DECLARE_int32(raft_shared_log_file_size);
+DECLARE_bool(raft_recover_log_from_corrupt);
+}
+
+class SharedLogStorageTest : public testing::Test {
+protected:
+    void SetUp() {
+        braft::FLAGS_raft_sync = false;
+        system("rm -rf data");
+        braft::global_init_once_or_die();
+    }
+    void TearDown() {
+        braft::FLAGS_raft_shared_log_file_size = 64 * 1024 * 1024;
+        braft::FLAGS_raft_recover_log_from_corrupt = false;
+    }
+};
+
+static std::string shared_uri(const char* group) {
+    return butil::string_printf(
+            "local-shared://shared_path=./data/shared_log&&group=%s", group);
+}
+
+static void append_entries(braft::LogStorage* storage, int64_t first_index,
+                           int64_t last_index, int64_t term) {
+    std::vector<braft::LogEntry*> entries;
+    for (int64_t i = first_index; i <= last_index; ++i) {
+        braft::LogEntry* entry = new braft::LogEntry();
+        entry->AddRef();
+        entry->type = braft::ENTRY_TYPE_DATA;
+        entry->id.term = term;
+        entry->id.index = i;
+        char data_buf[128];
+        snprintf(data_buf, sizeof(data_buf), "hello, world: %" PRId64, i);
+        entry->data.append(data_buf);
+        entries.push_back(entry);
+    }
+    ASSERT_EQ((int)entries.size(), storage->append_entries(entries, NULL));
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i]->Release();
+    }
+}
+
+static void check_entries(braft::LogStorage* storage, int64_t first_index,
+                          int64_t last_index, int64_t term) {
+    ASSERT_EQ(first_index, storage->first_log_index());
+    ASSERT_EQ(last_index, storage->last_log_index());
+    for (int64_t i = first_index; i <= last_index; ++i) {
+        ASSERT_EQ(term, storage->get_term(i));
+        braft::LogEntry* entry = storage->get_entry(i);
+        ASSERT_TRUE(entry != NULL);
+        ASSERT_EQ(term, entry->id.term);
+        ASSERT_EQ(i, entry->id.index);
+        char data_buf[128];
+        snprintf(data_buf, sizeof(data_buf), "hello, world: %" PRId64, i);
+        ASSERT_EQ(data_buf, entry->data.to_string());
+        entry->Release();
+    }
+    ASSERT_TRUE(storage->get_entry(first_index - 1) == NULL);
+    ASSERT_TRUE(storage->get_entry(last_index + 1) == NULL);
+}
+
+static int count_shared_log_files() {
+    int count = 0;
+    butil::DirReaderPosix dir_reader("./data/shared_log");
+    while (dir_reader.Next()) {
+        if (strncmp(dir_reader.name(), "wal_", strlen("wal_")) == 0) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+static std::vector<std::string> list_shared_log_files() {
+    std::vector<std::string> files;
+    butil::DirReaderPosix dir_reader("./data/shared_log");
+    while (dir_reader.Next()) {
+        if (strncmp(dir_reader.name(), "wal_", strlen("wal_")) == 0) {
+            files.push_back(std::string("./data/shared_log/") +
+                            dir_reader.name());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+static void append_to_file(const std::string& path, const char* data) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ((ssize_t)strlen(data), ::write(fd, data, strlen(data)));
+    ::close(fd);
+}
+
+TEST_F(SharedLogStorageTest, init) {
+    braft::ConfigurationManager cm;
+    // bad uri
+    braft::LogStorage* storage =
+            braft::LogStorage::create("local-shared://./data/shared_log");
+    ASSERT_TRUE(storage);
+    ASSERT_NE(0, storage->init(&cm));
+    delete storage;
+    storage = braft::LogStorage::create(
+            "local-shared://shared_path=./data/shared_log&&group=");
+    ASSERT_TRUE(storage);
+    ASSERT_NE(0, storage->init(&cm));
+    delete storage;
+
+    storage = braft::LogStorage::create(shared_uri("g1"));
+    ASSERT_TRUE(storage);
+    ASSERT_EQ(0, storage->init(&cm));
+    ASSERT_EQ(1, storage->first_log_index());
+    ASSERT_EQ(0, storage->last_log_index());
+
+    // a group can't be opened twice
+    braft::LogStorage* storage2 = braft::LogStorage::create(shared_uri("g1"));
+    ASSERT_TRUE(storage2);
+    ASSERT_NE(0, storage2->init(&cm));
+    delete storage2;
+    delete storage;
+}
+
+TEST_F(SharedLogStorageTest, multiple_groups) {
+    braft::ConfigurationManager cm1;
+    braft::ConfigurationManager cm2;
+    braft::LogStorage* storage1 = braft::LogStorage::create(shared_uri("g1"));
+    braft::LogStorage* storage2 = braft::LogStorage::create(shared_uri("g2"));
+    ASSERT_EQ(0, storage1->init(&cm1));
+    ASSERT_EQ(0, storage2->init(&cm2));
+
+    // interleaved appends of the two groups
+    for (int64_t i = 1; i <= 100; i += 10) {
+        append_entries(storage1, i, i + 9, 1);
+        append_entries(storage2, i, i + 9, 2);
+    }
+    braft::LogEntry* conf = new braft::LogEntry();
+    conf->AddRef();
+    conf->type = braft::ENTRY_TYPE_CONFIGURATION;
+    conf->id = braft::LogId(101, 1);
+    conf->peers.push_back(braft::PeerId("1.1.1.1:1000:0"));
+    conf->peers.push_back(braft::PeerId("1.1.1.1:2000:0"));
+    ASSERT_EQ(0, storage1->append_entry(conf));
+    conf->Release();
+
+    check_entries(storage2, 1, 100, 2);
+    ASSERT_EQ(101, storage1->last_log_index());
+
+    // truncating one group doesn't affect the other
+    ASSERT_EQ(0, storage2->truncate_suffix(50));
+    append_entries(storage2, 51, 60, 3);
+    ASSERT_EQ(0, storage2->truncate_prefix(21));
+    ASSERT_EQ(21, storage2->first_log_index());
+    ASSERT_EQ(60, storage2->last_log_index());
+    ASSERT_EQ(2, storage2->get_term(50));
+    ASSERT_EQ(3, storage2->get_term(51));
+    ASSERT_EQ(1, storage1->get_term(50));
+
+    // the index is rebuilt from the shared files after restart
+    delete storage1;
+    delete storage2;
+    storage1 = braft::LogStorage::create(shared_uri("g1"));
+    storage2 = braft::LogStorage::create(shared_uri("g2"));
+    braft::ConfigurationManager cm3;
+    ASSERT_EQ(0, storage1->init(&cm3));
+    ASSERT_EQ(0, storage2->init(&cm2));
+
+    ASSERT_EQ(1, storage1->first_log_index());
+    ASSERT_EQ(101, storage1->last_log_index());
+    ASSERT_EQ(101, cm3.last_configuration().id.index);
+    ASSERT_EQ(2u, cm3.last_configuration().conf.size());
+    ASSERT_EQ(0, storage1->truncate_suffix(100));
+    check_entries(storage1, 1, 100, 1);
+
+    ASSERT_EQ(21, storage2->first_log_index());
+    ASSERT_EQ(60, storage2->last_log_index());
+    ASSERT_EQ(2, storage2->get_term(50));
+    ASSERT_EQ(3, storage2->get_term(51));
+
+    // reset drops all the logs of the group
+    ASSERT_EQ(0, storage2->reset(1000));
+    delete storage2;
+    storage2 = braft::LogStorage::create(shared_uri("g2"));
+    ASSERT_EQ(0, storage2->init(&cm2));
+    ASSERT_EQ(1000, storage2->first_log_index());
+    ASSERT_EQ(999, storage2->last_log_index());
+    append_entries(storage2, 1000, 1009, 4);
+    check_entries(storage2, 1000, 1009, 4);
+
+    delete storage1;
+    delete storage2;
+}
+
+TEST_F(SharedLogStorageTest, purge_and_gc) {
+    braft::FLAGS_raft_shared_log_file_size = 4096;
+    braft::ConfigurationManager cm;
+    braft::LogStorage* storage1 = braft::LogStorage::create(shared_uri("g1"));
+    braft::LogStorage* storage2 = braft::LogStorage::create(shared_uri("g2"));
+    ASSERT_EQ(0, storage1->init(&cm));
+    ASSERT_EQ(0, storage2->init(&cm));
+    for (int64_t i = 1; i <= 1000; i += 10) {
+        append_entries(storage1, i, i + 9, 1);
+        append_entries(storage2, i, i + 9, 1);
+    }
+    const int nfiles = count_shared_log_files();
+    ASSERT_GT(nfiles, 10);
+
+    // files are kept as long as any group still references them
+    ASSERT_EQ(0, storage1->truncate_prefix(901));
+    ASSERT_EQ(nfiles, count_shared_log_files());
+    ASSERT_EQ(0, storage2->truncate_prefix(901));
+    ASSERT_LT(count_shared_log_files(), nfiles);
+    check_entries(storage1, 901, 1000, 1);
+    check_entries(storage2, 901, 1000, 1);
+
+    // restart with the purged files
+    delete storage1;
+    delete storage2;
+    storage1 = braft::LogStorage::create(shared_uri("g1"));
+    ASSERT_EQ(0, storage1->init(&cm));
+    check_entries(storage1, 901, 1000, 1);
+
+    // gc drops the group from the shared log
+    ASSERT_TRUE(braft::LogStorage::destroy(shared_uri("g2")).ok());
+    storage2 = braft::LogStorage::create(shared_uri("g2"));
+    ASSERT_EQ(0, storage2->init(&cm));
+    ASSERT_EQ(1, storage2->first_log_index());
+    ASSERT_EQ(0, storage2->last_log_index());
+    // a group which is opened can't be dropped
+    ASSERT_FALSE(braft::LogStorage::destroy(shared_uri("g1")).ok());
+
+    delete storage1;
+    delete storage2;
+}
+
+TEST_F(SharedLogStorageTest, corrupted_files) {
+    braft::FLAGS_raft_shared_log_file_size = 4096;
+    braft::ConfigurationManager cm;
+    braft::LogStorage* storage1 = braft::LogStorage::create(shared_uri("g1"));
+    braft::LogStorage* storage2 = braft::LogStorage::create(shared_uri("g2"));
+    ASSERT_EQ(0, storage1->init(&cm));
+    ASSERT_EQ(0, storage2->init(&cm));
+    // the files in the front only have the entries of g1
+    append_entries(storage1, 1, 300, 1);
+    append_entries(storage2, 1, 300, 1);
+    delete storage1;
+    delete storage2;
+    std::vector<std::string> files = list_shared_log_files();
+    ASSERT_GT(files.size(), 4u);
+    int64_t file_size = 0;
+    ASSERT_TRUE(butil::GetFileSize(butil::FilePath(files[0]), &file_size));
+
+    // an incomplete record is only allowed at the end of the last file
+    append_to_file(files[0], "torn");
+    storage1 = braft::LogStorage::create(shared_uri("g1"));
+    ASSERT_NE(0, storage1->init(&cm));
+    delete storage1;
+    ASSERT_EQ(0, ::truncate(files[0].c_str(), file_size));
+    append_to_file(files.back(), "torn");
+    storage1 = braft::LogStorage::create(shared_uri("g1"));
+    ASSERT_EQ(0, storage1->init(&cm));
+    check_entries(storage1, 1, 300, 1);
+    delete storage1;
+
+    // the entries of g1 in the second file are lost
+    ASSERT_EQ(0, ::unlink(files[1].c_str()));
+    storage2 = braft::LogStorage::create(shared_uri("g2"));
+    ASSERT_NE(0, storage2->init(&cm));
+    delete storage2;
+
+    // only g1 is broken, and it can be opened again once dropped
+    braft::FLAGS_raft_recover_log_from_corrupt = true;
+    storage2 = braft::LogStorage::create(shared_uri("g2"));
+    ASSERT_EQ(0, storage2->init(&cm));
+    check_entries(storage2, 1, 300, 1);
+    storage1 = braft::LogStorage::create(shared_uri("g1"));
+    ASSERT_NE(0, storage1->init(&cm));
+    delete storage1;
+    ASSERT_TRUE(braft::LogStorage::destroy(shared_uri("g1")).ok());
+    storage1 = braft::LogStorage::create(shared_uri("g1"));
+    ASSERT_EQ(0, storage1->init(&cm));
+    ASSERT_EQ(1, storage1->first_log_index());
+    ASSERT_EQ(0, storage1->last_log_index());
+
+    delete storage1;
+    delete storage2;
+}